@@ -13,8 +13,12 @@
 #include <stdbool.h>
 
 #define STS_MIN_CARDINALITY 2
-#define STS_MAX_CARDINALITY 16
+// symbol c stands for the NaN frames so c itself has to fit a sts_symbol
+#define STS_MAX_CARDINALITY 255
+// the SAX string form letters the symbols from 'A' to 'Z'
+#define STS_MAX_STRING_CARDINALITY 26
 #define STS_STAT_EPS 1e-2
+#define STS_SLIDING_CHUNK 65536
 
 #if defined(_MSC_VER)
 #define PRIuSIZE "Iu"
@@ -32,19 +36,288 @@ typedef struct sts_word {
   unsigned char c; // TODO: migrate to multi-cardinal words (for indexing)
 } * sts_word;
 
+/* 8 log-linear sub-buckets per power of two nanoseconds, up to 2^40 ns */
+#define STS_HISTOGRAM_BUCKETS 312
+
+/**
+ * HDR-style latency histogram, bucket i covers the durations reported by
+ * sts_histogram_bucket_ns(i) up to sts_histogram_bucket_ns(i + 1) ns
+ */
+struct sts_histogram {
+  unsigned long long count;
+  unsigned long long total_ns, min_ns, max_ns;
+  unsigned long long buckets[STS_HISTOGRAM_BUCKETS];
+};
+
+/* Per-window counters, only maintained when built with STS_ENABLE_STATS */
+struct sts_window_stats {
+  unsigned long long appends; // values appended
+  unsigned long long word_recomputes; // re-symbolizations of current_word
+  unsigned long long nan_inputs;
+  unsigned long long inf_inputs;
+};
+
+/* Library-wide counters, see sts_get_stats */
+struct sts_stats {
+  bool enabled; // false when built without STS_ENABLE_STATS
+  unsigned long long appends;
+  unsigned long long word_recomputes;
+  unsigned long long nan_inputs;
+  unsigned long long inf_inputs;
+  unsigned long long nan_frames; // frames symbolized as all-NaN
+  unsigned long long mindist_calls;
+  unsigned long long allocations;
+  struct sts_histogram append_latency; // sts_append_value/sts_append_array
+  struct sts_histogram mindist_latency; // sts_mindist/sts_mindist_ab
+};
+
 struct sts_ring_buffer
 {
   double* buffer, * buffer_end;
   double* head, * tail;
+  float* fbuffer, * fbuffer_end; // float32 storage, buffer is NULL then
+  float* fhead, * ftail;
   double mu, s2; // mean and sum of squared deviations for on-line estimation
   size_t finite_cnt; // number of non-nan and non-inf elements
 };
 
+/* Aggregation state of time-bucketed windows, see sts_new_time_window */
+struct sts_time_bucket
+{
+  long long interval; // bucket width in timestamp units
+  long long start; // timestamp where the open bucket starts
+  double sum; // sum of the non-NaN samples in the open bucket
+  size_t cnt; // number of non-NaN samples in the open bucket
+  bool open; // false until the first sample arrives
+};
+
+/*
+ * Caller supplied normalization replacing the statistics of the window's
+ * values, see sts_set_window_scale
+ */
+struct sts_window_scale
+{
+  double mu, var; // in use, var is sigma^2
+  double alpha; // EWMA weight of a new value, 0 keeps mu and var fixed
+  double init_mu, init_var; // restored by sts_reset_window
+};
+
+/* Keeps the producer and consumer positions on separate cache lines */
+#define STS_CACHE_LINE 64
+
+/*
+ * Single-producer/single-consumer queue of samples in front of a window, plus
+ * the triple buffer publishing its words, see sts_enable_ingest
+ */
+struct sts_ingest
+{
+  // written by the producer
+  size_t tail; // next slot to fill
+  size_t head_cache; // last head seen by the producer
+  unsigned long long dropped; // pushes rejected because the queue was full
+  char pad1[STS_CACHE_LINE];
+  // written by the consumer
+  size_t head; // next slot to drain
+  char pad2[STS_CACHE_LINE];
+  size_t mask; // capacity - 1, the capacity is a power of two
+  double* values;
+  long long* ts;
+  // word snapshots: the consumer owns back, the reader front, middle is
+  // swapped atomically between them
+  sts_symbol* slots; // 3 * w symbols
+  size_t back, middle, front;
+  struct sts_word snapshot; // front slot as handed to the reader
+  bool has_snapshot;
+};
+
+/*
+ * 1d-SAX word: the SAX word of the frame averages plus a symbol per frame for
+ * the slope of its least squares line, see sts_trend_from_double_array
+ */
+typedef struct sts_trend_word {
+  struct sts_word word; // frame averages
+  sts_symbol* slopes; // w symbols, 0 the steepest rise, cs for frames with NaNs
+  unsigned char cs; // slope cardinality
+} * sts_trend_word;
+
+struct sts_window;
+
+/* Routines specialized for the window's c, frame size and storage */
+struct sts_kernels
+{
+  sts_symbol (*symbol)(double value, unsigned char c);
+  // symbolization when the whole window is finite (no NaN checks), slopes
+  // of the trend symbols or NULL
+  void (*transform)(const struct sts_window* window, sts_symbol* out,
+                    double* paa, sts_symbol* slopes);
+};
+
 typedef struct sts_window {
   struct sts_ring_buffer* values;
   struct sts_word current_word;
+  struct sts_window_stats stats;
+  struct sts_time_bucket* bucket; // NULL unless time-bucketed
+  struct sts_kernels kernels; // chosen at creation
+  struct sts_ingest* ingest; // NULL unless sts_enable_ingest
+  struct sts_window_scale* scale; // NULL unless sts_set_window_scale
+  struct sts_trend_word* trend; // NULL unless sts_enable_window_trend
 } * sts_window;
 
+/*
+ * Windows of several channels advancing together, see sts_new_multi_window.
+ * The values are stored channel-major in one buffer and the channel words are
+ * consecutive slices of the concatenated word.
+ */
+typedef struct sts_multi_window {
+  size_t channels;
+  struct sts_window* windows; // one per channel, owned by the multi window
+  struct sts_ring_buffer* rings; // one per channel, slices of buffer
+  double* buffer; // channels * n values
+  struct sts_word word; // channels * w symbols, n_values is channels * n
+} * sts_multi_window;
+
+/* Open bucket of a pyramid level, see sts_new_pyramid */
+struct sts_pyramid_level
+{
+  size_t factor; // values of the finer level (raw samples for level 0) per value
+  size_t filled; // of them already in the open bucket
+  double sum; // sum of the non-NaN raw samples in the open bucket
+  size_t cnt; // number of non-NaN raw samples in the open bucket
+};
+
+/*
+ * Windows of one series at increasingly coarse resolutions, see
+ * sts_new_pyramid. Level i is windows[i], its values stored in the i-th slice
+ * of buffer.
+ */
+typedef struct sts_pyramid {
+  size_t levels;
+  struct sts_window* windows; // one per level, finest first
+  struct sts_pyramid_level* buckets; // one per level
+  struct sts_ring_buffer* rings; // one per level, slices of buffer
+  double* buffer; // levels * n values
+  sts_symbol* symbols; // levels * w symbols
+} * sts_pyramid;
+
+/* Collection of words sharing n_values, w and c, stored back to back */
+typedef struct sts_word_set {
+  sts_symbol* symbols; // count * w symbols
+  size_t count, capacity;
+  size_t n_values;
+  size_t w;
+  unsigned char c;
+} * sts_word_set;
+
+/* Result of a nearest-word query, index is the position in the set */
+struct sts_neighbor {
+  size_t index;
+  double distance;
+};
+
+/* Entry of a pattern registry posting list */
+struct sts_posting {
+  double budget; // squared threshold / (n / w)
+  size_t pattern; // index into the registry
+};
+
+/*
+ * Registry of patterns (words with a mindist threshold) indexed by
+ * (position, symbol) posting lists, see sts_pattern_set_match
+ */
+typedef struct sts_pattern_set {
+  sts_symbol* symbols; // count * w symbols
+  double* thresholds;
+  size_t* ids; // caller-provided pattern ids
+  size_t count, capacity;
+  size_t n_values;
+  size_t w;
+  unsigned char c;
+  // posting lists, rebuilt lazily after additions
+  size_t* offsets; // w * (c + 1) + 1 list boundaries into postings
+  struct sts_posting* postings; // by descending budget within a list
+  bool dirty;
+  // per-query scratch
+  double* lut;
+  size_t* matched;
+} * sts_pattern_set;
+
+/*
+ * Shard of a window registry: an open addressing table from series id to
+ * window, only ever touched by one worker at a time
+ */
+struct sts_registry_shard
+{
+  unsigned long long* ids;
+  sts_window* windows; // NULL marks an empty slot
+  size_t count;
+  size_t mask; // capacity - 1, the capacity is a power of two
+  size_t applied; // values appended by the running batch
+  char pad[STS_CACHE_LINE]; // keeps the shards off each other's cache lines
+};
+
+struct sts_pool;
+
+/* Windows sharing n, w and c keyed by series id, see sts_new_registry */
+typedef struct sts_registry {
+  size_t n_values;
+  size_t w;
+  unsigned char c;
+  struct sts_registry_shard* shards;
+  size_t n_shards;
+  struct sts_pool* pool; // worker threads applying the batches
+  // batch partitioning scratch
+  size_t* order; // batch positions grouped by shard
+  size_t* shard_start; // n_shards + 1 boundaries into order
+  size_t capacity; // of order
+} * sts_registry;
+
+/* Upper bound on the c^L cells of a SAX bitmap grid */
+#define STS_BITMAP_MAX_CELLS (1 << 20)
+
+/*
+ * Frequencies of the length-L subwords of the last lag + lead subwords of a
+ * symbol stream, kept as two c^L grids, see sts_new_bitmap
+ */
+typedef struct sts_bitmap {
+  size_t w;
+  unsigned char c;
+  size_t L; // subword length
+  size_t lag, lead; // number of subwords in each window
+  size_t cells; // c^L
+  unsigned int* lag_counts, * lead_counts;
+  size_t* subwords; // ring of the last lag + lead cells, cells if NaN
+  size_t sub_head; // slot receiving the next subword
+  size_t sub_seen; // subwords in the ring
+  size_t cell; // newest L symbols
+  size_t valid; // symbols since the last NaN, capped at L
+  sts_symbol* history; // ring of the last span symbols, for serialization
+  size_t span; // max(w, lag + lead + L - 1)
+  size_t head; // slot receiving the next symbol
+  size_t seen; // symbols in history
+  // running totals and sums of squares/products for the O(1) score
+  unsigned long long lag_total, lead_total;
+  unsigned long long lag_sq, lead_sq, cross;
+} * sts_bitmap;
+
+/*
+ * Compressed sequence of words sharing n_values, w and c, see
+ * sts_new_word_stream. data holds the whole encoding (header included) and can
+ * be archived as is.
+ */
+typedef struct sts_word_stream {
+  unsigned char* data;
+  size_t size, capacity; // bytes
+  size_t* blocks; // offset in data of the first record of each block
+  size_t n_blocks, blocks_capacity;
+  size_t count; // number of words
+  size_t block_words; // words per block
+  size_t n_values;
+  size_t w;
+  unsigned char c;
+  sts_symbol* last; // last word appended
+  size_t run_at; // offset of the run record still open, 0 if none
+} * sts_word_stream;
+
 /**
  * Initializes empty window-like-container
  * @param n size of the window
@@ -55,6 +328,121 @@ typedef struct sts_window {
  */
 sts_window sts_new_window(size_t n, size_t w, unsigned char c);
 
+/**
+ * Same as sts_new_window but the values are stored as float, halving the
+ * buffer footprint. mu, s2 and frame sums are still accumulated in double.
+ * Appended values are rounded to float (magnitudes beyond FLT_MAX become
+ * infinite), which may flip a symbol when a frame average lands within float
+ * precision of a breakpoint
+ * @param n size of the window
+ * @param w code's cardinality
+ * @param c length of the produced code, should be divisor of n
+ * @return NULL on failure or allocated window
+ */
+sts_window sts_new_float_window(size_t n, size_t w, unsigned char c);
+
+/**
+ * Initializes a time-bucketed window: samples appended with sts_append_timed
+ * are averaged per interval and every closed interval becomes one value of the
+ * window
+ * @param n size of the window (number of intervals)
+ * @param w code's cardinality
+ * @param c length of the produced code, should be divisor of n
+ * @param interval bucket width in the unit of the timestamps, > 0
+ * @return NULL on failure or allocated window
+ */
+sts_window sts_new_time_window(size_t n,
+                               size_t w,
+                               unsigned char c,
+                               long long interval);
+
+/**
+ * Turns an existing (e.g. float32) window into a time-bucketed one, any open
+ * bucket is discarded
+ * @param window
+ * @param interval bucket width in the unit of the timestamps, > 0
+ * @return false on failure
+ */
+bool sts_set_window_interval(sts_window window, long long interval);
+
+/**
+ * Normalizes the window's frames with the given mu and sigma instead of the
+ * mean and deviation of the values in the window, so that words of different
+ * windows (or of the same window before and after a level shift) are
+ * comparable. With alpha > 0 mu and sigma then follow an exponentially
+ * weighted moving average of the finite appended values (weight alpha for the
+ * newest one). Either way the per-sample sliding statistics are no longer
+ * maintained, the window stays in this mode and may be called again to move
+ * the scale. sts_reset_window restores the last mu and sigma set.
+ * @param window
+ * @param mu
+ * @param sigma >= 0, frames are normalized to 0 below STS_STAT_EPS
+ * @param alpha in [0, 1)
+ * @return false on failure, the current word is recomputed otherwise
+ */
+bool sts_set_window_scale(sts_window window,
+                          double mu,
+                          double sigma,
+                          double alpha);
+
+/**
+ * @param window
+ * @param mu receives the mean normalizing the window's frames
+ * @param sigma receives the deviation normalizing the window's frames
+ * @return false on failure
+ */
+bool sts_get_window_scale(const struct sts_window* window,
+                          double* mu,
+                          double* sigma);
+
+/**
+ * Adds a slope symbol per frame to the window's words (1d-SAX), recomputed
+ * on every update in the same transform kernel pass as the frame averages.
+ * Calling it again changes the slope cardinality.
+ * @param window
+ * @param cs slope cardinality, at least STS_MIN_CARDINALITY
+ * @return false on failure
+ */
+bool sts_enable_window_trend(sts_window window, unsigned char cs);
+
+/**
+ * @param window
+ * @return NULL unless sts_enable_window_trend was called, otherwise the trend
+ * word of the window, whose word is window->current_word
+ */
+const struct sts_trend_word* sts_window_trend(const struct sts_window* window);
+
+/**
+ * Aggregates a sample into the bucket holding ts. Once a sample for a later
+ * bucket arrives the open bucket is closed and appended (NaN if it only saw
+ * NaNs), skipped buckets are appended as NaN and the word is re-computed once.
+ * Samples older than the open bucket are dropped.
+ * @param window time-bucketed window
+ * @param ts timestamp of the sample
+ * @param value
+ * @return pointer to window->current_word, NULL if the window isn't
+ * time-bucketed
+ */
+const struct sts_word*
+sts_append_timed(sts_window window, long long ts, double value);
+
+/**
+ * Closes the open bucket (and appends NaN buckets for the gap) if ts lies past
+ * its end, so that silent series keep sliding
+ * @param window time-bucketed window
+ * @param ts current time
+ * @return pointer to window->current_word, NULL if the window isn't
+ * time-bucketed
+ */
+const struct sts_word* sts_advance_timed(sts_window window, long long ts);
+
+/**
+ * @param window
+ * @param i position in the window, 0 is the oldest value
+ * @return the stored value (NaN for empty slots or i out of range)
+ */
+double sts_window_value(const struct sts_window* window, size_t i);
+
 /**
  * Appends new value to the end of the window
  * If window->n_values == window->values->cnt drops the head value
@@ -79,6 +467,156 @@ const struct sts_word* sts_append_value(sts_window window, double value);
 const struct sts_word*
 sts_append_array(sts_window window, const double* values, size_t n_values);
 
+/**
+ * Attaches a lock-free queue to the window so that one producer thread can
+ * feed it while another thread owns the window: the producer calls
+ * sts_ingest_value (or sts_ingest_timed), the owner periodically calls
+ * sts_drain and a single reader thread (possibly a third one) reads the latest
+ * word with sts_snapshot. Must be called before the producer starts.
+ * @param window
+ * @param capacity number of samples the queue holds, rounded up to a power of
+ * two
+ * @return false on failure or if the window already has a queue
+ */
+bool sts_enable_ingest(sts_window window, size_t capacity);
+
+/**
+ * Queues a value for the next sts_drain, wait-free. Producer thread only.
+ * @param window window with a queue, not time-bucketed
+ * @param value
+ * @return false if the queue is full (the value is dropped and counted in
+ * window->ingest->dropped) or the window can't take plain values
+ */
+bool sts_ingest_value(sts_window window, double value);
+
+/**
+ * Same as sts_ingest_value for time-bucketed windows, the sample is applied
+ * with sts_append_timed
+ * @param window time-bucketed window with a queue
+ * @param ts
+ * @param value
+ * @return false if the queue is full or the window isn't time-bucketed
+ */
+bool sts_ingest_timed(sts_window window, long long ts, double value);
+
+/**
+ * Applies every queued sample (in batches through sts_append_array) and
+ * publishes the resulting word for sts_snapshot. Consumer thread only, i.e.
+ * the thread owning the window.
+ * @param window
+ * @return same as the last append, NULL if nothing was queued
+ */
+const struct sts_word* sts_drain(sts_window window);
+
+/**
+ * Returns the word published by the latest sts_drain. Never blocks the
+ * consumer; a single reader thread at a time.
+ * @param window window with a queue
+ * @return NULL until a word has been published, otherwise a copy owned by
+ * the window that stays unchanged until the next sts_snapshot call
+ */
+const struct sts_word* sts_snapshot(sts_window window);
+
+/**
+ * Initializes a window per channel, all sharing n, w and c, for series whose
+ * samples arrive as rows (e.g. user/sys/iowait). Every channel keeps its own
+ * mu and s2 and is symbolized independently; mw->windows[i].current_word is
+ * the word of channel i and mw->word the concatenation of all of them. The
+ * channel windows must only be updated through the multi window functions.
+ * @param channels number of values per row, > 0
+ * @param n size of the windows
+ * @param w length of the channel words, should be divisor of n
+ * @param c cardinality
+ * @return NULL on failure or allocated multi window
+ */
+sts_multi_window sts_new_multi_window(size_t channels,
+                                      size_t n,
+                                      size_t w,
+                                      unsigned char c);
+
+/**
+ * Appends one value to every channel and re-computes the channel words
+ * @param mw
+ * @param row mw->channels values, row[i] going to channel i
+ * @return pointer to mw->word, NULL on failure
+ */
+const struct sts_word* sts_append_row(sts_multi_window mw, const double* row);
+
+/**
+ * Appends several rows, the words are only re-computed once
+ * @param mw
+ * @param rows n_rows * mw->channels values, row-major
+ * @param n_rows
+ * @return pointer to mw->word, NULL on failure
+ */
+const struct sts_word* sts_append_rows(sts_multi_window mw,
+                                       const double* rows,
+                                       size_t n_rows);
+
+/**
+ * Empties every channel
+ * @param mw
+ * @return false if mw is malformed
+ */
+bool sts_reset_multi_window(sts_multi_window mw);
+
+/**
+ * Frees allocated multi window
+ * @param mw
+ */
+void sts_free_multi_window(sts_multi_window mw);
+
+/**
+ * Initializes a pyramid of windows, all sharing n, w and c, watching a series
+ * at several horizons (e.g. minute, 10-minute and hourly). Raw samples are
+ * appended once; every level averages factors[i] values of the level below
+ * (raw samples for level 0) and only appends to its window, and recomputes its
+ * word, when that bucket completes. The averages are those of the non-NaN raw
+ * samples, so NaNs don't skew the coarser levels. The level windows must only
+ * be updated through the pyramid functions.
+ * @param levels number of levels, > 0
+ * @param factors levels values, each > 0, e.g. { 1, 10, 6 }
+ * @param n size of the windows
+ * @param w length of the words, should be divisor of n
+ * @param c cardinality
+ * @return NULL on failure or allocated pyramid
+ */
+sts_pyramid sts_new_pyramid(size_t levels,
+                            const size_t* factors,
+                            size_t n,
+                            size_t w,
+                            unsigned char c);
+
+/**
+ * Aggregates a raw sample into the pyramid
+ * @param p
+ * @param value
+ * @return number of levels that completed a bucket (levels 0 to the result - 1
+ * have new words), 0 on failure
+ */
+size_t sts_pyramid_append(sts_pyramid p, double value);
+
+/**
+ * @param p
+ * @param level
+ * @return current word of the level, NULL on failure
+ */
+const struct sts_word* sts_pyramid_word(const struct sts_pyramid* p,
+                                        size_t level);
+
+/**
+ * Empties every level and discards the open buckets
+ * @param p
+ * @return false if p is malformed
+ */
+bool sts_reset_pyramid(sts_pyramid p);
+
+/**
+ * Frees allocated pyramid
+ * @param p
+ */
+void sts_free_pyramid(sts_pyramid p);
+
 /**
  * Returns symbolic representation of series which doesn't store initial values
  * @param series number of elements in series
@@ -92,23 +630,56 @@ sts_word sts_from_double_array(const double* series,
                                size_t w,
                                unsigned int c);
 
+/**
+ * Words of every length n subsequence of a series, as produced by a window
+ * fed the series. The work is split in chunks of STS_SLIDING_CHUNK words
+ * spread over the threads; each chunk starts with a new window fed from the
+ * first value of its first subsequence, so the words don't depend on
+ * n_threads. The frame sums are computed once per position and shared by the
+ * w words using them, the cost is O(len * (n / w + w)).
+ * @param series
+ * @param len number of values in series
+ * @param n subsequence length, <= len
+ * @param w length of the words, should be divisor of n
+ * @param c cardinality
+ * @param n_threads maximum number of threads (including the caller)
+ * @param out receives (len - n + 1) * w symbols
+ * @return false on failure
+ */
+bool sts_sliding_words(const double* series,
+                       size_t len,
+                       size_t n,
+                       size_t w,
+                       unsigned char c,
+                       unsigned int n_threads,
+                       sts_symbol* out);
+
 /**
  * Constructs word from symbolic representation, e.g. "AABBC"
  * @param symbols symbolic representation in SAX notation
  * @param c cardinality of the word
  * @return NULL on failure (illegal symbols for cardinality or unprocessable
- * cardinality itself) or freshly-allocated sts_word with
- * sts_word.w == strlen(symbols)
+ * cardinality itself, above STS_MAX_STRING_CARDINALITY) or freshly-allocated
+ * sts_word with sts_word.w == strlen(symbols)
  */
 sts_word sts_from_sax_string(const char* symbols, unsigned char c);
 
 /**
  * @param a word
- * @return NULL on failure (illegal symbols for cardinality) or SAX string
- * corresponding to a
+ * @return NULL on failure (illegal symbols for cardinality or cardinality
+ * above STS_MAX_STRING_CARDINALITY) or SAX string corresponding to a
  */
 char* sts_word_to_sax_string(const struct sts_word* a);
 
+/**
+ * Same as sts_word_to_sax_string without the allocation
+ * @param a word
+ * @param str receives the a->w symbols and the terminating '\0'
+ * @return false on failure (illegal symbols for cardinality or cardinality
+ * above STS_MAX_STRING_CARDINALITY), str is unspecified then
+ */
+bool sts_word_write_sax_string(const struct sts_word* a, char* str);
+
 /**
  * Returns the lowerbounding approximation on distance between sax-represented
  * series a and b. One of the words can have sts_word->n_values == 0 and method
@@ -141,6 +712,95 @@ double sts_mindist_ab(const struct sts_word* a,
                       double* above,
                       double* below);
 
+/**
+ * Writes the normalized frame averages (PAA) the current word is built from
+ * @param window
+ * @param paa receives window->current_word.w values, NaN for all-NaN frames
+ * and +-INFINITY for frames dominated by infinite values
+ * @return false on failure
+ */
+bool sts_window_paa(const struct sts_window* window, double* paa);
+
+/**
+ * Same as sts_window_paa for a series, i.e. the averages sts_from_double_array
+ * symbolizes
+ * @param series
+ * @param n_values number of elements in series
+ * @param w number of frames, should be divisor of n_values
+ * @param paa receives w values
+ * @return false on failure
+ */
+bool sts_paa_from_double_array(const double* series,
+                               size_t n_values,
+                               size_t w,
+                               double* paa);
+
+/**
+ * Lowerbounding distance between the series a PAA vector was computed from and
+ * the series represented by word, using the breakpoint interval of every
+ * symbol. Never looser than sts_mindist against the symbolized query.
+ * @param paa word->w normalized frame averages
+ * @param word
+ * @return NaN on failure, otherwise minimum possible distance between original
+ * series (NaN frames follow the sts_mindist conventions)
+ */
+double sts_mindist_paa(const double* paa, const struct sts_word* word);
+
+/**
+ * sts_mindist_paa against count words stored back to back
+ * @param paa w normalized frame averages
+ * @param n_values length of the original series, 0 for a compression rate of 1
+ * @param w
+ * @param c cardinality of the words
+ * @param words count * w symbols
+ * @param count
+ * @param out receives count distances
+ * @return false on failure
+ */
+bool sts_mindist_paa_batch(const double* paa,
+                           size_t n_values,
+                           size_t w,
+                           unsigned char c,
+                           const sts_symbol* words,
+                           size_t count,
+                           double* out);
+
+/**
+ * Same as sts_from_double_array plus the slope symbols (1d-SAX). The slope of
+ * every frame is normalized like the averages and quantized on the normal
+ * quantiles scaled to its expected deviation, sqrt(0.03 / frame size) for a
+ * normalized random walk.
+ * @param series
+ * @param n_values
+ * @param w divisor of n_values
+ * @param c cardinality of the averages
+ * @param cs cardinality of the slopes
+ * @return NULL on failure or freshly-allocated sts_trend_word
+ */
+sts_trend_word sts_trend_from_double_array(const double* series,
+                                           size_t n_values,
+                                           size_t w,
+                                           unsigned char c,
+                                           unsigned char cs);
+
+/**
+ * Lower bound of the Euclidean distance between the z-normalized series of
+ * two trend words: the frame average and slope are orthogonal projections of
+ * each frame, so the squared gaps between their intervals add up. Never below
+ * sts_mindist of the average words; frames with NaNs contribute their average
+ * only.
+ * @param a
+ * @param b same w, c, cs and n_values (or 0) as a
+ * @return NAN on failure
+ */
+double sts_trend_mindist(const struct sts_trend_word* a,
+                         const struct sts_trend_word* b);
+
+/**
+ * @param a
+ */
+void sts_free_trend_word(sts_trend_word a);
+
 /**
  * Returns whether to words are considered equal in terms of w, c and
  * representation
@@ -179,4 +839,451 @@ bool sts_reset_window(sts_window w);
  */
 sts_word sts_dup_word(const struct sts_word* a);
 
+/**
+ * Initializes an empty word set
+ * @param n_values length of the series the words represent, 0 for a
+ * compression rate of 1
+ * @param w word length
+ * @param c cardinality
+ * @return NULL on failure or allocated set
+ */
+sts_word_set sts_new_word_set(size_t n_values, size_t w, unsigned char c);
+
+/**
+ * Copies the symbols of a word into the set
+ * @param set
+ * @param word must match the w and c of the set, n_values must match or be 0
+ * @return false on failure (mismatching or malformed word, out of memory)
+ */
+bool sts_word_set_add(sts_word_set set, const struct sts_word* word);
+
+/**
+ * Finds the k words of the set closest to query in terms of sts_mindist. The
+ * scan keeps a bounded max-heap of the best candidates and abandons a word as
+ * soon as its partial distance exceeds the current k-th best.
+ * @param set
+ * @param query word with the w and c of the set
+ * @param k
+ * @param out receives up to k neighbors ordered by distance, ties by index
+ * @return number of neighbors written (min(k, set->count)), 0 on failure
+ */
+size_t sts_word_set_topk(const struct sts_word_set* set,
+                         const struct sts_word* query,
+                         size_t k,
+                         struct sts_neighbor* out);
+
+/**
+ * Same as sts_word_set_topk with the set partitioned across threads, each
+ * partition keeps its own heap and the partial results are merged. Only worth
+ * it for large sets, the results are identical to sts_word_set_topk.
+ * @param set
+ * @param query
+ * @param k
+ * @param out
+ * @param n_threads maximum number of threads (including the caller)
+ * @return number of neighbors written, 0 on failure
+ */
+size_t sts_word_set_topk_mt(const struct sts_word_set* set,
+                            const struct sts_word* query,
+                            size_t k,
+                            struct sts_neighbor* out,
+                            unsigned int n_threads);
+
+/**
+ * Computes sts_mindist between query and every word of the set in one pass
+ * over a per-query squared distance table
+ * @param set
+ * @param query word with the w and c of the set
+ * @param out receives set->count distances in insertion order
+ * @return false on failure (mismatching query, out of memory)
+ */
+bool sts_word_set_mindist(const struct sts_word_set* set,
+                          const struct sts_word* query,
+                          double* out);
+
+/**
+ * Finds the words within threshold of query in terms of sts_mindist, the
+ * distance of a word stops being summed as soon as it exceeds the threshold
+ * @param set
+ * @param query word with the w and c of the set
+ * @param threshold >= 0
+ * @param indices receives the positions of the matching words in insertion
+ * order, up to set->count entries
+ * @return number of matching words, 0 on failure
+ */
+size_t sts_word_set_within(const struct sts_word_set* set,
+                           const struct sts_word* query,
+                           double threshold,
+                           size_t* indices);
+
+/**
+ * Pairwise sts_mindist between all the words of the set
+ * @param set
+ * @param out receives set->count * set->count distances, row-major (the
+ * matrix is symmetric)
+ * @return false on failure
+ */
+bool sts_word_set_distance_matrix(const struct sts_word_set* set,
+                                  double* out);
+
+/**
+ * Sorts the words of the set and groups the identical ones, e.g. to
+ * deduplicate shapes. Words are packed into 64-bit keys of base c + 1 digits
+ * and ordered with a stable LSD radix sort on the key bytes, so the cost is a
+ * few linear passes over the set instead of string comparisons.
+ * @param set
+ * @param perm receives set->count word indices ordered by symbols (position 0
+ * first, NaN after every other symbol), identical words by index
+ * @param starts NULL or receives the offset in perm of every group followed by
+ * set->count, up to set->count + 1 entries
+ * @param n_threads maximum number of threads (including the caller), only used
+ * for large sets
+ * @return number of groups, 0 for an empty set or on failure
+ */
+size_t sts_word_set_group(const struct sts_word_set* set,
+                          size_t* perm,
+                          size_t* starts,
+                          unsigned int n_threads);
+
+/**
+ * Clusters the words of the set with k-modes under sts_mindist: centers are
+ * seeded k-means++ style, then every pass assigns each word to its nearest
+ * center (per-center squared distance tables with early abandon) and moves the
+ * centers to the per-position modal symbols of their members, until the
+ * assignment stops changing. Passes over large sets are split across threads,
+ * the result doesn't depend on n_threads.
+ * @param set
+ * @param k number of clusters, <= set->count
+ * @param max_iter maximum number of assignment passes
+ * @param seed seeds the random center selection
+ * @param n_threads maximum number of threads (including the caller)
+ * @param centers receives k * set->w symbols, the cluster modes
+ * @param assignment receives set->count cluster indices, each word's nearest
+ * center (ties to the lowest index)
+ * @return number of assignment passes run, 0 on failure
+ */
+size_t sts_word_set_kmodes(const struct sts_word_set* set,
+                           size_t k,
+                           size_t max_iter,
+                           unsigned int seed,
+                           unsigned int n_threads,
+                           sts_symbol* centers,
+                           size_t* assignment);
+
+/**
+ * Removes all words, keeping the allocated storage
+ * @param set
+ */
+void sts_clear_word_set(sts_word_set set);
+
+/**
+ * Frees allocated word set
+ * @param set
+ */
+void sts_free_word_set(sts_word_set set);
+
+/**
+ * Initializes an empty pattern registry
+ * @param n_values length of the series the patterns represent, 0 for a
+ * compression rate of 1
+ * @param w word length
+ * @param c cardinality
+ * @return NULL on failure or allocated registry
+ */
+sts_pattern_set sts_new_pattern_set(size_t n_values,
+                                    size_t w,
+                                    unsigned char c);
+
+/**
+ * Registers a pattern, a word matches it when their sts_mindist is within
+ * threshold
+ * @param set
+ * @param pattern must match the w and c of the set, n_values must match or be
+ * 0
+ * @param threshold >= 0
+ * @param id returned by sts_pattern_set_match, needn't be unique
+ * @return false on failure
+ */
+bool sts_pattern_set_add(sts_pattern_set set,
+                         const struct sts_word* pattern,
+                         double threshold,
+                         size_t id);
+
+/**
+ * Finds the patterns within their threshold of word. For every position the
+ * posting lists give the patterns whose threshold can still absorb the
+ * distance of that single symbol; only the candidates of the most selective
+ * position are verified (with early abandon), so the cost depends on the
+ * number of plausible patterns rather than on the registry size. Not safe for
+ * concurrent calls on the same set.
+ * @param set
+ * @param word e.g. the result of sts_append_value
+ * @param ids receives up to max_ids pattern ids in registration order
+ * @param max_ids
+ * @return total number of matching patterns (may exceed max_ids)
+ */
+size_t sts_pattern_set_match(sts_pattern_set set,
+                             const struct sts_word* word,
+                             size_t* ids,
+                             size_t max_ids);
+
+/**
+ * Removes all patterns, keeping the allocated storage
+ * @param set
+ */
+void sts_clear_pattern_set(sts_pattern_set set);
+
+/**
+ * Frees allocated pattern registry
+ * @param set
+ */
+void sts_free_pattern_set(sts_pattern_set set);
+
+/**
+ * Initializes a SAX bitmap over a symbol stream: every symbol pushed completes
+ * a length-L subword entering the lead window, the oldest lead subword moves
+ * to the lag window and the oldest lag subword is dropped. Subwords containing
+ * NaN symbols hold their place in the windows but are not counted.
+ * @param w word length of sts_bitmap_update
+ * @param c cardinality
+ * @param L subword length, 1 <= L <= w and c^L <= STS_BITMAP_MAX_CELLS
+ * @param lag number of subwords in the lag window, > 0
+ * @param lead number of subwords in the lead window, > 0
+ * @return NULL on failure or allocated bitmap
+ */
+sts_bitmap sts_new_bitmap(size_t w,
+                          unsigned char c,
+                          size_t L,
+                          size_t lag,
+                          size_t lead);
+
+/**
+ * Pushes a symbol updating both grids in O(1)
+ * @param bitmap
+ * @param s symbol, c for NaN
+ * @return the new score, NaN on failure
+ */
+double sts_bitmap_push(sts_bitmap bitmap, sts_symbol s);
+
+/**
+ * Pushes a word. Consecutive words are taken as the stream advanced by one
+ * symbol: the first word after a reset pushes all of its symbols, the later
+ * ones only their last symbol. To follow a window, push its current_word once
+ * every n / w appends, when its newest frame has been completely replaced;
+ * pushing after every append would count the same, partially filled, frame
+ * several times.
+ * @param bitmap
+ * @param word must match the w and c of the bitmap
+ * @return the new score, NaN on failure
+ */
+double sts_bitmap_update(sts_bitmap bitmap, const struct sts_word* word);
+
+/**
+ * Distance between the subword frequencies of the lag and lead windows:
+ * sum((lag_i / lag_total - lead_i / lead_total)^2) / 2, in [0, 1]. O(1).
+ * @param bitmap
+ * @return the score, NaN while either window hasn't counted any subword
+ */
+double sts_bitmap_score(const struct sts_bitmap* bitmap);
+
+/**
+ * Forgets all the words pushed so far
+ * @param bitmap
+ */
+void sts_reset_bitmap(sts_bitmap bitmap);
+
+/**
+ * Frees allocated bitmap
+ * @param bitmap
+ */
+void sts_free_bitmap(sts_bitmap bitmap);
+
+/**
+ * Initializes an empty window registry. Series ids are hashed onto the shards
+ * and every shard is handled by a single worker per batch, so the windows keep
+ * the sts_append_value semantics without any locking.
+ * @param n_values size of every window
+ * @param w word length, should be divisor of n_values
+ * @param c cardinality
+ * @param n_shards number of independent shards, a few per thread
+ * @param n_threads size of the worker pool, including the calling thread
+ * @return NULL on failure or allocated registry
+ */
+sts_registry sts_new_registry(size_t n_values,
+                              size_t w,
+                              unsigned char c,
+                              size_t n_shards,
+                              unsigned int n_threads);
+
+/**
+ * Looks up the window of a series
+ * @param registry
+ * @param id series id
+ * @param create creates an empty window for unknown ids when true
+ * @return NULL if the id is unknown (and create is false) or on failure
+ */
+sts_window sts_registry_window(sts_registry registry,
+                               unsigned long long id,
+                               bool create);
+
+/**
+ * Appends values[i] to the window of ids[i] for every i, creating windows as
+ * needed. The batch is partitioned by shard and the shards are processed in
+ * parallel by the worker pool; the values of a series are appended in batch
+ * order. Not safe for concurrent calls on the same registry.
+ * @param registry
+ * @param ids
+ * @param values
+ * @param count
+ * @return number of values appended, less than count only if windows could not
+ * be allocated
+ */
+size_t sts_registry_append(sts_registry registry,
+                           const unsigned long long* ids,
+                           const double* values,
+                           size_t count);
+
+/**
+ * @param registry
+ * @return number of windows in the registry
+ */
+size_t sts_registry_size(const struct sts_registry* registry);
+
+/**
+ * Frees the registry along with all its windows
+ * @param registry
+ */
+void sts_free_registry(sts_registry registry);
+
+/**
+ * Initializes an empty compressed word stream, for archiving the word of every
+ * tick. A word identical to the previous one extends a run, any other is
+ * stored as the XOR of its changed symbols with the previous word, or packed
+ * when that is smaller. Every block_words words start a block that decodes on
+ * its own, so seeking only decodes from the start of a block.
+ * @param n_values size of the windows the words come from, 0 if unknown
+ * @param w length of the words
+ * @param c cardinality
+ * @param block_words words per block, 1 to 65535 (e.g. 256)
+ * @return NULL on failure or allocated stream
+ */
+sts_word_stream sts_new_word_stream(size_t n_values,
+                                    size_t w,
+                                    unsigned char c,
+                                    size_t block_words);
+
+/**
+ * Encodes a word at the end of the stream
+ * @param stream
+ * @param word must match the w and c of the stream, n_values must match or be
+ * 0
+ * @return false on failure (mismatching or malformed word, out of memory)
+ */
+bool sts_word_stream_append(sts_word_stream stream,
+                            const struct sts_word* word);
+
+/**
+ * Rebuilds a stream from an archived encoding, which can be appended to
+ * @param data the data of a stream
+ * @param size its size in bytes
+ * @return NULL if the encoding is malformed or on allocation failure
+ */
+sts_word_stream sts_load_word_stream(const unsigned char* data, size_t size);
+
+/**
+ * Decodes consecutive words
+ * @param stream
+ * @param first index of the first word
+ * @param count number of words
+ * @param symbols receives count * w symbols
+ * @return false if the range is out of the stream
+ */
+bool sts_word_stream_decode(const struct sts_word_stream* stream,
+                            size_t first,
+                            size_t count,
+                            sts_symbol* symbols);
+
+/**
+ * sts_mindist of query to consecutive words without materializing them: a run
+ * reuses the distance of its word and a delta only updates the distance terms
+ * of the changed symbols
+ * @param stream
+ * @param query must match the w and c of the stream, n_values must match or
+ * be 0
+ * @param first index of the first word
+ * @param count number of words
+ * @param out receives count distances
+ * @return false on failure (mismatching query, range out of the stream, out of
+ * memory)
+ */
+bool sts_word_stream_mindist(const struct sts_word_stream* stream,
+                             const struct sts_word* query,
+                             size_t first,
+                             size_t count,
+                             double* out);
+
+/**
+ * @param stream
+ */
+void sts_free_word_stream(sts_word_stream stream);
+
+/* Index of a subsequence without any candidate neighbour */
+#define STS_NO_NEIGHBOR ((size_t)-1)
+
+/**
+ * Matrix profile of a whole series: the z-normalized Euclidean distance of
+ * every length n subsequence to its nearest non-trivial neighbour, normalized
+ * like the SAX words (population deviation, subsequences whose deviation is
+ * below STS_STAT_EPS normalize to zeros). Subsequences holding non-finite
+ * values are skipped. STOMP style: the covariances are updated in O(1) along
+ * the diagonals of the distance matrix, which are processed in bands of
+ * adjacent diagonals spread over the threads, so the cost is O(len^2 / 2)
+ * steps. Scratch memory is 16 bytes per subsequence for every thread beyond
+ * the first. The result doesn't depend on n_threads.
+ * @param series
+ * @param len number of values in series
+ * @param n subsequence length, > 1 and <= len
+ * @param exclusion subsequences closer than this are trivial matches of each
+ * other, 0 picks n / 4 (rounded up)
+ * @param n_threads maximum number of threads (including the caller)
+ * @param profile receives len - n + 1 distances, INFINITY when a subsequence
+ * has no neighbour
+ * @param index receives len - n + 1 nearest neighbour positions (ties to the
+ * lowest), STS_NO_NEIGHBOR when a subsequence has no neighbour
+ * @return false on failure
+ */
+bool sts_matrix_profile(const double* series,
+                        size_t len,
+                        size_t n,
+                        size_t exclusion,
+                        unsigned int n_threads,
+                        double* profile,
+                        size_t* index);
+
+/**
+ * Copies the library-wide counters, safe to call while other threads are
+ * appending (individual counters are read atomically, not the whole set)
+ * @param out receives the counters, out->enabled is false and everything else
+ * zero when the library was built without STS_ENABLE_STATS
+ */
+void sts_get_stats(struct sts_stats* out);
+
+/**
+ * Zeroes the library-wide counters and histograms
+ */
+void sts_reset_stats(void);
+
+/**
+ * @param h histogram
+ * @param q quantile in [0, 1]
+ * @return upper bound in ns of the bucket holding the q-quantile, 0 if empty
+ */
+double sts_histogram_quantile(const struct sts_histogram* h, double q);
+
+/**
+ * @param bucket histogram bucket index
+ * @return lower bound of the bucket in ns
+ */
+unsigned long long sts_histogram_bucket_ns(size_t bucket);
+
 #endif
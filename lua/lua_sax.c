@@ -20,8 +20,17 @@
 static const char* mozsvc_sax_table = "sax";
 static const char* mozsvc_sax_window = "mozsvc.sax.window";
 static const char* mozsvc_sax_word = "mozsvc.sax.word";
+static const char* mozsvc_sax_word_view = "mozsvc.sax.word_view";
+static const char* mozsvc_sax_word_set = "mozsvc.sax.word_set";
+static const char* mozsvc_sax_pattern_set = "mozsvc.sax.pattern_set";
+static const char* mozsvc_sax_bitmap = "mozsvc.sax.bitmap";
+static const char* mozsvc_sax_pyramid = "mozsvc.sax.pyramid";
 static const char* mozsvc_sax_win_suffix = "window";
 static const char* mozsvc_sax_word_suffix = "word";
+static const char* mozsvc_sax_word_set_suffix = "word_set";
+static const char* mozsvc_sax_pattern_set_suffix = "pattern_set";
+static const char* mozsvc_sax_bitmap_suffix = "bitmap";
+static const char* mozsvc_sax_pyramid_suffix = "pyramid";
 
 static void check_nwc(lua_State* lua, int n, int w, int c, int offset)
 {
@@ -30,10 +39,30 @@ static void check_nwc(lua_State* lua, int n, int w, int c, int offset)
   luaL_argcheck(lua, w > 1 && w <= 2048, offset, "w is out of range");
   luaL_argcheck(lua, n % w == 0, offset,
                 "n must be evenly divisible by w");
-  luaL_argcheck(lua, 1 < c && c <= STS_MAX_CARDINALITY, offset,
+  luaL_argcheck(lua, 1 < c && c <= STS_MAX_STRING_CARDINALITY, offset,
                 "cardinality is out of range");
 }
 
+/*
+ * Window userdata, the window comes first so that it reads as a sts_window
+ * handle like the other types. last holds the word seen by the previous
+ * changed() call.
+ */
+typedef struct sax_window_ud {
+  sts_window win;
+  bool seen;
+  sts_symbol last[];
+} sax_window_ud;
+
+/* Largest integer a lua_Number holds exactly, bounds the symbols() keys */
+static const double sax_max_key = 9007199254740992.0;
+
+/* Longest word converted to a string on the C stack */
+#define SAX_STACK_STRING 2048
+
+/* Most levels of a pyramid */
+#define SAX_MAX_LEVELS 16
+
 static sts_word check_sax_word(lua_State* lua, int ind)
 {
   // word was previously successfully constructed -> No need to check for NULLs
@@ -41,25 +70,29 @@ static sts_word check_sax_word(lua_State* lua, int ind)
   return *ud;
 }
 
-typedef enum {SAX_WORD, SAX_WINDOW} sax_type;
+typedef enum {
+  SAX_WORD, SAX_WINDOW, SAX_WORD_VIEW, SAX_WORD_SET, SAX_PATTERN_SET,
+  SAX_BITMAP, SAX_PYRAMID
+} sax_type;
 
 static sax_type sax_gettype(lua_State* lua, int ind)
 {
+  // in sax_type order
+  const char* types[] = { mozsvc_sax_word, mozsvc_sax_window,
+    mozsvc_sax_word_view, mozsvc_sax_word_set, mozsvc_sax_pattern_set,
+    mozsvc_sax_bitmap, mozsvc_sax_pyramid };
   void* ud = lua_touserdata(lua, ind);
   if (ud) {
     if (lua_getmetatable(lua, ind)) {
-      lua_getfield(lua, LUA_REGISTRYINDEX, mozsvc_sax_word);
-      if (lua_rawequal(lua, -1, -2)) {
-        lua_pop(lua, 2);  /* remove both metatables */
-        return SAX_WORD;
-      } else {
-        lua_pop(lua, 1);  /* remove word metatable */
-        lua_getfield(lua, LUA_REGISTRYINDEX, mozsvc_sax_window);
+      for (size_t i = 0; i < sizeof types / sizeof*types; ++i) {
+        lua_getfield(lua, LUA_REGISTRYINDEX, types[i]);
         if (lua_rawequal(lua, -1, -2)) {
           lua_pop(lua, 2);  /* remove both metatables */
-          return SAX_WINDOW;
+          return (sax_type)i;
         }
+        lua_pop(lua, 1);  /* remove the candidate metatable */
       }
+      lua_pop(lua, 1);
     }
   }
   luaL_typerror(lua, ind, "sax.window or sax.word expected");
@@ -70,47 +103,142 @@ static const struct sts_word* check_word_or_window(lua_State* lua, int ind)
 {
   sax_type type = sax_gettype(lua, ind);
   void* ud = lua_touserdata(lua, ind);
-  if (type == SAX_WORD) {
+  switch (type) {
+  case SAX_WORD:
     return *((sts_word*)ud);
-  } else {
-    sts_window window = *((struct sts_window**)ud);
-    return &window->current_word;
+  case SAX_WINDOW:
+    return &((sax_window_ud*)ud)->win->current_word;
+  case SAX_WORD_VIEW:
+    return *((const struct sts_word**)ud);
+  default:
+    luaL_typerror(lua, ind, "sax.window or sax.word expected");
+    return NULL; // unreachable due to longjmp
   }
 }
 
+static sts_word_set check_sax_word_set(lua_State* lua, int ind)
+{
+  sts_word_set* ud = luaL_checkudata(lua, ind, mozsvc_sax_word_set);
+  return *ud;
+}
+
+static sts_pattern_set check_sax_pattern_set(lua_State* lua, int ind)
+{
+  sts_pattern_set* ud = luaL_checkudata(lua, ind, mozsvc_sax_pattern_set);
+  return *ud;
+}
+
+static sts_bitmap check_sax_bitmap(lua_State* lua, int ind)
+{
+  sts_bitmap* ud = luaL_checkudata(lua, ind, mozsvc_sax_bitmap);
+  return *ud;
+}
+
+static sts_pyramid check_sax_pyramid(lua_State* lua, int ind)
+{
+  sts_pyramid* ud = luaL_checkudata(lua, ind, mozsvc_sax_pyramid);
+  return *ud;
+}
+
+/*
+ * Word, window or SAX string of cardinality c, *tmp receives the word parsed
+ * from a string (or NULL) and has to be freed by the caller
+ */
+static const struct sts_word* check_word_like(lua_State* lua,
+                                              int ind,
+                                              unsigned char c,
+                                              sts_word* tmp)
+{
+  *tmp = NULL;
+  if (lua_type(lua, ind) == LUA_TSTRING) {
+    *tmp = sts_from_sax_string(lua_tostring(lua, ind), c);
+    if (!*tmp) {
+      luaL_argerror(lua, ind, "illegal symbols for the set cardinality");
+    }
+    return *tmp;
+  }
+  return check_word_or_window(lua, ind);
+}
+
+static sax_window_ud* check_sax_window_ud(lua_State* lua, int ind)
+{
+  return luaL_checkudata(lua, ind, mozsvc_sax_window);
+}
+
 static sts_window check_sax_window(lua_State* lua, int ind)
 {
   /* same as with check_sax_word - no need to check for NULLs */
-  sts_window* ud = luaL_checkudata(lua, ind, mozsvc_sax_window);
-  return *ud;
+  return check_sax_window_ud(lua, ind)->win;
 }
 
 static void push_window(lua_State* lua, sts_window win)
 {
-  sts_window* ud = lua_newuserdata(lua, sizeof*ud);
+  size_t w = win->current_word.w;
+  sax_window_ud* ud = lua_newuserdata(lua, sizeof*ud + w * sizeof*ud->last);
   if (!ud) {
     luaL_error(lua, "memory allocation failed");
     // never reached since error long jumps but aids static analysis
     return;
   }
 
-  *ud = win;
+  ud->win = win;
+  ud->seen = false;
   luaL_getmetatable(lua, mozsvc_sax_window);
   lua_setmetatable(lua, -2);
 }
 
+static bool opt_boolean(lua_State* lua, int ind, const char* key)
+{
+  lua_getfield(lua, ind, key);
+  bool value = lua_toboolean(lua, -1);
+  lua_pop(lua, 1);
+  return value;
+}
+
+static lua_Number opt_number(lua_State* lua, int ind, const char* key,
+                             lua_Number dflt)
+{
+  lua_getfield(lua, ind, key);
+  lua_Number value = dflt;
+  if (!lua_isnil(lua, -1)) {
+    if (lua_type(lua, -1) != LUA_TNUMBER) {
+      lua_pop(lua, 1);
+      luaL_argerror(lua, ind, "option must be a number");
+      // never reached since argerror long jumps but aids static analysis
+      return dflt;
+    }
+    value = lua_tonumber(lua, -1);
+  }
+  lua_pop(lua, 1);
+  return value;
+}
+
 static int sax_new_window(lua_State* lua)
 {
-  luaL_argcheck(lua, lua_gettop(lua) == 3, 0, "incorrect number of args");
+  int argc = lua_gettop(lua);
+  luaL_argcheck(lua, argc == 3 || argc == 4, 0, "incorrect number of args");
   int n = luaL_checkint(lua, 1);
   int w = luaL_checkint(lua, 2);
   int c = luaL_checkint(lua, 3);
   check_nwc(lua, n, w, c, 1);
+  bool single = false;
+  lua_Number interval = 0;
+  if (argc == 4) {
+    luaL_checktype(lua, 4, LUA_TTABLE);
+    single = opt_boolean(lua, 4, "float");
+    interval = opt_number(lua, 4, "interval", 0);
+    luaL_argcheck(lua, interval >= 0, 4, "interval must be > 0");
+  }
 
-  sts_window win = sts_new_window(n, w, c);
+  sts_window win = single ? sts_new_float_window(n, w, c)
+                          : sts_new_window(n, w, c);
   if (!win) {
     return luaL_error(lua, "memory allocation failed");
   }
+  if (interval > 0 && !sts_set_window_interval(win, (long long)interval)) {
+    sts_free_window(win);
+    return luaL_error(lua, "memory allocation failed");
+  }
 
   push_window(lua, win);
   return 1;
@@ -173,6 +301,56 @@ static int sax_add(lua_State* lua)
   return 0;
 }
 
+static int sax_add_timed(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 3, 0, "incorrect number of args");
+  sts_window win = check_sax_window(lua, 1);
+  lua_Number ts = luaL_checknumber(lua, 2);
+  double value = luaL_checknumber(lua, 3);
+  luaL_argcheck(lua, win->bucket != NULL, 1, "window has no interval");
+  sts_append_timed(win, (long long)ts, value);
+  return 0;
+}
+
+static int sax_advance(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 2, 0, "incorrect number of args");
+  sts_window win = check_sax_window(lua, 1);
+  lua_Number ts = luaL_checknumber(lua, 2);
+  luaL_argcheck(lua, win->bucket != NULL, 1, "window has no interval");
+  sts_advance_timed(win, (long long)ts);
+  return 0;
+}
+
+static int sax_set_scale(lua_State* lua)
+{
+  int argc = lua_gettop(lua);
+  luaL_argcheck(lua, argc == 3 || argc == 4, 0, "incorrect number of args");
+  sts_window win = check_sax_window(lua, 1);
+  double mu = luaL_checknumber(lua, 2);
+  double sigma = luaL_checknumber(lua, 3);
+  double alpha = luaL_optnumber(lua, 4, 0);
+  luaL_argcheck(lua, isfinite(mu), 2, "mu must be finite");
+  luaL_argcheck(lua, isfinite(sigma) && sigma >= 0, 3,
+                "sigma must be finite and >= 0");
+  luaL_argcheck(lua, alpha >= 0 && alpha < 1, 4, "alpha must be in [0, 1)");
+  if (!sts_set_window_scale(win, mu, sigma, alpha)) {
+    return luaL_error(lua, "memory allocation failed");
+  }
+  return 0;
+}
+
+static int sax_scale(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 1, 0, "incorrect number of args");
+  sts_window win = check_sax_window(lua, 1);
+  double mu, sigma;
+  sts_get_window_scale(win, &mu, &sigma);
+  lua_pushnumber(lua, mu);
+  lua_pushnumber(lua, sigma);
+  return 2;
+}
+
 static int sax_mindist(lua_State* lua)
 {
   luaL_argcheck(lua, lua_gettop(lua) == 2, 0, "incorrect number of args");
@@ -192,23 +370,136 @@ static int sax_mindist(lua_State* lua)
   return 3;
 }
 
+/*
+ * Word set argument: either a word set or an array of words, windows or SAX
+ * strings that gets packed into a temporary set pushed on the stack (and left
+ * to the collector). w, c and n come from model or, if it's NULL, from the
+ * first array element which must then be a word or a window.
+ */
+static sts_word_set check_word_list(lua_State* lua, int ind,
+                                    const struct sts_word* model)
+{
+  if (lua_type(lua, ind) == LUA_TUSERDATA) {
+    return check_sax_word_set(lua, ind);
+  }
+  luaL_checktype(lua, ind, LUA_TTABLE);
+  size_t count = lua_objlen(lua, ind);
+  if (!model) {
+    luaL_argcheck(lua, count > 0, ind, "empty word list");
+    lua_rawgeti(lua, ind, 1);
+    model = check_word_or_window(lua, -1);
+    lua_pop(lua, 1);
+  }
+  sts_word_set* ud = lua_newuserdata(lua, sizeof*ud);
+  *ud = sts_new_word_set(model->n_values, model->w, model->c);
+  if (!*ud) {
+    luaL_error(lua, "memory allocation failed");
+    return NULL; // unreachable due to longjmp
+  }
+  luaL_getmetatable(lua, mozsvc_sax_word_set);
+  lua_setmetatable(lua, -2);
+  sts_word_set set = *ud;
+  for (size_t i = 1; i <= count; ++i) {
+    lua_rawgeti(lua, ind, (int)i);
+    sts_word tmp;
+    const struct sts_word* a = check_word_like(lua, -1, set->c, &tmp);
+    // the first word carrying n decides it for words built from strings
+    if (set->n_values == 0) set->n_values = a->n_values;
+    bool added = sts_word_set_add(set, a);
+    sts_free_word(tmp);
+    if (!added) {
+      luaL_argerror(lua, ind, "words don't share the same n, w and c");
+    }
+    lua_pop(lua, 1);
+  }
+  return set;
+}
+
+static int sax_mindist_many(lua_State* lua)
+{
+  int argc = lua_gettop(lua);
+  luaL_argcheck(lua, argc == 2 || argc == 3, 0, "incorrect number of args");
+  const struct sts_word* query = check_word_or_window(lua, 1);
+  sts_word_set set = check_word_list(lua, 2, query);
+  luaL_argcheck(lua, query->w == set->w && query->c == set->c
+                && (query->n_values == set->n_values || query->n_values == 0
+                    || set->n_values == 0), 1,
+                "word doesn't match the words n, w or c");
+  if (argc == 3) {
+    double threshold = luaL_checknumber(lua, 3);
+    luaL_argcheck(lua, threshold >= 0, 3, "threshold must be >= 0");
+    size_t* indices = lua_newuserdata(lua, (set->count + 1) * sizeof*indices);
+    size_t found = sts_word_set_within(set, query, threshold, indices);
+    lua_createtable(lua, (int)found, 0);
+    for (size_t i = 0; i < found; ++i) {
+      lua_pushnumber(lua, (lua_Number)indices[i] + 1);
+      lua_rawseti(lua, -2, (int)i + 1);
+    }
+    return 1;
+  }
+  double* out = lua_newuserdata(lua, (set->count + 1) * sizeof*out);
+  if (!sts_word_set_mindist(set, query, out)) {
+    return luaL_error(lua, "memory allocation failed");
+  }
+  lua_createtable(lua, (int)set->count, 0);
+  for (size_t i = 0; i < set->count; ++i) {
+    lua_pushnumber(lua, out[i]);
+    lua_rawseti(lua, -2, (int)i + 1);
+  }
+  return 1;
+}
+
+static int sax_distance_matrix(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 1, 0, "incorrect number of args");
+  sts_word_set set = check_word_list(lua, 1, NULL);
+  size_t count = set->count;
+  double* out = lua_newuserdata(lua, (count * count + 1) * sizeof*out);
+  if (!sts_word_set_distance_matrix(set, out)) {
+    return luaL_error(lua, "memory allocation failed");
+  }
+  lua_createtable(lua, (int)count, 0);
+  for (size_t i = 0; i < count; ++i) {
+    lua_createtable(lua, (int)count, 0);
+    for (size_t j = 0; j < count; ++j) {
+      lua_pushnumber(lua, out[i * count + j]);
+      lua_rawseti(lua, -2, (int)j + 1);
+    }
+    lua_rawseti(lua, -2, (int)i + 1);
+  }
+  return 1;
+}
+
 static int sax_to_string(lua_State* lua)
 {
   luaL_argcheck(lua, lua_gettop(lua) == 1, 0, "incorrect number of args");
   const struct sts_word* a = check_word_or_window(lua, 1);
-  char* str = sts_word_to_sax_string(a);
+  char buf[SAX_STACK_STRING + 1];
+  char* str = a->w <= SAX_STACK_STRING ? buf : malloc(a->w + 1);
   if (!str) {
+    return luaL_error(lua, "memory allocation failed");
+  }
+  bool valid = sts_word_write_sax_string(a, str);
+  if (valid) {
+    lua_pushlstring(lua, str, a->w);
+  }
+  if (str != buf) free(str);
+  if (!valid) {
     return luaL_argerror(lua, 1, "unprocessable symbols for cardinality "
                          "detected");
   }
-  lua_pushstring(lua, str);
-  free(str);
   return 1;
 }
 
 static int sax_equal(lua_State* lua)
 {
   luaL_argcheck(lua, lua_gettop(lua) == 2, 0, "incorrect number of args");
+  // collections only compare by identity
+  if (sax_gettype(lua, 1) > SAX_WORD_VIEW
+      || sax_gettype(lua, 2) > SAX_WORD_VIEW) {
+    lua_pushboolean(lua, lua_rawequal(lua, 1, 2));
+    return 1;
+  }
   const struct sts_word* a = check_word_or_window(lua, 1);
   const struct sts_word* b = check_word_or_window(lua, 2);
   lua_pushboolean(lua, sts_words_equal(a, b));
@@ -223,6 +514,76 @@ static int sax_window_get_word(lua_State* lua)
   return 1;
 }
 
+/* Pushes a view of a word owned by the object at index 1 */
+static void push_word_view(lua_State* lua, const struct sts_word* a)
+{
+  const struct sts_word** ud = lua_newuserdata(lua, sizeof*ud);
+  *ud = a;
+  luaL_getmetatable(lua, mozsvc_sax_word_view);
+  lua_setmetatable(lua, -2);
+
+  // the view's environment keeps the owner alive
+  lua_createtable(lua, 1, 0);
+#ifdef LUA_SANDBOX
+  // and carries the module's serialize and output functions
+  lua_pushnil(lua);
+  while (lua_next(lua, LUA_ENVIRONINDEX)) {
+    lua_pushvalue(lua, -2);
+    lua_insert(lua, -2);
+    lua_rawset(lua, -4);
+  }
+#endif
+  lua_pushvalue(lua, 1);
+  lua_rawseti(lua, -2, 1);
+  lua_setfenv(lua, -2);
+}
+
+static int sax_window_word(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 1, 0, "incorrect number of args");
+  push_word_view(lua, &check_sax_window(lua, 1)->current_word);
+  return 1;
+}
+
+static int sax_window_symbols(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 1, 0, "incorrect number of args");
+  const struct sts_word* a = &check_sax_window(lua, 1)->current_word;
+  // base c + 1 digits (NaN included) as long as they fit in a lua_Number
+  double key = 0, span = 1;
+  for (size_t i = 0; i < a->w && span <= sax_max_key; ++i) {
+    key = key * (a->c + 1) + a->symbols[i];
+    span *= a->c + 1;
+  }
+  if (span <= sax_max_key) {
+    lua_pushnumber(lua, key);
+    return 1;
+  }
+  // windows have w <= 2048, the string is interned by Lua
+  char buf[SAX_STACK_STRING + 1];
+  if (!sts_word_write_sax_string(a, buf)) {
+    return luaL_argerror(lua, 1, "unprocessable symbols for cardinality "
+                         "detected");
+  }
+  lua_pushlstring(lua, buf, a->w);
+  return 1;
+}
+
+static int sax_window_changed(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 1, 0, "incorrect number of args");
+  sax_window_ud* ud = check_sax_window_ud(lua, 1);
+  const struct sts_word* a = &ud->win->current_word;
+  bool changed = !ud->seen
+    || memcmp(ud->last, a->symbols, a->w * sizeof*ud->last) != 0;
+  if (changed) {
+    memcpy(ud->last, a->symbols, a->w * sizeof*ud->last);
+    ud->seen = true;
+  }
+  lua_pushboolean(lua, changed);
+  return 1;
+}
+
 static int sax_from_double_array(lua_State* lua)
 {
   int w = luaL_checkint(lua, 2);
@@ -272,6 +633,353 @@ static int sax_new_word(lua_State* lua)
   }
 }
 
+static int sax_new_word_set(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 3, 0, "incorrect number of args");
+  int n = luaL_checkint(lua, 1);
+  int w = luaL_checkint(lua, 2);
+  int c = luaL_checkint(lua, 3);
+  check_nwc(lua, n, w, c, 1);
+
+  sts_word_set* ud = lua_newuserdata(lua, sizeof*ud);
+  *ud = sts_new_word_set(n, w, c);
+  if (!*ud) {
+    return luaL_error(lua, "memory allocation failed");
+  }
+  luaL_getmetatable(lua, mozsvc_sax_word_set);
+  lua_setmetatable(lua, -2);
+  return 1;
+}
+
+static int sax_word_set_add(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 2, 0, "incorrect number of args");
+  sts_word_set set = check_sax_word_set(lua, 1);
+  sts_word tmp;
+  const struct sts_word* a = check_word_like(lua, 2, set->c, &tmp);
+  bool added = sts_word_set_add(set, a);
+  sts_free_word(tmp);
+  luaL_argcheck(lua, added, 2, "word doesn't match the set n, w or c");
+  return 0;
+}
+
+static int sax_word_set_nearest(lua_State* lua)
+{
+  int argc = lua_gettop(lua);
+  luaL_argcheck(lua, argc >= 2 && argc <= 4, 0, "incorrect number of args");
+  sts_word_set set = check_sax_word_set(lua, 1);
+  const struct sts_word* query = check_word_or_window(lua, 2);
+  int k = luaL_optint(lua, 3, 1);
+  int threads = luaL_optint(lua, 4, 1);
+  luaL_argcheck(lua, k > 0, 3, "k must be > 0");
+  luaL_argcheck(lua, threads > 0, 4, "threads must be > 0");
+  if ((size_t)k > set->count) k = (int)set->count;
+
+  lua_createtable(lua, k, 0);
+  lua_createtable(lua, k, 0);
+  if (k == 0) return 2;
+  struct sts_neighbor* out = lua_newuserdata(lua, k * sizeof*out);
+  size_t found = sts_word_set_topk_mt(set, query, k, out, threads);
+  if (found == 0) {
+    return luaL_argerror(lua, 2, "word doesn't match the set n, w or c");
+  }
+  for (size_t i = 0; i < found; ++i) {
+    lua_pushnumber(lua, (lua_Number)out[i].index + 1);
+    lua_rawseti(lua, -4, (int)i + 1);
+    lua_pushnumber(lua, out[i].distance);
+    lua_rawseti(lua, -3, (int)i + 1);
+  }
+  lua_pop(lua, 1); // scratch userdata
+  return 2;
+}
+
+static int sax_word_set_cluster(lua_State* lua)
+{
+  int argc = lua_gettop(lua);
+  luaL_argcheck(lua, argc >= 2 && argc <= 4, 0, "incorrect number of args");
+  sts_word_set set = check_sax_word_set(lua, 1);
+  int k = luaL_checkint(lua, 2);
+  int iterations = luaL_optint(lua, 3, 100);
+  int threads = luaL_optint(lua, 4, 1);
+  luaL_argcheck(lua, k > 0 && (size_t)k <= set->count, 2,
+                "k must be > 0 and <= the set size");
+  luaL_argcheck(lua, iterations > 0, 3, "iterations must be > 0");
+  luaL_argcheck(lua, threads > 0, 4, "threads must be > 0");
+
+  size_t* assignment = malloc(set->count * sizeof*assignment);
+  sts_symbol* centers = malloc(k * set->w * sizeof*centers);
+  if (!assignment || !centers
+      || !sts_word_set_kmodes(set, k, iterations, 0, threads, centers,
+                              assignment)) {
+    free(assignment);
+    free(centers);
+    return luaL_error(lua, "memory allocation failed");
+  }
+  lua_createtable(lua, (int)set->count, 0);
+  for (size_t i = 0; i < set->count; ++i) {
+    lua_pushnumber(lua, (lua_Number)assignment[i] + 1);
+    lua_rawseti(lua, -2, (int)i + 1);
+  }
+  free(assignment);
+  lua_createtable(lua, k, 0);
+  for (int c = 0; c < k; ++c) {
+    struct sts_word center = { centers + c * set->w, set->n_values, set->w,
+      set->c };
+    sts_word a = sts_dup_word(&center);
+    if (!a) {
+      free(centers);
+      return luaL_error(lua, "memory allocation failed");
+    }
+    push_word(lua, a);
+    lua_rawseti(lua, -2, c + 1);
+  }
+  free(centers);
+  return 2;
+}
+
+static int sax_word_set_size(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 1, 0, "incorrect number of args");
+  sts_word_set set = check_sax_word_set(lua, 1);
+  lua_pushnumber(lua, (lua_Number)set->count);
+  return 1;
+}
+
+static int sax_word_set_clear(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 1, 0, "incorrect number of args");
+  sts_clear_word_set(check_sax_word_set(lua, 1));
+  return 0;
+}
+
+static int sax_new_pattern_set(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 3, 0, "incorrect number of args");
+  int n = luaL_checkint(lua, 1);
+  int w = luaL_checkint(lua, 2);
+  int c = luaL_checkint(lua, 3);
+  check_nwc(lua, n, w, c, 1);
+
+  sts_pattern_set* ud = lua_newuserdata(lua, sizeof*ud);
+  *ud = sts_new_pattern_set(n, w, c);
+  if (!*ud) {
+    return luaL_error(lua, "memory allocation failed");
+  }
+  luaL_getmetatable(lua, mozsvc_sax_pattern_set);
+  lua_setmetatable(lua, -2);
+  return 1;
+}
+
+static int sax_pattern_set_add(lua_State* lua)
+{
+  int argc = lua_gettop(lua);
+  luaL_argcheck(lua, argc == 3 || argc == 4, 0, "incorrect number of args");
+  sts_pattern_set set = check_sax_pattern_set(lua, 1);
+  double threshold = luaL_checknumber(lua, 3);
+  lua_Number id = luaL_optnumber(lua, 4, (lua_Number)set->count + 1);
+  luaL_argcheck(lua, threshold >= 0, 3, "threshold must be >= 0");
+  luaL_argcheck(lua, id >= 0, 4, "id must be >= 0");
+  sts_word tmp;
+  const struct sts_word* a = check_word_like(lua, 2, set->c, &tmp);
+  bool added = sts_pattern_set_add(set, a, threshold, (size_t)id);
+  sts_free_word(tmp);
+  luaL_argcheck(lua, added, 2, "pattern doesn't match the set n, w or c");
+  lua_pushnumber(lua, id);
+  return 1;
+}
+
+static int sax_pattern_set_match(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 2, 0, "incorrect number of args");
+  sts_pattern_set set = check_sax_pattern_set(lua, 1);
+  const struct sts_word* a = check_word_or_window(lua, 2);
+  size_t buf[64];
+  size_t* ids = buf;
+  size_t found = sts_pattern_set_match(set, a, ids, sizeof buf / sizeof*buf);
+  if (found > sizeof buf / sizeof*buf) {
+    ids = lua_newuserdata(lua, found * sizeof*ids);
+    sts_pattern_set_match(set, a, ids, found);
+  }
+  lua_createtable(lua, (int)found, 0);
+  for (size_t i = 0; i < found; ++i) {
+    lua_pushnumber(lua, (lua_Number)ids[i]);
+    lua_rawseti(lua, -2, (int)i + 1);
+  }
+  return 1;
+}
+
+static int sax_pattern_set_size(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 1, 0, "incorrect number of args");
+  sts_pattern_set set = check_sax_pattern_set(lua, 1);
+  lua_pushnumber(lua, (lua_Number)set->count);
+  return 1;
+}
+
+static int sax_pattern_set_clear(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 1, 0, "incorrect number of args");
+  sts_clear_pattern_set(check_sax_pattern_set(lua, 1));
+  return 0;
+}
+
+static int sax_new_bitmap(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 5, 0, "incorrect number of args");
+  int w = luaL_checkint(lua, 1);
+  int c = luaL_checkint(lua, 2);
+  int L = luaL_checkint(lua, 3);
+  int lag = luaL_checkint(lua, 4);
+  int lead = luaL_checkint(lua, 5);
+  luaL_argcheck(lua, w > 1 && w <= 2048, 1, "w is out of range");
+  luaL_argcheck(lua, 1 < c && c <= STS_MAX_STRING_CARDINALITY, 2,
+                "cardinality is out of range");
+  luaL_argcheck(lua, L > 0 && L <= w, 3, "L is out of range");
+  luaL_argcheck(lua, lag > 0, 4, "lag must be > 0");
+  luaL_argcheck(lua, lead > 0, 5, "lead must be > 0");
+
+  sts_bitmap* ud = lua_newuserdata(lua, sizeof*ud);
+  *ud = sts_new_bitmap(w, c, L, lag, lead);
+  if (!*ud) {
+    return luaL_error(lua, "c^L is too large or memory allocation failed");
+  }
+  luaL_getmetatable(lua, mozsvc_sax_bitmap);
+  lua_setmetatable(lua, -2);
+  return 1;
+}
+
+static void push_score(lua_State* lua, double score)
+{
+  if (isnan(score)) {
+    lua_pushnil(lua);
+  } else {
+    lua_pushnumber(lua, score);
+  }
+}
+
+static int sax_bitmap_add(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 2, 0, "incorrect number of args");
+  sts_bitmap bm = check_sax_bitmap(lua, 1);
+  sts_word tmp;
+  const struct sts_word* a = check_word_like(lua, 2, bm->c, &tmp);
+  bool valid = a->w == bm->w && a->c == bm->c;
+  if (valid) {
+    push_score(lua, sts_bitmap_update(bm, a));
+  }
+  sts_free_word(tmp);
+  luaL_argcheck(lua, valid, 2, "word doesn't match the bitmap w or c");
+  return 1;
+}
+
+static int sax_bitmap_score(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 1, 0, "incorrect number of args");
+  push_score(lua, sts_bitmap_score(check_sax_bitmap(lua, 1)));
+  return 1;
+}
+
+static int sax_bitmap_clear(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 1, 0, "incorrect number of args");
+  sts_reset_bitmap(check_sax_bitmap(lua, 1));
+  return 0;
+}
+
+static int sax_new_pyramid(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 4, 0, "incorrect number of args");
+  int n = luaL_checkint(lua, 1);
+  int w = luaL_checkint(lua, 2);
+  int c = luaL_checkint(lua, 3);
+  check_nwc(lua, n, w, c, 1);
+  luaL_checktype(lua, 4, LUA_TTABLE);
+  size_t levels = lua_objlen(lua, 4);
+  luaL_argcheck(lua, levels > 0 && levels <= SAX_MAX_LEVELS, 4,
+                "number of levels is out of range");
+  size_t factors[SAX_MAX_LEVELS];
+  for (size_t i = 0; i < levels; ++i) {
+    lua_rawgeti(lua, 4, (int)i + 1);
+    lua_Number f = lua_tonumber(lua, -1);
+    lua_pop(lua, 1);
+    luaL_argcheck(lua, f >= 1 && f <= 1e9 && f == floor(f), 4,
+                  "factors must be positive integers");
+    factors[i] = (size_t)f;
+  }
+
+  sts_pyramid* ud = lua_newuserdata(lua, sizeof*ud);
+  *ud = sts_new_pyramid(levels, factors, n, w, c);
+  if (!*ud) {
+    return luaL_error(lua, "memory allocation failed");
+  }
+  luaL_getmetatable(lua, mozsvc_sax_pyramid);
+  lua_setmetatable(lua, -2);
+  return 1;
+}
+
+static int sax_pyramid_add(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 2, 0, "incorrect number of args");
+  sts_pyramid p = check_sax_pyramid(lua, 1);
+  double value = luaL_checknumber(lua, 2);
+  lua_pushnumber(lua, (lua_Number)sts_pyramid_append(p, value));
+  return 1;
+}
+
+static size_t check_level(lua_State* lua, const struct sts_pyramid* p,
+                          int ind)
+{
+  int level = luaL_checkint(lua, ind);
+  luaL_argcheck(lua, level > 0 && (size_t)level <= p->levels, ind,
+                "level is out of range");
+  return (size_t)level - 1;
+}
+
+static int sax_pyramid_word(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 2, 0, "incorrect number of args");
+  sts_pyramid p = check_sax_pyramid(lua, 1);
+  push_word_view(lua, sts_pyramid_word(p, check_level(lua, p, 2)));
+  return 1;
+}
+
+static int sax_pyramid_restore(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 6, 0, "incorrect number of args");
+  sts_pyramid p = check_sax_pyramid(lua, 1);
+  size_t level = check_level(lua, p, 2);
+  luaL_checktype(lua, 3, LUA_TTABLE);
+  int filled = luaL_checkint(lua, 4);
+  double sum = luaL_checknumber(lua, 5);
+  int cnt = luaL_checkint(lua, 6);
+  struct sts_pyramid_level* b = &p->buckets[level];
+  luaL_argcheck(lua, filled >= 0 && (size_t)filled < b->factor, 4,
+                "filled is out of range");
+  luaL_argcheck(lua, cnt >= 0, 6, "cnt must be >= 0");
+
+  sts_window win = &p->windows[level];
+  size_t n = lua_objlen(lua, 3);
+  luaL_argcheck(lua, n <= win->current_word.n_values, 3,
+                "too many values for the level");
+  for (size_t i = 1; i <= n; ++i) {
+    lua_rawgeti(lua, 3, (int)i);
+    double value = lua_isnumber(lua, -1) ? lua_tonumber(lua, -1) : NAN;
+    lua_pop(lua, 1);
+    sts_append_value(win, value);
+  }
+  b->filled = (size_t)filled;
+  b->sum = sum;
+  b->cnt = (size_t)cnt;
+  return 0;
+}
+
+static int sax_pyramid_clear(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 1, 0, "incorrect number of args");
+  sts_reset_pyramid(check_sax_pyramid(lua, 1));
+  return 0;
+}
+
 static int sax_clear(lua_State* lua)
 {
   luaL_argcheck(lua, lua_gettop(lua) == 1, 0, "incorrect number of arguments");
@@ -282,10 +990,10 @@ static int sax_clear(lua_State* lua)
 
 #ifdef LUA_SANDBOX
 
-static bool all_nans(double* array, size_t size)
+static bool all_nans(const struct sts_window* win)
 {
-  for (size_t i = 0; i < size; ++i) {
-    if (!isnan(array[i])) return false;
+  for (size_t i = 0; i < win->current_word.n_values; ++i) {
+    if (!isnan(sts_window_value(win, i))) return false;
   }
   return true;
 }
@@ -305,19 +1013,47 @@ static int serialize_sax(lua_State* lua)
       size_t c = win->current_word.c;
       if (lsb_outputf(ob,
                       "if %s == nil then %s = sax.window.new(%" PRIuSIZE
-                      ", %" PRIuSIZE ", %" PRIuSIZE ") end\n",
+                      ", %" PRIuSIZE ", %" PRIuSIZE,
                       key, key, n, w, c)) return 1;
-      if (!all_nans(win->values->buffer, win->current_word.n_values)) {
+      if (win->values->fbuffer || win->bucket) {
+        if (lsb_outputs(ob, ", {", 3)) return 1;
+        if (win->values->fbuffer) {
+          if (lsb_outputs(ob, "float = true,", 13)) return 1;
+        }
+        if (win->bucket) {
+          if (lsb_outputf(ob, "interval = %lld,", win->bucket->interval)) {
+            return 1;
+          }
+        }
+        if (lsb_outputs(ob, "}", 1)) return 1;
+      }
+      if (lsb_outputs(ob, ") end\n", 6)) return 1;
+      if (!all_nans(win)) {
         if (lsb_outputf(ob, "%s:clear()\n%s:add({", key, key)) return 1;
-        double* val = win->values->head;
-        size_t n_values = 0;
-        while (n_values < n) {
-          if (n_values++ != 0 && lsb_outputs(ob, ",", 1)) return 1;
-          if (lsb_serialize_double(ob, *val)) return 1;
-          if (++val == win->values->buffer_end) val = win->values->buffer;
+        for (size_t i = 0; i < n; ++i) {
+          if (i != 0 && lsb_outputs(ob, ",", 1)) return 1;
+          if (lsb_serialize_double(ob, sts_window_value(win, i))) return 1;
         }
         if (lsb_outputs(ob, "})\n", 3)) return 1;
       }
+      const struct sts_time_bucket* b = win->bucket;
+      if (b && b->open) {
+        // the open bucket is restored as a single sample carrying its mean
+        if (lsb_outputf(ob, "%s:add_timed(%lld, ", key, b->start)) return 1;
+        if (lsb_serialize_double(ob, b->cnt ? b->sum / b->cnt : NAN)) return 1;
+        if (lsb_outputs(ob, ")\n", 2)) return 1;
+      }
+      const struct sts_window_scale* scale = win->scale;
+      if (scale) {
+        // after the replay, which moves an EWMA scale
+        if (lsb_outputf(ob, "%s:set_scale(", key)) return 1;
+        if (lsb_serialize_double(ob, scale->mu)) return 1;
+        if (lsb_outputs(ob, ", ", 2)) return 1;
+        if (lsb_serialize_double(ob, sqrt(scale->var))) return 1;
+        if (lsb_outputs(ob, ", ", 2)) return 1;
+        if (lsb_serialize_double(ob, scale->alpha)) return 1;
+        if (lsb_outputs(ob, ")\n", 2)) return 1;
+      }
       return 0;
     }
   case SAX_WORD:
@@ -337,6 +1073,117 @@ static int serialize_sax(lua_State* lua)
       free(sax);
       return 0;
     }
+  case SAX_WORD_SET:
+    {
+      const struct sts_word_set* set = check_sax_word_set(lua, -3);
+      if (lsb_outputf(ob,
+                      "if %s == nil then %s = sax.word_set.new(%" PRIuSIZE
+                      ", %" PRIuSIZE ", %u) end\n%s:clear()\n",
+                      key, key, set->n_values, set->w, (unsigned)set->c,
+                      key)) return 1;
+      struct sts_word a = { NULL, set->n_values, set->w, set->c };
+      for (size_t i = 0; i < set->count; ++i) {
+        a.symbols = set->symbols + i * set->w;
+        char* sax = sts_word_to_sax_string(&a);
+        if (!sax) {
+          return luaL_error(lua, "memory allocation failed");
+        }
+        if (lsb_outputf(ob, "%s:add(\"%s\")\n", key, sax)) {
+          free(sax);
+          return 1;
+        }
+        free(sax);
+      }
+      return 0;
+    }
+  case SAX_PATTERN_SET:
+    {
+      const struct sts_pattern_set* set = check_sax_pattern_set(lua, -3);
+      if (lsb_outputf(ob,
+                      "if %s == nil then %s = sax.pattern_set.new(%" PRIuSIZE
+                      ", %" PRIuSIZE ", %u) end\n%s:clear()\n",
+                      key, key, set->n_values, set->w, (unsigned)set->c,
+                      key)) return 1;
+      struct sts_word a = { NULL, set->n_values, set->w, set->c };
+      for (size_t i = 0; i < set->count; ++i) {
+        a.symbols = set->symbols + i * set->w;
+        char* sax = sts_word_to_sax_string(&a);
+        if (!sax) {
+          return luaL_error(lua, "memory allocation failed");
+        }
+        if (lsb_outputf(ob, "%s:add(\"%s\", ", key, sax)) {
+          free(sax);
+          return 1;
+        }
+        free(sax);
+        if (lsb_serialize_double(ob, set->thresholds[i])) return 1;
+        if (lsb_outputf(ob, ", %" PRIuSIZE ")\n", set->ids[i])) return 1;
+      }
+      return 0;
+    }
+  case SAX_WORD_VIEW:
+    // recreated from the window by the plugin code, nothing to restore
+    return 0;
+  case SAX_BITMAP:
+    {
+      const struct sts_bitmap* bm = check_sax_bitmap(lua, -3);
+      if (lsb_outputf(ob,
+                      "if %s == nil then %s = sax.bitmap.new(%" PRIuSIZE
+                      ", %u, %" PRIuSIZE ", %" PRIuSIZE ", %" PRIuSIZE
+                      ") end\n%s:clear()\n",
+                      key, key, bm->w, (unsigned)bm->c, bm->L, bm->lag,
+                      bm->lead, key)) return 1;
+      // replay the symbol history, the first word pushes its w symbols and
+      // each later one its last symbol
+      sts_symbol symbols[2048]; // bitmaps created from Lua have w <= 2048
+      struct sts_word a = { symbols, 0, bm->w, bm->c };
+      size_t oldest = bm->head + bm->span - bm->seen;
+      for (size_t i = bm->w - 1; i < bm->seen; ++i) {
+        for (size_t j = 0; j < bm->w; ++j) {
+          symbols[j] = bm->history[(oldest + i + 1 - bm->w + j) % bm->span];
+        }
+        char* sax = sts_word_to_sax_string(&a);
+        if (!sax) {
+          return luaL_error(lua, "memory allocation failed");
+        }
+        if (lsb_outputf(ob, "%s:add(\"%s\")\n", key, sax)) {
+          free(sax);
+          return 1;
+        }
+        free(sax);
+      }
+      return 0;
+    }
+  case SAX_PYRAMID:
+    {
+      const struct sts_pyramid* p = check_sax_pyramid(lua, -3);
+      const struct sts_word* a = &p->windows[0].current_word;
+      if (lsb_outputf(ob,
+                      "if %s == nil then %s = sax.pyramid.new(%" PRIuSIZE
+                      ", %" PRIuSIZE ", %u, {",
+                      key, key, a->n_values, a->w, (unsigned)a->c)) return 1;
+      for (size_t i = 0; i < p->levels; ++i) {
+        if (lsb_outputf(ob, "%s%" PRIuSIZE, i ? "," : "",
+                        p->buckets[i].factor)) return 1;
+      }
+      if (lsb_outputf(ob, "}) end\n%s:clear()\n", key)) return 1;
+      for (size_t i = 0; i < p->levels; ++i) {
+        const struct sts_window* win = &p->windows[i];
+        const struct sts_pyramid_level* b = &p->buckets[i];
+        if (all_nans(win) && b->filled == 0) continue;
+        if (lsb_outputf(ob, "%s:restore(%" PRIuSIZE ", {", key, i + 1)) {
+          return 1;
+        }
+        for (size_t j = 0; j < a->n_values; ++j) {
+          if (j != 0 && lsb_outputs(ob, ",", 1)) return 1;
+          if (lsb_serialize_double(ob, sts_window_value(win, j))) return 1;
+        }
+        if (lsb_outputf(ob, "}, %" PRIuSIZE ", ", b->filled)) return 1;
+        if (lsb_serialize_double(ob, b->sum)) return 1;
+        if (lsb_outputf(ob, ", %" PRIuSIZE ")\n", b->cnt)) return 1;
+      }
+      return 0;
+    }
   }
   return 1;
 }
@@ -378,6 +1225,95 @@ static int sax_gc_word(lua_State* lua)
   return 0;
 }
 
+static int sax_gc_word_set(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 1, 0, "incorrect number of arguments");
+  sts_free_word_set(check_sax_word_set(lua, 1));
+  return 0;
+}
+
+static int sax_gc_pattern_set(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 1, 0, "incorrect number of arguments");
+  sts_free_pattern_set(check_sax_pattern_set(lua, 1));
+  return 0;
+}
+
+static int sax_gc_bitmap(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 1, 0, "incorrect number of arguments");
+  sts_free_bitmap(check_sax_bitmap(lua, 1));
+  return 0;
+}
+
+static int sax_gc_pyramid(lua_State* lua)
+{
+  luaL_argcheck(lua, lua_gettop(lua) == 1, 0, "incorrect number of arguments");
+  sts_free_pyramid(check_sax_pyramid(lua, 1));
+  return 0;
+}
+
+static void push_histogram(lua_State* lua, const struct sts_histogram* h)
+{
+  lua_newtable(lua);
+  lua_pushnumber(lua, (lua_Number)h->count);
+  lua_setfield(lua, -2, "count");
+  lua_pushnumber(lua, (lua_Number)h->min_ns);
+  lua_setfield(lua, -2, "min");
+  lua_pushnumber(lua, (lua_Number)h->max_ns);
+  lua_setfield(lua, -2, "max");
+  lua_pushnumber(lua, h->count ? (lua_Number)h->total_ns / h->count : 0);
+  lua_setfield(lua, -2, "mean");
+  lua_pushnumber(lua, sts_histogram_quantile(h, 0.5));
+  lua_setfield(lua, -2, "p50");
+  lua_pushnumber(lua, sts_histogram_quantile(h, 0.9));
+  lua_setfield(lua, -2, "p90");
+  lua_pushnumber(lua, sts_histogram_quantile(h, 0.99));
+  lua_setfield(lua, -2, "p99");
+}
+
+static void push_counter(lua_State* lua, const char* name,
+                         unsigned long long value)
+{
+  lua_pushnumber(lua, (lua_Number)value);
+  lua_setfield(lua, -2, name);
+}
+
+static int sax_stats(lua_State* lua)
+{
+  int argc = lua_gettop(lua);
+  luaL_argcheck(lua, argc <= 1, 0, "incorrect number of args");
+  if (argc == 1) {
+    sts_window win = check_sax_window(lua, 1);
+    lua_newtable(lua);
+    push_counter(lua, "appends", win->stats.appends);
+    push_counter(lua, "word_recomputes", win->stats.word_recomputes);
+    push_counter(lua, "nan_inputs", win->stats.nan_inputs);
+    push_counter(lua, "inf_inputs", win->stats.inf_inputs);
+    return 1;
+  }
+
+  // too large for the C stack, scratch userdata is collected with the call
+  struct sts_stats* stats = lua_newuserdata(lua, sizeof*stats);
+  sts_get_stats(stats);
+  lua_newtable(lua);
+  lua_pushboolean(lua, stats->enabled);
+  lua_setfield(lua, -2, "enabled");
+  push_counter(lua, "appends", stats->appends);
+  push_counter(lua, "word_recomputes", stats->word_recomputes);
+  push_counter(lua, "nan_inputs", stats->nan_inputs);
+  push_counter(lua, "inf_inputs", stats->inf_inputs);
+  push_counter(lua, "nan_frames", stats->nan_frames);
+  push_counter(lua, "mindist_calls", stats->mindist_calls);
+  push_counter(lua, "allocations", stats->allocations);
+  push_histogram(lua, &stats->append_latency);
+  lua_setfield(lua, -2, "append_latency");
+  push_histogram(lua, &stats->mindist_latency);
+  lua_setfield(lua, -2, "mindist_latency");
+  lua_remove(lua, -2); // scratch userdata
+  return 1;
+}
+
 static int sax_version(lua_State* lua)
 {
   lua_pushstring(lua, DIST_VERSION);
@@ -386,7 +1322,10 @@ static int sax_version(lua_State* lua)
 
 static const struct luaL_Reg saxlib_f[] =
 {
-  { "mindist", sax_mindist }
+  { "distance_matrix", sax_distance_matrix }
+  , { "mindist", sax_mindist }
+  , { "mindist_many", sax_mindist_many }
+  , { "stats", sax_stats }
   , { "version", sax_version }
   , { NULL, NULL }
 };
@@ -398,13 +1337,66 @@ static const struct luaL_Reg saxlib_word[] =
   , { NULL, NULL }
 };
 
+static const struct luaL_Reg saxlib_word_view[] =
+{
+  { "__tostring", sax_to_string }
+  , { NULL, NULL }
+};
+
 static const struct luaL_Reg saxlib_win[] =
 {
   { "add", sax_add }
+  , { "add_timed", sax_add_timed }
+  , { "advance", sax_advance }
+  , { "changed", sax_window_changed }
   , { "clear", sax_clear }
   , { "__gc", sax_gc_window }
   , { "__tostring", sax_to_string }
   , { "get_word", sax_window_get_word }
+  , { "scale", sax_scale }
+  , { "set_scale", sax_set_scale }
+  , { "symbols", sax_window_symbols }
+  , { "word", sax_window_word }
+  , { NULL, NULL }
+};
+
+static const struct luaL_Reg saxlib_word_set[] =
+{
+  { "add", sax_word_set_add }
+  , { "clear", sax_word_set_clear }
+  , { "cluster", sax_word_set_cluster }
+  , { "nearest", sax_word_set_nearest }
+  , { "size", sax_word_set_size }
+  , { "__gc", sax_gc_word_set }
+  , { NULL, NULL }
+};
+
+static const struct luaL_Reg saxlib_pattern_set[] =
+{
+  { "add", sax_pattern_set_add }
+  , { "clear", sax_pattern_set_clear }
+  , { "match", sax_pattern_set_match }
+  , { "size", sax_pattern_set_size }
+  , { "__gc", sax_gc_pattern_set }
+  , { NULL, NULL }
+};
+
+static const struct luaL_Reg saxlib_bitmap[] =
+{
+  { "add", sax_bitmap_add }
+  , { "clear", sax_bitmap_clear }
+  , { "score", sax_bitmap_score }
+  , { "__gc", sax_gc_bitmap }
+  , { NULL, NULL }
+};
+
+static const struct luaL_Reg saxlib_pyramid[] =
+{
+  { "add", sax_pyramid_add }
+  , { "clear", sax_pyramid_clear }
+  , { "restore", sax_pyramid_restore }
+  , { "word", sax_pyramid_word }
+  , { "__gc", sax_gc_pyramid }
   , { NULL, NULL }
 };
 
@@ -447,11 +1439,20 @@ int luaopen_sax(lua_State* lua)
 
   reg_class(lua, mozsvc_sax_window, saxlib_win);
   reg_class(lua, mozsvc_sax_word, saxlib_word);
+  reg_class(lua, mozsvc_sax_word_view, saxlib_word_view);
+  reg_class(lua, mozsvc_sax_word_set, saxlib_word_set);
+  reg_class(lua, mozsvc_sax_pattern_set, saxlib_pattern_set);
+  reg_class(lua, mozsvc_sax_bitmap, saxlib_bitmap);
+  reg_class(lua, mozsvc_sax_pyramid, saxlib_pyramid);
 
   lua_newtable(lua);
   luaL_register(lua, NULL, saxlib_f);
   reg_module(lua, mozsvc_sax_word_suffix, sax_new_word);
   reg_module(lua, mozsvc_sax_win_suffix, sax_new_window);
+  reg_module(lua, mozsvc_sax_word_set_suffix, sax_new_word_set);
+  reg_module(lua, mozsvc_sax_pattern_set_suffix, sax_new_pattern_set);
+  reg_module(lua, mozsvc_sax_bitmap_suffix, sax_new_bitmap);
+  reg_module(lua, mozsvc_sax_pyramid_suffix, sax_new_pyramid);
   lua_pushvalue(lua, -1);
   lua_setfield(lua, LUA_GLOBALSINDEX, mozsvc_sax_table);
 
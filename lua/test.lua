@@ -8,6 +8,10 @@ local a = sax.word.new({10.3, 7, 1, -5, -5, 7.2}, 2, 8)
 local b = sax.word.new("FC", 8)
 assert(a == b, "Expected array to be equal to it's sax representation after transform")
 
+local a = sax.word.new({-3, -1, 0, 1, 3}, 5, 26)
+assert(tostring(a) == "BINRY", "received: " .. tostring(a))
+assert(a == sax.word.new("BINRY", 26))
+
 
 local a = sax.word.new({10.3, 7, 1, -5, -5, 7.2}, 2, 8)
 local values = {-9, -8, -7, -5, -5, 7.2}
@@ -73,7 +77,7 @@ local errors = {
     function() local sw = sax.window.new(1, 3, 3) end, -- out of bounds parameters
     function() local sw = sax.window.new(9, 1, 3) end,
     function() local sw = sax.window.new(9, 3, 1) end,
-    function() local sw = sax.window.new(9, 3, 17) end,
+    function() local sw = sax.window.new(9, 3, 27) end,
     function() local sw = sax.window.new(5000, 5, 5) end,
     function() local sw = sax.window.new(10, 3, 3) end, -- n not equally divisible by w
     function() local sw = sax.word.new() end, -- new() incorrect # args
@@ -87,11 +91,11 @@ local errors = {
     function() local sw = sax.word.new("AAABF", 5) end,
     function() local sw = sax.word.new("aaabc", 5) end,
     function() local sw = sax.word.new("AABBC", 1) end,
-    function() local sw = sax.word.new("AABBC", 17) end,
+    function() local sw = sax.word.new("AABBC", 27) end,
     function() local sw = sax.word.new({}, 1, 5) end,
     function() local sw = sax.word.new({1, 2, 3}, 1, 5) end,
     function() local sw = sax.word.new(data, 3, 1) end,
-    function() local sw = sax.word.new(data, 3, 17) end,
+    function() local sw = sax.word.new(data, 3, 27) end,
     function() local sw = sax.word.new(data, 4, 5) end,
     function() sax.mindist() end, -- invalid parameter types
     function() sax.mindist(1, 1) end,
@@ -196,3 +200,223 @@ local function test_nan_inf()
 end
 
 test_nan_inf()
+
+local function test_stats()
+    local s = sax.stats()
+    assert(type(s.enabled) == "boolean")
+    local win = sax.window.new(4, 2, 4)
+    win:add({1, 0/0, 1/0, 2})
+    local ws = sax.stats(win)
+    if s.enabled then
+        assert(ws.appends == 4, ws.appends)
+        assert(ws.nan_inputs == 1 and ws.inf_inputs == 1)
+        assert(sax.stats().appends >= 4)
+    else
+        assert(ws.appends == 0)
+    end
+    assert(type(sax.stats().append_latency.p99) == "number")
+end
+
+test_stats()
+
+local function test_float_window()
+    local values = {1, 2, 3, 10.1}
+    local win = sax.window.new(4, 2, 4, {float = true})
+    assert(tostring(win) == "##", "received: " .. tostring(win))
+    win:add(values)
+    assert(win == sax.word.new(values, 2, 4), "received: " .. tostring(win))
+    win:clear()
+    assert(tostring(win) == "##", "received: " .. tostring(win))
+    local ok = pcall(sax.window.new, 4, 2, 4, "float")
+    assert(not ok, "options must be a table")
+end
+
+test_float_window()
+
+local function test_time_window()
+    local win = sax.window.new(4, 2, 4, {interval = 10})
+    win:add_timed(0, 1)
+    win:add_timed(5, 3)
+    assert(tostring(win) == "##", "received: " .. tostring(win))
+    win:add_timed(12, 4)
+    win:add_timed(35, 6)
+    win:advance(45)
+    local plain = sax.window.new(4, 2, 4)
+    plain:add({2, 4, 0/0, 6})
+    assert(win == plain, "received: " .. tostring(win))
+    win:advance(1e6)
+    assert(tostring(win) == "##", "received: " .. tostring(win))
+    assert(not pcall(plain.add_timed, plain, 0, 1), "plain window has no interval")
+    assert(not pcall(sax.window.new, 4, 2, 4, {interval = "1m"}))
+end
+
+test_time_window()
+
+local function test_word_set()
+    local set = sax.word_set.new(4, 2, 4)
+    set:add("AA")
+    set:add("DD")
+    set:add(sax.word.new("AB", 4))
+    local win = sax.window.new(4, 2, 4)
+    win:add({1, 2, 3, 10.1})
+    set:add(win)
+    assert(set:size() == 4, "received: " .. set:size())
+    local indices, distances = set:nearest(sax.word.new("AC", 4), 2)
+    -- "AB" and the window's "AD" are both adjacent, ties go by index
+    assert(#indices == 2 and indices[1] == 3 and indices[2] == 4)
+    assert(distances[1] == 0 and distances[2] == 0)
+    indices, distances = set:nearest(sax.word.new("AA", 4), 3)
+    assert(indices[1] == 1 and distances[1] == 0)
+    assert(distances[2] == sax.mindist(sax.word.new("AA", 4), sax.word.new("AB", 4)))
+    indices = set:nearest(win, 10, 2)
+    assert(#indices == 4 and indices[1] == 4, "received: " .. tostring(indices[1]))
+    assert(not pcall(set.add, set, "AAA"), "w mismatch")
+    assert(not pcall(set.nearest, set, sax.word.new("AAA", 4)), "w mismatch")
+    assert(not pcall(sax.mindist, set, win), "sets aren't words")
+    local clusters, centers = set:cluster(2)
+    assert(#clusters == 4 and #centers == 2)
+    assert(clusters[1] == clusters[3], "AA and AB")
+    assert(clusters[2] ~= clusters[1], "DD has its own cluster")
+    assert(tostring(centers[clusters[2]]) == "DD", tostring(centers[clusters[2]]))
+    assert(not pcall(set.cluster, set, 5), "k > size")
+    set:clear()
+    indices = set:nearest(win, 3)
+    assert(#indices == 0)
+end
+
+test_word_set()
+
+local function test_mindist_many()
+    local q = sax.word.new("ABCD", 4)
+    local words = {"ABCD", sax.word.new("DCBA", 4), "ABDD", "#BCD"}
+    local d = sax.mindist_many(q, words)
+    assert(#d == 4 and d[1] == 0)
+    for i, w in ipairs(words) do
+        if type(w) == "string" then w = sax.word.new(w, 4) end
+        assert(math.abs(d[i] - sax.mindist(q, w)) < 1e-9, i)
+    end
+    local set = sax.word_set.new(4, 4, 4)
+    for _, w in ipairs(words) do set:add(w) end
+    local d2 = sax.mindist_many(q, set)
+    for i = 1, 4 do assert(math.abs(d2[i] - d[i]) < 1e-9) end
+    local within = sax.mindist_many(q, set, d[3])
+    assert(within[1] == 1)
+    for _, i in ipairs(within) do assert(d[i] <= d[3]) end
+    assert(#sax.mindist_many(q, {}) == 0)
+    assert(not pcall(sax.mindist_many, q, {"ABC"}), "w mismatch")
+    assert(not pcall(sax.mindist_many, sax.word.new("ABC", 4), set), "w mismatch")
+    assert(not pcall(sax.mindist_many, q, set, -1), "negative threshold")
+
+    local m = sax.distance_matrix({q, "DCBA", "ABDD"})
+    assert(#m == 3 and m[1][1] == 0 and m[2][3] == m[3][2])
+    assert(math.abs(m[1][2] - sax.mindist(q, sax.word.new("DCBA", 4))) < 1e-9)
+    assert(not pcall(sax.distance_matrix, {"ABCD"}), "no word to take c from")
+    assert(#sax.distance_matrix(set) == 4)
+end
+
+test_mindist_many()
+
+local function test_word_access()
+    local window = sax.window.new(4, 2, 4)
+    local view = window:word()
+    assert(tostring(view) == "##" and window:symbols() == 4 * 5 + 4)
+    assert(window:changed() and not window:changed())
+    window:add({1, 2, 3, 10.1})
+    assert(view == sax.word.new("AD", 4) and tostring(view) == "AD")
+    assert(window:symbols() == 3 * 5, window:symbols())
+    assert(sax.mindist(view, window) == 0)
+    assert(window:changed() and not window:changed())
+    window:add(10.1)
+    assert(not window:changed(), "same word")
+    window:add(-20)
+    assert(window:changed() and tostring(view) == "DA")
+    local copy = window:get_word()
+    window:clear()
+    assert(view ~= copy and tostring(view) == "##")
+
+    local long = sax.window.new(32, 32, 16)
+    for i = 1, 32 do long:add(i) end
+    assert(long:symbols() == tostring(long), "key falls back to the string")
+end
+
+test_word_access()
+
+local function test_scale()
+    local a = sax.window.new(4, 2, 4)
+    local b = sax.window.new(4, 2, 4)
+    a:add({1, 2, 3, 4})
+    b:add({101, 102, 103, 104})
+    assert(a == b, "sliding statistics hide the level")
+    local mu, sigma = b:scale()
+    assert(mu == 102.5, mu)
+    a:set_scale(50, 20)
+    b:set_scale(50, 20)
+    assert(tostring(a) == "AA" and tostring(b) == "DD", tostring(a) .. tostring(b))
+    mu, sigma = a:scale()
+    assert(mu == 50 and sigma == 20)
+    b:set_scale(0, 1, 0.5)
+    b:add(1)
+    mu = b:scale()
+    assert(mu == 0.5, mu)
+    b:clear()
+    assert(b:scale() == 0)
+    assert(not pcall(a.set_scale, a, 0, -1), "negative sigma")
+    assert(not pcall(a.set_scale, a, 0, 1, 1), "alpha = 1")
+end
+
+test_scale()
+
+local function test_pattern_set()
+    local alerts = sax.pattern_set.new(4, 2, 4)
+    assert(alerts:add("AA", 0) == 1)
+    assert(alerts:add(sax.word.new("DD", 4), 10, 42) == 42)
+    alerts:add("AD", 0, 7)
+    local win = sax.window.new(4, 2, 4)
+    win:add({1, 2, 3, 10.1}) -- AD
+    local ids = alerts:match(win)
+    assert(#ids == 2 and ids[1] == 42 and ids[2] == 7, "received: " .. #ids)
+    ids = alerts:match(sax.word.new("BB", 4))
+    assert(#ids == 2 and ids[1] == 1 and ids[2] == 42, "received: " .. #ids)
+    assert(alerts:size() == 3)
+    assert(not pcall(alerts.add, alerts, "AA", -1), "negative threshold")
+    assert(not pcall(alerts.match, alerts, sax.word.new("AAA", 4)), "w mismatch")
+    alerts:clear()
+    assert(#alerts:match(win) == 0)
+end
+
+test_pattern_set()
+
+local function test_bitmap()
+    local bitmap = sax.bitmap.new(4, 4, 1, 4, 4)
+    assert(bitmap:add("ABCD") == nil, "empty lag window")
+    local score = bitmap:add(sax.word.new("AAAA", 4))
+    assert(math.abs(score - 0.375) < 1e-9, "received: " .. score)
+    score = bitmap:add("AAAB")
+    assert(math.abs(score - 0.125) < 1e-9, "received: " .. score)
+    assert(bitmap:score() == score)
+    local win = sax.window.new(8, 4, 4)
+    local nan_only = sax.bitmap.new(4, 4, 1, 1, 1)
+    assert(nan_only:add(win) == nil, "NaN subwords are not counted")
+    assert(not pcall(bitmap.add, bitmap, "ABC"), "w mismatch")
+    assert(not pcall(sax.bitmap.new, 8, 16, 6, 2, 2), "c^L too large")
+    bitmap:clear()
+    assert(bitmap:score() == nil)
+end
+
+test_bitmap()
+
+local function test_pyramid()
+    local pyramid = sax.pyramid.new(4, 2, 4, {1, 2})
+    assert(pyramid:add(1) == 1)
+    assert(pyramid:add(2) == 2)
+    local coarse = pyramid:word(2)
+    for i = 1, 6 do pyramid:add(i * 2) end
+    assert(tostring(coarse) == tostring(pyramid:word(2)), "views track the level")
+    assert(tostring(pyramid:word(2)) == "AD", "received: " .. tostring(coarse))
+    assert(not pcall(pyramid.word, pyramid, 3), "level out of range")
+    assert(not pcall(sax.pyramid.new, 4, 2, 4, {1, 0}), "zero factor")
+    pyramid:clear()
+    assert(tostring(pyramid:word(1)) == "##")
+end
+
+test_pyramid()
@@ -0,0 +1,382 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Symbolic time series hot path microbenchmarks */
+
+#if !defined(_MSC_VER) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "symtseries.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <windows.h>
+#define snprintf _snprintf
+#pragma warning( disable : 4996 )
+#else
+#include <time.h>
+#endif
+
+#ifndef DIST_VERSION
+#define DIST_VERSION "unknown"
+#endif
+
+#define BENCH_SERIES_LEN (1 << 16)
+#define BENCH_MAX_RESULTS 512
+#define BENCH_NAME_LEN 64
+
+/*
+ * The library sources are compiled into this executable with STS_MALLOC and
+ * STS_FREE pointing here, so every heap allocation made on the measured paths
+ * is counted.
+ */
+static size_t bench_allocs = 0;
+
+void* sts_bench_malloc(size_t size)
+{
+  ++bench_allocs;
+  return malloc(size);
+}
+
+void sts_bench_free(void* ptr)
+{
+  free(ptr);
+}
+
+typedef struct bench_result {
+  char name[BENCH_NAME_LEN];
+  size_t n, w, batch;
+  unsigned int c;
+  double nan_ratio;
+  size_t ops;
+  double ns_per_op, ops_per_sec, allocs_per_op;
+} bench_result;
+
+typedef struct bench_config {
+  double min_time; // seconds spent per case
+  const char* filter;
+  const char* json_path;
+} bench_config;
+
+static bench_result results[BENCH_MAX_RESULTS];
+static size_t n_results = 0;
+
+static double now_ns()
+{
+#ifdef _MSC_VER
+  LARGE_INTEGER freq, cnt;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&cnt);
+  return (double)cnt.QuadPart * 1e9 / (double)freq.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+#endif
+}
+
+/* xorshift64* keeps the synthetic data identical across runs and platforms */
+static uint64_t rng_state;
+
+static void rng_seed(uint64_t seed)
+{
+  rng_state = seed ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+static double rng_uniform()
+{
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  uint64_t r = rng_state * 2685821657736338717ULL;
+  return (double)(r >> 11) / (double)(1ULL << 53);
+}
+
+/*
+ * Gaussian random walk, nan_ratio of the values replaced with NaN runs of up to
+ * 8 values to mimic missing data
+ */
+static void fill_random_walk(double* series, size_t len, double nan_ratio,
+                             uint64_t seed)
+{
+  rng_seed(seed);
+  double level = 0;
+  size_t nan_run = 0;
+  for (size_t i = 0; i < len; ++i) {
+    // Irwin-Hall approximation of a standard normal step
+    double step = -6;
+    for (int j = 0; j < 12; ++j) step += rng_uniform();
+    level += step;
+    if (nan_run == 0 && rng_uniform() < nan_ratio / 4.5) {
+      nan_run = 1 + (size_t)(rng_uniform() * 8);
+    }
+    if (nan_run) {
+      --nan_run;
+      series[i] = NAN;
+    } else {
+      series[i] = level;
+    }
+  }
+}
+
+static bool skip_case(const bench_config* cfg, const char* name)
+{
+  return cfg->filter && !strstr(name, cfg->filter);
+}
+
+static bench_result* new_result(const char* name, size_t n, size_t w,
+                                unsigned int c, size_t batch, double nan_ratio)
+{
+  if (n_results == BENCH_MAX_RESULTS) return NULL;
+  bench_result* r = &results[n_results++];
+  snprintf(r->name, BENCH_NAME_LEN, "%s", name);
+  r->n = n;
+  r->w = w;
+  r->c = c;
+  r->batch = batch;
+  r->nan_ratio = nan_ratio;
+  return r;
+}
+
+static void finish_result(bench_result* r, size_t ops, double elapsed_ns,
+                          size_t allocs)
+{
+  r->ops = ops;
+  r->ns_per_op = ops ? elapsed_ns / ops : 0;
+  r->ops_per_sec = elapsed_ns > 0 ? ops * 1e9 / elapsed_ns : 0;
+  r->allocs_per_op = ops ? (double)allocs / ops : 0;
+  printf("%-22s n=%-5" PRIuSIZE " w=%-4" PRIuSIZE " c=%-3u nan=%.2f "
+         "%10.1f ns/op %14.0f ops/s %6.2f allocs/op\n",
+         r->name, r->n, r->w, r->c, r->nan_ratio, r->ns_per_op,
+         r->ops_per_sec, r->allocs_per_op);
+}
+
+/*
+ * Each case runs its body in rounds of doubling size until min_time is spent,
+ * only the last round is reported so that warm-up is excluded
+ */
+#define BENCH_LOOP(cfg, ops, elapsed, allocs, body)                            \
+do {                                                                           \
+  size_t round = 16;                                                           \
+  for (;;) {                                                                   \
+    size_t allocs_before = bench_allocs;                                       \
+    double start = now_ns();                                                   \
+    for (size_t iter = 0; iter < round; ++iter) { body; }                      \
+    (elapsed) = now_ns() - start;                                              \
+    (allocs) = bench_allocs - allocs_before;                                   \
+    (ops) = round;                                                             \
+    if ((elapsed) >= (cfg)->min_time * 1e9 || round >= ((size_t)1 << 40)) {    \
+      break;                                                                   \
+    }                                                                          \
+    round *= 2;                                                                \
+  }                                                                            \
+} while (0)
+
+static void bench_append_value(const bench_config* cfg, const double* series,
+                               size_t n, size_t w, unsigned char c,
+                               double nan_ratio)
+{
+  if (skip_case(cfg, "append_value")) return;
+  bench_result* r = new_result("append_value", n, w, c, 1, nan_ratio);
+  if (!r) return;
+  sts_window win = sts_new_window(n, w, c);
+  sts_append_array(win, series, n);
+  size_t pos = n, ops, allocs;
+  double elapsed;
+  BENCH_LOOP(cfg, ops, elapsed, allocs, {
+    sts_append_value(win, series[pos]);
+    if (++pos == BENCH_SERIES_LEN) pos = 0;
+  });
+  finish_result(r, ops, elapsed, allocs);
+  sts_free_window(win);
+}
+
+/* same with a fixed caller scale instead of the sliding statistics */
+static void bench_append_scaled(const bench_config* cfg, const double* series,
+                                size_t n, size_t w, unsigned char c,
+                                double nan_ratio)
+{
+  if (skip_case(cfg, "append_scaled")) return;
+  bench_result* r = new_result("append_scaled", n, w, c, 1, nan_ratio);
+  if (!r) return;
+  sts_window win = sts_new_window(n, w, c);
+  sts_set_window_scale(win, 0, 100, 0);
+  sts_append_array(win, series, n);
+  size_t pos = n, ops, allocs;
+  double elapsed;
+  BENCH_LOOP(cfg, ops, elapsed, allocs, {
+    sts_append_value(win, series[pos]);
+    if (++pos == BENCH_SERIES_LEN) pos = 0;
+  });
+  finish_result(r, ops, elapsed, allocs);
+  sts_free_window(win);
+}
+
+/* same keeping the 1d-SAX slope symbols of the frames */
+static void bench_append_trend(const bench_config* cfg, const double* series,
+                               size_t n, size_t w, unsigned char c,
+                               double nan_ratio)
+{
+  if (skip_case(cfg, "append_trend")) return;
+  bench_result* r = new_result("append_trend", n, w, c, 1, nan_ratio);
+  if (!r) return;
+  sts_window win = sts_new_window(n, w, c);
+  sts_enable_window_trend(win, c);
+  sts_append_array(win, series, n);
+  size_t pos = n, ops, allocs;
+  double elapsed;
+  BENCH_LOOP(cfg, ops, elapsed, allocs, {
+    sts_append_value(win, series[pos]);
+    if (++pos == BENCH_SERIES_LEN) pos = 0;
+  });
+  finish_result(r, ops, elapsed, allocs);
+  sts_free_window(win);
+}
+
+static void bench_append_array(const bench_config* cfg, const double* series,
+                               size_t n, size_t w, unsigned char c,
+                               size_t batch, double nan_ratio)
+{
+  if (skip_case(cfg, "append_array")) return;
+  bench_result* r = new_result("append_array", n, w, c, batch, nan_ratio);
+  if (!r) return;
+  sts_window win = sts_new_window(n, w, c);
+  size_t pos = 0, ops, allocs;
+  double elapsed;
+  BENCH_LOOP(cfg, ops, elapsed, allocs, {
+    sts_append_array(win, series + pos, batch);
+    pos += batch;
+    if (pos + batch > BENCH_SERIES_LEN) pos = 0;
+  });
+  finish_result(r, ops, elapsed, allocs);
+  sts_free_window(win);
+}
+
+static void bench_from_double_array(const bench_config* cfg,
+                                    const double* series, size_t n, size_t w,
+                                    unsigned char c, double nan_ratio)
+{
+  if (skip_case(cfg, "from_double_array")) return;
+  bench_result* r = new_result("from_double_array", n, w, c, 1, nan_ratio);
+  if (!r) return;
+  size_t pos = 0, ops, allocs;
+  double elapsed;
+  BENCH_LOOP(cfg, ops, elapsed, allocs, {
+    sts_free_word(sts_from_double_array(series + pos, n, w, c));
+    pos += w;
+    if (pos + n > BENCH_SERIES_LEN) pos = 0;
+  });
+  finish_result(r, ops, elapsed, allocs);
+}
+
+#define BENCH_MINDIST_WORDS 1024
+
+static void bench_mindist(const bench_config* cfg, const double* series,
+                          size_t n, size_t w, unsigned char c,
+                          double nan_ratio)
+{
+  if (skip_case(cfg, "mindist")) return;
+  bench_result* r = new_result("mindist", n, w, c, 1, nan_ratio);
+  if (!r) return;
+  sts_word words[BENCH_MINDIST_WORDS];
+  size_t stride = (BENCH_SERIES_LEN - n) / BENCH_MINDIST_WORDS;
+  for (size_t i = 0; i < BENCH_MINDIST_WORDS; ++i) {
+    words[i] = sts_from_double_array(series + i * stride, n, w, c);
+  }
+  size_t a = 0, ops, allocs;
+  double elapsed, sink = 0;
+  BENCH_LOOP(cfg, ops, elapsed, allocs, {
+    size_t b = (a * 7 + 1) % BENCH_MINDIST_WORDS;
+    sink += sts_mindist(words[a], words[b]);
+    if (++a == BENCH_MINDIST_WORDS) a = 0;
+  });
+  finish_result(r, ops, elapsed, allocs);
+  if (sink < 0) printf("unexpected negative distance\n");
+  for (size_t i = 0; i < BENCH_MINDIST_WORDS; ++i) {
+    sts_free_word(words[i]);
+  }
+}
+
+static int write_json(const char* path)
+{
+  FILE* fh = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+  if (!fh) {
+    fprintf(stderr, "unable to open %s\n", path);
+    return 1;
+  }
+  fprintf(fh, "{\"benchmark\":\"sts_bench\",\"version\":\"%s\",\"results\":[",
+          DIST_VERSION);
+  for (size_t i = 0; i < n_results; ++i) {
+    const bench_result* r = &results[i];
+    fprintf(fh, "%s\n{\"name\":\"%s\",\"n\":%" PRIuSIZE ",\"w\":%" PRIuSIZE
+            ",\"c\":%u,\"batch\":%" PRIuSIZE ",\"nan_ratio\":%.2f"
+            ",\"ops\":%" PRIuSIZE ",\"ns_per_op\":%.3f,\"ops_per_sec\":%.1f"
+            ",\"allocs_per_op\":%.4f}",
+            i ? "," : "", r->name, r->n, r->w, r->c, r->batch, r->nan_ratio,
+            r->ops, r->ns_per_op, r->ops_per_sec, r->allocs_per_op);
+  }
+  fprintf(fh, "\n]}\n");
+  if (fh != stdout) fclose(fh);
+  return 0;
+}
+
+static void usage(const char* name)
+{
+  printf("usage: %s [--quick] [--time seconds] [--filter substring] "
+         "[--json path|-]\n", name);
+}
+
+int main(int argc, char* argv[])
+{
+  bench_config cfg = { 0.2, NULL, NULL };
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--quick") == 0) {
+      cfg.min_time = 0.005;
+    } else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc) {
+      cfg.min_time = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      cfg.filter = argv[++i];
+    } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      cfg.json_path = argv[++i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  static const size_t ns[] = { 64, 256, 1440 };
+  static const size_t ws[] = { 8, 16, 32 };
+  static const unsigned char cs[] = { 4, 8, 16 };
+  static const double nan_ratios[] = { 0.0, 0.3 };
+  double* series = malloc(BENCH_SERIES_LEN * sizeof*series);
+  if (!series) return 1;
+
+  for (size_t r = 0; r < sizeof nan_ratios / sizeof*nan_ratios; ++r) {
+    fill_random_walk(series, BENCH_SERIES_LEN, nan_ratios[r], 42);
+    for (size_t in = 0; in < sizeof ns / sizeof*ns; ++in) {
+      for (size_t iw = 0; iw < sizeof ws / sizeof*ws; ++iw) {
+        if (ns[in] % ws[iw] != 0) continue;
+        for (size_t ic = 0; ic < sizeof cs / sizeof*cs; ++ic) {
+          size_t n = ns[in], w = ws[iw];
+          unsigned char c = cs[ic];
+          bench_append_value(&cfg, series, n, w, c, nan_ratios[r]);
+          bench_append_scaled(&cfg, series, n, w, c, nan_ratios[r]);
+          bench_append_trend(&cfg, series, n, w, c, nan_ratios[r]);
+          bench_append_array(&cfg, series, n, w, c, 64, nan_ratios[r]);
+          bench_from_double_array(&cfg, series, n, w, c, nan_ratios[r]);
+          bench_mindist(&cfg, series, n, w, c, nan_ratios[r]);
+        }
+      }
+    }
+  }
+  free(series);
+
+  if (cfg.json_path) return write_json(cfg.json_path);
+  return 0;
+}
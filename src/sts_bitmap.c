@@ -0,0 +1,350 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Symbolic time series incremental SAX bitmaps */
+
+#include "symtseries.h"
+#include "sts_internal.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+sts_bitmap sts_new_bitmap(size_t w,
+                          unsigned char c,
+                          size_t L,
+                          size_t lag,
+                          size_t lead)
+{
+  if (w == 0
+      || L == 0
+      || L > w
+      || lag == 0
+      || lead == 0
+      || lag > SIZE_MAX / sizeof(size_t) / 2
+      || lead > SIZE_MAX / sizeof(size_t) / 2
+      || c < STS_MIN_CARDINALITY) {
+    return NULL;
+  }
+  size_t cells = 1;
+  for (size_t i = 0; i < L; ++i) {
+    cells *= c;
+    if (cells > STS_BITMAP_MAX_CELLS) return NULL;
+  }
+  sts_bitmap bm = STS_MALLOC(sizeof*bm);
+  if (!bm) return NULL;
+  memset(bm, 0, sizeof*bm);
+  bm->w = w;
+  bm->c = c;
+  bm->L = L;
+  bm->lag = lag;
+  bm->lead = lead;
+  bm->cells = cells;
+  // enough symbols to replay every subword of both windows
+  bm->span = lag + lead + L - 1 > w ? lag + lead + L - 1 : w;
+  bm->lag_counts = STS_MALLOC(cells * sizeof*bm->lag_counts);
+  bm->lead_counts = STS_MALLOC(cells * sizeof*bm->lead_counts);
+  bm->subwords = STS_MALLOC((lag + lead) * sizeof*bm->subwords);
+  bm->history = STS_MALLOC(bm->span * sizeof*bm->history);
+  if (!bm->lag_counts || !bm->lead_counts || !bm->subwords
+      || !bm->history) {
+    sts_free_bitmap(bm);
+    return NULL;
+  }
+  sts_reset_bitmap(bm);
+  return bm;
+}
+
+/*
+ * Adds delta (+-1) to a cell of one grid, keeping the sum of squares of that
+ * grid and the cross product sum in sync
+ */
+static void add_count(sts_bitmap bm, bool lag, size_t cell, int delta)
+{
+  unsigned int* counts = lag ? bm->lag_counts : bm->lead_counts;
+  unsigned int* other = lag ? bm->lead_counts : bm->lag_counts;
+  unsigned long long* sq = lag ? &bm->lag_sq : &bm->lead_sq;
+  unsigned long long* total = lag ? &bm->lag_total : &bm->lead_total;
+  unsigned long long v = counts[cell];
+  if (delta > 0) {
+    *sq += 2 * v + 1;
+    bm->cross += other[cell];
+    ++counts[cell];
+    ++*total;
+  } else {
+    *sq -= 2 * v - 1;
+    bm->cross -= other[cell];
+    --counts[cell];
+    --*total;
+  }
+}
+
+double sts_bitmap_push(sts_bitmap bm, sts_symbol s)
+{
+  if (!bm || s > bm->c) return NAN;
+  bm->history[bm->head] = s;
+  bm->head = (bm->head + 1) % bm->span;
+  if (bm->seen < bm->span) ++bm->seen;
+  if (s == bm->c) {
+    bm->valid = 0; // NaN, restart the subword after it
+  } else {
+    bm->cell = (bm->cell * bm->c + s) % bm->cells;
+    if (bm->valid < bm->L) ++bm->valid;
+  }
+  if (bm->seen < bm->L) return sts_bitmap_score(bm);
+
+  size_t slots = bm->lag + bm->lead;
+  if (bm->sub_seen == slots) {
+    // the oldest subword (lag window) is overwritten by the new one
+    size_t cell = bm->subwords[bm->sub_head];
+    if (cell < bm->cells) add_count(bm, true, cell, -1);
+    --bm->sub_seen;
+  }
+  if (bm->sub_seen >= bm->lead) {
+    // oldest lead subword moves over to the lag window
+    size_t cell = bm->subwords[(bm->sub_head + slots - bm->lead) % slots];
+    if (cell < bm->cells) {
+      add_count(bm, false, cell, -1);
+      add_count(bm, true, cell, 1);
+    }
+  }
+  size_t cell = bm->valid == bm->L ? bm->cell : bm->cells;
+  bm->subwords[bm->sub_head] = cell;
+  if (cell < bm->cells) add_count(bm, false, cell, 1);
+  bm->sub_head = (bm->sub_head + 1) % slots;
+  ++bm->sub_seen;
+  return sts_bitmap_score(bm);
+}
+
+double sts_bitmap_update(sts_bitmap bm, const struct sts_word* word)
+{
+  if (!bm || !word || !word->symbols || word->w != bm->w
+      || word->c != bm->c) {
+    return NAN;
+  }
+  size_t i = bm->seen ? bm->w - 1 : 0;
+  double score = NAN;
+  for (; i < bm->w; ++i) {
+    score = sts_bitmap_push(bm, word->symbols[i]);
+  }
+  return score;
+}
+
+double sts_bitmap_score(const struct sts_bitmap* bm)
+{
+  if (!bm || bm->lag_total == 0 || bm->lead_total == 0) return NAN;
+  double a = (double)bm->lag_total, b = (double)bm->lead_total;
+  double d = (double)bm->lag_sq / (a * a) + (double)bm->lead_sq / (b * b)
+    - 2 * (double)bm->cross / (a * b);
+  return d > 0 ? d / 2 : 0;
+}
+
+void sts_reset_bitmap(sts_bitmap bm)
+{
+  if (!bm) return;
+  memset(bm->lag_counts, 0, bm->cells * sizeof*bm->lag_counts);
+  memset(bm->lead_counts, 0, bm->cells * sizeof*bm->lead_counts);
+  bm->sub_head = bm->sub_seen = 0;
+  bm->cell = bm->valid = 0;
+  bm->head = bm->seen = 0;
+  bm->lag_total = bm->lead_total = 0;
+  bm->lag_sq = bm->lead_sq = bm->cross = 0;
+}
+
+void sts_free_bitmap(sts_bitmap bm)
+{
+  if (!bm) return;
+  STS_FREE(bm->lag_counts);
+  STS_FREE(bm->lead_counts);
+  STS_FREE(bm->subwords);
+  STS_FREE(bm->history);
+  STS_FREE(bm);
+}
+
+#ifdef STS_COMPILE_UNIT_TESTS
+
+#include "test/sts_test.h"
+
+static bool isclose(double a, double b)
+{
+  return fabs(a - b) < 1e-9;
+}
+
+/* rebuilds both grids from the last lag + lead subwords of the stream */
+static void brute_grids(const sts_symbol* stream, size_t pushed,
+                        unsigned char c, size_t L, size_t lag, size_t lead,
+                        double* a, double* b)
+{
+  size_t n_sub = pushed >= L ? pushed - L + 1 : 0;
+  size_t first = n_sub > lag + lead ? n_sub - lag - lead : 0;
+  for (size_t t = first; t < n_sub; ++t) {
+    size_t cell = 0, j = 0;
+    for (; j < L && stream[t + j] < c; ++j) cell = cell * c + stream[t + j];
+    if (j < L) continue;
+    ++(t + lead >= n_sub ? b : a)[cell];
+  }
+}
+
+static double brute_score(const sts_symbol* stream, size_t pushed,
+                          unsigned char c, size_t L, size_t lag, size_t lead)
+{
+  size_t cells = 1;
+  for (size_t i = 0; i < L; ++i) cells *= c;
+  double* a = calloc(cells, sizeof*a), * b = calloc(cells, sizeof*b);
+  brute_grids(stream, pushed, c, L, lag, lead, a, b);
+  double ta = 0, tb = 0;
+  for (size_t i = 0; i < cells; ++i) {
+    ta += a[i];
+    tb += b[i];
+  }
+  double d = 0;
+  for (size_t i = 0; i < cells; ++i) {
+    double diff = a[i] / ta - b[i] / tb;
+    d += diff * diff;
+  }
+  free(a);
+  free(b);
+  return ta == 0 || tb == 0 ? NAN : d / 2;
+}
+
+static double update_with(sts_bitmap bm, const char* sax)
+{
+  sts_word a = sts_from_sax_string(sax, 4);
+  double score = sts_bitmap_update(bm, a);
+  sts_free_word(a);
+  return score;
+}
+
+static char* test_bitmap_validation()
+{
+  mu_assert(!sts_new_bitmap(8, 4, 0, 2, 2), "L = 0");
+  mu_assert(!sts_new_bitmap(8, 4, 9, 2, 2), "L > w");
+  mu_assert(!sts_new_bitmap(8, 4, 2, 0, 2), "empty lag");
+  mu_assert(!sts_new_bitmap(8, 4, 2, SIZE_MAX, 2), "lag overflow");
+  mu_assert(!sts_new_bitmap(8, 16, 6, 2, 2), "too many cells");
+  sts_bitmap bm = sts_new_bitmap(4, 4, 1, 2, 2);
+  mu_assert(bm, "allocation failed");
+  mu_assert(isnan(update_with(bm, "ABC")), "w mismatch");
+  mu_assert(isnan(sts_bitmap_push(bm, 5)), "symbol out of range");
+  mu_assert(isnan(sts_bitmap_push(bm, 3)), "empty lag window");
+  sts_reset_bitmap(bm);
+  // the first word pushes all its symbols, the later ones their last
+  mu_assert(isclose(update_with(bm, "AAAA"), 0), "identical windows");
+  mu_assert(isclose(update_with(bm, "BBBB"), 0.25), "half shifted");
+  mu_assert(isclose(update_with(bm, "AAAC"), 0.75), "lead moved");
+  mu_assert(isclose(update_with(bm, "CCCD"), 0.5), "disjoint windows");
+  mu_assert(isclose(update_with(bm, "DDD#"), 0.75), "NaN not counted");
+  mu_assert(isclose(sts_bitmap_push(bm, 1), 0.25), "single lead subword");
+  mu_assert(isclose(sts_bitmap_push(bm, 4), 1), "disjoint single cells");
+  mu_assert(isnan(sts_bitmap_push(bm, 4)), "empty lead window");
+  sts_reset_bitmap(bm);
+  mu_assert(isnan(sts_bitmap_score(bm)), "reset");
+  sts_free_bitmap(bm);
+  return NULL;
+}
+
+static char* test_bitmap_incremental()
+{
+  const size_t w = 8, pushes = 300;
+  sts_symbol* words = malloc(pushes * w);
+  sts_symbol* stream = malloc(pushes + w);
+  mu_assert(words && stream, "allocation failed");
+  unsigned int seed = 5;
+  // the brute force scores walk all c^L cells
+  for (unsigned c = 2; c <= 16; c += 7) {
+    for (size_t L = 1; L <= 3; ++L) {
+      sts_bitmap bm = sts_new_bitmap(w, c, L, 7, 3);
+      mu_assert(bm, "allocation failed");
+      size_t pushed = 0;
+      for (size_t t = 0; t < pushes; ++t) {
+        for (size_t i = 0; i < w; ++i) {
+          seed = seed * 1103515245 + 12345;
+          unsigned int r = (seed >> 16) & 0x7fff;
+          // slowly drifting distribution with occasional NaNs
+          words[t * w + i] = r % 17 == 0 ? c : (sts_symbol)((r % 3 + t / 50)
+                                                            % c);
+        }
+        for (size_t i = t ? w - 1 : 0; i < w; ++i) {
+          stream[pushed++] = words[t * w + i];
+        }
+        struct sts_word word = { words + t * w, 0, w, c };
+        double score = sts_bitmap_update(bm, &word);
+        double expected = brute_score(stream, pushed, c, L, 7, 3);
+        mu_assert((isnan(score) && isnan(expected))
+                  || isclose(score, expected),
+                  "c = %u L = %" PRIuSIZE " t = %" PRIuSIZE ": %f != %f",
+                  c, L, t, score, expected);
+      }
+      sts_free_bitmap(bm);
+    }
+  }
+  free(words);
+  free(stream);
+  return NULL;
+}
+
+static char* test_bitmap_window()
+{
+  // the window's word once per frame, its newest symbol extends the stream
+  enum { n = 32, w = 8, c = 4, L = 2, lag = 64, lead = 16, frame = n / w };
+  enum { values = 1600, cells = c * c };
+  sts_window win = sts_new_window(n, w, c);
+  sts_bitmap bm = sts_new_bitmap(w, c, L, lag, lead);
+  mu_assert(win && bm, "allocation failed");
+  sts_symbol stream[w + values / frame];
+  size_t pushed = 0;
+  double before = 0, peak = 0, pi = acos(-1);
+  for (size_t t = 0; t < values; ++t) {
+    // one period per window, then twice the frequency
+    double v = sin(t * (t >= 1200 ? 2 : 1) * pi / 16);
+    const struct sts_word* word = sts_append_value(win, v);
+    mu_assert(word, "append %" PRIuSIZE, t);
+    if ((t + 1) % frame != 0) continue;
+    for (size_t i = pushed ? w - 1 : 0; i < w; ++i) {
+      stream[pushed++] = word->symbols[i];
+    }
+    double score = sts_bitmap_update(bm, word);
+
+    double a[cells] = { 0 }, b[cells] = { 0 };
+    brute_grids(stream, pushed, c, L, lag, lead, a, b);
+    for (size_t i = 0; i < cells; ++i) {
+      mu_assert(bm->lag_counts[i] == a[i] && bm->lead_counts[i] == b[i],
+                "t = %" PRIuSIZE " cell %" PRIuSIZE ": %u %u != %g %g", t, i,
+                bm->lag_counts[i], bm->lead_counts[i], a[i], b[i]);
+    }
+    double expected = brute_score(stream, pushed, c, L, lag, lead);
+    mu_assert((isnan(score) && isnan(expected)) || isclose(score, expected),
+              "t = %" PRIuSIZE ": %f != %f", t, score, expected);
+    if (t >= 800 && t < 1200 && score > before) before = score;
+    if (t >= 1200 && score > peak) peak = score;
+  }
+  // the periodic stream fills both windows alike until the frequency changes
+  mu_assert(before < 1e-9 && peak > 0.1, "before %f peak %f", before, peak);
+  sts_free_bitmap(bm);
+  sts_free_window(win);
+  return NULL;
+}
+
+static char* all_tests()
+{
+  mu_run_test(test_bitmap_validation);
+  mu_run_test(test_bitmap_incremental);
+  mu_run_test(test_bitmap_window);
+  return NULL;
+}
+
+int main()
+{
+  char* result = all_tests();
+  if (result) {
+    printf("%s\n", result);
+  } else {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n", mu_tests_run);
+
+  return result != 0;
+}
+
+#endif // STS_COMPILE_UNIT_TESTS
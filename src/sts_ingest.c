@@ -0,0 +1,348 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Symbolic time series lock-free ingest queues */
+
+#include "symtseries.h"
+#include "sts_internal.h"
+
+#include <string.h>
+
+/* Set in ingest->middle when the slot holds a word the reader hasn't seen */
+#define STS_SNAPSHOT_FRESH 4
+
+bool sts_enable_ingest(sts_window window, size_t capacity)
+{
+  if (!window || window->ingest || capacity == 0
+      || capacity > ((size_t)-1 >> 2)) {
+    return false;
+  }
+  size_t size = 1;
+  while (size < capacity) size <<= 1;
+  size_t w = window->current_word.w;
+  struct sts_ingest* q = STS_MALLOC(sizeof*q);
+  if (!q) return false;
+  memset(q, 0, sizeof*q);
+  q->mask = size - 1;
+  q->values = STS_MALLOC(size * sizeof*q->values);
+  q->ts = STS_MALLOC(size * sizeof*q->ts);
+  q->slots = STS_MALLOC(3 * w * sizeof*q->slots);
+  if (!q->values || !q->ts || !q->slots) {
+    sts_free_ingest(q);
+    return false;
+  }
+  q->back = 0;
+  q->middle = 1;
+  q->front = 2;
+  q->snapshot.n_values = window->current_word.n_values;
+  q->snapshot.w = w;
+  q->snapshot.c = window->current_word.c;
+  window->ingest = q;
+  return true;
+}
+
+/* Checks that the slot at tail is free, counts the drop if it isn't */
+static bool has_room(struct sts_ingest* q)
+{
+  if (q->tail - q->head_cache > q->mask) {
+    // only re-read the consumer position when the cached one says full
+    q->head_cache = STS_ATOMIC_LOAD_ACQUIRE(&q->head);
+    if (q->tail - q->head_cache > q->mask) {
+      STS_ATOMIC_ADD(&q->dropped, 1ULL);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool sts_ingest_value(sts_window window, double value)
+{
+  if (!window || !window->ingest || window->bucket) return false;
+  struct sts_ingest* q = window->ingest;
+  if (!has_room(q)) return false;
+  q->values[q->tail & q->mask] = value;
+  STS_ATOMIC_STORE_RELEASE(&q->tail, q->tail + 1);
+  return true;
+}
+
+bool sts_ingest_timed(sts_window window, long long ts, double value)
+{
+  if (!window || !window->ingest || !window->bucket) return false;
+  struct sts_ingest* q = window->ingest;
+  if (!has_room(q)) return false;
+  q->values[q->tail & q->mask] = value;
+  q->ts[q->tail & q->mask] = ts;
+  STS_ATOMIC_STORE_RELEASE(&q->tail, q->tail + 1);
+  return true;
+}
+
+/* Hands the back slot over to the reader side */
+static void publish(struct sts_ingest* q, const struct sts_word* word)
+{
+  size_t w = word->w;
+  memcpy(q->slots + q->back * w, word->symbols, w * sizeof*q->slots);
+  size_t prev = STS_ATOMIC_EXCHANGE(&q->middle, q->back | STS_SNAPSHOT_FRESH);
+  q->back = prev & ~(size_t)STS_SNAPSHOT_FRESH;
+}
+
+const struct sts_word* sts_drain(sts_window window)
+{
+  if (!window || !window->ingest) return NULL;
+  struct sts_ingest* q = window->ingest;
+  size_t tail = STS_ATOMIC_LOAD_ACQUIRE(&q->tail);
+  size_t head = q->head;
+  if (head == tail) return NULL;
+
+  const struct sts_word* word = NULL;
+  if (window->bucket) {
+    for (size_t i = head; i != tail; ++i) {
+      word = sts_append_timed(window, q->ts[i & q->mask],
+                              q->values[i & q->mask]);
+    }
+  } else {
+    // at most two contiguous runs, the one wrapping around is appended first
+    size_t begin = head & q->mask, end = tail & q->mask;
+    if (end <= begin) {
+      word = sts_append_array(window, q->values + begin, q->mask + 1 - begin);
+      begin = 0;
+    }
+    if (end > begin) {
+      word = sts_append_array(window, q->values + begin, end - begin);
+    }
+  }
+  STS_ATOMIC_STORE_RELEASE(&q->head, tail);
+  if (word) publish(q, word);
+  return word;
+}
+
+const struct sts_word* sts_snapshot(sts_window window)
+{
+  if (!window || !window->ingest) return NULL;
+  struct sts_ingest* q = window->ingest;
+  if (STS_ATOMIC_LOAD_ACQUIRE(&q->middle) & STS_SNAPSHOT_FRESH) {
+    size_t prev = STS_ATOMIC_EXCHANGE(&q->middle, q->front);
+    q->front = prev & ~(size_t)STS_SNAPSHOT_FRESH;
+    q->has_snapshot = true;
+  }
+  if (!q->has_snapshot) return NULL;
+  q->snapshot.symbols = q->slots + q->front * q->snapshot.w;
+  return &q->snapshot;
+}
+
+void sts_discard_ingest(struct sts_ingest* ingest)
+{
+  if (!ingest) return;
+  STS_ATOMIC_STORE_RELEASE(&ingest->head,
+                           STS_ATOMIC_LOAD_ACQUIRE(&ingest->tail));
+}
+
+void sts_free_ingest(struct sts_ingest* ingest)
+{
+  if (!ingest) return;
+  STS_FREE(ingest->values);
+  STS_FREE(ingest->ts);
+  STS_FREE(ingest->slots);
+  STS_FREE(ingest);
+}
+
+#ifdef STS_COMPILE_UNIT_TESTS
+
+#include "sts_parallel.h"
+#include "test/sts_test.h"
+
+#include <math.h>
+
+static char* test_ingest_validation()
+{
+  sts_window win = sts_new_window(8, 4, 4);
+  mu_assert(!sts_ingest_value(win, 1), "no queue");
+  mu_assert(!sts_drain(win) && !sts_snapshot(win), "no queue");
+  mu_assert(!sts_enable_ingest(win, 0), "zero capacity");
+  mu_assert(sts_enable_ingest(win, 3), "sts_enable_ingest failed");
+  mu_assert(win->ingest->mask == 3, "capacity not rounded up");
+  mu_assert(!sts_enable_ingest(win, 3), "queue enabled twice");
+  mu_assert(!sts_ingest_timed(win, 0, 1), "timed sample on a plain window");
+  mu_assert(!sts_drain(win), "empty queue");
+  for (int i = 0; i < 4; ++i) {
+    mu_assert(sts_ingest_value(win, i), "push %d", i);
+  }
+  mu_assert(!sts_ingest_value(win, 4), "full queue");
+  mu_assert(win->ingest->dropped == 1, "dropped %llu", win->ingest->dropped);
+  mu_assert(!sts_snapshot(win), "nothing published");
+  const struct sts_word* word = sts_drain(win);
+  mu_assert(word == &win->current_word, "drain should return the word");
+  mu_assert(sts_window_value(win, 7) == 3, "last value");
+  mu_assert(sts_words_equal(sts_snapshot(win), word), "published word");
+  sts_ingest_value(win, 9);
+  sts_reset_window(win);
+  mu_assert(!sts_drain(win), "reset should discard the queue");
+  sts_free_window(win);
+  return NULL;
+}
+
+static char* test_ingest_batches()
+{
+  // feeding through the queue in uneven batches matches plain appends,
+  // including the runs wrapping around the end of the ring
+  sts_window ref = sts_new_window(12, 4, 6);
+  sts_window win = sts_new_window(12, 4, 6);
+  mu_assert(sts_enable_ingest(win, 32), "sts_enable_ingest failed");
+  size_t t = 0;
+  for (size_t batch = 1; t <= 200; batch = batch * 3 % 17 + 1) {
+    const struct sts_word* expected = NULL;
+    for (size_t i = 0; i < batch; ++i, ++t) {
+      double v = t % 13 == 0 ? NAN : sin(t * 0.3) * 10 + t % 5;
+      mu_assert(sts_ingest_value(win, v), "push %" PRIuSIZE, t);
+      expected = sts_append_value(ref, v);
+    }
+    const struct sts_word* word = sts_drain(win);
+    mu_assert(!word == !expected, "t = %" PRIuSIZE, t);
+    if (!word) continue;
+    mu_assert(sts_words_equal(word, expected), "t = %" PRIuSIZE, t);
+    const struct sts_word* snap = sts_snapshot(win);
+    mu_assert(snap && sts_words_equal(snap, expected), "snapshot");
+    mu_assert(snap->symbols != win->current_word.symbols, "not a copy");
+  }
+  // the reader keeps its copy until it asks again
+  const struct sts_word* snap = sts_snapshot(win);
+  sts_word keep = sts_dup_word(snap);
+  for (int i = 0; i < 12; ++i) sts_ingest_value(win, i * i);
+  sts_drain(win);
+  mu_assert(sts_words_equal(snap, keep), "snapshot changed under the reader");
+  mu_assert(sts_words_equal(sts_snapshot(win), &win->current_word),
+            "latest snapshot");
+  sts_free_word(keep);
+  sts_free_window(win);
+  sts_free_window(ref);
+  return NULL;
+}
+
+static char* test_ingest_timed()
+{
+  sts_window ref = sts_new_time_window(4, 2, 4, 10);
+  sts_window win = sts_new_time_window(4, 2, 4, 10);
+  mu_assert(sts_enable_ingest(win, 8), "sts_enable_ingest failed");
+  mu_assert(!sts_ingest_value(win, 1), "plain value on a timed window");
+  for (long long ts = 0; ts < 200; ts += 7) {
+    double v = (double)(ts % 30);
+    mu_assert(sts_ingest_timed(win, ts, v), "push %lld", ts);
+    sts_append_timed(ref, ts, v);
+    if (ts % 3 == 0) sts_drain(win);
+  }
+  sts_drain(win);
+  mu_assert(sts_words_equal(&win->current_word, &ref->current_word),
+            "timed drain");
+  for (size_t i = 0; i < 4; ++i) {
+    mu_assert(sts_window_value(win, i) == sts_window_value(ref, i), "value");
+  }
+  sts_free_window(win);
+  sts_free_window(ref);
+  return NULL;
+}
+
+#ifndef STS_NO_THREADS
+
+#define THREADED_N 32
+#define THREADED_SEGMENTS 600
+
+struct threaded_ctx {
+  sts_window win;
+  const struct sts_word* words[2]; // of the rising and the falling ramps
+  size_t done;
+  size_t bad_snapshots;
+  size_t snapshots[2];
+};
+
+static void threaded_task(void* arg, size_t task)
+{
+  struct threaded_ctx* ctx = arg;
+  sts_window win = ctx->win;
+  struct sts_ingest* q = win->ingest;
+  if (task == 0) {
+    // producer: alternately falling and rising ramps of a window each, a
+    // segment is queued once the previous one has been drained
+    for (size_t s = 0; s < THREADED_SEGMENTS; ++s) {
+      for (size_t i = 0; i < THREADED_N; ) {
+        double v = (double)(s % 2 ? i : THREADED_N - 1 - i);
+        if (sts_ingest_value(win, v)) ++i;
+      }
+      while (STS_ATOMIC_LOAD_ACQUIRE(&q->head) != q->tail) {}
+    }
+  } else if (task == 1) {
+    // consumer: drains whole segments, so every published word is one of
+    // the two ramps
+    size_t total = THREADED_SEGMENTS * THREADED_N;
+    while (q->head != total) {
+      size_t tail = STS_ATOMIC_LOAD_ACQUIRE(&q->tail);
+      if (tail != q->head && tail % THREADED_N == 0) sts_drain(win);
+    }
+    STS_ATOMIC_STORE_RELEASE(&ctx->done, (size_t)1);
+  } else {
+    // reader: a torn copy would mix the two words
+    while (!STS_ATOMIC_LOAD_ACQUIRE(&ctx->done)) {
+      const struct sts_word* snap = sts_snapshot(win);
+      if (!snap) continue;
+      if (sts_words_equal(snap, ctx->words[0])) {
+        ++ctx->snapshots[0];
+      } else if (sts_words_equal(snap, ctx->words[1])) {
+        ++ctx->snapshots[1];
+      } else {
+        ++ctx->bad_snapshots;
+      }
+    }
+  }
+}
+
+static char* test_ingest_threaded()
+{
+  double rising[THREADED_N], falling[THREADED_N];
+  for (int i = 0; i < THREADED_N; ++i) {
+    rising[i] = i;
+    falling[i] = THREADED_N - 1 - i;
+  }
+  sts_word up = sts_from_double_array(rising, THREADED_N, 8, 8);
+  sts_word down = sts_from_double_array(falling, THREADED_N, 8, 8);
+  mu_assert(up && down && !sts_words_equal(up, down), "ramp words");
+  struct threaded_ctx ctx = { sts_new_window(THREADED_N, 8, 8), { up, down },
+                              0, 0, { 0, 0 } };
+  mu_assert(sts_enable_ingest(ctx.win, 256), "sts_enable_ingest failed");
+  sts_append_array(ctx.win, rising, THREADED_N);
+  sts_parallel_for(3, 3, threaded_task, &ctx);
+  mu_assert(ctx.bad_snapshots == 0, "%" PRIuSIZE " snapshots torn, %" PRIuSIZE
+            " rising and %" PRIuSIZE " falling", ctx.bad_snapshots,
+            ctx.snapshots[0], ctx.snapshots[1]);
+  mu_assert(sts_words_equal(sts_snapshot(ctx.win), up), "last word");
+  sts_free_window(ctx.win);
+  sts_free_word(up);
+  sts_free_word(down);
+  return NULL;
+}
+
+#endif // STS_NO_THREADS
+
+static char* all_tests()
+{
+  mu_run_test(test_ingest_validation);
+  mu_run_test(test_ingest_batches);
+  mu_run_test(test_ingest_timed);
+#ifndef STS_NO_THREADS
+  mu_run_test(test_ingest_threaded);
+#endif
+  return NULL;
+}
+
+int main()
+{
+  char* result = all_tests();
+  if (result) {
+    printf("%s\n", result);
+  } else {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n", mu_tests_run);
+
+  return result != 0;
+}
+
+#endif // STS_COMPILE_UNIT_TESTS
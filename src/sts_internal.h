@@ -0,0 +1,128 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Symbolic time series internals shared between sources */
+
+#ifndef _STS_INTERNAL_H_
+#define _STS_INTERNAL_H_
+
+#include "symtseries.h"
+
+#include <stdlib.h>
+
+/*
+ * Heap hooks used by the library sources. Builds that need to observe the
+ * library allocations (e.g. sts_bench) define these on the command line; the
+ * replacements must be compatible with free() since some of the returned
+ * buffers are released by the caller.
+ */
+#ifdef STS_MALLOC
+void* STS_MALLOC(size_t size);
+#elif defined(STS_ENABLE_STATS)
+#define STS_MALLOC sts_counted_malloc
+void* sts_counted_malloc(size_t size);
+#else
+#define STS_MALLOC malloc
+#endif
+
+#ifdef STS_FREE
+void STS_FREE(void* ptr);
+#else
+#define STS_FREE free
+#endif
+
+/*
+ * Atomics for state shared between threads: relaxed for counters, acquire/
+ * release for the ingest queue hand-offs
+ */
+#if defined(_MSC_VER)
+#include <intrin.h>
+/* size_t is 4 bytes on 32-bit targets, the intrinsic follows the operand */
+#define STS_INTERLOCKED(op, ptr, v) \
+  (sizeof(*(ptr)) == 8 \
+   ? op##64((volatile __int64*)(ptr), (__int64)(v)) \
+   : op((volatile long*)(ptr), (long)(v)))
+#define STS_ATOMIC_ADD(ptr, v) STS_INTERLOCKED(_InterlockedExchangeAdd, ptr, v)
+#define STS_ATOMIC_LOAD(ptr) \
+  (sizeof(*(ptr)) == 8 ? *(volatile unsigned __int64*)(ptr) \
+                       : *(volatile unsigned long*)(ptr))
+#define STS_ATOMIC_STORE(ptr, v) STS_INTERLOCKED(_InterlockedExchange, ptr, v)
+#define STS_ATOMIC_LOAD_ACQUIRE(ptr) STS_INTERLOCKED(_InterlockedOr, ptr, 0)
+#define STS_ATOMIC_STORE_RELEASE(ptr, v) STS_ATOMIC_STORE(ptr, v)
+#define STS_ATOMIC_EXCHANGE(ptr, v) \
+  STS_INTERLOCKED(_InterlockedExchange, ptr, v)
+#define STS_ATOMIC_CAS(ptr, expected, desired) \
+  (sizeof(*(ptr)) == 8 \
+   ? _InterlockedCompareExchange64((volatile __int64*)(ptr), \
+                                   (__int64)(desired), \
+                                   (__int64)*(expected)) \
+     == (__int64)*(expected) \
+   : _InterlockedCompareExchange((volatile long*)(ptr), (long)(desired), \
+                                 (long)*(expected)) == (long)*(expected))
+#else
+#define STS_ATOMIC_ADD(ptr, v) __atomic_fetch_add((ptr), (v), __ATOMIC_RELAXED)
+#define STS_ATOMIC_LOAD(ptr) __atomic_load_n((ptr), __ATOMIC_RELAXED)
+#define STS_ATOMIC_STORE(ptr, v) __atomic_store_n((ptr), (v), __ATOMIC_RELAXED)
+#define STS_ATOMIC_LOAD_ACQUIRE(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define STS_ATOMIC_STORE_RELEASE(ptr, v) \
+  __atomic_store_n((ptr), (v), __ATOMIC_RELEASE)
+#define STS_ATOMIC_EXCHANGE(ptr, v) \
+  __atomic_exchange_n((ptr), (v), __ATOMIC_ACQ_REL)
+#define STS_ATOMIC_CAS(ptr, expected, desired) \
+  __atomic_compare_exchange_n((ptr), (expected), (desired), false, \
+                              __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#endif
+
+/*
+ * Fills lut with w rows of c + 1 squared symbol distances, row i holding the
+ * distance of query[i] to every symbol including NaN (c) with the sts_mindist
+ * conventions. Summing lut[i * (c + 1) + word[i]] over the frames and scaling
+ * by n / w gives the squared mindist. query symbols must be <= c.
+ */
+void sts_symbol_dist2_lut(const sts_symbol* query,
+                          size_t w,
+                          unsigned char c,
+                          double* lut);
+
+/* Releases the queue attached by sts_enable_ingest */
+void sts_free_ingest(struct sts_ingest* ingest);
+
+/* Drops the queued samples, consumer thread only */
+void sts_discard_ingest(struct sts_ingest* ingest);
+
+/*
+ * Thread-safe histogram update, ns is the measured duration. An empty
+ * histogram has min_ns ULLONG_MAX.
+ */
+void sts_histogram_record(struct sts_histogram* h, unsigned long long ns);
+
+/*
+ * Hot path instrumentation, compiles to nothing unless STS_ENABLE_STATS is
+ * defined. Window counters belong to the single thread updating the window,
+ * global ones are updated atomically.
+ */
+#ifdef STS_ENABLE_STATS
+
+extern struct sts_stats sts_global_stats;
+
+unsigned long long sts_now_ns(void);
+
+#define STS_STAT_ADD(field, v) \
+  STS_ATOMIC_ADD(&sts_global_stats.field, (unsigned long long)(v))
+#define STS_WINDOW_STAT_ADD(win, field, v) \
+  ((win)->stats.field += (v), STS_STAT_ADD(field, v))
+#define STS_LATENCY_START(t) unsigned long long t = sts_now_ns()
+#define STS_LATENCY_STOP(hist, t) \
+  sts_histogram_record(&sts_global_stats.hist, sts_now_ns() - (t))
+
+#else
+
+#define STS_STAT_ADD(field, v) ((void)0)
+#define STS_WINDOW_STAT_ADD(win, field, v) ((void)0)
+#define STS_LATENCY_START(t) ((void)0)
+#define STS_LATENCY_STOP(hist, t) ((void)0)
+
+#endif
+
+#endif
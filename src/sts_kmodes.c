@@ -0,0 +1,346 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Symbolic time series k-modes clustering of word sets */
+
+#include "symtseries.h"
+#include "sts_internal.h"
+#include "sts_parallel.h"
+
+#include <math.h>
+#include <string.h>
+
+/* below this many words per thread the partitioned passes aren't worth it */
+#define STS_KMODES_MIN_PARTITION 4096
+#define STS_KMODES_MAX_BLOCKS 64
+#define STS_KMODES_UNASSIGNED ((size_t)-1)
+
+struct kmodes_state {
+  const struct sts_word_set* set;
+  size_t k;
+  size_t row; // c + 1, symbols per LUT row
+  double* lut; // k blocks of w * row squared symbol distances
+  size_t* assignment;
+  double* dist; // seeding: squared distance to the closest center so far
+  const double* seed_lut; // seeding: LUT of the newest center
+  size_t n_blocks, block_size;
+  size_t* counts; // per block k * w * row symbol counts
+  size_t changed[STS_KMODES_MAX_BLOCKS];
+};
+
+static size_t block_end(const struct kmodes_state* st, size_t task)
+{
+  size_t end = (task + 1) * st->block_size;
+  return end < st->set->count ? end : st->set->count;
+}
+
+static double word_dist2(const double* lut, const sts_symbol* word, size_t w,
+                         size_t row, double bound)
+{
+  double sum = 0;
+  for (size_t j = 0; j < w && sum <= bound; ++j, lut += row) {
+    sum += lut[word[j]];
+  }
+  return sum;
+}
+
+static void seed_task(void* ctx, size_t task)
+{
+  struct kmodes_state* st = ctx;
+  const struct sts_word_set* set = st->set;
+  for (size_t i = task * st->block_size; i < block_end(st, task); ++i) {
+    double d = word_dist2(st->seed_lut, set->symbols + i * set->w, set->w,
+                          st->row, st->dist[i]);
+    if (d < st->dist[i]) st->dist[i] = d;
+  }
+}
+
+/* Nearest center of every word (ties to the lower index) and symbol counts */
+static void assign_task(void* ctx, size_t task)
+{
+  struct kmodes_state* st = ctx;
+  const struct sts_word_set* set = st->set;
+  size_t w = set->w, row = st->row, stride = w * row;
+  size_t* counts = st->counts + task * st->k * stride;
+  memset(counts, 0, st->k * stride * sizeof*counts);
+  size_t changed = 0;
+  for (size_t i = task * st->block_size; i < block_end(st, task); ++i) {
+    const sts_symbol* word = set->symbols + i * w;
+    size_t best = 0;
+    double best_d = INFINITY;
+    for (size_t c = 0; c < st->k; ++c) {
+      double d = word_dist2(st->lut + c * stride, word, w, row, best_d);
+      if (d < best_d) {
+        best_d = d;
+        best = c;
+      }
+    }
+    if (st->assignment[i] != best) {
+      st->assignment[i] = best;
+      ++changed;
+    }
+    size_t* cell = counts + best * stride;
+    for (size_t j = 0; j < w; ++j, cell += row) ++cell[word[j]];
+  }
+  st->changed[task] = changed;
+}
+
+static unsigned long long next_random(unsigned long long* state)
+{
+  *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return *state >> 11;
+}
+
+/* k-means++ seeding with mindist, returns false on allocation failure */
+static bool seed_centers(struct kmodes_state* st, unsigned int seed,
+                         unsigned int n_threads, sts_symbol* centers)
+{
+  const struct sts_word_set* set = st->set;
+  size_t w = set->w, stride = w * st->row;
+  st->dist = STS_MALLOC(set->count * sizeof*st->dist);
+  if (!st->dist) return false;
+  for (size_t i = 0; i < set->count; ++i) st->dist[i] = INFINITY;
+  unsigned long long rng = seed;
+  next_random(&rng);
+  size_t pick = (size_t)(next_random(&rng) % set->count);
+  for (size_t c = 0; c < st->k; ++c) {
+    memcpy(centers + c * w, set->symbols + pick * w, w * sizeof*centers);
+    sts_symbol_dist2_lut(centers + c * w, w, set->c, st->lut + c * stride);
+    if (c + 1 == st->k) break;
+    st->seed_lut = st->lut + c * stride;
+    sts_parallel_for(n_threads, st->n_blocks, seed_task, st);
+    double total = 0;
+    for (size_t i = 0; i < set->count; ++i) total += st->dist[i];
+    if (total > 0) {
+      // 53 random bits scaled to [0, total)
+      double r = (double)next_random(&rng) / 9007199254740992.0 * total;
+      pick = set->count - 1;
+      for (size_t i = 0; i < set->count; ++i) {
+        r -= st->dist[i];
+        if (r < 0 && st->dist[i] > 0) {
+          pick = i;
+          break;
+        }
+      }
+    } else {
+      // every word already coincides with a center
+      pick = (size_t)(next_random(&rng) % set->count);
+    }
+  }
+  STS_FREE(st->dist);
+  st->dist = NULL;
+  return true;
+}
+
+/*
+ * Moves every center to the per-position modal symbol of its members. NaN only
+ * wins a position when all the members are NaN there, ties keep the current
+ * symbol or else take the lowest one. Empty clusters keep their center.
+ */
+static void update_centers(struct kmodes_state* st, sts_symbol* centers)
+{
+  const struct sts_word_set* set = st->set;
+  size_t w = set->w, row = st->row, stride = w * row;
+  sts_symbol nan_symbol = set->c;
+  for (size_t b = 1; b < st->n_blocks; ++b) {
+    const size_t* src = st->counts + b * st->k * stride;
+    for (size_t i = 0; i < st->k * stride; ++i) st->counts[i] += src[i];
+  }
+  for (size_t c = 0; c < st->k; ++c) {
+    sts_symbol* center = centers + c * w;
+    for (size_t j = 0; j < w; ++j) {
+      const size_t* cnt = st->counts + c * stride + j * row;
+      size_t best = center[j] < nan_symbol ? cnt[center[j]] : 0;
+      sts_symbol mode = center[j];
+      for (sts_symbol s = 0; s < nan_symbol; ++s) {
+        if (cnt[s] > best) {
+          best = cnt[s];
+          mode = s;
+        }
+      }
+      if (best == 0 && cnt[nan_symbol] > 0) mode = nan_symbol;
+      center[j] = mode;
+    }
+    sts_symbol_dist2_lut(center, w, set->c, st->lut + c * stride);
+  }
+}
+
+size_t sts_word_set_kmodes(const struct sts_word_set* set,
+                           size_t k,
+                           size_t max_iter,
+                           unsigned int seed,
+                           unsigned int n_threads,
+                           sts_symbol* centers,
+                           size_t* assignment)
+{
+  if (!set || !centers || !assignment || k == 0 || k > set->count
+      || max_iter == 0) {
+    return 0;
+  }
+  struct kmodes_state st;
+  memset(&st, 0, sizeof st);
+  st.set = set;
+  st.k = k;
+  st.row = (size_t)set->c + 1;
+  st.assignment = assignment;
+  if (n_threads < 1) n_threads = 1;
+  st.n_blocks = set->count / STS_KMODES_MIN_PARTITION;
+  if (st.n_blocks > n_threads) st.n_blocks = n_threads;
+  if (st.n_blocks > STS_KMODES_MAX_BLOCKS) st.n_blocks = STS_KMODES_MAX_BLOCKS;
+  if (st.n_blocks < 1) st.n_blocks = 1;
+  st.block_size = (set->count + st.n_blocks - 1) / st.n_blocks;
+
+  size_t stride = set->w * st.row;
+  st.lut = STS_MALLOC(k * stride * sizeof*st.lut);
+  st.counts = STS_MALLOC(st.n_blocks * k * stride * sizeof*st.counts);
+  size_t iter = 0;
+  if (st.lut && st.counts && seed_centers(&st, seed, n_threads, centers)) {
+    for (size_t i = 0; i < set->count; ++i) {
+      assignment[i] = STS_KMODES_UNASSIGNED;
+    }
+    while (iter < max_iter) {
+      ++iter;
+      sts_parallel_for(n_threads, st.n_blocks, assign_task, &st);
+      size_t changed = 0;
+      for (size_t b = 0; b < st.n_blocks; ++b) changed += st.changed[b];
+      if (changed == 0 || iter == max_iter) break;
+      update_centers(&st, centers);
+    }
+  }
+  STS_FREE(st.lut);
+  STS_FREE(st.counts);
+  return iter;
+}
+
+#ifdef STS_COMPILE_UNIT_TESTS
+
+#include "test/sts_test.h"
+
+static sts_word_set clustered_set(size_t per_cluster, size_t w,
+                                  unsigned char c, const char** shapes,
+                                  size_t n_shapes, unsigned int seed)
+{
+  sts_word_set set = sts_new_word_set(0, w, c);
+  sts_symbol* word = malloc(w);
+  struct sts_word tmp = { word, 0, w, c };
+  for (size_t i = 0; i < per_cluster * n_shapes; ++i) {
+    sts_word shape = sts_from_sax_string(shapes[i % n_shapes], c);
+    memcpy(word, shape->symbols, w);
+    sts_free_word(shape);
+    // nudge a symbol now and then
+    seed = seed * 1103515245 + 12345;
+    if ((seed >> 16) % 4 == 0) {
+      size_t j = (seed >> 8) % w;
+      if (word[j] > 0 && word[j] < c) --word[j];
+    }
+    sts_word_set_add(set, &tmp);
+  }
+  free(word);
+  return set;
+}
+
+static char* test_kmodes_validation()
+{
+  sts_word_set set = sts_new_word_set(0, 4, 4);
+  sts_symbol centers[8];
+  size_t assignment[4];
+  mu_assert(sts_word_set_kmodes(set, 1, 10, 0, 1, centers, assignment) == 0,
+            "empty set");
+  sts_word word = sts_from_sax_string("ABCD", 4);
+  sts_word_set_add(set, word);
+  sts_word_set_add(set, word);
+  sts_free_word(word);
+  mu_assert(sts_word_set_kmodes(set, 3, 10, 0, 1, centers, assignment) == 0,
+            "k > count");
+  mu_assert(sts_word_set_kmodes(set, 1, 0, 0, 1, centers, assignment) == 0,
+            "no iterations");
+  // identical words: the second center duplicates the first
+  mu_assert(sts_word_set_kmodes(set, 2, 10, 0, 1, centers, assignment) == 2,
+            "nothing should move after the first update");
+  mu_assert(assignment[0] == 0 && assignment[1] == 0, "ties to the lowest");
+  mu_assert(memcmp(centers, set->symbols, 4) == 0, "center");
+  sts_free_word_set(set);
+  return NULL;
+}
+
+static char* test_kmodes_clusters()
+{
+  const char* shapes[] = { "AAAAHHHH", "HHHHAAAA", "ADADADAD", "DDDDDDDD" };
+  sts_word_set set = clustered_set(500, 8, 8, shapes, 4, 3);
+  size_t* assignment = malloc(set->count * sizeof*assignment);
+  sts_symbol centers[4 * 8];
+  size_t iter = sts_word_set_kmodes(set, 4, 50, 7, 1, centers, assignment);
+  mu_assert(iter > 0 && iter < 50, "iterations %" PRIuSIZE, iter);
+  // every shape ends up in its own cluster with the shape as its mode
+  for (size_t s = 0; s < 4; ++s) {
+    size_t cluster = assignment[s];
+    sts_word shape = sts_from_sax_string(shapes[s], 8);
+    mu_assert(memcmp(centers + cluster * 8, shape->symbols, 8) == 0,
+              "center of %s", shapes[s]);
+    sts_free_word(shape);
+    for (size_t i = s; i < set->count; i += 4) {
+      mu_assert(assignment[i] == cluster, "word %" PRIuSIZE, i);
+    }
+    for (size_t t = 0; t < s; ++t) {
+      mu_assert(assignment[t] != cluster, "%s merged", shapes[s]);
+    }
+  }
+  free(assignment);
+  sts_free_word_set(set);
+  return NULL;
+}
+
+static char* test_kmodes_threads()
+{
+  // the partitioned passes give the same clustering
+  const char* shapes[] = { "ABCDEFGHIJ#P", "PONMLKJIHGFE", "AAAAAAPPPPPP",
+    "PPPPPPAAAAAA", "AHAHAHAHAHAH", "HHHH####HHHH" };
+  sts_word_set set = clustered_set(3000, 12, 16, shapes, 6, 9);
+  size_t* a1 = malloc(set->count * sizeof*a1);
+  size_t* a4 = malloc(set->count * sizeof*a4);
+  sts_symbol c1[8 * 12], c4[8 * 12];
+  size_t i1 = sts_word_set_kmodes(set, 8, 30, 1, 1, c1, a1);
+  size_t i4 = sts_word_set_kmodes(set, 8, 30, 1, 4, c4, a4);
+  mu_assert(i1 > 0 && i1 == i4, "iterations %" PRIuSIZE " %" PRIuSIZE, i1,
+            i4);
+  mu_assert(memcmp(c1, c4, sizeof c1) == 0, "centers differ");
+  mu_assert(memcmp(a1, a4, set->count * sizeof*a1) == 0, "assignment differs");
+  // every word sits with its nearest center
+  for (size_t i = 0; i < set->count; i += 97) {
+    struct sts_word word = { set->symbols + i * 12, 0, 12, 16 };
+    struct sts_word own = { c1 + a1[i] * 12, 0, 12, 16 };
+    for (size_t c = 0; c < 8; ++c) {
+      struct sts_word other = { c1 + c * 12, 0, 12, 16 };
+      mu_assert(sts_mindist(&word, &own) <= sts_mindist(&word, &other),
+                "word %" PRIuSIZE " closer to %" PRIuSIZE, i, c);
+    }
+  }
+  free(a1);
+  free(a4);
+  sts_free_word_set(set);
+  return NULL;
+}
+
+static char* all_tests()
+{
+  mu_run_test(test_kmodes_validation);
+  mu_run_test(test_kmodes_clusters);
+  mu_run_test(test_kmodes_threads);
+  return NULL;
+}
+
+int main()
+{
+  char* result = all_tests();
+  if (result) {
+    printf("%s\n", result);
+  } else {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n", mu_tests_run);
+
+  return result != 0;
+}
+
+#endif // STS_COMPILE_UNIT_TESTS
@@ -0,0 +1,391 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Symbolic time series matrix profile */
+
+#include "symtseries.h"
+#include "sts_internal.h"
+#include "sts_parallel.h"
+
+#include <math.h>
+#include <string.h>
+
+/* diagonals advanced together, their columns stay in L1 */
+#define STS_PROFILE_BAND 256
+#define STS_PROFILE_MAX_ACC 64
+#define STS_PROFILE_MERGE_BLOCK 65536
+
+/*
+ * The distance of subsequences i and j is derived from their Pearson
+ * correlation, corr = cov(i, j) * norm[i] * norm[j] + half[i] + half[j]:
+ * norm is 1 / sqrt(sum of squared deviations), or 0 for flat subsequences
+ * whose half of 0.5 then gives the distances of an all-zero normalized
+ * series. Subsequences holding non-finite values have a NaN norm, so no
+ * comparison ever picks them.
+ *
+ * Along a diagonal (j = i + k) the covariance is updated in O(1):
+ * cov(i + 1, j + 1) = cov(i, j) + df[i + 1] * dg[j + 1] + df[j + 1] * dg[i + 1]
+ */
+struct profile_state {
+  const double* clean; // series with non-finite values zeroed
+  size_t n, m; // subsequence length and count
+  size_t exclusion;
+  double* mu, * norm, * half;
+  double* df, * dg; // m + 1 entries, the last one padding
+  size_t n_bands, n_acc;
+  double* corr[STS_PROFILE_MAX_ACC]; // best correlation of every subsequence
+  size_t* index[STS_PROFILE_MAX_ACC];
+};
+
+/* Updates the best match of a subsequence, ties go to the lower index */
+static void keep_best(double* corr, size_t* index, double c, size_t j)
+{
+  if (c > *corr || (c == *corr && j < *index)) {
+    *corr = c;
+    *index = j;
+  }
+}
+
+static double first_cov(const struct profile_state* st, size_t k)
+{
+  const double* a = st->clean, * b = st->clean + k;
+  double mu_a = st->mu[0], mu_b = st->mu[k], sum = 0;
+  for (size_t t = 0; t < st->n; ++t) sum += (a[t] - mu_a) * (b[t] - mu_b);
+  return sum;
+}
+
+/* Accumulator task: every n_acc-th band of diagonals, starting at task */
+static void band_task(void* ctx, size_t task)
+{
+  struct profile_state* st = ctx;
+  double* corr = st->corr[task];
+  size_t* index = st->index[task];
+  for (size_t i = 0; i < st->m; ++i) {
+    corr[i] = -INFINITY;
+    index[i] = STS_NO_NEIGHBOR;
+  }
+  const double* norm = st->norm, * half = st->half, * df = st->df,
+        * dg = st->dg;
+  double cov[STS_PROFILE_BAND];
+  for (size_t band = task; band < st->n_bands; band += st->n_acc) {
+    size_t k0 = st->exclusion + band * STS_PROFILE_BAND;
+    size_t k1 = k0 + STS_PROFILE_BAND < st->m ? k0 + STS_PROFILE_BAND : st->m;
+    for (size_t k = k0; k < k1; ++k) cov[k - k0] = first_cov(st, k);
+    for (size_t i = 0; i + k0 < st->m; ++i) {
+      size_t end = k1 < st->m - i ? k1 : st->m - i;
+      double ni = norm[i], hi = half[i], df_next = df[i + 1],
+             dg_next = dg[i + 1];
+      double best = -INFINITY;
+      size_t best_j = STS_NO_NEIGHBOR;
+      for (size_t k = k0; k < end; ++k) {
+        size_t j = i + k;
+        double v = cov[k - k0];
+        double c = v * ni * norm[j] + hi + half[j];
+        // a column's candidates from other bands may come later
+        if (c > corr[j] || (c == corr[j] && i < index[j])) {
+          corr[j] = c;
+          index[j] = i;
+        }
+        if (c > best) {
+          best = c;
+          best_j = j;
+        }
+        cov[k - k0] = v + df_next * dg[j + 1] + df[j + 1] * dg_next;
+      }
+      keep_best(corr + i, index + i, best, best_j);
+    }
+  }
+}
+
+static void merge_task(void* ctx, size_t task)
+{
+  struct profile_state* st = ctx;
+  size_t begin = task * STS_PROFILE_MERGE_BLOCK;
+  size_t end = begin + STS_PROFILE_MERGE_BLOCK;
+  if (end > st->m) end = st->m;
+  double* corr = st->corr[0];
+  size_t* index = st->index[0];
+  for (size_t i = begin; i < end; ++i) {
+    for (size_t a = 1; a < st->n_acc; ++a) {
+      keep_best(corr + i, index + i, st->corr[a][i], st->index[a][i]);
+    }
+    if (index[i] == STS_NO_NEIGHBOR) {
+      corr[i] = INFINITY;
+    } else {
+      double d2 = 2 * (double)st->n * (1 - corr[i]);
+      corr[i] = d2 > 0 ? sqrt(d2) : 0;
+    }
+  }
+}
+
+/*
+ * Sliding mean and squared deviations of the cleaned series, recomputed from
+ * scratch every n subsequences to keep the rolling error bounded
+ */
+static void sliding_stats(struct profile_state* st, const double* series)
+{
+  const double* x = st->clean;
+  size_t n = st->n, bad = 0;
+  double mean = 0, ssq = 0;
+  for (size_t i = 0; i < st->m; ++i) {
+    if (i % n == 0) {
+      mean = ssq = 0;
+      bad = 0;
+      for (size_t t = i; t < i + n; ++t) {
+        mean += x[t];
+        bad += !isfinite(series[t]);
+      }
+      mean /= n;
+      for (size_t t = i; t < i + n; ++t) ssq += (x[t] - mean) * (x[t] - mean);
+    } else {
+      double in = x[i + n - 1], out = x[i - 1], old = mean;
+      mean += (in - out) / n;
+      ssq += (in - out) * (in - mean + out - old);
+      if (ssq < 0) ssq = 0;
+      bad += !isfinite(series[i + n - 1]);
+      bad -= !isfinite(series[i - 1]);
+    }
+    st->mu[i] = mean;
+    st->half[i] = 0;
+    if (bad) {
+      st->norm[i] = NAN;
+    } else if (sqrt(ssq / n) < STS_STAT_EPS) {
+      st->norm[i] = 0;
+      st->half[i] = 0.5;
+    } else {
+      st->norm[i] = 1 / sqrt(ssq);
+    }
+  }
+  st->df[0] = st->dg[0] = st->df[st->m] = st->dg[st->m] = 0;
+  for (size_t i = 1; i < st->m; ++i) {
+    st->df[i] = (x[i + n - 1] - x[i - 1]) / 2;
+    st->dg[i] = (x[i + n - 1] - st->mu[i]) + (x[i - 1] - st->mu[i - 1]);
+  }
+}
+
+bool sts_matrix_profile(const double* series,
+                        size_t len,
+                        size_t n,
+                        size_t exclusion,
+                        unsigned int n_threads,
+                        double* profile,
+                        size_t* index)
+{
+  if (!series || !profile || !index || n < 2 || len < n) return false;
+  struct profile_state st;
+  memset(&st, 0, sizeof st);
+  st.n = n;
+  st.m = len - n + 1;
+  st.exclusion = exclusion ? exclusion : (n + 3) / 4;
+  if (st.exclusion < st.m) {
+    st.n_bands = (st.m - st.exclusion + STS_PROFILE_BAND - 1)
+      / STS_PROFILE_BAND;
+  }
+  if (n_threads < 1) n_threads = 1;
+  st.n_acc = n_threads < st.n_bands ? n_threads : st.n_bands;
+  if (st.n_acc > STS_PROFILE_MAX_ACC) st.n_acc = STS_PROFILE_MAX_ACC;
+  if (st.n_acc < 1) st.n_acc = 1;
+
+  size_t m = st.m;
+  double* clean = STS_MALLOC(len * sizeof*clean);
+  double* stats = STS_MALLOC((5 * m + 2) * sizeof*stats);
+  double* scratch_corr = NULL;
+  size_t* scratch_index = NULL;
+  if (st.n_acc > 1) {
+    scratch_corr = STS_MALLOC((st.n_acc - 1) * m * sizeof*scratch_corr);
+    scratch_index = STS_MALLOC((st.n_acc - 1) * m * sizeof*scratch_index);
+  }
+  bool ok = clean && stats && (st.n_acc == 1
+                               || (scratch_corr && scratch_index));
+  if (ok) {
+    for (size_t t = 0; t < len; ++t) {
+      clean[t] = isfinite(series[t]) ? series[t] : 0;
+    }
+    st.clean = clean;
+    st.mu = stats;
+    st.norm = stats + m;
+    st.half = stats + 2 * m;
+    st.df = stats + 3 * m;
+    st.dg = stats + 4 * m + 1;
+    sliding_stats(&st, series);
+    // the output arrays are the first accumulator
+    st.corr[0] = profile;
+    st.index[0] = index;
+    for (size_t a = 1; a < st.n_acc; ++a) {
+      st.corr[a] = scratch_corr + (a - 1) * m;
+      st.index[a] = scratch_index + (a - 1) * m;
+    }
+    sts_parallel_for(n_threads, st.n_acc, band_task, &st);
+    sts_parallel_for(n_threads, (m + STS_PROFILE_MERGE_BLOCK - 1)
+                     / STS_PROFILE_MERGE_BLOCK, merge_task, &st);
+  }
+  STS_FREE(clean);
+  STS_FREE(stats);
+  STS_FREE(scratch_corr);
+  STS_FREE(scratch_index);
+  return ok;
+}
+
+#ifdef STS_COMPILE_UNIT_TESTS
+
+#include "test/sts_test.h"
+
+static void random_walk(double* series, size_t len, unsigned int seed)
+{
+  double level = 0;
+  for (size_t i = 0; i < len; ++i) {
+    seed = seed * 1103515245 + 12345;
+    level += ((seed >> 16) & 0x7fff) / 16384.0 - 1.0;
+    series[i] = level;
+  }
+}
+
+/* z-normalized distance computed directly, same conventions as the engine */
+static double brute_dist(const double* series, size_t n, size_t i, size_t j)
+{
+  double z[2][64], mu[2] = { 0, 0 }, sd[2] = { 0, 0 };
+  size_t at[2] = { i, j };
+  for (int s = 0; s < 2; ++s) {
+    for (size_t t = 0; t < n; ++t) {
+      if (!isfinite(series[at[s] + t])) return INFINITY;
+      mu[s] += series[at[s] + t];
+    }
+    mu[s] /= n;
+    for (size_t t = 0; t < n; ++t) {
+      double d = series[at[s] + t] - mu[s];
+      sd[s] += d * d;
+    }
+    sd[s] = sqrt(sd[s] / n);
+    for (size_t t = 0; t < n; ++t) {
+      z[s][t] = sd[s] < STS_STAT_EPS ? 0 : (series[at[s] + t] - mu[s]) / sd[s];
+    }
+  }
+  double sum = 0;
+  for (size_t t = 0; t < n; ++t) {
+    sum += (z[0][t] - z[1][t]) * (z[0][t] - z[1][t]);
+  }
+  return sqrt(sum);
+}
+
+static char* test_profile_validation()
+{
+  double series[8] = { 1, 2, 3, 4, 5, 6, 7, 8 }, profile[8];
+  size_t index[8];
+  mu_assert(!sts_matrix_profile(series, 8, 1, 0, 1, profile, index), "n < 2");
+  mu_assert(!sts_matrix_profile(series, 3, 4, 0, 1, profile, index), "len < n");
+  mu_assert(!sts_matrix_profile(NULL, 8, 4, 0, 1, profile, index), "series");
+  // 5 subsequences, all within the exclusion zone of each other
+  mu_assert(sts_matrix_profile(series, 8, 4, 5, 2, profile, index), "failed");
+  for (size_t i = 0; i < 5; ++i) {
+    mu_assert(isinf(profile[i]) && index[i] == STS_NO_NEIGHBOR,
+              "neighbour of %" PRIuSIZE, i);
+  }
+  // a ramp matches all of its shifts exactly
+  mu_assert(sts_matrix_profile(series, 8, 4, 2, 1, profile, index), "failed");
+  mu_assert(profile[0] < 1e-6 && index[0] == 2, "ramp %f %" PRIuSIZE,
+            profile[0], index[0]);
+  mu_assert(index[4] == 0, "ties go to the lower index");
+  return NULL;
+}
+
+static char* test_profile_brute()
+{
+  const size_t len = 1500, n = 24;
+  const size_t m = len - n + 1;
+  double* series = malloc(len * sizeof*series);
+  random_walk(series, len, 7);
+  for (size_t t = 400; t < 460; ++t) series[t] = 3; // flat stretch
+  series[900] = NAN;
+  series[901] = INFINITY;
+  double* profile = malloc(m * sizeof*profile);
+  double* other = malloc(m * sizeof*other);
+  size_t* index = malloc(m * sizeof*index);
+  size_t* other_index = malloc(m * sizeof*other_index);
+  size_t exclusion = (n + 3) / 4;
+  mu_assert(sts_matrix_profile(series, len, n, 0, 1, profile, index),
+            "failed");
+  for (size_t i = 0; i < m; ++i) {
+    double best = INFINITY;
+    for (size_t j = 0; j < m; ++j) {
+      if (j + exclusion > i && i + exclusion > j) continue;
+      double d = brute_dist(series, n, i, j);
+      if (d < best) best = d;
+    }
+    mu_assert(fabs(profile[i] - best) < 1e-6
+              || (isinf(best) && isinf(profile[i])),
+              "%" PRIuSIZE ": %f != %f", i, profile[i], best);
+    if (isinf(best)) {
+      mu_assert(index[i] == STS_NO_NEIGHBOR, "no neighbour");
+      continue;
+    }
+    size_t j = index[i];
+    mu_assert(j + exclusion <= i || i + exclusion <= j, "trivial match");
+    mu_assert(fabs(brute_dist(series, n, i, j) - best) < 1e-6,
+              "index of %" PRIuSIZE, i);
+  }
+  mu_assert(profile[420] == 0, "flat subsequences match exactly");
+  mu_assert(isinf(profile[890]), "NaN subsequence");
+
+  for (unsigned int threads = 2; threads <= 5; threads += 3) {
+    mu_assert(sts_matrix_profile(series, len, n, 0, threads, other,
+                                 other_index), "failed");
+    mu_assert(memcmp(profile, other, m * sizeof*other) == 0
+              && memcmp(index, other_index, m * sizeof*index) == 0,
+              "%u threads", threads);
+  }
+  free(series);
+  free(profile);
+  free(other);
+  free(index);
+  free(other_index);
+  return NULL;
+}
+
+static char* test_profile_motif()
+{
+  // a long walk with a shape planted twice, far apart
+  const size_t len = 20000, n = 64, at[2] = { 3000, 15000 };
+  double* series = malloc(len * sizeof*series);
+  random_walk(series, len, 11);
+  for (int s = 0; s < 2; ++s) {
+    for (size_t t = 0; t < n; ++t) {
+      series[at[s] + t] = series[at[s]] + 40 * sin(t * 0.3) * (s + 1);
+    }
+  }
+  size_t m = len - n + 1;
+  double* profile = malloc(m * sizeof*profile);
+  size_t* index = malloc(m * sizeof*index);
+  mu_assert(sts_matrix_profile(series, len, n, 0, 4, profile, index),
+            "failed");
+  mu_assert(index[at[0]] == at[1] && index[at[1]] == at[0],
+            "%" PRIuSIZE " %" PRIuSIZE, index[at[0]], index[at[1]]);
+  mu_assert(profile[at[0]] < 1e-6, "motif distance %f", profile[at[0]]);
+  free(series);
+  free(profile);
+  free(index);
+  return NULL;
+}
+
+static char* all_tests()
+{
+  mu_run_test(test_profile_validation);
+  mu_run_test(test_profile_brute);
+  mu_run_test(test_profile_motif);
+  return NULL;
+}
+
+int main()
+{
+  char* result = all_tests();
+  if (result) {
+    printf("%s\n", result);
+  } else {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n", mu_tests_run);
+
+  return result != 0;
+}
+
+#endif // STS_COMPILE_UNIT_TESTS
@@ -0,0 +1,379 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Minimal threading helpers (fork-join and one-time init) */
+
+#if !defined(_MSC_VER) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "sts_parallel.h"
+#include "sts_internal.h"
+
+#include <string.h>
+
+#define STS_MAX_THREADS 64
+
+struct parallel_job {
+  sts_task_fn fn;
+  void* ctx;
+  size_t n_tasks;
+  size_t next;
+};
+
+static void run_tasks(struct parallel_job* job)
+{
+  for (;;) {
+    size_t task = STS_ATOMIC_ADD(&job->next, (size_t)1);
+    if (task >= job->n_tasks) break;
+    job->fn(job->ctx, task);
+  }
+}
+
+#if defined(STS_NO_THREADS)
+#elif defined(_MSC_VER)
+static DWORD WINAPI thread_main(LPVOID arg)
+{
+  run_tasks(arg);
+  return 0;
+}
+#else
+static void* thread_main(void* arg)
+{
+  run_tasks(arg);
+  return NULL;
+}
+#endif
+
+void sts_parallel_for(unsigned int n_threads,
+                      size_t n_tasks,
+                      sts_task_fn fn,
+                      void* ctx)
+{
+  if (!fn || n_tasks == 0) return;
+  struct parallel_job job = { fn, ctx, n_tasks, 0 };
+  size_t helpers = n_threads > 1 ? n_threads - 1 : 0;
+  if (helpers > n_tasks - 1) helpers = n_tasks - 1;
+  if (helpers > STS_MAX_THREADS - 1) helpers = STS_MAX_THREADS - 1;
+
+#if defined(STS_NO_THREADS)
+  (void)helpers;
+  run_tasks(&job);
+#elif defined(_MSC_VER)
+  HANDLE threads[STS_MAX_THREADS];
+  size_t started = 0;
+  for (; started < helpers; ++started) {
+    threads[started] = CreateThread(NULL, 0, thread_main, &job, 0, NULL);
+    if (!threads[started]) break;
+  }
+  run_tasks(&job);
+  for (size_t i = 0; i < started; ++i) {
+    WaitForSingleObject(threads[i], INFINITE);
+    CloseHandle(threads[i]);
+  }
+#else
+  pthread_t threads[STS_MAX_THREADS];
+  size_t started = 0;
+  for (; started < helpers; ++started) {
+    if (pthread_create(&threads[started], NULL, thread_main, &job)) break;
+  }
+  run_tasks(&job);
+  for (size_t i = 0; i < started; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+#endif
+}
+
+#if defined(STS_NO_THREADS)
+void sts_call_once(sts_once_flag* flag, void (*fn)(void))
+{
+  if (!*flag) {
+    *flag = 1;
+    fn();
+  }
+}
+#elif defined(_MSC_VER)
+struct once_call {
+  void (*fn)(void);
+};
+
+static BOOL CALLBACK once_callback(PINIT_ONCE flag, PVOID arg, PVOID* ctx)
+{
+  (void)flag;
+  (void)ctx;
+  ((struct once_call*)arg)->fn();
+  return TRUE;
+}
+
+void sts_call_once(sts_once_flag* flag, void (*fn)(void))
+{
+  struct once_call call = { fn };
+  InitOnceExecuteOnce(flag, once_callback, &call, NULL);
+}
+#else
+void sts_call_once(sts_once_flag* flag, void (*fn)(void))
+{
+  pthread_once(flag, fn);
+}
+#endif
+
+struct sts_pool {
+  struct parallel_job* job; // current call, NULL between calls
+  unsigned long long generation; // bumped by every sts_pool_for
+  size_t busy; // helpers still working on the current call
+  size_t started;
+  bool stop;
+#if defined(STS_NO_THREADS)
+#elif defined(_MSC_VER)
+  SRWLOCK lock;
+  CONDITION_VARIABLE wake, done;
+  HANDLE threads[STS_MAX_THREADS];
+#else
+  pthread_mutex_t lock;
+  pthread_cond_t wake, done;
+  pthread_t threads[STS_MAX_THREADS];
+#endif
+};
+
+#if defined(STS_NO_THREADS)
+#elif defined(_MSC_VER)
+#define pool_lock(pool) AcquireSRWLockExclusive(&(pool)->lock)
+#define pool_unlock(pool) ReleaseSRWLockExclusive(&(pool)->lock)
+#define pool_wait(pool, cond) \
+  SleepConditionVariableSRW(&(pool)->cond, &(pool)->lock, INFINITE, 0)
+#define pool_broadcast(pool, cond) WakeAllConditionVariable(&(pool)->cond)
+#else
+#define pool_lock(pool) pthread_mutex_lock(&(pool)->lock)
+#define pool_unlock(pool) pthread_mutex_unlock(&(pool)->lock)
+#define pool_wait(pool, cond) pthread_cond_wait(&(pool)->cond, &(pool)->lock)
+#define pool_broadcast(pool, cond) pthread_cond_broadcast(&(pool)->cond)
+#endif
+
+#if !defined(STS_NO_THREADS)
+/* Helpers sleep between calls and join every generation exactly once */
+static void pool_main(struct sts_pool* pool)
+{
+  unsigned long long seen = 0;
+  pool_lock(pool);
+  for (;;) {
+    while (pool->generation == seen && !pool->stop) pool_wait(pool, wake);
+    if (pool->stop) break;
+    seen = pool->generation;
+    struct parallel_job* job = pool->job;
+    pool_unlock(pool);
+    run_tasks(job);
+    pool_lock(pool);
+    if (--pool->busy == 0) pool_broadcast(pool, done);
+  }
+  pool_unlock(pool);
+}
+#endif
+
+#if defined(STS_NO_THREADS)
+#elif defined(_MSC_VER)
+static DWORD WINAPI pool_thread_main(LPVOID arg)
+{
+  pool_main(arg);
+  return 0;
+}
+#else
+static void* pool_thread_main(void* arg)
+{
+  pool_main(arg);
+  return NULL;
+}
+#endif
+
+struct sts_pool* sts_new_pool(unsigned int n_threads)
+{
+  struct sts_pool* pool = STS_MALLOC(sizeof*pool);
+  if (!pool) return NULL;
+  memset(pool, 0, sizeof*pool);
+  size_t helpers = n_threads > 1 ? n_threads - 1 : 0;
+  if (helpers > STS_MAX_THREADS - 1) helpers = STS_MAX_THREADS - 1;
+
+#if defined(STS_NO_THREADS)
+  (void)helpers;
+#elif defined(_MSC_VER)
+  InitializeSRWLock(&pool->lock);
+  InitializeConditionVariable(&pool->wake);
+  InitializeConditionVariable(&pool->done);
+  for (; pool->started < helpers; ++pool->started) {
+    pool->threads[pool->started] =
+      CreateThread(NULL, 0, pool_thread_main, pool, 0, NULL);
+    if (!pool->threads[pool->started]) break;
+  }
+#else
+  int err = pthread_mutex_init(&pool->lock, NULL);
+  if (!err && (err = pthread_cond_init(&pool->wake, NULL))) {
+    pthread_mutex_destroy(&pool->lock);
+  }
+  if (!err && (err = pthread_cond_init(&pool->done, NULL))) {
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+  }
+  if (err) {
+    STS_FREE(pool);
+    return NULL;
+  }
+  for (; pool->started < helpers; ++pool->started) {
+    if (pthread_create(&pool->threads[pool->started], NULL, pool_thread_main,
+                       pool)) {
+      break;
+    }
+  }
+#endif
+  return pool;
+}
+
+void sts_pool_for(struct sts_pool* pool,
+                  size_t n_tasks,
+                  sts_task_fn fn,
+                  void* ctx)
+{
+  if (!pool || !fn || n_tasks == 0) return;
+  struct parallel_job job = { fn, ctx, n_tasks, 0 };
+#if !defined(STS_NO_THREADS)
+  if (pool->started > 0 && n_tasks > 1) {
+    pool_lock(pool);
+    pool->job = &job;
+    pool->busy = pool->started;
+    ++pool->generation;
+    pool_broadcast(pool, wake);
+    pool_unlock(pool);
+    run_tasks(&job);
+    pool_lock(pool);
+    while (pool->busy > 0) pool_wait(pool, done);
+    pool->job = NULL;
+    pool_unlock(pool);
+    return;
+  }
+#endif
+  run_tasks(&job);
+}
+
+void sts_free_pool(struct sts_pool* pool)
+{
+  if (!pool) return;
+#if !defined(STS_NO_THREADS)
+  pool_lock(pool);
+  pool->stop = true;
+  pool_broadcast(pool, wake);
+  pool_unlock(pool);
+  for (size_t i = 0; i < pool->started; ++i) {
+#if defined(_MSC_VER)
+    WaitForSingleObject(pool->threads[i], INFINITE);
+    CloseHandle(pool->threads[i]);
+#else
+    pthread_join(pool->threads[i], NULL);
+#endif
+  }
+#if !defined(_MSC_VER)
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->wake);
+  pthread_mutex_destroy(&pool->lock);
+#endif
+#endif
+  STS_FREE(pool);
+}
+
+#ifdef STS_COMPILE_UNIT_TESTS
+
+#include "test/sts_test.h"
+
+struct sum_ctx {
+  size_t hits[1000];
+};
+
+static void mark_task(void* ctx, size_t task)
+{
+  struct sum_ctx* c = ctx;
+  STS_ATOMIC_ADD(&c->hits[task], (size_t)1);
+}
+
+static char* test_parallel_for()
+{
+  static struct sum_ctx ctx;
+  unsigned int threads[] = { 0, 1, 4, 200 };
+  for (size_t t = 0; t < sizeof threads / sizeof*threads; ++t) {
+    memset(&ctx, 0, sizeof ctx);
+    sts_parallel_for(threads[t], 1000, mark_task, &ctx);
+    for (size_t i = 0; i < 1000; ++i) {
+      mu_assert(ctx.hits[i] == 1, "task %" PRIuSIZE " ran %" PRIuSIZE
+                " times with %u threads", i, ctx.hits[i], threads[t]);
+    }
+  }
+  sts_parallel_for(4, 0, mark_task, &ctx);
+  return NULL;
+}
+
+static size_t once_calls = 0;
+
+static void count_once(void)
+{
+  STS_ATOMIC_ADD(&once_calls, (size_t)1);
+}
+
+static void once_task(void* ctx, size_t task)
+{
+  (void)task;
+  sts_call_once(ctx, count_once);
+}
+
+static char* test_call_once()
+{
+  static sts_once_flag flag = STS_ONCE_INIT;
+  sts_parallel_for(8, 100, once_task, &flag);
+  sts_call_once(&flag, count_once);
+  mu_assert(once_calls == 1, "called %" PRIuSIZE " times", once_calls);
+  return NULL;
+}
+
+static char* test_pool()
+{
+  static struct sum_ctx ctx;
+  unsigned int threads[] = { 0, 1, 4, 200 };
+  for (size_t t = 0; t < sizeof threads / sizeof*threads; ++t) {
+    struct sts_pool* pool = sts_new_pool(threads[t]);
+    mu_assert(pool, "sts_new_pool failed");
+    // the same helpers serve repeated calls of varying size
+    for (size_t round = 0; round < 50; ++round) {
+      size_t n_tasks = round * 37 % 1000 + 1;
+      memset(&ctx, 0, sizeof ctx);
+      sts_pool_for(pool, n_tasks, mark_task, &ctx);
+      for (size_t i = 0; i < 1000; ++i) {
+        mu_assert(ctx.hits[i] == (i < n_tasks), "task %" PRIuSIZE " ran %"
+                  PRIuSIZE " times with %u threads", i, ctx.hits[i],
+                  threads[t]);
+      }
+    }
+    sts_pool_for(pool, 0, mark_task, &ctx);
+    sts_free_pool(pool);
+  }
+  sts_free_pool(NULL);
+  return NULL;
+}
+
+static char* all_tests()
+{
+  mu_run_test(test_parallel_for);
+  mu_run_test(test_pool);
+  mu_run_test(test_call_once);
+  return NULL;
+}
+
+int main()
+{
+  char* result = all_tests();
+  if (result) {
+    printf("%s\n", result);
+  } else {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n", mu_tests_run);
+
+  return result != 0;
+}
+
+#endif // STS_COMPILE_UNIT_TESTS
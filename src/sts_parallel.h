@@ -0,0 +1,78 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Minimal threading helpers (fork-join and one-time init) */
+
+#ifndef _STS_PARALLEL_H_
+#define _STS_PARALLEL_H_
+
+#include <stddef.h>
+
+#if defined(STS_NO_THREADS)
+typedef int sts_once_flag;
+#define STS_ONCE_INIT 0
+#elif defined(_MSC_VER)
+#include <windows.h>
+typedef INIT_ONCE sts_once_flag;
+#define STS_ONCE_INIT INIT_ONCE_STATIC_INIT
+#else
+#include <pthread.h>
+typedef pthread_once_t sts_once_flag;
+#define STS_ONCE_INIT PTHREAD_ONCE_INIT
+#endif
+
+/**
+ * Runs fn exactly once per flag, concurrent callers wait for it to complete
+ * @param flag statically initialized with STS_ONCE_INIT
+ * @param fn
+ */
+void sts_call_once(sts_once_flag* flag, void (*fn)(void));
+
+typedef void (*sts_task_fn)(void* ctx, size_t task);
+
+/**
+ * Runs fn(ctx, task) for every task in [0, n_tasks) and returns once all of
+ * them completed. Tasks are claimed dynamically by the calling thread and up to
+ * n_threads - 1 helper threads; if a helper can't be started (or the build has
+ * STS_NO_THREADS) the remaining tasks simply run on the calling thread.
+ * @param n_threads maximum number of threads, including the caller
+ * @param n_tasks
+ * @param fn
+ * @param ctx
+ */
+void sts_parallel_for(unsigned int n_threads,
+                      size_t n_tasks,
+                      sts_task_fn fn,
+                      void* ctx);
+
+/* Persistent helper threads for repeated sts_parallel_for style calls */
+struct sts_pool;
+
+/**
+ * Starts up to n_threads - 1 helper threads that sleep until work arrives
+ * @param n_threads maximum number of threads, including the caller
+ * @return NULL on failure or allocated pool (possibly without helpers)
+ */
+struct sts_pool* sts_new_pool(unsigned int n_threads);
+
+/**
+ * Same as sts_parallel_for on the threads of the pool. Calls on the same pool
+ * must not overlap.
+ * @param pool
+ * @param n_tasks
+ * @param fn
+ * @param ctx
+ */
+void sts_pool_for(struct sts_pool* pool,
+                  size_t n_tasks,
+                  sts_task_fn fn,
+                  void* ctx);
+
+/**
+ * Stops the helper threads and frees the pool
+ * @param pool
+ */
+void sts_free_pool(struct sts_pool* pool);
+
+#endif
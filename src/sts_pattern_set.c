@@ -0,0 +1,386 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Symbolic time series pattern registry */
+
+#include "symtseries.h"
+#include "sts_internal.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Relative slack on the squared budgets when pruning, the final decision is
+ * taken on the distance itself so rounding can't drop a boundary match
+ */
+#define STS_BUDGET_SLACK (1 + 1e-9)
+
+static double get_compression(const struct sts_pattern_set* set)
+{
+  size_t n = set->n_values > 0 ? set->n_values : set->w;
+  return (double)n / (double)set->w;
+}
+
+static bool valid_word(const struct sts_pattern_set* set,
+                       const struct sts_word* word)
+{
+  if (!set || !word || !word->symbols) return false;
+  if (word->w != set->w || word->c != set->c) return false;
+  if (word->n_values != set->n_values && word->n_values != 0
+      && set->n_values != 0) {
+    return false;
+  }
+  for (size_t i = 0; i < word->w; ++i) {
+    if (word->symbols[i] > word->c) return false;
+  }
+  return true;
+}
+
+sts_pattern_set sts_new_pattern_set(size_t n_values,
+                                    size_t w,
+                                    unsigned char c)
+{
+  if (w == 0
+      || (n_values != 0 && n_values % w != 0)
+      || c < STS_MIN_CARDINALITY) {
+    return NULL;
+  }
+  sts_pattern_set set = STS_MALLOC(sizeof*set);
+  if (!set) return NULL;
+  memset(set, 0, sizeof*set);
+  set->n_values = n_values;
+  set->w = w;
+  set->c = c;
+  size_t lists = w * ((size_t)c + 1);
+  set->offsets = STS_MALLOC((lists + 1) * sizeof*set->offsets);
+  set->lut = STS_MALLOC(lists * sizeof*set->lut);
+  if (!set->offsets || !set->lut) {
+    sts_free_pattern_set(set);
+    return NULL;
+  }
+  memset(set->offsets, 0, (lists + 1) * sizeof*set->offsets);
+  return set;
+}
+
+/* grows every per-pattern array at once so that matching never allocates */
+static bool grow(sts_pattern_set set)
+{
+  size_t capacity = set->capacity ? set->capacity * 2 : 64;
+  size_t w = set->w;
+  sts_symbol* symbols = STS_MALLOC(capacity * w * sizeof*symbols);
+  double* thresholds = STS_MALLOC(capacity * sizeof*thresholds);
+  size_t* ids = STS_MALLOC(capacity * sizeof*ids);
+  size_t* matched = STS_MALLOC(capacity * sizeof*matched);
+  struct sts_posting* postings = STS_MALLOC(capacity * w * sizeof*postings);
+  if (!symbols || !thresholds || !ids || !matched || !postings) {
+    STS_FREE(symbols);
+    STS_FREE(thresholds);
+    STS_FREE(ids);
+    STS_FREE(matched);
+    STS_FREE(postings);
+    return false;
+  }
+  if (set->count) {
+    memcpy(symbols, set->symbols, set->count * w * sizeof*symbols);
+    memcpy(thresholds, set->thresholds, set->count * sizeof*thresholds);
+    memcpy(ids, set->ids, set->count * sizeof*ids);
+  }
+  STS_FREE(set->symbols);
+  STS_FREE(set->thresholds);
+  STS_FREE(set->ids);
+  STS_FREE(set->matched);
+  STS_FREE(set->postings);
+  set->symbols = symbols;
+  set->thresholds = thresholds;
+  set->ids = ids;
+  set->matched = matched;
+  set->postings = postings;
+  set->capacity = capacity;
+  set->dirty = true;
+  return true;
+}
+
+bool sts_pattern_set_add(sts_pattern_set set,
+                         const struct sts_word* pattern,
+                         double threshold,
+                         size_t id)
+{
+  if (!valid_word(set, pattern) || !(threshold >= 0)) return false;
+  if (set->count == set->capacity && !grow(set)) return false;
+  memcpy(set->symbols + set->count * set->w, pattern->symbols,
+         set->w * sizeof*pattern->symbols);
+  set->thresholds[set->count] = threshold;
+  set->ids[set->count] = id;
+  ++set->count;
+  set->dirty = true;
+  return true;
+}
+
+static int compare_postings(const void* a, const void* b)
+{
+  const struct sts_posting* x = a, * y = b;
+  if (x->budget != y->budget) return x->budget > y->budget ? -1 : 1;
+  return x->pattern < y->pattern ? -1 : x->pattern > y->pattern;
+}
+
+/* counting sort of the patterns into w * (c + 1) lists */
+static void rebuild_index(sts_pattern_set set)
+{
+  size_t w = set->w, row = (size_t)set->c + 1, lists = w * row;
+  size_t* offsets = set->offsets;
+  memset(offsets, 0, (lists + 1) * sizeof*offsets);
+  const sts_symbol* p = set->symbols;
+  for (size_t j = 0; j < set->count; ++j, p += w) {
+    for (size_t i = 0; i < w; ++i) {
+      ++offsets[i * row + p[i] + 1];
+    }
+  }
+  for (size_t l = 0; l < lists; ++l) {
+    offsets[l + 1] += offsets[l];
+  }
+  // offsets[l] is used as the insertion cursor of list l and restored below
+  double compression = get_compression(set);
+  p = set->symbols;
+  for (size_t j = 0; j < set->count; ++j, p += w) {
+    double budget = set->thresholds[j] * set->thresholds[j] / compression;
+    for (size_t i = 0; i < w; ++i) {
+      struct sts_posting* e = &set->postings[offsets[i * row + p[i]]++];
+      e->budget = budget;
+      e->pattern = j;
+    }
+  }
+  memmove(offsets + 1, offsets, lists * sizeof*offsets);
+  offsets[0] = 0;
+  for (size_t l = 0; l < lists; ++l) {
+    qsort(set->postings + offsets[l], offsets[l + 1] - offsets[l],
+          sizeof*set->postings, compare_postings);
+  }
+  set->dirty = false;
+}
+
+/* number of leading postings whose budget can absorb d2 */
+static size_t viable_prefix(const struct sts_posting* list,
+                            size_t len,
+                            double d2)
+{
+  size_t lo = 0, hi = len;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (list[mid].budget * STS_BUDGET_SLACK >= d2) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static int compare_indices(const void* a, const void* b)
+{
+  size_t x = *(const size_t*)a, y = *(const size_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+size_t sts_pattern_set_match(sts_pattern_set set,
+                             const struct sts_word* word,
+                             size_t* ids,
+                             size_t max_ids)
+{
+  if (!valid_word(set, word) || (!ids && max_ids) || set->count == 0) {
+    return 0;
+  }
+  if (set->dirty) rebuild_index(set);
+
+  size_t w = set->w, row = (size_t)set->c + 1;
+  const double* lut = set->lut;
+  sts_symbol_dist2_lut(word->symbols, w, set->c, set->lut);
+
+  // pick the position leaving the fewest candidates
+  size_t pivot = 0, best = SIZE_MAX;
+  for (size_t i = 0; i < w && best > 0; ++i) {
+    size_t total = 0;
+    for (size_t s = 0; s < row; ++s) {
+      size_t l = i * row + s;
+      total += viable_prefix(set->postings + set->offsets[l],
+                             set->offsets[l + 1] - set->offsets[l],
+                             lut[l]);
+    }
+    if (total < best) {
+      best = total;
+      pivot = i;
+    }
+  }
+
+  double compression = get_compression(set);
+  size_t found = 0;
+  for (size_t s = 0; s < row && best > 0; ++s) {
+    size_t l = pivot * row + s;
+    const struct sts_posting* list = set->postings + set->offsets[l];
+    size_t len = viable_prefix(list, set->offsets[l + 1] - set->offsets[l],
+                               lut[l]);
+    for (size_t e = 0; e < len; ++e) {
+      size_t j = list[e].pattern;
+      double bound = list[e].budget * STS_BUDGET_SLACK;
+      const sts_symbol* p = set->symbols + j * w;
+      double sum = 0;
+      size_t i = 0;
+      for (; i < w; ++i) {
+        sum += lut[i * row + p[i]];
+        if (sum > bound) break;
+      }
+      if (i == w && sqrt(compression * sum) <= set->thresholds[j]) {
+        set->matched[found++] = j;
+      }
+    }
+  }
+
+  qsort(set->matched, found, sizeof*set->matched, compare_indices);
+  for (size_t i = 0; i < found && i < max_ids; ++i) {
+    ids[i] = set->ids[set->matched[i]];
+  }
+  return found;
+}
+
+void sts_clear_pattern_set(sts_pattern_set set)
+{
+  if (!set) return;
+  set->count = 0;
+  set->dirty = true;
+}
+
+void sts_free_pattern_set(sts_pattern_set set)
+{
+  if (!set) return;
+  STS_FREE(set->symbols);
+  STS_FREE(set->thresholds);
+  STS_FREE(set->ids);
+  STS_FREE(set->offsets);
+  STS_FREE(set->postings);
+  STS_FREE(set->lut);
+  STS_FREE(set->matched);
+  STS_FREE(set);
+}
+
+#ifdef STS_COMPILE_UNIT_TESTS
+
+#include "test/sts_test.h"
+
+static unsigned int test_seed = 3;
+
+static unsigned int test_rand()
+{
+  test_seed = test_seed * 1103515245 + 12345;
+  return (test_seed >> 16) & 0x7fff;
+}
+
+static sts_word random_word(size_t n, size_t w, unsigned char c)
+{
+  sts_symbol* symbols = malloc(w);
+  for (size_t i = 0; i < w; ++i) {
+    unsigned int r = test_rand();
+    symbols[i] = r % 13 == 0 ? c : (sts_symbol)(r % c);
+  }
+  sts_word a = malloc(sizeof*a);
+  a->symbols = symbols;
+  a->n_values = n;
+  a->w = w;
+  a->c = c;
+  return a;
+}
+
+static char* test_pattern_set_validation()
+{
+  mu_assert(!sts_new_pattern_set(10, 3, 4), "n not divisible by w");
+  sts_pattern_set set = sts_new_pattern_set(0, 4, 4);
+  mu_assert(set, "allocation failed");
+  sts_word a = sts_from_sax_string("ABCD", 4);
+  sts_word b = sts_from_sax_string("ABC", 4);
+  size_t ids[4];
+  mu_assert(sts_pattern_set_match(set, a, ids, 4) == 0, "empty set");
+  mu_assert(!sts_pattern_set_add(set, a, -1, 0), "negative threshold");
+  mu_assert(!sts_pattern_set_add(set, a, NAN, 0), "NaN threshold");
+  mu_assert(!sts_pattern_set_add(set, b, 1, 0), "w mismatch");
+  mu_assert(sts_pattern_set_add(set, a, 0, 42), "add failed");
+  mu_assert(sts_pattern_set_match(set, b, ids, 4) == 0, "w mismatch");
+  mu_assert(sts_pattern_set_match(set, a, ids, 4) == 1 && ids[0] == 42,
+            "exact match");
+  mu_assert(sts_pattern_set_match(set, a, NULL, 0) == 1, "count only");
+  sts_clear_pattern_set(set);
+  mu_assert(sts_pattern_set_match(set, a, ids, 4) == 0, "cleared");
+  sts_free_word(a);
+  sts_free_word(b);
+  sts_free_pattern_set(set);
+  return NULL;
+}
+
+static char* test_pattern_set_match()
+{
+  const size_t n = 64, w = 8, count = 2000;
+  static size_t ids[2000], expected[2000];
+  for (unsigned c = 3; c <= STS_MAX_CARDINALITY; c += 6) {
+    sts_pattern_set set = sts_new_pattern_set(n, w, c);
+    sts_word* patterns = malloc(count * sizeof*patterns);
+    double* thresholds = malloc(count * sizeof*thresholds);
+    for (size_t j = 0; j < count; ++j) {
+      patterns[j] = random_word(j % 3 ? n : 0, w, c);
+      thresholds[j] = test_rand() / 32768.0 * 6;
+      mu_assert(sts_pattern_set_add(set, patterns[j], thresholds[j], j * 10),
+                "add failed");
+      if (j == count / 2) {
+        // matching in between additions triggers a rebuild
+        sts_word q = random_word(n, w, c);
+        sts_pattern_set_match(set, q, ids, count);
+        sts_free_word(q);
+      }
+    }
+    for (size_t q = 0; q < 50; ++q) {
+      sts_word query = random_word(n, w, c);
+      size_t n_expected = 0;
+      for (size_t j = 0; j < count; ++j) {
+        if (sts_mindist(query, patterns[j]) <= thresholds[j]) {
+          expected[n_expected++] = j * 10;
+        }
+      }
+      size_t found = sts_pattern_set_match(set, query, ids, count);
+      mu_assert(found == n_expected, "c = %u: matched %" PRIuSIZE " expected %"
+                PRIuSIZE, c, found, n_expected);
+      mu_assert(memcmp(ids, expected, n_expected * sizeof*ids) == 0,
+                "ids differ");
+      if (n_expected > 2) {
+        mu_assert(sts_pattern_set_match(set, query, ids, 2) == n_expected,
+                  "truncated output");
+        mu_assert(ids[1] == expected[1], "truncated ids differ");
+      }
+      sts_free_word(query);
+    }
+    for (size_t j = 0; j < count; ++j) sts_free_word(patterns[j]);
+    free(patterns);
+    free(thresholds);
+    sts_free_pattern_set(set);
+  }
+  return NULL;
+}
+
+static char* all_tests()
+{
+  mu_run_test(test_pattern_set_validation);
+  mu_run_test(test_pattern_set_match);
+  return NULL;
+}
+
+int main()
+{
+  char* result = all_tests();
+  if (result) {
+    printf("%s\n", result);
+  } else {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n", mu_tests_run);
+
+  return result != 0;
+}
+
+#endif // STS_COMPILE_UNIT_TESTS
@@ -0,0 +1,330 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Symbolic time series sharded window registry */
+
+#include "symtseries.h"
+#include "sts_internal.h"
+#include "sts_parallel.h"
+
+#include <string.h>
+
+#define STS_REGISTRY_MIN_SLOTS 16
+
+/* splitmix64 finalizer, the high half picks the shard, the low the slot */
+static unsigned long long hash_id(unsigned long long id)
+{
+  id ^= id >> 30;
+  id *= 0xbf58476d1ce4e5b9ULL;
+  id ^= id >> 27;
+  id *= 0x94d049bb133111ebULL;
+  id ^= id >> 31;
+  return id;
+}
+
+static size_t shard_of(const struct sts_registry* reg, unsigned long long h)
+{
+  return (size_t)((h >> 32) % reg->n_shards);
+}
+
+sts_registry sts_new_registry(size_t n_values,
+                              size_t w,
+                              unsigned char c,
+                              size_t n_shards,
+                              unsigned int n_threads)
+{
+  if (w == 0 || n_values == 0 || n_values % w != 0 || n_shards == 0
+      || c < STS_MIN_CARDINALITY) {
+    return NULL;
+  }
+  sts_registry reg = STS_MALLOC(sizeof*reg);
+  if (!reg) return NULL;
+  memset(reg, 0, sizeof*reg);
+  reg->n_values = n_values;
+  reg->w = w;
+  reg->c = c;
+  reg->n_shards = n_shards;
+  reg->shards = STS_MALLOC(n_shards * sizeof*reg->shards);
+  if (reg->shards) memset(reg->shards, 0, n_shards * sizeof*reg->shards);
+  reg->shard_start = STS_MALLOC((n_shards + 1) * sizeof*reg->shard_start);
+  reg->pool = sts_new_pool(n_threads);
+  if (!reg->shards || !reg->shard_start || !reg->pool) {
+    sts_free_registry(reg);
+    return NULL;
+  }
+  return reg;
+}
+
+static bool grow_shard(struct sts_registry_shard* shard)
+{
+  size_t capacity = shard->windows ? (shard->mask + 1) * 2
+    : STS_REGISTRY_MIN_SLOTS;
+  unsigned long long* ids = STS_MALLOC(capacity * sizeof*ids);
+  sts_window* windows = STS_MALLOC(capacity * sizeof*windows);
+  if (!ids || !windows) {
+    STS_FREE(ids);
+    STS_FREE(windows);
+    return false;
+  }
+  memset(windows, 0, capacity * sizeof*windows);
+  size_t mask = capacity - 1;
+  for (size_t i = 0; shard->windows && i <= shard->mask; ++i) {
+    if (!shard->windows[i]) continue;
+    size_t slot = (size_t)hash_id(shard->ids[i]) & mask;
+    while (windows[slot]) slot = (slot + 1) & mask;
+    ids[slot] = shard->ids[i];
+    windows[slot] = shard->windows[i];
+  }
+  STS_FREE(shard->ids);
+  STS_FREE(shard->windows);
+  shard->ids = ids;
+  shard->windows = windows;
+  shard->mask = mask;
+  return true;
+}
+
+static sts_window shard_window(const struct sts_registry* reg,
+                               struct sts_registry_shard* shard,
+                               unsigned long long id,
+                               unsigned long long h,
+                               bool create)
+{
+  if (shard->windows) {
+    for (size_t slot = (size_t)h & shard->mask; shard->windows[slot];
+         slot = (slot + 1) & shard->mask) {
+      if (shard->ids[slot] == id) return shard->windows[slot];
+    }
+  }
+  if (!create) return NULL;
+  // keep the load factor under 3/4
+  if ((!shard->windows || (shard->count + 1) * 4 > (shard->mask + 1) * 3)
+      && !grow_shard(shard)) {
+    return NULL;
+  }
+  sts_window window = sts_new_window(reg->n_values, reg->w, reg->c);
+  if (!window) return NULL;
+  size_t slot = (size_t)h & shard->mask;
+  while (shard->windows[slot]) slot = (slot + 1) & shard->mask;
+  shard->ids[slot] = id;
+  shard->windows[slot] = window;
+  ++shard->count;
+  return window;
+}
+
+sts_window sts_registry_window(sts_registry registry,
+                               unsigned long long id,
+                               bool create)
+{
+  if (!registry) return NULL;
+  unsigned long long h = hash_id(id);
+  return shard_window(registry, &registry->shards[shard_of(registry, h)], id,
+                      h, create);
+}
+
+struct append_job {
+  sts_registry reg;
+  const unsigned long long* ids;
+  const double* values;
+};
+
+static void append_shard(void* ctx, size_t task)
+{
+  struct append_job* job = ctx;
+  sts_registry reg = job->reg;
+  struct sts_registry_shard* shard = &reg->shards[task];
+  size_t applied = 0;
+  for (size_t i = reg->shard_start[task]; i < reg->shard_start[task + 1];
+       ++i) {
+    size_t pos = reg->order[i];
+    unsigned long long id = job->ids[pos];
+    sts_window window = shard_window(reg, shard, id, hash_id(id), true);
+    if (window) {
+      sts_append_value(window, job->values[pos]);
+      ++applied;
+    }
+  }
+  shard->applied = applied;
+}
+
+size_t sts_registry_append(sts_registry registry,
+                           const unsigned long long* ids,
+                           const double* values,
+                           size_t count)
+{
+  if (!registry || !ids || !values || count == 0) return 0;
+  sts_registry reg = registry;
+  if (count > reg->capacity) {
+    size_t* order = STS_MALLOC(count * sizeof*order);
+    if (!order) return 0;
+    STS_FREE(reg->order);
+    reg->order = order;
+    reg->capacity = count;
+  }
+  // stable counting sort by shard so every series keeps its order
+  size_t* start = reg->shard_start;
+  memset(start, 0, (reg->n_shards + 1) * sizeof*start);
+  for (size_t i = 0; i < count; ++i) {
+    ++start[shard_of(reg, hash_id(ids[i])) + 1];
+  }
+  for (size_t s = 0; s < reg->n_shards; ++s) start[s + 1] += start[s];
+  for (size_t i = 0; i < count; ++i) {
+    reg->order[start[shard_of(reg, hash_id(ids[i]))]++] = i;
+  }
+  // the scatter advanced every start to the next shard's boundary
+  memmove(start + 1, start, reg->n_shards * sizeof*start);
+  start[0] = 0;
+
+  struct append_job job = { reg, ids, values };
+  sts_pool_for(reg->pool, reg->n_shards, append_shard, &job);
+  size_t applied = 0;
+  for (size_t s = 0; s < reg->n_shards; ++s) applied += reg->shards[s].applied;
+  return applied;
+}
+
+size_t sts_registry_size(const struct sts_registry* registry)
+{
+  if (!registry) return 0;
+  size_t size = 0;
+  for (size_t s = 0; s < registry->n_shards; ++s) {
+    size += registry->shards[s].count;
+  }
+  return size;
+}
+
+void sts_free_registry(sts_registry registry)
+{
+  if (!registry) return;
+  for (size_t s = 0; registry->shards && s < registry->n_shards; ++s) {
+    struct sts_registry_shard* shard = &registry->shards[s];
+    for (size_t i = 0; shard->windows && i <= shard->mask; ++i) {
+      sts_free_window(shard->windows[i]);
+    }
+    STS_FREE(shard->ids);
+    STS_FREE(shard->windows);
+  }
+  STS_FREE(registry->shards);
+  STS_FREE(registry->order);
+  STS_FREE(registry->shard_start);
+  sts_free_pool(registry->pool);
+  STS_FREE(registry);
+}
+
+#ifdef STS_COMPILE_UNIT_TESTS
+
+#include "test/sts_test.h"
+
+#include <math.h>
+
+static char* test_registry_validation()
+{
+  mu_assert(!sts_new_registry(10, 3, 4, 4, 1), "n not divisible by w");
+  mu_assert(!sts_new_registry(12, 0, 4, 4, 1), "w = 0");
+  mu_assert(!sts_new_registry(12, 3, 1, 4, 1), "c too small");
+  mu_assert(!sts_new_registry(12, 3, 4, 0, 1), "no shards");
+  sts_registry reg = sts_new_registry(12, 3, 4, 4, 2);
+  mu_assert(reg, "sts_new_registry failed");
+  mu_assert(!sts_registry_window(reg, 42, false), "unknown id");
+  sts_window win = sts_registry_window(reg, 42, true);
+  mu_assert(win && win->current_word.w == 3, "window not created");
+  mu_assert(sts_registry_window(reg, 42, false) == win, "lookup");
+  mu_assert(sts_registry_window(reg, 42, true) == win, "created twice");
+  mu_assert(sts_registry_size(reg) == 1, "size");
+  unsigned long long id = 42;
+  double v = 1;
+  mu_assert(sts_registry_append(reg, &id, &v, 0) == 0, "empty batch");
+  mu_assert(sts_registry_append(reg, &id, &v, 1) == 1, "single value");
+  mu_assert(sts_window_value(win, 11) == 1, "value not appended");
+  sts_free_registry(reg);
+  sts_free_registry(NULL);
+  return NULL;
+}
+
+static char* test_registry_growth()
+{
+  // a single shard has to rehash many times
+  sts_registry reg = sts_new_registry(4, 2, 4, 1, 1);
+  for (unsigned long long id = 0; id < 5000; ++id) {
+    mu_assert(sts_registry_window(reg, id * 7919, true), "id %llu", id);
+  }
+  mu_assert(sts_registry_size(reg) == 5000, "size %" PRIuSIZE,
+            sts_registry_size(reg));
+  for (unsigned long long id = 0; id < 5000; ++id) {
+    mu_assert(sts_registry_window(reg, id * 7919, false), "lost %llu", id);
+    mu_assert(!sts_registry_window(reg, id * 7919 + 1, false), "phantom");
+  }
+  sts_free_registry(reg);
+  return NULL;
+}
+
+#define REG_SERIES 300
+#define REG_VALUES 50000
+
+static char* test_registry_batches()
+{
+  // batches applied by the pool match appending series by series
+  static unsigned long long ids[REG_VALUES];
+  static size_t series[REG_VALUES];
+  static double values[REG_VALUES];
+  unsigned int seed = 11;
+  for (size_t i = 0; i < REG_VALUES; ++i) {
+    seed = seed * 1103515245 + 12345;
+    series[i] = (seed >> 8) % REG_SERIES;
+    ids[i] = series[i] * 0x9e3779b97f4a7c15ULL;
+    values[i] = i % 97 == 0 ? NAN : (double)((seed >> 4) % 1000) + i * 0.01;
+  }
+  unsigned int threads[] = { 1, 4 };
+  for (size_t t = 0; t < sizeof threads / sizeof*threads; ++t) {
+    sts_registry reg = sts_new_registry(16, 4, 6, 13, threads[t]);
+    sts_window ref[REG_SERIES];
+    for (size_t s = 0; s < REG_SERIES; ++s) ref[s] = sts_new_window(16, 4, 6);
+    size_t pos = 0;
+    for (size_t batch = 1; pos < REG_VALUES; batch = batch * 7 % 4093 + 1) {
+      size_t count = pos + batch > REG_VALUES ? REG_VALUES - pos : batch;
+      mu_assert(sts_registry_append(reg, ids + pos, values + pos, count)
+                == count, "batch at %" PRIuSIZE, pos);
+      for (size_t i = pos; i < pos + count; ++i) {
+        sts_append_value(ref[series[i]], values[i]);
+      }
+      pos += count;
+    }
+    mu_assert(sts_registry_size(reg) == REG_SERIES, "size");
+    for (size_t s = 0; s < REG_SERIES; ++s) {
+      sts_window win =
+        sts_registry_window(reg, s * 0x9e3779b97f4a7c15ULL, false);
+      mu_assert(win, "series %" PRIuSIZE " missing", s);
+      mu_assert(sts_words_equal(&win->current_word, &ref[s]->current_word),
+                "series %" PRIuSIZE " with %u threads", s, threads[t]);
+      for (size_t i = 0; i < 16; ++i) {
+        double a = sts_window_value(win, i), b = sts_window_value(ref[s], i);
+        mu_assert(a == b || (isnan(a) && isnan(b)), "series %" PRIuSIZE, s);
+      }
+      sts_free_window(ref[s]);
+    }
+    sts_free_registry(reg);
+  }
+  return NULL;
+}
+
+static char* all_tests()
+{
+  mu_run_test(test_registry_validation);
+  mu_run_test(test_registry_growth);
+  mu_run_test(test_registry_batches);
+  return NULL;
+}
+
+int main()
+{
+  char* result = all_tests();
+  if (result) {
+    printf("%s\n", result);
+  } else {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n", mu_tests_run);
+
+  return result != 0;
+}
+
+#endif // STS_COMPILE_UNIT_TESTS
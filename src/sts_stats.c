@@ -0,0 +1,241 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Symbolic time series hot path counters */
+
+#if !defined(_MSC_VER) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "symtseries.h"
+#include "sts_internal.h"
+
+#include <limits.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define STS_HISTOGRAM_SUB_BITS 3
+#define STS_HISTOGRAM_SUB (1 << STS_HISTOGRAM_SUB_BITS)
+
+/*
+ * Values below STS_HISTOGRAM_SUB get a bucket each, above that every power of
+ * two is split into STS_HISTOGRAM_SUB linear sub-buckets (~12% resolution)
+ */
+static size_t histogram_bucket(unsigned long long ns)
+{
+  if (ns < STS_HISTOGRAM_SUB) return (size_t)ns;
+  int msb = 0;
+  for (unsigned long long v = ns; v > 1; v >>= 1) ++msb;
+  size_t sub = (size_t)(ns >> (msb - STS_HISTOGRAM_SUB_BITS))
+    & (STS_HISTOGRAM_SUB - 1);
+  size_t bucket = (size_t)(msb - STS_HISTOGRAM_SUB_BITS + 1) * STS_HISTOGRAM_SUB
+    + sub;
+  return bucket < STS_HISTOGRAM_BUCKETS ? bucket : STS_HISTOGRAM_BUCKETS - 1;
+}
+
+unsigned long long sts_histogram_bucket_ns(size_t bucket)
+{
+  if (bucket < STS_HISTOGRAM_SUB) return bucket;
+  size_t shift = bucket / STS_HISTOGRAM_SUB - 1;
+  return (unsigned long long)(STS_HISTOGRAM_SUB + bucket % STS_HISTOGRAM_SUB)
+    << shift;
+}
+
+double sts_histogram_quantile(const struct sts_histogram* h, double q)
+{
+  if (!h || h->count == 0) return 0;
+  if (q < 0) q = 0;
+  if (q > 1) q = 1;
+  unsigned long long rank = (unsigned long long)(q * (h->count - 1)) + 1;
+  unsigned long long seen = 0;
+  for (size_t i = 0; i < STS_HISTOGRAM_BUCKETS; ++i) {
+    seen += h->buckets[i];
+    if (seen >= rank) {
+      double upper = i + 1 < STS_HISTOGRAM_BUCKETS
+        ? (double)sts_histogram_bucket_ns(i + 1) : (double)h->max_ns;
+      return upper < (double)h->max_ns ? upper : (double)h->max_ns;
+    }
+  }
+  return (double)h->max_ns;
+}
+
+void sts_histogram_record(struct sts_histogram* h, unsigned long long ns)
+{
+  STS_ATOMIC_ADD(&h->buckets[histogram_bucket(ns)], 1ULL);
+  STS_ATOMIC_ADD(&h->total_ns, ns);
+  unsigned long long cur = STS_ATOMIC_LOAD(&h->max_ns);
+  while (ns > cur && !STS_ATOMIC_CAS(&h->max_ns, &cur, ns)) {
+    cur = STS_ATOMIC_LOAD(&h->max_ns);
+  }
+  // counted last: a reader seeing this record in count also sees its min_ns
+  // or a lower one
+  cur = STS_ATOMIC_LOAD(&h->min_ns);
+  while (ns < cur && !STS_ATOMIC_CAS(&h->min_ns, &cur, ns)) {
+    cur = STS_ATOMIC_LOAD(&h->min_ns);
+  }
+  STS_ATOMIC_ADD(&h->count, 1ULL);
+}
+
+#ifdef STS_ENABLE_STATS
+
+struct sts_stats sts_global_stats = {
+  .append_latency.min_ns = ULLONG_MAX,
+  .mindist_latency.min_ns = ULLONG_MAX
+};
+
+unsigned long long sts_now_ns(void)
+{
+#ifdef _MSC_VER
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER cnt;
+  if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&cnt);
+  return (unsigned long long)(cnt.QuadPart * 1000000000.0 / freq.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL
+    + (unsigned long long)ts.tv_nsec;
+#endif
+}
+
+void* sts_counted_malloc(size_t size)
+{
+  STS_STAT_ADD(allocations, 1);
+  return malloc(size);
+}
+
+static void copy_histogram(struct sts_histogram* dst,
+                           struct sts_histogram* src)
+{
+  dst->count = STS_ATOMIC_LOAD(&src->count);
+  dst->total_ns = STS_ATOMIC_LOAD(&src->total_ns);
+  dst->min_ns = dst->count ? STS_ATOMIC_LOAD(&src->min_ns) : 0;
+  dst->max_ns = STS_ATOMIC_LOAD(&src->max_ns);
+  for (size_t i = 0; i < STS_HISTOGRAM_BUCKETS; ++i) {
+    dst->buckets[i] = STS_ATOMIC_LOAD(&src->buckets[i]);
+  }
+}
+
+void sts_get_stats(struct sts_stats* out)
+{
+  if (!out) return;
+  struct sts_stats* g = &sts_global_stats;
+  out->enabled = true;
+  out->appends = STS_ATOMIC_LOAD(&g->appends);
+  out->word_recomputes = STS_ATOMIC_LOAD(&g->word_recomputes);
+  out->nan_inputs = STS_ATOMIC_LOAD(&g->nan_inputs);
+  out->inf_inputs = STS_ATOMIC_LOAD(&g->inf_inputs);
+  out->nan_frames = STS_ATOMIC_LOAD(&g->nan_frames);
+  out->mindist_calls = STS_ATOMIC_LOAD(&g->mindist_calls);
+  out->allocations = STS_ATOMIC_LOAD(&g->allocations);
+  copy_histogram(&out->append_latency, &g->append_latency);
+  copy_histogram(&out->mindist_latency, &g->mindist_latency);
+}
+
+void sts_reset_stats(void)
+{
+  memset(&sts_global_stats, 0, sizeof sts_global_stats);
+  sts_global_stats.enabled = true;
+  sts_global_stats.append_latency.min_ns = ULLONG_MAX;
+  sts_global_stats.mindist_latency.min_ns = ULLONG_MAX;
+}
+
+#else
+
+void sts_get_stats(struct sts_stats* out)
+{
+  if (!out) return;
+  memset(out, 0, sizeof*out);
+  out->enabled = false;
+}
+
+void sts_reset_stats(void)
+{
+}
+
+#endif // STS_ENABLE_STATS
+
+#ifdef STS_COMPILE_UNIT_TESTS
+
+#include "test/sts_test.h"
+
+static char* test_histogram_buckets()
+{
+  for (unsigned long long ns = 0; ns < (1ULL << 20); ns += 1 + ns / 64) {
+    size_t b = histogram_bucket(ns);
+    mu_assert(sts_histogram_bucket_ns(b) <= ns
+              && ns < sts_histogram_bucket_ns(b + 1),
+              "%llu ns landed in bucket %u", ns, (unsigned)b);
+  }
+  mu_assert(histogram_bucket(~0ULL) == STS_HISTOGRAM_BUCKETS - 1,
+            "overflow bucket");
+  return NULL;
+}
+
+static char* test_histogram_quantile()
+{
+  static struct sts_histogram h;
+  mu_assert(sts_histogram_quantile(&h, 0.5) == 0, "empty histogram");
+  for (unsigned long long ns = 1; ns <= 1000; ++ns) {
+    ++h.buckets[histogram_bucket(ns)];
+    ++h.count;
+    h.max_ns = ns;
+  }
+  double p50 = sts_histogram_quantile(&h, 0.5);
+  mu_assert(p50 >= 500 && p50 <= 500 * 1.125, "p50 %f", p50);
+  mu_assert(sts_histogram_quantile(&h, 1) == 1000, "p100");
+  return NULL;
+}
+
+static char* test_get_stats()
+{
+  struct sts_stats s;
+  sts_reset_stats();
+  sts_get_stats(&s);
+#ifdef STS_ENABLE_STATS
+  mu_assert(s.enabled, "stats should be enabled");
+  mu_assert(s.append_latency.count == 0 && s.append_latency.min_ns == 0,
+            "empty histogram");
+  STS_STAT_ADD(appends, 3);
+  sts_histogram_record(&sts_global_stats.append_latency, 42);
+  sts_histogram_record(&sts_global_stats.append_latency, 7);
+  sts_get_stats(&s);
+  mu_assert(s.appends == 3, "appends %llu", s.appends);
+  mu_assert(s.append_latency.count == 2
+            && s.append_latency.min_ns == 7
+            && s.append_latency.max_ns == 42, "latency histogram");
+#else
+  mu_assert(!s.enabled && s.appends == 0, "stats should be disabled");
+#endif
+  return NULL;
+}
+
+static char* all_tests()
+{
+  mu_run_test(test_histogram_buckets);
+  mu_run_test(test_histogram_quantile);
+  mu_run_test(test_get_stats);
+  return NULL;
+}
+
+int main()
+{
+  char* result = all_tests();
+  if (result) {
+    printf("%s\n", result);
+  } else {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n", mu_tests_run);
+
+  return result != 0;
+}
+
+#endif // STS_COMPILE_UNIT_TESTS
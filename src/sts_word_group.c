@@ -0,0 +1,322 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Symbolic time series radix sort and grouping of word sets */
+
+#include "symtseries.h"
+#include "sts_internal.h"
+#include "sts_parallel.h"
+
+#include <limits.h>
+#include <string.h>
+
+#define STS_SORT_BUCKETS 256
+/* below this many words per thread the partitioned passes aren't worth it */
+#define STS_SORT_MIN_PARTITION 65536
+#define STS_SORT_MAX_BLOCKS 64
+
+/*
+ * Words are packed chunk by chunk into 64-bit keys holding as many base c + 1
+ * digits as fit, position 0 being the most significant. The chunks are sorted
+ * from last to first with a stable LSD radix sort on the key bytes, so the
+ * final order is lexicographic on the whole word.
+ */
+struct sort_state {
+  const struct sts_word_set* set;
+  size_t per_key; // symbols per key
+  size_t chunk; // first position of the chunk being sorted
+  size_t len; // symbols in that chunk
+  unsigned int shift; // byte of the key being sorted
+  size_t n_blocks, block_size;
+  unsigned long long* keys, * keys_tmp;
+  size_t* perm, * perm_tmp;
+  size_t (*hist)[STS_SORT_BUCKETS]; // one row per block
+};
+
+static void pack_task(void* ctx, size_t task)
+{
+  struct sort_state* st = ctx;
+  const struct sts_word_set* set = st->set;
+  size_t begin = task * st->block_size, end = begin + st->block_size;
+  if (end > set->count) end = set->count;
+  unsigned long long base = set->c + 1;
+  for (size_t i = begin; i < end; ++i) {
+    const sts_symbol* s = set->symbols + st->perm[i] * set->w + st->chunk;
+    unsigned long long key = 0;
+    for (size_t j = 0; j < st->len; ++j) key = key * base + s[j];
+    st->keys[i] = key;
+  }
+}
+
+static void histogram_task(void* ctx, size_t task)
+{
+  struct sort_state* st = ctx;
+  size_t begin = task * st->block_size, end = begin + st->block_size;
+  if (end > st->set->count) end = st->set->count;
+  size_t* hist = st->hist[task];
+  memset(hist, 0, STS_SORT_BUCKETS * sizeof*hist);
+  for (size_t i = begin; i < end; ++i) {
+    ++hist[(st->keys[i] >> st->shift) & (STS_SORT_BUCKETS - 1)];
+  }
+}
+
+/* hist holds the output offsets of each (block, digit) by then */
+static void scatter_task(void* ctx, size_t task)
+{
+  struct sort_state* st = ctx;
+  size_t begin = task * st->block_size, end = begin + st->block_size;
+  if (end > st->set->count) end = st->set->count;
+  size_t* offset = st->hist[task];
+  for (size_t i = begin; i < end; ++i) {
+    size_t pos = offset[(st->keys[i] >> st->shift) & (STS_SORT_BUCKETS - 1)]++;
+    st->keys_tmp[pos] = st->keys[i];
+    st->perm_tmp[pos] = st->perm[i];
+  }
+}
+
+/* Stable sort of (keys, perm) on one key byte, false if the pass is a no-op */
+static bool radix_pass(struct sort_state* st, unsigned int n_threads)
+{
+  sts_parallel_for(n_threads, st->n_blocks, histogram_task, st);
+  size_t sum = 0;
+  for (size_t d = 0; d < STS_SORT_BUCKETS; ++d) {
+    size_t total = 0;
+    for (size_t b = 0; b < st->n_blocks; ++b) total += st->hist[b][d];
+    if (total == st->set->count) return false; // every key has this digit
+    for (size_t b = 0; b < st->n_blocks; ++b) {
+      size_t cnt = st->hist[b][d];
+      st->hist[b][d] = sum;
+      sum += cnt;
+    }
+  }
+  sts_parallel_for(n_threads, st->n_blocks, scatter_task, st);
+  unsigned long long* keys = st->keys;
+  st->keys = st->keys_tmp;
+  st->keys_tmp = keys;
+  size_t* perm = st->perm;
+  st->perm = st->perm_tmp;
+  st->perm_tmp = perm;
+  return true;
+}
+
+size_t sts_word_set_group(const struct sts_word_set* set,
+                          size_t* perm,
+                          size_t* starts,
+                          unsigned int n_threads)
+{
+  if (!set || !perm || set->count == 0) return 0;
+  size_t count = set->count, w = set->w;
+  struct sort_state st;
+  memset(&st, 0, sizeof st);
+  st.set = set;
+  unsigned long long base = set->c + 1;
+  st.per_key = 1;
+  for (unsigned long long p = base; p <= ULLONG_MAX / base; p *= base) {
+    ++st.per_key;
+  }
+
+  if (n_threads < 1) n_threads = 1;
+  st.n_blocks = count / STS_SORT_MIN_PARTITION;
+  if (st.n_blocks > n_threads) st.n_blocks = n_threads;
+  if (st.n_blocks > STS_SORT_MAX_BLOCKS) st.n_blocks = STS_SORT_MAX_BLOCKS;
+  if (st.n_blocks < 1) st.n_blocks = 1;
+  st.block_size = (count + st.n_blocks - 1) / st.n_blocks;
+
+  st.keys = STS_MALLOC(count * sizeof*st.keys);
+  st.keys_tmp = STS_MALLOC(count * sizeof*st.keys_tmp);
+  st.perm_tmp = STS_MALLOC(count * sizeof*st.perm_tmp);
+  st.hist = STS_MALLOC(st.n_blocks * sizeof*st.hist);
+  if (!st.keys || !st.keys_tmp || !st.perm_tmp || !st.hist) {
+    STS_FREE(st.keys);
+    STS_FREE(st.keys_tmp);
+    STS_FREE(st.perm_tmp);
+    STS_FREE(st.hist);
+    return 0;
+  }
+  st.perm = perm;
+  for (size_t i = 0; i < count; ++i) perm[i] = i;
+
+  size_t n_chunks = (w + st.per_key - 1) / st.per_key;
+  for (size_t chunk = n_chunks; chunk-- > 0; ) {
+    st.chunk = chunk * st.per_key;
+    st.len = w - st.chunk < st.per_key ? w - st.chunk : st.per_key;
+    sts_parallel_for(n_threads, st.n_blocks, pack_task, &st);
+    // only the bytes the largest possible key spans
+    unsigned long long max_key = 1;
+    for (size_t j = 0; j < st.len; ++j) max_key *= base;
+    --max_key;
+    for (st.shift = 0; st.shift < 64 && (max_key >> st.shift) != 0;
+         st.shift += 8) {
+      radix_pass(&st, n_threads);
+    }
+  }
+  if (st.perm != perm) memcpy(perm, st.perm, count * sizeof*perm);
+
+  // the keys of the first chunk are in perm order now
+  size_t groups = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (i > 0 && st.keys[i] == st.keys[i - 1]
+        && (n_chunks == 1
+            || memcmp(set->symbols + perm[i] * w + st.per_key,
+                      set->symbols + perm[i - 1] * w + st.per_key,
+                      (w - st.per_key) * sizeof*set->symbols) == 0)) {
+      continue;
+    }
+    if (starts) starts[groups] = i;
+    ++groups;
+  }
+  if (starts) starts[groups] = count;
+
+  STS_FREE(st.perm == perm ? st.perm_tmp : st.perm);
+  STS_FREE(st.keys);
+  STS_FREE(st.keys_tmp);
+  STS_FREE(st.hist);
+  return groups;
+}
+
+#ifdef STS_COMPILE_UNIT_TESTS
+
+#include "test/sts_test.h"
+
+static const struct sts_word_set* cmp_set;
+
+/* reference order: lexicographic on the symbols, ties by index */
+static int compare_words(const void* a, const void* b)
+{
+  size_t ia = *(const size_t*)a, ib = *(const size_t*)b;
+  int r = memcmp(cmp_set->symbols + ia * cmp_set->w,
+                 cmp_set->symbols + ib * cmp_set->w, cmp_set->w);
+  return r ? r : (ia > ib) - (ia < ib);
+}
+
+static sts_word_set random_set(size_t count, size_t w, unsigned char c,
+                               unsigned int distinct, unsigned int seed)
+{
+  sts_word_set set = sts_new_word_set(0, w, c);
+  sts_symbol* word = malloc(w);
+  struct sts_word tmp = { word, 0, w, c };
+  for (size_t i = 0; i < count; ++i) {
+    unsigned int shape = (seed = seed * 1103515245 + 12345) >> 8;
+    shape %= distinct;
+    for (size_t j = 0; j < w; ++j) {
+      shape = shape * 2654435761u + (unsigned int)j;
+      word[j] = (sts_symbol)((shape >> 16) % (c + 1));
+    }
+    sts_word_set_add(set, &tmp);
+  }
+  free(word);
+  return set;
+}
+
+static char* check_grouping(const struct sts_word_set* set,
+                            unsigned int n_threads)
+{
+  size_t count = set->count;
+  size_t* perm = malloc(count * sizeof*perm);
+  size_t* starts = malloc((count + 1) * sizeof*starts);
+  size_t* expected = malloc(count * sizeof*expected);
+  for (size_t i = 0; i < count; ++i) expected[i] = i;
+  cmp_set = set;
+  qsort(expected, count, sizeof*expected, compare_words);
+  size_t groups = sts_word_set_group(set, perm, starts, n_threads);
+  mu_assert(memcmp(perm, expected, count * sizeof*perm) == 0,
+            "w = %" PRIuSIZE " c = %u: order differs", set->w, set->c);
+  size_t n_expected = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (i > 0 && memcmp(set->symbols + expected[i] * set->w,
+                        set->symbols + expected[i - 1] * set->w,
+                        set->w) == 0) {
+      continue;
+    }
+    mu_assert(starts[n_expected] == i, "group %" PRIuSIZE " starts at %"
+              PRIuSIZE, n_expected, starts[n_expected]);
+    ++n_expected;
+  }
+  mu_assert(groups == n_expected && starts[groups] == count,
+            "%" PRIuSIZE " groups, expected %" PRIuSIZE, groups, n_expected);
+  mu_assert(sts_word_set_group(set, perm, NULL, n_threads) == groups,
+            "grouping without starts");
+  free(perm);
+  free(starts);
+  free(expected);
+  return NULL;
+}
+
+static char* test_group_small()
+{
+  sts_word_set set = sts_new_word_set(0, 3, 4);
+  size_t perm[4], starts[5];
+  mu_assert(sts_word_set_group(set, perm, starts, 1) == 0, "empty set");
+  mu_assert(sts_word_set_group(NULL, perm, starts, 1) == 0, "NULL set");
+  const char* words[] = { "DA#", "ABC", "DA#", "ABC" };
+  for (size_t i = 0; i < 4; ++i) {
+    sts_word word = sts_from_sax_string(words[i], 4);
+    sts_word_set_add(set, word);
+    sts_free_word(word);
+  }
+  mu_assert(sts_word_set_group(set, perm, starts, 1) == 2, "groups");
+  // 'D' is symbol 0, groups keep the insertion order
+  mu_assert(perm[0] == 0 && perm[1] == 2 && perm[2] == 1 && perm[3] == 3,
+            "perm %" PRIuSIZE " %" PRIuSIZE " %" PRIuSIZE " %" PRIuSIZE,
+            perm[0], perm[1], perm[2], perm[3]);
+  mu_assert(starts[0] == 0 && starts[1] == 2 && starts[2] == 4, "starts");
+  sts_free_word_set(set);
+  return NULL;
+}
+
+static char* test_group_random()
+{
+  // single and multi-key words, with and without repeated shapes
+  size_t lengths[] = { 1, 7, 16, 27, 40 };
+  unsigned char cards[] = { 2, 4, 9, 16 };
+  for (size_t l = 0; l < sizeof lengths / sizeof*lengths; ++l) {
+    for (size_t k = 0; k < sizeof cards / sizeof*cards; ++k) {
+      sts_word_set set = random_set(3000, lengths[l], cards[k], 200,
+                                    (unsigned int)(l * 31 + k));
+      char* msg = check_grouping(set, 1);
+      sts_free_word_set(set);
+      if (msg) return msg;
+      set = random_set(3000, lengths[l], cards[k], 1u << 30,
+                       (unsigned int)(l * 17 + k));
+      msg = check_grouping(set, 1);
+      sts_free_word_set(set);
+      if (msg) return msg;
+    }
+  }
+  return NULL;
+}
+
+static char* test_group_parallel()
+{
+  // enough words for several partitions
+  sts_word_set set = random_set(4 * STS_SORT_MIN_PARTITION + 123, 20, 8,
+                                5000, 7);
+  char* msg = check_grouping(set, 4);
+  if (!msg) msg = check_grouping(set, 1);
+  sts_free_word_set(set);
+  return msg;
+}
+
+static char* all_tests()
+{
+  mu_run_test(test_group_small);
+  mu_run_test(test_group_random);
+  mu_run_test(test_group_parallel);
+  return NULL;
+}
+
+int main()
+{
+  char* result = all_tests();
+  if (result) {
+    printf("%s\n", result);
+  } else {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n", mu_tests_run);
+
+  return result != 0;
+}
+
+#endif // STS_COMPILE_UNIT_TESTS
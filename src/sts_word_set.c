@@ -0,0 +1,552 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Symbolic time series word set and nearest-word queries */
+
+#include "symtseries.h"
+#include "sts_internal.h"
+#include "sts_parallel.h"
+
+#include <math.h>
+#include <string.h>
+
+/* below this many words per thread the partitioned scan isn't worth it */
+#define STS_TOPK_MIN_PARTITION 4096
+
+struct candidate {
+  double sum; // squared distance before the n / w scaling
+  size_t index;
+};
+
+static bool candidate_less(const struct candidate* a,
+                           const struct candidate* b)
+{
+  return a->sum < b->sum || (a->sum == b->sum && a->index < b->index);
+}
+
+/* max-heap on (sum, index), heap[0] is the current k-th best */
+static void sift_down(struct candidate* heap, size_t size, size_t i)
+{
+  for (;;) {
+    size_t largest = i, l = 2 * i + 1, r = l + 1;
+    if (l < size && candidate_less(&heap[largest], &heap[l])) largest = l;
+    if (r < size && candidate_less(&heap[largest], &heap[r])) largest = r;
+    if (largest == i) return;
+    struct candidate tmp = heap[i];
+    heap[i] = heap[largest];
+    heap[largest] = tmp;
+    i = largest;
+  }
+}
+
+static void sift_up(struct candidate* heap, size_t i)
+{
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
+    if (!candidate_less(&heap[parent], &heap[i])) return;
+    struct candidate tmp = heap[i];
+    heap[i] = heap[parent];
+    heap[parent] = tmp;
+    i = parent;
+  }
+}
+
+/*
+ * Scans words [begin, end) keeping the k best in heap, returns the heap size.
+ * Words are visited in index order so a candidate only enters a full heap with
+ * a strictly smaller sum, which is also the early-abandon bound.
+ */
+static size_t scan_topk(const struct sts_word_set* set,
+                        const double* lut,
+                        size_t begin,
+                        size_t end,
+                        size_t k,
+                        struct candidate* heap)
+{
+  size_t w = set->w, row = (size_t)set->c + 1, size = 0;
+  const sts_symbol* word = set->symbols + begin * w;
+  for (size_t j = begin; j < end; ++j, word += w) {
+    double bound = size == k ? heap[0].sum : INFINITY;
+    double sum = 0;
+    const double* l = lut;
+    size_t i = 0;
+    for (; i < w; ++i, l += row) {
+      sum += l[word[i]];
+      if (sum >= bound) break;
+    }
+    if (i < w) continue;
+    if (size < k) {
+      heap[size].sum = sum;
+      heap[size].index = j;
+      sift_up(heap, size++);
+    } else {
+      heap[0].sum = sum;
+      heap[0].index = j;
+      sift_down(heap, size, 0);
+    }
+  }
+  return size;
+}
+
+static int compare_candidates(const void* a, const void* b)
+{
+  if (candidate_less(a, b)) return -1;
+  return candidate_less(b, a) ? 1 : 0;
+}
+
+static size_t write_neighbors(struct candidate* found,
+                              size_t size,
+                              size_t k,
+                              double compression,
+                              struct sts_neighbor* out)
+{
+  qsort(found, size, sizeof*found, compare_candidates);
+  if (size > k) size = k;
+  for (size_t i = 0; i < size; ++i) {
+    out[i].index = found[i].index;
+    out[i].distance = sqrt(compression * found[i].sum);
+  }
+  return size;
+}
+
+static bool valid_query(const struct sts_word_set* set,
+                        const struct sts_word* query)
+{
+  if (!set || !query || !query->symbols) return false;
+  if (query->w != set->w || query->c != set->c) return false;
+  if (query->n_values != set->n_values && query->n_values != 0
+      && set->n_values != 0) {
+    return false;
+  }
+  for (size_t i = 0; i < query->w; ++i) {
+    if (query->symbols[i] > query->c) return false;
+  }
+  return true;
+}
+
+static double get_compression(const struct sts_word_set* set,
+                              const struct sts_word* query)
+{
+  size_t n = set->n_values > 0 ? set->n_values : query->n_values;
+  if (n == 0) n = set->w;
+  return (double)n / (double)set->w;
+}
+
+sts_word_set sts_new_word_set(size_t n_values, size_t w, unsigned char c)
+{
+  if (w == 0
+      || (n_values != 0 && n_values % w != 0)
+      || c < STS_MIN_CARDINALITY) {
+    return NULL;
+  }
+  sts_word_set set = STS_MALLOC(sizeof*set);
+  if (!set) return NULL;
+  set->symbols = NULL;
+  set->count = set->capacity = 0;
+  set->n_values = n_values;
+  set->w = w;
+  set->c = c;
+  return set;
+}
+
+bool sts_word_set_add(sts_word_set set, const struct sts_word* word)
+{
+  if (!valid_query(set, word)) return false;
+  if (set->count == set->capacity) {
+    size_t capacity = set->capacity ? set->capacity * 2 : 64;
+    sts_symbol* symbols = STS_MALLOC(capacity * set->w * sizeof*symbols);
+    if (!symbols) return false;
+    if (set->count) {
+      memcpy(symbols, set->symbols, set->count * set->w * sizeof*symbols);
+    }
+    STS_FREE(set->symbols);
+    set->symbols = symbols;
+    set->capacity = capacity;
+  }
+  memcpy(set->symbols + set->count * set->w, word->symbols,
+         set->w * sizeof*word->symbols);
+  ++set->count;
+  return true;
+}
+
+size_t sts_word_set_topk(const struct sts_word_set* set,
+                         const struct sts_word* query,
+                         size_t k,
+                         struct sts_neighbor* out)
+{
+  if (!valid_query(set, query) || !out || k == 0 || set->count == 0) {
+    return 0;
+  }
+  if (k > set->count) k = set->count;
+  double* lut = STS_MALLOC(set->w * (set->c + 1) * sizeof*lut);
+  struct candidate* heap = STS_MALLOC(k * sizeof*heap);
+  size_t found = 0;
+  if (lut && heap) {
+    sts_symbol_dist2_lut(query->symbols, set->w, set->c, lut);
+    size_t size = scan_topk(set, lut, 0, set->count, k, heap);
+    found = write_neighbors(heap, size, k, get_compression(set, query), out);
+  }
+  STS_FREE(lut);
+  STS_FREE(heap);
+  return found;
+}
+
+struct topk_job {
+  const struct sts_word_set* set;
+  const double* lut;
+  size_t k;
+  size_t partition; // words per task
+  struct candidate* heaps; // k entries per task
+  size_t* sizes;
+};
+
+static void topk_task(void* ctx, size_t task)
+{
+  struct topk_job* job = ctx;
+  size_t begin = task * job->partition;
+  size_t end = begin + job->partition;
+  if (end > job->set->count) end = job->set->count;
+  job->sizes[task] = scan_topk(job->set, job->lut, begin, end, job->k,
+                               job->heaps + task * job->k);
+}
+
+size_t sts_word_set_topk_mt(const struct sts_word_set* set,
+                            const struct sts_word* query,
+                            size_t k,
+                            struct sts_neighbor* out,
+                            unsigned int n_threads)
+{
+  if (!valid_query(set, query) || !out || k == 0 || set->count == 0) {
+    return 0;
+  }
+  size_t tasks = set->count / STS_TOPK_MIN_PARTITION;
+  if (tasks > n_threads) tasks = n_threads;
+  if (tasks < 2) return sts_word_set_topk(set, query, k, out);
+
+  if (k > set->count) k = set->count;
+  struct topk_job job;
+  job.set = set;
+  job.k = k;
+  job.partition = (set->count + tasks - 1) / tasks;
+  tasks = (set->count + job.partition - 1) / job.partition;
+  double* lut = STS_MALLOC(set->w * (set->c + 1) * sizeof*lut);
+  job.heaps = STS_MALLOC(tasks * k * sizeof*job.heaps);
+  job.sizes = STS_MALLOC(tasks * sizeof*job.sizes);
+  size_t found = 0;
+  if (lut && job.heaps && job.sizes) {
+    sts_symbol_dist2_lut(query->symbols, set->w, set->c, lut);
+    job.lut = lut;
+    sts_parallel_for(n_threads, tasks, topk_task, &job);
+    // compact the partial heaps and keep the k best overall
+    size_t size = 0;
+    for (size_t t = 0; t < tasks; ++t) {
+      memmove(job.heaps + size, job.heaps + t * k,
+              job.sizes[t] * sizeof*job.heaps);
+      size += job.sizes[t];
+    }
+    found = write_neighbors(job.heaps, size, k, get_compression(set, query),
+                            out);
+  }
+  STS_FREE(lut);
+  STS_FREE(job.heaps);
+  STS_FREE(job.sizes);
+  return found;
+}
+
+/* Squared distance of a word before the n / w scaling, stops past bound */
+static double word_sum(const double* lut, const sts_symbol* word, size_t w,
+                       size_t row, double bound)
+{
+  double sum = 0;
+  for (size_t i = 0; i < w && sum <= bound; ++i, lut += row) {
+    sum += lut[word[i]];
+  }
+  return sum;
+}
+
+bool sts_word_set_mindist(const struct sts_word_set* set,
+                          const struct sts_word* query,
+                          double* out)
+{
+  if (!valid_query(set, query) || !out) return false;
+  double* lut = STS_MALLOC(set->w * (set->c + 1) * sizeof*lut);
+  if (!lut) return false;
+  sts_symbol_dist2_lut(query->symbols, set->w, set->c, lut);
+  double compression = get_compression(set, query);
+  size_t w = set->w, row = (size_t)set->c + 1;
+  const sts_symbol* word = set->symbols;
+  for (size_t j = 0; j < set->count; ++j, word += w) {
+    out[j] = sqrt(compression * word_sum(lut, word, w, row, INFINITY));
+  }
+  STS_FREE(lut);
+  return true;
+}
+
+size_t sts_word_set_within(const struct sts_word_set* set,
+                           const struct sts_word* query,
+                           double threshold,
+                           size_t* indices)
+{
+  if (!valid_query(set, query) || !indices || !(threshold >= 0)) return 0;
+  double* lut = STS_MALLOC(set->w * (set->c + 1) * sizeof*lut);
+  if (!lut) return 0;
+  sts_symbol_dist2_lut(query->symbols, set->w, set->c, lut);
+  double compression = get_compression(set, query);
+  // squared threshold before the n / w scaling, with some slack for the
+  // rounding of the division; the final check is on the distance itself
+  double bound = threshold * threshold / compression * (1 + 1e-9);
+  size_t w = set->w, row = (size_t)set->c + 1, found = 0;
+  const sts_symbol* word = set->symbols;
+  for (size_t j = 0; j < set->count; ++j, word += w) {
+    double sum = word_sum(lut, word, w, row, bound);
+    if (sum <= bound && sqrt(compression * sum) <= threshold) {
+      indices[found++] = j;
+    }
+  }
+  STS_FREE(lut);
+  return found;
+}
+
+bool sts_word_set_distance_matrix(const struct sts_word_set* set,
+                                  double* out)
+{
+  if (!set || !out) return false;
+  size_t w = set->w, row = (size_t)set->c + 1, count = set->count;
+  double* lut = STS_MALLOC(w * row * sizeof*lut);
+  if (!lut) return false;
+  double compression = set->n_values > 0
+    ? (double)set->n_values / (double)w : 1;
+  for (size_t i = 0; i < count; ++i) {
+    const sts_symbol* query = set->symbols + i * w;
+    sts_symbol_dist2_lut(query, w, set->c, lut);
+    out[i * count + i] = 0;
+    const sts_symbol* word = query + w;
+    for (size_t j = i + 1; j < count; ++j, word += w) {
+      double d = sqrt(compression * word_sum(lut, word, w, row, INFINITY));
+      out[i * count + j] = d;
+      out[j * count + i] = d;
+    }
+  }
+  STS_FREE(lut);
+  return true;
+}
+
+void sts_clear_word_set(sts_word_set set)
+{
+  if (set) set->count = 0;
+}
+
+void sts_free_word_set(sts_word_set set)
+{
+  if (!set) return;
+  STS_FREE(set->symbols);
+  STS_FREE(set);
+}
+
+#ifdef STS_COMPILE_UNIT_TESTS
+
+#include "test/sts_test.h"
+
+static unsigned int test_seed = 1;
+
+static sts_word random_word(size_t n, size_t w, unsigned char c, bool nans)
+{
+  sts_symbol* symbols = malloc(w);
+  for (size_t i = 0; i < w; ++i) {
+    test_seed = test_seed * 1103515245 + 12345;
+    unsigned int r = (test_seed >> 16) & 0x7fff;
+    symbols[i] = nans && r % 11 == 0 ? c : (sts_symbol)(r % c);
+  }
+  sts_word a = malloc(sizeof*a);
+  a->symbols = symbols;
+  a->n_values = n;
+  a->w = w;
+  a->c = c;
+  return a;
+}
+
+static int compare_brute(const void* a, const void* b)
+{
+  const struct sts_neighbor* x = a, * y = b;
+  if (x->distance != y->distance) return x->distance < y->distance ? -1 : 1;
+  return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static char* test_word_set_validation()
+{
+  mu_assert(!sts_new_word_set(10, 3, 4), "n not divisible by w");
+  mu_assert(!sts_new_word_set(8, 4, 1), "bad cardinality");
+  sts_word_set set = sts_new_word_set(8, 4, 4);
+  mu_assert(set, "allocation failed");
+  sts_word other = sts_from_sax_string("ABC", 4);
+  mu_assert(!sts_word_set_add(set, other), "w mismatch accepted");
+  sts_free_word(other);
+  other = sts_from_sax_string("ABCD", 5);
+  mu_assert(!sts_word_set_add(set, other), "c mismatch accepted");
+  struct sts_neighbor out[2];
+  mu_assert(sts_word_set_topk(set, other, 2, out) == 0, "c mismatch queried");
+  sts_free_word(other);
+  other = sts_from_sax_string("AB#D", 4);
+  mu_assert(sts_word_set_topk(set, other, 2, out) == 0, "empty set");
+  mu_assert(sts_word_set_add(set, other), "add failed");
+  mu_assert(sts_word_set_topk(set, other, 0, out) == 0, "k = 0");
+  mu_assert(sts_word_set_topk(set, other, 2, out) == 1, "k > count");
+  mu_assert(out[0].index == 0 && out[0].distance == 0, "self distance");
+  sts_free_word(other);
+  sts_clear_word_set(set);
+  mu_assert(set->count == 0, "clear failed");
+  sts_free_word_set(set);
+  return NULL;
+}
+
+static char* test_word_set_topk()
+{
+  const size_t n = 32, w = 8, count = 3000;
+  struct sts_neighbor brute[3000], got[50], got_mt[50];
+  for (unsigned c = STS_MIN_CARDINALITY; c <= STS_MAX_CARDINALITY;
+       c += 7) {
+    sts_word_set set = sts_new_word_set(n, w, c);
+    sts_word* words = malloc(count * sizeof*words);
+    for (size_t j = 0; j < count; ++j) {
+      words[j] = random_word(j % 2 ? n : 0, w, c, true);
+      mu_assert(sts_word_set_add(set, words[j]), "add failed");
+    }
+    for (size_t q = 0; q < 20; ++q) {
+      sts_word query = random_word(n, w, c, q % 2);
+      for (size_t j = 0; j < count; ++j) {
+        brute[j].index = j;
+        brute[j].distance = sts_mindist(query, words[j]);
+      }
+      qsort(brute, count, sizeof*brute, compare_brute);
+      size_t ks[] = { 1, 7, 50 };
+      for (size_t t = 0; t < 3; ++t) {
+        size_t k = ks[t];
+        mu_assert(sts_word_set_topk(set, query, k, got) == k, "topk count");
+        for (size_t i = 0; i < k; ++i) {
+          mu_assert(fabs(got[i].distance - brute[i].distance) < 1e-9,
+                    "c = %u k = %" PRIuSIZE " rank %" PRIuSIZE ": %f != %f",
+                    c, k, i, got[i].distance, brute[i].distance);
+        }
+        // ties may order differently between float and double accumulation,
+        // the multi-threaded scan must match the sequential one exactly
+        mu_assert(sts_word_set_topk_mt(set, query, k, got_mt, 4) == k,
+                  "topk_mt count");
+        for (size_t i = 0; i < k; ++i) {
+          mu_assert(got_mt[i].index == got[i].index
+                    && got_mt[i].distance == got[i].distance,
+                    "mt rank %" PRIuSIZE " differs", i);
+        }
+      }
+      sts_free_word(query);
+    }
+    for (size_t j = 0; j < count; ++j) sts_free_word(words[j]);
+    free(words);
+    sts_free_word_set(set);
+  }
+  return NULL;
+}
+
+static char* test_word_set_topk_mt()
+{
+  const size_t count = STS_TOPK_MIN_PARTITION * 5 + 17;
+  sts_word_set set = sts_new_word_set(0, 16, 8);
+  for (size_t j = 0; j < count; ++j) {
+    sts_word a = random_word(0, 16, 8, false);
+    sts_word_set_add(set, a);
+    sts_free_word(a);
+  }
+  sts_word query = random_word(0, 16, 8, false);
+  struct sts_neighbor got[100], got_mt[100];
+  size_t k = sts_word_set_topk(set, query, 100, got);
+  unsigned int threads[] = { 1, 2, 3, 8 };
+  for (size_t t = 0; t < 4; ++t) {
+    mu_assert(sts_word_set_topk_mt(set, query, 100, got_mt, threads[t]) == k,
+              "count");
+    mu_assert(memcmp(got, got_mt, k * sizeof*got) == 0,
+              "results differ with %u threads", threads[t]);
+  }
+  sts_free_word(query);
+  sts_free_word_set(set);
+  return NULL;
+}
+
+static char* test_word_set_batch()
+{
+  const size_t n = 24, w = 6, count = 400;
+  double got[400], matrix[50 * 50];
+  size_t indices[400];
+  for (unsigned c = STS_MIN_CARDINALITY; c <= STS_MAX_CARDINALITY;
+       c += 5) {
+    sts_word_set set = sts_new_word_set(n, w, c);
+    sts_word* words = malloc(count * sizeof*words);
+    for (size_t j = 0; j < count; ++j) {
+      words[j] = random_word(j % 3 ? n : 0, w, c, true);
+      sts_word_set_add(set, words[j]);
+    }
+    sts_word query = random_word(n, w, c, true);
+    mu_assert(sts_word_set_mindist(set, query, got), "mindist failed");
+    double threshold = sts_mindist(query, words[count / 2]);
+    size_t found = sts_word_set_within(set, query, threshold, indices);
+    size_t expected = 0;
+    for (size_t j = 0; j < count; ++j) {
+      double d = sts_mindist(query, words[j]);
+      mu_assert(fabs(got[j] - d) < 1e-9, "c = %u word %" PRIuSIZE, c, j);
+      if (d <= threshold) {
+        mu_assert(expected < found && indices[expected] == j,
+                  "c = %u: %" PRIuSIZE " within %f", c, j, threshold);
+        ++expected;
+      }
+    }
+    mu_assert(found == expected, "c = %u: %" PRIuSIZE " found, %" PRIuSIZE
+              " expected", c, found, expected);
+    sts_free_word(query);
+
+    sts_clear_word_set(set);
+    for (size_t j = 0; j < 50; ++j) sts_word_set_add(set, words[j]);
+    mu_assert(sts_word_set_distance_matrix(set, matrix), "matrix failed");
+    for (size_t i = 0; i < 50; ++i) {
+      for (size_t j = 0; j < 50; ++j) {
+        // words built without n take the set's n
+        struct sts_word a = *words[i], b = *words[j];
+        a.n_values = b.n_values = n;
+        mu_assert(fabs(matrix[i * 50 + j] - sts_mindist(&a, &b)) < 1e-9,
+                  "c = %u: matrix[%" PRIuSIZE "][%" PRIuSIZE "]", c, i, j);
+      }
+    }
+    for (size_t j = 0; j < count; ++j) sts_free_word(words[j]);
+    free(words);
+    sts_free_word_set(set);
+  }
+  sts_word_set set = sts_new_word_set(n, w, 4);
+  sts_word other = sts_from_sax_string("ABC", 4);
+  mu_assert(!sts_word_set_mindist(set, other, got), "w mismatch");
+  mu_assert(sts_word_set_within(set, other, 1, indices) == 0, "w mismatch");
+  sts_free_word(other);
+  sts_free_word_set(set);
+  return NULL;
+}
+
+static char* all_tests()
+{
+  mu_run_test(test_word_set_validation);
+  mu_run_test(test_word_set_topk);
+  mu_run_test(test_word_set_topk_mt);
+  mu_run_test(test_word_set_batch);
+  return NULL;
+}
+
+int main()
+{
+  char* result = all_tests();
+  if (result) {
+    printf("%s\n", result);
+  } else {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n", mu_tests_run);
+
+  return result != 0;
+}
+
+#endif // STS_COMPILE_UNIT_TESTS
@@ -0,0 +1,675 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Symbolic time series compressed word streams */
+
+#include "symtseries.h"
+#include "sts_internal.h"
+
+#include <math.h>
+#include <string.h>
+
+/*
+ * Layout: the header (magic, version, then n_values, w, c and block_words as
+ * varints) followed by the records. A record starts with a byte holding its
+ * type in the low 2 bits and its argument above them, or 0 there and the
+ * argument as a varint after it when it doesn't fit:
+ *
+ * - literal: no argument, the word packed on bits_for(c) bits per symbol
+ * - delta: the number of changed symbols, then per change the varint gap
+ *   since the previous changed position and the XOR of the old and new symbol
+ * - run: the number of repeats of the previous word
+ *
+ * Every block_words words start a block with a literal so that a block
+ * decodes on its own; runs never cross a block boundary. An open run is the
+ * last record, it is rewritten in place as it grows.
+ */
+static const unsigned char stream_magic[4] = { 'S', 'T', 'S', 'W' };
+static const unsigned char stream_version = 1;
+
+enum record_type {
+  RECORD_LITERAL, RECORD_DELTA, RECORD_RUN
+};
+
+#define STS_STREAM_MAX_BLOCK 65535
+#define STS_STREAM_INLINE_ARG 64
+
+static unsigned bits_for(unsigned char c)
+{
+  unsigned bits = 1;
+  while ((1u << bits) <= c) ++bits; // symbols 0 to c (NaN)
+  return bits;
+}
+
+static size_t literal_size(size_t w, unsigned char c)
+{
+  return (w * bits_for(c) + 7) / 8;
+}
+
+static size_t varint_size(size_t v)
+{
+  size_t size = 1;
+  for (; v >= 0x80; v >>= 7) ++size;
+  return size;
+}
+
+static unsigned char* put_varint(unsigned char* p, size_t v)
+{
+  for (; v >= 0x80; v >>= 7) *p++ = (unsigned char)(v | 0x80);
+  *p++ = (unsigned char)v;
+  return p;
+}
+
+/* NULL if the varint is truncated or overflows a size_t */
+static const unsigned char* get_varint(const unsigned char* p,
+                                       const unsigned char* end,
+                                       size_t* v)
+{
+  *v = 0;
+  for (unsigned shift = 0; p < end && shift < sizeof(size_t) * 8;
+       shift += 7) {
+    *v |= (size_t)(*p & 0x7f) << shift;
+    if (!(*p++ & 0x80)) return p;
+  }
+  return NULL;
+}
+
+static size_t record_header_size(size_t arg)
+{
+  return arg > 0 && arg < STS_STREAM_INLINE_ARG ? 1 : 1 + varint_size(arg);
+}
+
+static unsigned char* put_record_header(unsigned char* p,
+                                        enum record_type type,
+                                        size_t arg)
+{
+  if (arg > 0 && arg < STS_STREAM_INLINE_ARG) {
+    *p++ = (unsigned char)(type | arg << 2);
+    return p;
+  }
+  *p++ = (unsigned char)type;
+  return put_varint(p, arg);
+}
+
+/* NULL if the header is truncated */
+static const unsigned char* get_record_header(const unsigned char* p,
+                                              const unsigned char* end,
+                                              enum record_type* type,
+                                              size_t* arg)
+{
+  *type = (enum record_type)(*p & 3);
+  *arg = *p++ >> 2;
+  if (*type == RECORD_LITERAL || *arg) return p;
+  return get_varint(p, end, arg);
+}
+
+static void pack(const sts_symbol* word, size_t w, unsigned bits,
+                 unsigned char* p)
+{
+  unsigned acc = 0, used = 0;
+  for (size_t i = 0; i < w; ++i) {
+    acc |= (unsigned)word[i] << used;
+    for (used += bits; used >= 8; used -= 8, acc >>= 8) {
+      *p++ = (unsigned char)acc;
+    }
+  }
+  if (used) *p = (unsigned char)acc;
+}
+
+static void unpack(const unsigned char* p, size_t w, unsigned bits,
+                   sts_symbol* word)
+{
+  unsigned acc = 0, avail = 0, mask = (1u << bits) - 1;
+  for (size_t i = 0; i < w; ++i) {
+    for (; avail < bits; avail += 8) acc |= (unsigned)*p++ << avail;
+    word[i] = (sts_symbol)(acc & mask);
+    acc >>= bits;
+    avail -= bits;
+  }
+}
+
+static bool reserve(sts_word_stream s, size_t bytes)
+{
+  if (s->size + bytes <= s->capacity) return true;
+  size_t capacity = s->capacity ? s->capacity : 256;
+  while (capacity < s->size + bytes) capacity *= 2;
+  unsigned char* data = STS_MALLOC(capacity);
+  if (!data) return false;
+  if (s->size) memcpy(data, s->data, s->size);
+  STS_FREE(s->data);
+  s->data = data;
+  s->capacity = capacity;
+  return true;
+}
+
+static bool add_block(sts_word_stream s, size_t offset)
+{
+  if (s->n_blocks == s->blocks_capacity) {
+    size_t capacity = s->blocks_capacity ? s->blocks_capacity * 2 : 16;
+    size_t* blocks = STS_MALLOC(capacity * sizeof*blocks);
+    if (!blocks) return false;
+    if (s->n_blocks) memcpy(blocks, s->blocks, s->n_blocks * sizeof*blocks);
+    STS_FREE(s->blocks);
+    s->blocks = blocks;
+    s->blocks_capacity = capacity;
+  }
+  s->blocks[s->n_blocks++] = offset;
+  return true;
+}
+
+static sts_word_stream alloc_stream(size_t n_values,
+                                    size_t w,
+                                    unsigned char c,
+                                    size_t block_words)
+{
+  if (w == 0
+      || (n_values != 0 && n_values % w != 0)
+      || c < STS_MIN_CARDINALITY
+      || block_words == 0
+      || block_words > STS_STREAM_MAX_BLOCK) {
+    return NULL;
+  }
+  sts_word_stream s = STS_MALLOC(sizeof*s);
+  if (!s) return NULL;
+  memset(s, 0, sizeof*s);
+  s->n_values = n_values;
+  s->w = w;
+  s->c = c;
+  s->block_words = block_words;
+  s->last = STS_MALLOC(w * sizeof*s->last);
+  if (!s->last) {
+    STS_FREE(s);
+    return NULL;
+  }
+  return s;
+}
+
+sts_word_stream sts_new_word_stream(size_t n_values,
+                                    size_t w,
+                                    unsigned char c,
+                                    size_t block_words)
+{
+  sts_word_stream s = alloc_stream(n_values, w, c, block_words);
+  if (!s) return NULL;
+  if (!reserve(s, sizeof stream_magic + 1 + varint_size(n_values)
+               + varint_size(w) + 1 + varint_size(block_words))) {
+    sts_free_word_stream(s);
+    return NULL;
+  }
+  unsigned char* p = s->data;
+  memcpy(p, stream_magic, sizeof stream_magic);
+  p += sizeof stream_magic;
+  *p++ = stream_version;
+  p = put_varint(p, n_values);
+  p = put_varint(p, w);
+  *p++ = c;
+  p = put_varint(p, block_words);
+  s->size = (size_t)(p - s->data);
+  return s;
+}
+
+static bool valid_word(const struct sts_word_stream* s,
+                       const struct sts_word* word)
+{
+  if (!s || !word || !word->symbols) return false;
+  if (word->w != s->w || word->c != s->c) return false;
+  if (word->n_values != s->n_values && word->n_values != 0
+      && s->n_values != 0) {
+    return false;
+  }
+  for (size_t i = 0; i < word->w; ++i) {
+    if (word->symbols[i] > word->c) return false;
+  }
+  return true;
+}
+
+bool sts_word_stream_append(sts_word_stream s, const struct sts_word* word)
+{
+  if (!valid_word(s, word)) return false;
+  const sts_symbol* symbols = word->symbols;
+  size_t w = s->w, literal = literal_size(w, s->c);
+  // a record never takes more than a literal or a run of a block
+  if (!reserve(s, 1 + literal + record_header_size(STS_STREAM_MAX_BLOCK))) {
+    return false;
+  }
+
+  if (s->count % s->block_words == 0) {
+    if (!add_block(s, s->size)) return false;
+    s->data[s->size] = RECORD_LITERAL;
+    pack(symbols, w, bits_for(s->c), s->data + s->size + 1);
+    s->size += 1 + literal;
+    s->run_at = 0;
+  } else if (memcmp(s->last, symbols, w * sizeof*symbols) == 0) {
+    size_t repeats = 1;
+    if (s->run_at) {
+      enum record_type type;
+      get_record_header(s->data + s->run_at, s->data + s->size, &type,
+                        &repeats);
+      ++repeats;
+      s->size = s->run_at;
+    } else {
+      s->run_at = s->size;
+    }
+    unsigned char* p = put_record_header(s->data + s->size, RECORD_RUN,
+                                         repeats);
+    s->size = (size_t)(p - s->data);
+  } else {
+    size_t changes = 0, bytes = 0, prev = 0;
+    for (size_t i = 0; i < w && bytes < literal; ++i) {
+      if (symbols[i] == s->last[i]) continue;
+      bytes += varint_size(i - prev) + 1;
+      prev = i + 1;
+      ++changes;
+    }
+    bytes += record_header_size(changes) - 1;
+    unsigned char* p = s->data + s->size;
+    if (bytes < literal) {
+      p = put_record_header(p, RECORD_DELTA, changes);
+      prev = 0;
+      for (size_t i = 0; i < w; ++i) {
+        if (symbols[i] == s->last[i]) continue;
+        p = put_varint(p, i - prev);
+        *p++ = (unsigned char)(symbols[i] ^ s->last[i]);
+        prev = i + 1;
+      }
+    } else {
+      *p++ = RECORD_LITERAL;
+      pack(symbols, w, bits_for(s->c), p);
+      p += literal;
+    }
+    s->size = (size_t)(p - s->data);
+    s->run_at = 0;
+  }
+  memcpy(s->last, symbols, w * sizeof*symbols);
+  ++s->count;
+  return true;
+}
+
+/*
+ * Decoding position: the next record and the repeats left of the current run.
+ * When lut is set, sum tracks the squared distance (before the n / w scaling)
+ * of word to the query the lut was built for and nonzero the number of frames
+ * contributing to it, which pins the sum back to 0 despite the rounding of the
+ * updates.
+ */
+struct cursor {
+  const unsigned char* p;
+  size_t run;
+  sts_symbol* word;
+  const double* lut;
+  double sum;
+  size_t nonzero;
+};
+
+static void word_sum(struct cursor* cur, size_t w, size_t row)
+{
+  const double* lut = cur->lut;
+  cur->sum = 0;
+  cur->nonzero = 0;
+  for (size_t i = 0; i < w; ++i, lut += row) {
+    double d = lut[cur->word[i]];
+    cur->sum += d;
+    cur->nonzero += d != 0;
+  }
+}
+
+/* Moves to the next word, the stream records have been validated */
+static void next_word(const struct sts_word_stream* s, struct cursor* cur)
+{
+  if (cur->run) {
+    --cur->run;
+    return;
+  }
+  size_t w = s->w, row = (size_t)s->c + 1, arg;
+  enum record_type type;
+  const unsigned char* p = get_record_header(cur->p, s->data + s->size, &type,
+                                             &arg);
+  switch (type) {
+  case RECORD_LITERAL:
+    unpack(p, w, bits_for(s->c), cur->word);
+    p += literal_size(w, s->c);
+    if (cur->lut) word_sum(cur, w, row);
+    break;
+  case RECORD_DELTA:
+    {
+      size_t gap, i = 0;
+      for (size_t j = 0; j < arg; ++j, ++i) {
+        p = get_varint(p, s->data + s->size, &gap);
+        i += gap;
+        sts_symbol old = cur->word[i];
+        cur->word[i] = (sts_symbol)(old ^ *p++);
+        if (cur->lut) {
+          double from = cur->lut[i * row + old];
+          double to = cur->lut[i * row + cur->word[i]];
+          cur->sum += to - from;
+          cur->nonzero += (to != 0) - (from != 0);
+        }
+      }
+    }
+    break;
+  default: // RECORD_RUN, the first repeat is this word
+    cur->run = arg - 1;
+    break;
+  }
+  cur->p = p;
+}
+
+/* Positions the cursor on word first, which must be < s->count */
+static void seek(const struct sts_word_stream* s, size_t first,
+                 struct cursor* cur)
+{
+  size_t block = first / s->block_words;
+  cur->p = s->data + s->blocks[block];
+  cur->run = 0;
+  for (size_t i = block * s->block_words; i <= first; ++i) next_word(s, cur);
+}
+
+bool sts_word_stream_decode(const struct sts_word_stream* s,
+                            size_t first,
+                            size_t count,
+                            sts_symbol* symbols)
+{
+  if (!s || !symbols || first > s->count || count > s->count - first) {
+    return false;
+  }
+  if (count == 0) return true;
+  struct cursor cur = { NULL, 0, symbols, NULL, 0, 0 };
+  seek(s, first, &cur);
+  for (size_t j = 1; j < count; ++j) {
+    memcpy(symbols + s->w, symbols, s->w * sizeof*symbols);
+    symbols += s->w;
+    cur.word = symbols;
+    next_word(s, &cur);
+  }
+  return true;
+}
+
+bool sts_word_stream_mindist(const struct sts_word_stream* s,
+                             const struct sts_word* query,
+                             size_t first,
+                             size_t count,
+                             double* out)
+{
+  if (!valid_word(s, query) || !out || first > s->count
+      || count > s->count - first) {
+    return false;
+  }
+  if (count == 0) return true;
+  double* lut = STS_MALLOC(s->w * (s->c + 1) * sizeof*lut);
+  sts_symbol* word = STS_MALLOC(s->w * sizeof*word);
+  if (!lut || !word) {
+    STS_FREE(lut);
+    STS_FREE(word);
+    return false;
+  }
+  sts_symbol_dist2_lut(query->symbols, s->w, s->c, lut);
+  size_t n = s->n_values > 0 ? s->n_values : query->n_values;
+  if (n == 0) n = s->w;
+  double compression = (double)n / (double)s->w;
+
+  // repeats reuse the distance, deltas only update the changed frames
+  struct cursor cur = { NULL, 0, word, lut, 0, 0 };
+  seek(s, first, &cur);
+  for (size_t j = 0; j < count; ++j) {
+    if (j) next_word(s, &cur);
+    out[j] = cur.nonzero ? sqrt(compression * cur.sum) : 0;
+  }
+  STS_FREE(lut);
+  STS_FREE(word);
+  return true;
+}
+
+/* Checks a record and applies it to word, returns the words it holds */
+static size_t check_record(const struct sts_word_stream* s,
+                           const unsigned char** pp,
+                           sts_symbol* word)
+{
+  const unsigned char* p = *pp, * end = s->data + s->size;
+  size_t w = s->w, words = 1, arg;
+  enum record_type type;
+  p = get_record_header(p, end, &type, &arg);
+  if (!p) return 0;
+  switch (type) {
+  case RECORD_LITERAL:
+    if (arg || (size_t)(end - p) < literal_size(w, s->c)) return 0;
+    unpack(p, w, bits_for(s->c), word);
+    p += literal_size(w, s->c);
+    for (size_t i = 0; i < w; ++i) {
+      if (word[i] > s->c) return 0;
+    }
+    break;
+  case RECORD_DELTA:
+    {
+      size_t gap, i = 0;
+      if (arg == 0 || arg > w) return 0;
+      for (size_t j = 0; j < arg; ++j, ++i) {
+        p = get_varint(p, end, &gap);
+        if (!p || p == end || gap >= w - i) return 0;
+        i += gap;
+        word[i] ^= *p++;
+        if (word[i] > s->c) return 0;
+      }
+    }
+    break;
+  case RECORD_RUN:
+    words = arg;
+    break;
+  default:
+    return 0;
+  }
+  *pp = p;
+  return words;
+}
+
+sts_word_stream sts_load_word_stream(const unsigned char* data, size_t size)
+{
+  if (!data || size < sizeof stream_magic + 1
+      || memcmp(data, stream_magic, sizeof stream_magic) != 0
+      || data[sizeof stream_magic] != stream_version) {
+    return NULL;
+  }
+  const unsigned char* p = data + sizeof stream_magic + 1, * end = data + size;
+  size_t n_values, w, block_words;
+  p = get_varint(p, end, &n_values);
+  if (p) p = get_varint(p, end, &w);
+  if (!p || p == end || w > size * 8) return NULL;
+  unsigned char c = *p++;
+  p = get_varint(p, end, &block_words);
+  if (!p) return NULL;
+
+  sts_word_stream s = alloc_stream(n_values, w, c, block_words);
+  if (!s) return NULL;
+  if (!reserve(s, size)) {
+    sts_free_word_stream(s);
+    return NULL;
+  }
+  memcpy(s->data, data, size);
+  s->size = size;
+  p = s->data + (p - data);
+  end = s->data + size;
+
+  // replays every record, rebuilding the block index and the last word
+  memset(s->last, 0, w * sizeof*s->last);
+  while (p < end) {
+    bool starts_block = s->count % block_words == 0;
+    if (starts_block) {
+      if (*p != RECORD_LITERAL) break;
+      if (!add_block(s, (size_t)(p - s->data))) break;
+    }
+    s->run_at = (*p & 3) == RECORD_RUN ? (size_t)(p - s->data) : 0;
+    size_t words = check_record(s, &p, s->last);
+    if (words == 0 || words > block_words - s->count % block_words) break;
+    s->count += words;
+  }
+  if (p != end) {
+    sts_free_word_stream(s);
+    return NULL;
+  }
+  return s;
+}
+
+void sts_free_word_stream(sts_word_stream s)
+{
+  if (!s) return;
+  STS_FREE(s->data);
+  STS_FREE(s->blocks);
+  STS_FREE(s->last);
+  STS_FREE(s);
+}
+
+#ifdef STS_COMPILE_UNIT_TESTS
+
+#include "test/sts_test.h"
+
+/* Words of a sliding window over a slow random walk with a NaN gap */
+static void sliding_words(size_t n, size_t w, unsigned char c, size_t len,
+                          sts_word_set set)
+{
+  sts_window win = sts_new_window(n, w, c);
+  double level = 0;
+  unsigned int seed = 3;
+  for (size_t t = 0; t < len; ++t) {
+    seed = seed * 1103515245 + 12345;
+    level += ((seed >> 16) & 0x7fff) / 16384.0 - 1.0;
+    double value = t >= 500 && t < 520 ? NAN : level;
+    sts_word_set_add(set, sts_append_value(win, value));
+  }
+  sts_free_window(win);
+}
+
+static char* test_word_stream_validation()
+{
+  mu_assert(!sts_new_word_stream(10, 4, 4, 16), "w not a divisor of n");
+  mu_assert(!sts_new_word_stream(8, 4, 1, 16), "cardinality");
+  mu_assert(!sts_new_word_stream(8, 4, 4, 0), "empty blocks");
+  mu_assert(!sts_new_word_stream(8, 4, 4, 65536), "blocks too large");
+  sts_word_stream s = sts_new_word_stream(8, 4, 4, 3);
+  mu_assert(s, "allocation failed");
+  sts_word a = sts_from_sax_string("ABC", 4);
+  mu_assert(!sts_word_stream_append(s, a), "w mismatch");
+  sts_free_word(a);
+  a = sts_from_sax_string("AB#D", 4);
+  mu_assert(sts_word_stream_append(s, a), "append failed");
+  sts_symbol symbols[4];
+  mu_assert(!sts_word_stream_decode(s, 1, 1, symbols), "out of range");
+  mu_assert(!sts_word_stream_mindist(s, a, 0, 2, (double[2]){ 0 }),
+            "out of range");
+  mu_assert(sts_word_stream_decode(s, 0, 1, symbols), "decode failed");
+  mu_assert(memcmp(symbols, a->symbols, 4) == 0, "decoded word");
+  sts_free_word(a);
+
+  const unsigned char bad[] = { 'S', 'T', 'S', 'W', 1, 8, 4, 4, 3, 2 | 1 << 2 };
+  mu_assert(!sts_load_word_stream(bad, sizeof bad), "block starts with a run");
+  mu_assert(!sts_load_word_stream(s->data, s->size - 1), "truncated");
+  sts_word_stream copy = sts_load_word_stream(s->data, s->size);
+  mu_assert(copy && copy->count == 1, "reload");
+  sts_free_word_stream(copy);
+  sts_free_word_stream(s);
+  return NULL;
+}
+
+static char* test_word_stream_roundtrip()
+{
+  const size_t n = 1440, w = 24, len = 5000;
+  for (unsigned c = 2; c <= STS_MAX_CARDINALITY; c += 7) {
+    sts_word_set set = sts_new_word_set(n, w, c);
+    sliding_words(n, w, c, len, set);
+    sts_word_stream s = sts_new_word_stream(n, w, c, 100);
+    struct sts_word a = { NULL, n, w, c };
+    for (size_t i = 0; i < len; ++i) {
+      a.symbols = set->symbols + i * w;
+      mu_assert(sts_word_stream_append(s, &a), "append %" PRIuSIZE, i);
+    }
+    // an order of magnitude below the SAX strings up to 16 symbols
+    mu_assert(c > 16 || s->size * 10 < len * (w + 1), "c = %u: %" PRIuSIZE
+              " bytes", c, s->size);
+    mu_assert(s->n_blocks == len / 100, "%" PRIuSIZE " blocks", s->n_blocks);
+
+    sts_word_stream copy = sts_load_word_stream(s->data, s->size);
+    mu_assert(copy, "reload failed");
+    mu_assert(copy->count == len && copy->run_at == s->run_at
+              && memcmp(copy->last, s->last, w) == 0, "reloaded state");
+    a.symbols = set->symbols;
+    mu_assert(sts_word_stream_append(s, &a), "append");
+    mu_assert(sts_word_stream_append(copy, &a), "append to the reload");
+    mu_assert(copy->size == s->size
+              && memcmp(copy->data, s->data, s->size) == 0, "same encoding");
+
+    sts_symbol* symbols = malloc(len * w);
+    const size_t ranges[][2] = { { 0, len }, { 1234, 1 }, { 4990, 10 },
+      { 150, 777 } };
+    for (size_t r = 0; r < sizeof ranges / sizeof*ranges; ++r) {
+      size_t first = ranges[r][0], count = ranges[r][1];
+      mu_assert(sts_word_stream_decode(copy, first, count, symbols),
+                "decode failed");
+      mu_assert(memcmp(symbols, set->symbols + first * w, count * w) == 0,
+                "c = %u range %" PRIuSIZE, c, r);
+    }
+    free(symbols);
+    sts_free_word_stream(copy);
+    sts_free_word_stream(s);
+    sts_free_word_set(set);
+  }
+  return NULL;
+}
+
+static char* test_word_stream_mindist()
+{
+  const size_t n = 120, w = 12, len = 3000;
+  const unsigned char c = 8;
+  sts_word_set set = sts_new_word_set(n, w, c);
+  sliding_words(n, w, c, len, set);
+  sts_word_stream s = sts_new_word_stream(n, w, c, 256);
+  struct sts_word a = { NULL, n, w, c };
+  for (size_t i = 0; i < len; ++i) {
+    a.symbols = set->symbols + i * w;
+    sts_word_stream_append(s, &a);
+  }
+  double* expected = malloc(len * sizeof*expected);
+  double* distances = malloc(len * sizeof*distances);
+  for (size_t q = 0; q < len; q += 499) {
+    a.symbols = set->symbols + q * w;
+    mu_assert(sts_word_set_mindist(set, &a, expected), "set mindist");
+    mu_assert(sts_word_stream_mindist(s, &a, 0, len, distances),
+              "stream mindist");
+    for (size_t i = 0; i < len; ++i) {
+      mu_assert(fabs(distances[i] - expected[i]) < 1e-9, "q = %" PRIuSIZE
+                " i = %" PRIuSIZE ": %f != %f", q, i, distances[i],
+                expected[i]);
+    }
+    mu_assert(distances[q] == 0, "self distance");
+    mu_assert(sts_word_stream_mindist(s, &a, 700, 300, distances),
+              "partial scan");
+    mu_assert(fabs(distances[0] - expected[700]) < 1e-9
+              && fabs(distances[299] - expected[999]) < 1e-9, "offsets");
+  }
+  free(expected);
+  free(distances);
+  sts_free_word_stream(s);
+  sts_free_word_set(set);
+  return NULL;
+}
+
+static char* all_tests()
+{
+  mu_run_test(test_word_stream_validation);
+  mu_run_test(test_word_stream_roundtrip);
+  mu_run_test(test_word_stream_mindist);
+  return NULL;
+}
+
+int main()
+{
+  char* result = all_tests();
+  if (result) {
+    printf("%s\n", result);
+  } else {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n", mu_tests_run);
+
+  return result != 0;
+}
+
+#endif // STS_COMPILE_UNIT_TESTS
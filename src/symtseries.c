@@ -7,6 +7,8 @@
  * http://www.cs.ucr.edu/~eamonn/iSAX_2.0.pdf */
 
 #include "symtseries.h"
+#include "sts_internal.h"
+#include "sts_parallel.h"
 
 #include <float.h>
 #include <stdlib.h>
@@ -22,8 +24,12 @@
 #pragma warning( disable : 4305 )
 #endif
 
+/* Cardinalities with hand-written breakpoint and distance tables */
+#define STS_TABLE_CARDINALITY 16
+
 /* Breakpoints used in iSAX symbol estimation */
-static const float breaks[STS_MAX_CARDINALITY - 1][STS_MAX_CARDINALITY - 1] =
+static const float breaks[STS_TABLE_CARDINALITY - 1]
+                          [STS_TABLE_CARDINALITY - 1] =
 {
   { 0.0 },
   { -0.430, 0.430 },
@@ -224,7 +230,7 @@ static const float mindist_16[] = {
   3.068, 2.684, 2.421, 2.209, 2.023, 1.853, 1.691, 1.534, 1.377, 1.215, 1.045, 0.860, 0.647, 0.384, 0.000, 0.000
 };
 
-static const float* dist_table[STS_MAX_CARDINALITY - 1] = {
+static const float* dist_table[STS_TABLE_CARDINALITY - 1] = {
   mindist_2,
   mindist_3,
   mindist_4,
@@ -242,9 +248,113 @@ static const float* dist_table[STS_MAX_CARDINALITY - 1] = {
   mindist_16
 };
 
+/*
+ * Larger cardinalities use the c-quantiles of the standard normal as
+ * breakpoints, generated on first use for all of them and stored back to back
+ * (c - 1 floats per cardinality). The distance between two symbols only
+ * depends on the breakpoints bounding their intervals so it is computed from
+ * them rather than tabled.
+ */
+#define STS_WIDE_BREAKS_OFFSET(c)                                              \
+  (((size_t)(c) - 1) * ((size_t)(c) - 2) / 2                                   \
+   - (STS_TABLE_CARDINALITY - 1) * STS_TABLE_CARDINALITY / 2)
+#define STS_SQRT_2PI 2.50662827463100050242
+
+static float wide_breaks[STS_WIDE_BREAKS_OFFSET(STS_MAX_CARDINALITY + 1)];
+static sts_once_flag wide_breaks_once = STS_ONCE_INIT;
+
+/*
+ * Inverse of the standard normal CDF for 0 < p <= 0.5: Acklam's rational
+ * approximation refined by one Halley step
+ */
+static double inverse_normal_cdf(double p)
+{
+  static const double a[] = { -3.969683028665376e+01, 2.209460984245205e+02,
+    -2.759285104469687e+02, 1.383577518672690e+02, -3.066479806614716e+01,
+    2.506628277459239e+00 };
+  static const double b[] = { -5.447609879822406e+01, 1.615858368580409e+02,
+    -1.556989798598866e+02, 6.680131188771972e+01, -1.328068155288572e+01 };
+  static const double c[] = { -7.784894002430293e-03, -3.223964580411365e-01,
+    -2.400758277161838e+00, -2.549732539343734e+00, 4.374664141464968e+00,
+    2.938163982698783e+00 };
+  static const double d[] = { 7.784695709041462e-03, 3.224671290700398e-01,
+    2.445134137142996e+00, 3.754408661907416e+00 };
+  double x;
+  if (p < 0.02425) {
+    double q = sqrt(-2 * log(p));
+    x = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5])
+        / ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+  } else {
+    double q = p - 0.5, r = q * q;
+    double num = ((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r;
+    double den = ((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r;
+    x = (num + a[5]) * q / (den + 1);
+  }
+  double e = 0.5 * erfc(-x / sqrt(2.0)) - p;
+  double u = e * STS_SQRT_2PI * exp(x * x / 2);
+  return x - u / (1 + x * u / 2);
+}
+
+static void init_wide_breaks(void)
+{
+  for (unsigned c = STS_TABLE_CARDINALITY + 1; c <= STS_MAX_CARDINALITY; ++c) {
+    float* b = wide_breaks + STS_WIDE_BREAKS_OFFSET(c);
+    // mirrored so that the breakpoints are exactly symmetric around 0
+    for (unsigned i = 1; 2 * i <= c; ++i) {
+      float q = (float)inverse_normal_cdf((double)i / c);
+      b[c - 1 - i] = -q;
+      b[i - 1] = q;
+    }
+  }
+}
+
+/* Ascending breakpoints of cardinality c */
+static const float* sax_breaks(unsigned char c)
+{
+  if (c <= STS_TABLE_CARDINALITY) return breaks[c - STS_MIN_CARDINALITY];
+  sts_call_once(&wide_breaks_once, init_wide_breaks);
+  return wide_breaks + STS_WIDE_BREAKS_OFFSET(c);
+}
+
+/* Distance between the intervals of the symbols sa and sb, both below c */
+static double symbol_dist(sts_symbol sa, sts_symbol sb, unsigned char c)
+{
+  if (c <= STS_TABLE_CARDINALITY) {
+    return dist_table[c - STS_MIN_CARDINALITY][sa * c + sb];
+  }
+  // symbol 0 is the highest interval
+  sts_symbol top = sa < sb ? sa : sb, bottom = sa < sb ? sb : sa;
+  if (bottom - top < 2) return 0;
+  const float* b = sax_breaks(c);
+  return (double)b[c - 2 - top] - b[c - 1 - bottom];
+}
+
+/*
+ * Symbol kernel of the cardinalities without tables: branch-free binary
+ * search for the number of breakpoints <= value. The breakpoints must have
+ * been generated (select_kernels does it).
+ */
+static sts_symbol wide_symbol(double value, unsigned char c)
+{
+  if (isnan(value)) return c;
+  const float* b = wide_breaks + STS_WIDE_BREAKS_OFFSET(c), * base = b;
+  size_t len = c - 1;
+  while (len > 1) {
+    size_t half = len / 2;
+    base = base[half] <= value ? base + half : base;
+    len -= half;
+  }
+  size_t below = (size_t)(base - b) + (*base <= value);
+  return (sts_symbol)(c - 1 - below);
+}
+
 static sts_symbol get_symbol(double value, unsigned char c)
 {
   if (isnan(value)) return c;
+  if (c > STS_TABLE_CARDINALITY) {
+    sax_breaks(c);
+    return wide_symbol(value, c);
+  }
   for (int i = 0; i < c - 1; ++i) {
     if (value < breaks[c - STS_MIN_CARDINALITY][i]) {
       return c - i - 1;
@@ -253,6 +363,223 @@ static sts_symbol get_symbol(double value, unsigned char c)
   return 0;
 }
 
+/*
+ * Cardinality specializations: with c known at compile time the breakpoint
+ * comparisons unroll into a branch-free count of the breakpoints <= value (the
+ * same symbol as get_symbol since the breakpoints are ascending) and mindist
+ * reads pre-squared distances
+ */
+static double dist2_table[STS_TABLE_CARDINALITY - 1]
+                         [STS_TABLE_CARDINALITY * STS_TABLE_CARDINALITY];
+static sts_once_flag dist2_once = STS_ONCE_INIT;
+
+static void init_dist2_table(void)
+{
+  for (unsigned c = STS_MIN_CARDINALITY; c <= STS_TABLE_CARDINALITY; ++c) {
+    for (unsigned i = 0; i < c * c; ++i) {
+      double d = dist_table[c - STS_MIN_CARDINALITY][i];
+      dist2_table[c - STS_MIN_CARDINALITY][i] = d * d;
+    }
+  }
+}
+
+#define STS_CARDINALITY_KERNELS(C)                                             \
+static sts_symbol symbol_##C(double value, unsigned char c)                    \
+{                                                                              \
+  (void)c;                                                                     \
+  if (isnan(value)) return C;                                                  \
+  const float* b = breaks[C - STS_MIN_CARDINALITY];                            \
+  int below = 0;                                                               \
+  for (int i = 0; i < C - 1; ++i) below += b[i] <= value;                      \
+  return (sts_symbol)(C - 1 - below);                                          \
+}                                                                              \
+                                                                               \
+static void mindist_kernel_##C(const sts_symbol* a, const sts_symbol* b,      \
+                               size_t w, double* above, double* below)         \
+{                                                                              \
+  const double* d2 = dist2_table[C - STS_MIN_CARDINALITY];                     \
+  for (size_t i = 0; i < w; ++i) {                                             \
+    sts_symbol sa = a[i], sb = b[i];                                           \
+    if (sa == sb) continue;                                                    \
+    if (sa == C) {                                                             \
+      sa = sb > C - 1 - sb ? 0 : C - 1;                                        \
+    } else if (sb == C) {                                                      \
+      sb = sa > C - 1 - sa ? 0 : C - 1;                                        \
+    }                                                                          \
+    if (sa < sb) {                                                             \
+      *above += d2[sa * C + sb];                                               \
+    } else {                                                                   \
+      *below += d2[sa * C + sb];                                               \
+    }                                                                          \
+  }                                                                            \
+}
+
+STS_CARDINALITY_KERNELS(2)
+STS_CARDINALITY_KERNELS(3)
+STS_CARDINALITY_KERNELS(4)
+STS_CARDINALITY_KERNELS(5)
+STS_CARDINALITY_KERNELS(6)
+STS_CARDINALITY_KERNELS(7)
+STS_CARDINALITY_KERNELS(8)
+STS_CARDINALITY_KERNELS(9)
+STS_CARDINALITY_KERNELS(10)
+STS_CARDINALITY_KERNELS(11)
+STS_CARDINALITY_KERNELS(12)
+STS_CARDINALITY_KERNELS(13)
+STS_CARDINALITY_KERNELS(14)
+STS_CARDINALITY_KERNELS(15)
+STS_CARDINALITY_KERNELS(16)
+
+/*
+ * Fixed-point quantizer: the normalized value is clamped to +-STS_LUT_RANGE
+ * (beyond every breakpoint) and scaled to one of STS_LUT_BUCKETS buckets. A
+ * bucket holds the symbol at its lower edge and the single breakpoint falling
+ * inside it (+INF if none), so the lookup is one comparison with no branches
+ * on c. Buckets are widened by STS_LUT_MARGIN to absorb the rounding of the
+ * index computation, the grid is fine enough for every widened bucket to
+ * straddle at most one breakpoint (the closest breakpoints are 0.157 apart).
+ * Results are identical to get_symbol. Cheaper than the unrolled comparisons
+ * once c exceeds STS_LUT_MIN_CARDINALITY.
+ */
+#define STS_LUT_RANGE 2.0
+#define STS_LUT_BUCKETS 1024
+#define STS_LUT_SCALE (STS_LUT_BUCKETS / (2 * STS_LUT_RANGE))
+#define STS_LUT_MARGIN 1e-9
+#define STS_LUT_MIN_CARDINALITY 6
+
+static float lut_split[STS_TABLE_CARDINALITY - 1][STS_LUT_BUCKETS];
+static sts_symbol lut_base[STS_TABLE_CARDINALITY - 1][STS_LUT_BUCKETS];
+static sts_once_flag lut_once = STS_ONCE_INIT;
+
+static void init_lut(void)
+{
+  for (unsigned c = STS_MIN_CARDINALITY; c <= STS_TABLE_CARDINALITY; ++c) {
+    const float* b = breaks[c - STS_MIN_CARDINALITY];
+    for (size_t k = 0; k < STS_LUT_BUCKETS; ++k) {
+      double lo = k / STS_LUT_SCALE - STS_LUT_RANGE - STS_LUT_MARGIN;
+      double hi = (k + 1) / STS_LUT_SCALE - STS_LUT_RANGE + STS_LUT_MARGIN;
+      lut_base[c - STS_MIN_CARDINALITY][k] = get_symbol(lo, c);
+      lut_split[c - STS_MIN_CARDINALITY][k] = INFINITY;
+      for (unsigned i = 0; i < c - 1; ++i) {
+        if (b[i] > lo && b[i] <= hi) {
+          lut_split[c - STS_MIN_CARDINALITY][k] = b[i];
+        }
+      }
+    }
+  }
+}
+
+#define STS_LUT_KERNEL(C)                                                      \
+static sts_symbol lut_symbol_##C(double value, unsigned char c)                \
+{                                                                              \
+  (void)c;                                                                     \
+  if (isnan(value)) return C;                                                  \
+  double z = value < STS_LUT_RANGE ? value : STS_LUT_RANGE;                   \
+  z = z > -STS_LUT_RANGE ? z : -STS_LUT_RANGE;                                 \
+  size_t k = (size_t)((z + STS_LUT_RANGE) * STS_LUT_SCALE);                    \
+  k = k < STS_LUT_BUCKETS ? k : STS_LUT_BUCKETS - 1;                           \
+  return (sts_symbol)(lut_base[C - STS_MIN_CARDINALITY][k]                     \
+                      - (z >= lut_split[C - STS_MIN_CARDINALITY][k]));         \
+}
+
+STS_LUT_KERNEL(2)
+STS_LUT_KERNEL(3)
+STS_LUT_KERNEL(4)
+STS_LUT_KERNEL(5)
+STS_LUT_KERNEL(6)
+STS_LUT_KERNEL(7)
+STS_LUT_KERNEL(8)
+STS_LUT_KERNEL(9)
+STS_LUT_KERNEL(10)
+STS_LUT_KERNEL(11)
+STS_LUT_KERNEL(12)
+STS_LUT_KERNEL(13)
+STS_LUT_KERNEL(14)
+STS_LUT_KERNEL(15)
+STS_LUT_KERNEL(16)
+
+static sts_symbol (*const lut_symbol_kernels[])(double, unsigned char) =
+{
+  lut_symbol_2,
+  lut_symbol_3,
+  lut_symbol_4,
+  lut_symbol_5,
+  lut_symbol_6,
+  lut_symbol_7,
+  lut_symbol_8,
+  lut_symbol_9,
+  lut_symbol_10,
+  lut_symbol_11,
+  lut_symbol_12,
+  lut_symbol_13,
+  lut_symbol_14,
+  lut_symbol_15,
+  lut_symbol_16
+};
+
+static sts_symbol (*const symbol_kernels[])(double, unsigned char) =
+{
+  symbol_2,
+  symbol_3,
+  symbol_4,
+  symbol_5,
+  symbol_6,
+  symbol_7,
+  symbol_8,
+  symbol_9,
+  symbol_10,
+  symbol_11,
+  symbol_12,
+  symbol_13,
+  symbol_14,
+  symbol_15,
+  symbol_16
+};
+
+typedef void (*mindist_kernel)(const sts_symbol* a, const sts_symbol* b,
+                               size_t w, double* above, double* below);
+
+static const mindist_kernel mindist_kernels[] =
+{
+  mindist_kernel_2,
+  mindist_kernel_3,
+  mindist_kernel_4,
+  mindist_kernel_5,
+  mindist_kernel_6,
+  mindist_kernel_7,
+  mindist_kernel_8,
+  mindist_kernel_9,
+  mindist_kernel_10,
+  mindist_kernel_11,
+  mindist_kernel_12,
+  mindist_kernel_13,
+  mindist_kernel_14,
+  mindist_kernel_15,
+  mindist_kernel_16
+};
+
+/* mindist_kernel_##C for the cardinalities without tables */
+static void mindist_kernel_wide(const sts_symbol* a, const sts_symbol* b,
+                                size_t w, unsigned char c, double* above,
+                                double* below)
+{
+  for (size_t i = 0; i < w; ++i) {
+    sts_symbol sa = a[i], sb = b[i];
+    if (sa == sb) continue;
+    if (sa == c) {
+      sa = sb > c - 1 - sb ? 0 : c - 1;
+    } else if (sb == c) {
+      sb = sa > c - 1 - sa ? 0 : c - 1;
+    }
+    double d = symbol_dist(sa, sb, c);
+    if (sa < sb) {
+      *above += d * d;
+    } else {
+      *below += d * d;
+    }
+  }
+}
+
 // On-line estimation for better precision
 static void estimate_mu_and_std(const double* series,
                                 size_t n_values,
@@ -279,49 +606,124 @@ static void estimate_mu_and_std(const double* series,
   }
 }
 
-static sts_window new_window(size_t n,
-                             size_t w,
-                             unsigned char c,
-                             struct sts_ring_buffer* values)
+static void select_kernels(sts_window window);
+
+static void init_window(sts_window window,
+                        size_t n,
+                        size_t w,
+                        unsigned char c,
+                        struct sts_ring_buffer* values,
+                        sts_symbol* symbols)
 {
-  sts_window window = malloc(sizeof*window);
+  memset(&window->stats, 0, sizeof window->stats);
+  window->bucket = NULL;
+  window->ingest = NULL;
+  window->scale = NULL;
+  window->trend = NULL;
   window->current_word.n_values = n;
   window->current_word.w = w;
   window->current_word.c = c;
-  window->current_word.symbols =
-    malloc(w * sizeof*window->current_word.symbols);
-  if (window->current_word.symbols == NULL) return NULL;
+  window->current_word.symbols = symbols;
   for (size_t i = 0; i < w; ++i) {
     window->current_word.symbols[i] = c;
   }
   window->values = values;
-  return window;
+  select_kernels(window);
 }
 
-sts_window sts_new_window(size_t n, size_t w, unsigned char c)
+/*
+ * Frees the state a caller can attach to any window, those embedded in multi
+ * windows and pyramids included
+ */
+static void free_window_options(sts_window window)
+{
+  STS_FREE(window->bucket);
+  sts_free_ingest(window->ingest);
+  STS_FREE(window->scale);
+  if (window->trend) STS_FREE(window->trend->slopes); // word is current_word
+  STS_FREE(window->trend);
+}
+
+static sts_window new_window(size_t n,
+                             size_t w,
+                             unsigned char c,
+                             struct sts_ring_buffer* values)
 {
-  if (n % w != 0 || c > STS_MAX_CARDINALITY || c < STS_MIN_CARDINALITY) {
+  sts_window window = STS_MALLOC(sizeof*window);
+  if (!window) return NULL;
+  sts_symbol* symbols = STS_MALLOC(w * sizeof*symbols);
+  if (symbols == NULL) {
+    STS_FREE(window);
     return NULL;
   }
-  struct sts_ring_buffer* values = malloc(sizeof*values);
+  init_window(window, n, w, c, values, symbols);
+  return window;
+}
+
+static struct sts_ring_buffer* new_ring_buffer(size_t n, bool single)
+{
+  struct sts_ring_buffer* values = STS_MALLOC(sizeof*values);
   if (!values) return NULL;
-  values->buffer = malloc(n * sizeof*values->buffer);
-  if (!values->buffer) {
-    free(values);
+  memset(values, 0, sizeof*values);
+  if (single) {
+    values->fbuffer = STS_MALLOC(n * sizeof*values->fbuffer);
+    if (!values->fbuffer) {
+      STS_FREE(values);
+      return NULL;
+    }
+    values->fbuffer_end = values->fbuffer + n;
+  } else {
+    values->buffer = STS_MALLOC(n * sizeof*values->buffer);
+    if (!values->buffer) {
+      STS_FREE(values);
+      return NULL;
+    }
+    values->buffer_end = values->buffer + n;
+  }
+  return values;
+}
+
+/*
+ * Fills the buffer with NaNs and resets the on-line estimations
+ */
+static void rb_reset(struct sts_ring_buffer* rb)
+{
+  if (rb->fbuffer) {
+    for (float* val = rb->fbuffer; val != rb->fbuffer_end; ++val) *val = NAN;
+    rb->fhead = rb->fbuffer;
+    rb->ftail = rb->fbuffer_end - 1;
+  } else {
+    for (double* val = rb->buffer; val != rb->buffer_end; ++val) *val = NAN;
+    rb->head = rb->buffer;
+    rb->tail = rb->buffer_end - 1;
+  }
+  rb->mu = 0;
+  rb->s2 = 0;
+  rb->finite_cnt = 0;
+}
+
+static sts_window new_storage_window(size_t n, size_t w, unsigned char c,
+                                     bool single)
+{
+  if (n % w != 0 || c < STS_MIN_CARDINALITY) {
     return NULL;
   }
-  for (size_t i = 0; i < n; ++i) {
-    values->buffer[i] = NAN;
-  }
-  values->buffer_end = values->buffer + n;
-  values->head = values->buffer;
-  values->tail = values->buffer_end - 1;
-  values->mu = 0;
-  values->s2 = 0;
-  values->finite_cnt = 0;
+  struct sts_ring_buffer* values = new_ring_buffer(n, single);
+  if (!values) return NULL;
+  rb_reset(values);
   return new_window(n, w, c, values);
 }
 
+sts_window sts_new_window(size_t n, size_t w, unsigned char c)
+{
+  return new_storage_window(n, w, c, false);
+}
+
+sts_window sts_new_float_window(size_t n, size_t w, unsigned char c)
+{
+  return new_storage_window(n, w, c, true);
+}
+
 /*
  * Apend to circular buffer, updates finite_cnt
  */
@@ -350,9 +752,83 @@ static double rb_push(struct sts_ring_buffer* rb, double value)
   return prev_head;
 }
 
+/*
+ * rb_push for float32 storage, value must already be representable as float
+ */
+static double rb_push_f(struct sts_ring_buffer* rb, double value)
+{
+  double prev_head = 0;
+  if (isfinite(value)) {
+    ++rb->finite_cnt;
+  }
+  ++rb->ftail;
+  if (rb->ftail == rb->fbuffer_end) {
+    rb->ftail = rb->fbuffer;
+  }
+
+  if (rb->ftail == rb->fhead) {
+    prev_head = *rb->fhead;
+    if (isfinite(prev_head)) {
+      --rb->finite_cnt;
+    }
+    if (++rb->fhead == rb->fbuffer_end) {
+      rb->fhead = rb->fbuffer;
+    }
+  }
+  *rb->ftail = (float)value;
+
+  return prev_head;
+}
+
+/*
+ * Normalizes the sum of the cnt non-NaN values of a frame, the result is NaN
+ * for all-NaN frames and (-INF + INF)
+ */
+static double normalize_frame(double sum, size_t cnt, double mu, double std)
+{
+  if (cnt == 0 || isnan(sum)) {
+    STS_STAT_ADD(nan_frames, 1);
+    return NAN;
+  }
+  if (isfinite(sum)) {
+    if (std < STS_STAT_EPS) return 0;
+    return (sum - (cnt * mu)) / (cnt * std);
+  }
+  return sum;
+}
+
+/*
+ * Variance of the least squares slope of a frame of size L in a normalized
+ * random walk is about STS_SLOPE_VARIANCE / L (1d-SAX)
+ */
+#define STS_SLOPE_VARIANCE 0.03
+
+/*
+ * Divisor turning the sum of the values of a frame weighted by their positions
+ * relative to the frame center (offsets) into a slope in units of its
+ * standard deviation, 0 when the slope is 0
+ */
+static double slope_divisor(size_t frame_size, double std)
+{
+  double l = (double)frame_size;
+  double u2 = l * (l * l - 1) / 12; // sum of the squared offsets
+  if (u2 == 0 || std < STS_STAT_EPS) return 0;
+  return u2 * std * sqrt(STS_SLOPE_VARIANCE / l);
+}
+
+/* Slope symbol of a frame, cs if any value is NaN */
+static sts_symbol slope_symbol(double offsets, bool nan, double divisor,
+                               unsigned char cs)
+{
+  if (nan) return cs;
+  return get_symbol(divisor == 0 ? 0 : offsets / divisor, cs);
+}
+
 /*
  * Given code params, mu and std of series + buffer where that series lies
- * writes SAX-representation of the series into *out
+ * writes SAX-representation of the series into *out, the normalized frame
+ * averages (PAA) into *paa and/or the slope symbols of cardinality cs into
+ * *slopes, any of them can be NULL
  */
 
 static void apply_sax_transform(size_t n,
@@ -361,44 +837,83 @@ static void apply_sax_transform(size_t n,
                                 double mu,
                                 double std,
                                 sts_symbol* out,
+                                double* paa,
+                                sts_symbol* slopes,
+                                unsigned char cs,
                                 const double* series_begin,
                                 const double* buffer_start,
                                 const double* buffer_break)
 {
   size_t frame_size = n / w;
+  double center = (frame_size - 1) / 2.0;
+  double divisor = slopes ? slope_divisor(frame_size, std) : 0;
   const double* val = series_begin;
   for (unsigned int i = 0; i < w; ++i) {
-    double average = 0;
-    size_t current_frame_size = frame_size;
+    double sum = 0, offsets = 0;
+    size_t cnt = frame_size;
     for (size_t j = 0; j < frame_size; ++j) {
       if (isnan(*val)) {
-        --current_frame_size;
+        --cnt;
       } else {
-        average += *val;
+        sum += *val;
+        if (slopes) offsets += (j - center) * *val;
       }
       if (++val == buffer_break) val = buffer_start;
     }
-    if (current_frame_size == 0 || isnan(average)) {
-      // All NaNs or (-INF + INF)
-      average = NAN;
-    } else {
-      if (isfinite(average)) {
-        if (std < STS_STAT_EPS) {
-          average = 0;
-        } else {
-          average = (average - (current_frame_size * mu))
-            / (current_frame_size * std);
-        }
+    double average = normalize_frame(sum, cnt, mu, std);
+    if (paa) paa[i] = average;
+    if (out) out[i] = get_symbol(average, c);
+    if (slopes) {
+      slopes[i] = slope_symbol(offsets, cnt != frame_size, divisor, cs);
+    }
+  }
+}
+
+/*
+ * apply_sax_transform over float32 storage, sums are accumulated in double
+ */
+static void apply_sax_transform_f(size_t n,
+                                  size_t w,
+                                  unsigned char c,
+                                  double mu,
+                                  double std,
+                                  sts_symbol* out,
+                                  double* paa,
+                                  sts_symbol* slopes,
+                                  unsigned char cs,
+                                  const float* series_begin,
+                                  const float* buffer_start,
+                                  const float* buffer_break)
+{
+  size_t frame_size = n / w;
+  double center = (frame_size - 1) / 2.0;
+  double divisor = slopes ? slope_divisor(frame_size, std) : 0;
+  const float* val = series_begin;
+  for (unsigned int i = 0; i < w; ++i) {
+    double sum = 0, offsets = 0;
+    size_t cnt = frame_size;
+    for (size_t j = 0; j < frame_size; ++j) {
+      if (isnan(*val)) {
+        --cnt;
+      } else {
+        sum += *val;
+        if (slopes) offsets += (j - center) * *val;
       }
+      if (++val == buffer_break) val = buffer_start;
+    }
+    double average = normalize_frame(sum, cnt, mu, std);
+    if (paa) paa[i] = average;
+    if (out) out[i] = get_symbol(average, c);
+    if (slopes) {
+      slopes[i] = slope_symbol(offsets, cnt != frame_size, divisor, cs);
     }
-    out[i] = get_symbol(average, c);
   }
 }
 
 static sts_word new_word(size_t n, size_t w, unsigned char c,
                          sts_symbol* symbols)
 {
-  sts_word new = malloc(sizeof*new);
+  sts_word new = STS_MALLOC(sizeof*new);
   new->n_values = n;
   new->w = w;
   new->c = c;
@@ -406,35 +921,274 @@ static sts_word new_word(size_t n, size_t w, unsigned char c,
   return new;
 }
 
-static double get_window_std(sts_window window)
+static double get_window_std(const struct sts_window* window)
 {
   return window->values->finite_cnt == 0
          ? 0
          : sqrt(window->values->s2 / window->values->finite_cnt);
 }
 
+/* mu and std normalizing the frames of the window */
+static void get_window_scale(const struct sts_window* window, double* mu,
+                             double* std)
+{
+  if (window->scale) {
+    *mu = window->scale->mu;
+    *std = sqrt(window->scale->var);
+  } else {
+    *mu = window->values->mu;
+    *std = get_window_std(window);
+  }
+}
+
+/* Fastest symbolization of cardinality c, readying its tables */
+static sts_symbol (*symbol_kernel(unsigned char c))(double, unsigned char)
+{
+  if (c > STS_TABLE_CARDINALITY) {
+    sax_breaks(c);
+    return wide_symbol;
+  } else if (c > STS_LUT_MIN_CARDINALITY) {
+    sts_call_once(&lut_once, init_lut);
+    return lut_symbol_kernels[c - STS_MIN_CARDINALITY];
+  }
+  return symbol_kernels[c - STS_MIN_CARDINALITY];
+}
+
+/*
+ * Frame size specializations of the symbolization for windows without NaN or
+ * infinite values: a constant frame size unrolls the frame sums, the NaN
+ * checks are gone and the ring buffer wrap is only checked for the frame
+ * straddling it. The summation order is the one of apply_sax_transform so the
+ * results are identical, the slope symbols included when slopes isn't NULL.
+ */
+#define STS_TRANSFORM_KERNEL(NAME, T, HEAD, START, END, FS)                    \
+static void NAME(const struct sts_window* window, sts_symbol* out,             \
+                 double* paa, sts_symbol* slopes)                              \
+{                                                                              \
+  const struct sts_ring_buffer* rb = window->values;                           \
+  const T* val = rb->HEAD;                                                     \
+  size_t w = window->current_word.w;                                           \
+  size_t frame_size = FS ? FS : window->current_word.n_values / w;             \
+  double mu, std;                                                              \
+  get_window_scale(window, &mu, &std);                                         \
+  sts_symbol (*symbol)(double, unsigned char) = window->kernels.symbol;        \
+  unsigned char c = window->current_word.c;                                    \
+  double center = (frame_size - 1) / 2.0, divisor = 0;                         \
+  sts_symbol (*slope)(double, unsigned char) = NULL;                           \
+  unsigned char cs = 0;                                                        \
+  if (slopes) {                                                                \
+    divisor = slope_divisor(frame_size, std);                                  \
+    cs = window->trend->cs;                                                    \
+    slope = symbol_kernel(cs);                                                 \
+  }                                                                            \
+  for (size_t i = 0; i < w; ++i) {                                             \
+    double sum = 0, offsets = 0;                                               \
+    if ((size_t)(rb->END - val) >= frame_size) {                               \
+      if (slopes) {                                                            \
+        for (size_t j = 0; j < frame_size; ++j) {                              \
+          sum += val[j];                                                       \
+          offsets += (j - center) * val[j];                                    \
+        }                                                                      \
+      } else {                                                                 \
+        for (size_t j = 0; j < frame_size; ++j) sum += val[j];                 \
+      }                                                                        \
+      val += frame_size;                                                       \
+      if (val == rb->END) val = rb->START;                                     \
+    } else {                                                                   \
+      for (size_t j = 0; j < frame_size; ++j) {                                \
+        sum += *val;                                                           \
+        if (slopes) offsets += (j - center) * *val;                            \
+        if (++val == rb->END) val = rb->START;                                 \
+      }                                                                        \
+    }                                                                          \
+    double average = normalize_frame(sum, frame_size, mu, std);                \
+    if (paa) paa[i] = average;                                                 \
+    if (out) out[i] = symbol(average, c);                                      \
+    if (slopes) slopes[i] = slope(divisor == 0 ? 0 : offsets / divisor, cs);   \
+  }                                                                            \
+}
+
+#define STS_FRAME_KERNELS(FS)                                                  \
+STS_TRANSFORM_KERNEL(transform_##FS, double, head, buffer, buffer_end, FS)     \
+STS_TRANSFORM_KERNEL(transform_f_##FS, float, fhead, fbuffer, fbuffer_end, FS)
+
+STS_FRAME_KERNELS(1)
+STS_FRAME_KERNELS(2)
+STS_FRAME_KERNELS(3)
+STS_FRAME_KERNELS(4)
+STS_FRAME_KERNELS(5)
+STS_FRAME_KERNELS(6)
+STS_FRAME_KERNELS(8)
+STS_FRAME_KERNELS(10)
+STS_FRAME_KERNELS(12)
+STS_FRAME_KERNELS(15)
+STS_FRAME_KERNELS(16)
+STS_FRAME_KERNELS(20)
+STS_FRAME_KERNELS(24)
+STS_FRAME_KERNELS(30)
+STS_FRAME_KERNELS(32)
+STS_FRAME_KERNELS(60)
+STS_FRAME_KERNELS(0)
+
+typedef void (*transform_kernel)(const struct sts_window* window,
+                                 sts_symbol* out, double* paa,
+                                 sts_symbol* slopes);
+
+static const struct {
+  size_t frame_size;
+  transform_kernel transform, transform_f;
+} frame_kernels[] =
+{
+  { 1, transform_1, transform_f_1 },
+  { 2, transform_2, transform_f_2 },
+  { 3, transform_3, transform_f_3 },
+  { 4, transform_4, transform_f_4 },
+  { 5, transform_5, transform_f_5 },
+  { 6, transform_6, transform_f_6 },
+  { 8, transform_8, transform_f_8 },
+  { 10, transform_10, transform_f_10 },
+  { 12, transform_12, transform_f_12 },
+  { 15, transform_15, transform_f_15 },
+  { 16, transform_16, transform_f_16 },
+  { 20, transform_20, transform_f_20 },
+  { 24, transform_24, transform_f_24 },
+  { 30, transform_30, transform_f_30 },
+  { 32, transform_32, transform_f_32 },
+  { 60, transform_60, transform_f_60 },
+  { 0, transform_0, transform_f_0 } // any frame size
+};
+
+static void select_kernels(sts_window window)
+{
+  size_t frame_size = window->current_word.n_values / window->current_word.w;
+  size_t i = 0;
+  while (frame_kernels[i].frame_size != frame_size
+         && frame_kernels[i].frame_size != 0) {
+    ++i;
+  }
+  window->kernels.symbol = symbol_kernel(window->current_word.c);
+  window->kernels.transform = window->values->fbuffer
+                              ? frame_kernels[i].transform_f
+                              : frame_kernels[i].transform;
+}
+
+static void transform_window_generic(const struct sts_window* window,
+                                     sts_symbol* out,
+                                     double* paa,
+                                     sts_symbol* slopes)
+{
+  unsigned char cs = window->trend ? window->trend->cs : 0;
+  const struct sts_ring_buffer* rb = window->values;
+  double mu, std;
+  get_window_scale(window, &mu, &std);
+  if (rb->fbuffer) {
+    apply_sax_transform_f(window->current_word.n_values,
+                          window->current_word.w,
+                          window->current_word.c,
+                          mu,
+                          std,
+                          out,
+                          paa,
+                          slopes,
+                          cs,
+                          rb->fhead,
+                          rb->fbuffer,
+                          rb->fbuffer_end);
+  } else {
+    apply_sax_transform(window->current_word.n_values,
+                        window->current_word.w,
+                        window->current_word.c,
+                        mu,
+                        std,
+                        out,
+                        paa,
+                        slopes,
+                        cs,
+                        rb->head,
+                        rb->buffer,
+                        rb->buffer_end);
+  }
+}
+
+static void transform_window(const struct sts_window* window, sts_symbol* out,
+                             double* paa, sts_symbol* slopes)
+{
+  if (window->values->finite_cnt == window->current_word.n_values) {
+    window->kernels.transform(window, out, paa, slopes);
+  } else {
+    transform_window_generic(window, out, paa, slopes);
+  }
+}
+
 static sts_word update_current_word(sts_window window)
 {
-  apply_sax_transform(window->current_word.n_values,
-                      window->current_word.w,
-                      window->current_word.c,
-                      window->values->mu,
-                      get_window_std(window),
-                      window->current_word.symbols,
-                      window->values->head,
-                      window->values->buffer,
-                      window->values->buffer_end);
+  STS_WINDOW_STAT_ADD(window, word_recomputes, 1);
+  transform_window(window, window->current_word.symbols, NULL,
+                   window->trend ? window->trend->slopes : NULL);
   return &window->current_word;
 }
 
+static bool valid_window(const struct sts_window* window)
+{
+  return window
+    && window->values
+    && (window->values->buffer || window->values->fbuffer);
+}
+
+double sts_window_value(const struct sts_window* window, size_t i)
+{
+  if (!valid_window(window) || i >= window->current_word.n_values) return NAN;
+  const struct sts_ring_buffer* rb = window->values;
+  if (rb->fbuffer) {
+    size_t pos = (size_t)(rb->fhead - rb->fbuffer) + i;
+    size_t n = (size_t)(rb->fbuffer_end - rb->fbuffer);
+    return rb->fbuffer[pos < n ? pos : pos - n];
+  }
+  size_t pos = (size_t)(rb->head - rb->buffer) + i;
+  size_t n = (size_t)(rb->buffer_end - rb->buffer);
+  return rb->buffer[pos < n ? pos : pos - n];
+}
+
+/* Moves an EWMA scale by value, fixed scales and non-finite values don't */
+static void update_scale(const struct sts_window* window, double value)
+{
+  struct sts_window_scale* scale = window->scale;
+  if (window->values->fbuffer) value = (float)value;
+  if (scale->alpha > 0 && isfinite(value)) {
+    double diff = value - scale->mu;
+    scale->mu += scale->alpha * diff;
+    scale->var = (1 - scale->alpha) * (scale->var
+                                       + scale->alpha * diff * diff);
+  }
+}
+
 /*
- * Appends value, updates mu and s2 in on-line fashion, but doesn't update word
- * itself
+ * Appends value, updates mu and s2 (or the scale set by the caller) in on-line
+ * fashion, but doesn't update word itself
  */
 static void append_value(sts_window window, double value)
 {
+#ifdef STS_ENABLE_STATS
+  STS_WINDOW_STAT_ADD(window, appends, 1);
+  if (isnan(value)) {
+    STS_WINDOW_STAT_ADD(window, nan_inputs, 1);
+  } else if (isinf(value)) {
+    STS_WINDOW_STAT_ADD(window, inf_inputs, 1);
+  }
+#endif
   size_t prev_finite = window->values->finite_cnt;
-  double head = rb_push(window->values, value);
+  double head;
+  if (window->values->fbuffer) {
+    // the statistics must track the stored value to stay consistent
+    value = (float)value;
+    head = rb_push_f(window->values, value);
+  } else {
+    head = rb_push(window->values, value);
+  }
+  if (window->scale) {
+    update_scale(window, value);
+    return;
+  }
   size_t new_finite = window->values->finite_cnt;
   // Update mu and s2
   if (prev_finite == new_finite) {
@@ -480,91 +1234,544 @@ static void append_value(sts_window window, double value)
 
 const struct sts_word* sts_append_value(sts_window window, double value)
 {
-  if (window == NULL
-      || window->values == NULL
-      || window->values->buffer == NULL
-      || window->current_word.c < STS_MIN_CARDINALITY
-      || window->current_word.c > STS_MAX_CARDINALITY) {
+  if (!valid_window(window)
+      || window->current_word.c < STS_MIN_CARDINALITY) {
     return NULL;
   }
+  STS_LATENCY_START(start);
   append_value(window, value);
-  return update_current_word(window);
+  sts_word word = update_current_word(window);
+  STS_LATENCY_STOP(append_latency, start);
+  return word;
 }
 
 const struct sts_word* sts_append_array(sts_window window,
                                         const double* values,
                                         size_t n_values)
 {
-  if (window == NULL
-      || window->values == NULL
-      || window->values->buffer == NULL
+  if (!valid_window(window)
       || window->current_word.c < STS_MIN_CARDINALITY
-      || window->current_word.c > STS_MAX_CARDINALITY
       || !values) {
     return NULL;
   }
+  STS_LATENCY_START(latency_start);
   size_t start =
     n_values > window->current_word.n_values
     ? n_values - window->current_word.n_values : 0;
+  if (window->scale && window->scale->alpha > 0) {
+    // values pushed out again by the end of the call still move the scale
+    for (size_t i = 0; i < start; ++i) update_scale(window, values[i]);
+  }
   for (size_t i = start; i < n_values; ++i) {
     append_value(window, values[i]);
   }
-  return update_current_word(window);
+  sts_word word = update_current_word(window);
+  STS_LATENCY_STOP(append_latency, latency_start);
+  return word;
 }
 
-sts_word sts_from_double_array(const double* series,
-                               size_t n_values,
-                               size_t w,
-                               unsigned int c)
+sts_multi_window sts_new_multi_window(size_t channels,
+                                      size_t n,
+                                      size_t w,
+                                      unsigned char c)
 {
-  if (n_values % w != 0
-      || c > STS_MAX_CARDINALITY
-      || c < STS_MIN_CARDINALITY
-      || series == NULL) {
+  if (channels == 0 || w == 0 || n % w != 0 || c < STS_MIN_CARDINALITY) {
     return NULL;
   }
-  double mu, sigma;
-  estimate_mu_and_std(series, n_values, &mu, &sigma);
-  sts_symbol* symbols = malloc(w * sizeof*symbols);
-  if (!symbols) return NULL;
-  apply_sax_transform(n_values, w, c, mu, sigma, symbols, series, NULL, NULL);
-  return new_word(n_values, w, c, symbols);
+  sts_multi_window mw = STS_MALLOC(sizeof*mw);
+  if (!mw) return NULL;
+  mw->channels = channels;
+  mw->windows = STS_MALLOC(channels * sizeof*mw->windows);
+  mw->rings = STS_MALLOC(channels * sizeof*mw->rings);
+  mw->buffer = STS_MALLOC(channels * n * sizeof*mw->buffer);
+  mw->word.symbols = STS_MALLOC(channels * w * sizeof*mw->word.symbols);
+  if (!mw->windows || !mw->rings || !mw->buffer || !mw->word.symbols) {
+    STS_FREE(mw->windows);
+    STS_FREE(mw->rings);
+    STS_FREE(mw->buffer);
+    STS_FREE(mw->word.symbols);
+    STS_FREE(mw);
+    return NULL;
+  }
+  mw->word.n_values = channels * n;
+  mw->word.w = channels * w;
+  mw->word.c = c;
+  memset(mw->rings, 0, channels * sizeof*mw->rings);
+  for (size_t i = 0; i < channels; ++i) {
+    struct sts_ring_buffer* rb = &mw->rings[i];
+    rb->buffer = mw->buffer + i * n;
+    rb->buffer_end = rb->buffer + n;
+    rb_reset(rb);
+    init_window(&mw->windows[i], n, w, c, rb, mw->word.symbols + i * w);
+  }
+  return mw;
 }
 
-sts_word sts_from_sax_string(const char* symbols, unsigned char c)
+const struct sts_word* sts_append_rows(sts_multi_window mw,
+                                       const double* rows,
+                                       size_t n_rows)
 {
-  if (!symbols || c < STS_MIN_CARDINALITY || c > STS_MAX_CARDINALITY) {
-    return NULL;
-  }
-  size_t w = strlen(symbols);
-  if (w == 0) {
-    return NULL;
+  if (!mw || !mw->windows || !rows) return NULL;
+  size_t channels = mw->channels, n = mw->windows[0].current_word.n_values;
+  STS_LATENCY_START(latency_start);
+  // rows that would be pushed out again by the end of the call are skipped
+  size_t start = n_rows > n ? n_rows - n : 0;
+  for (size_t i = 0; i < channels; ++i) {
+    // but still move the EWMA scales
+    const struct sts_window* window = &mw->windows[i];
+    if (!window->scale || window->scale->alpha <= 0) continue;
+    for (size_t r = 0; r < start; ++r) {
+      update_scale(window, rows[r * channels + i]);
+    }
   }
-  sts_symbol* sts_symbols = malloc(w * sizeof*sts_symbols);
-  if (!sts_symbols) return NULL;
-  for (size_t i = 0; i < w; ++i) {
-    if (symbols[i] == '#') {
-      sts_symbols[i] = c;
-    } else {
-      if (symbols[i] < 'A' || symbols[i] >= (char)('A' + c)) return NULL;
-      sts_symbols[i] = c - (symbols[i] - 'A') - 1;
+  for (size_t r = start; r < n_rows; ++r) {
+    const double* row = rows + r * channels;
+    for (size_t i = 0; i < channels; ++i) {
+      append_value(&mw->windows[i], row[i]);
     }
   }
-  return new_word(0, w, c, sts_symbols);
+  for (size_t i = 0; i < channels; ++i) {
+    update_current_word(&mw->windows[i]);
+  }
+  STS_LATENCY_STOP(append_latency, latency_start);
+  return &mw->word;
 }
 
-char* sts_word_to_sax_string(const struct sts_word* a)
+const struct sts_word* sts_append_row(sts_multi_window mw, const double* row)
 {
-  if (!a || !a->symbols) return NULL;
-  char* str = malloc((a->w + 1) * sizeof*str);
-  if (!str) return NULL;
-  str[a->w] = '\0';
+  return sts_append_rows(mw, row, 1);
+}
+
+bool sts_reset_multi_window(sts_multi_window mw)
+{
+  if (!mw || !mw->windows) return false;
+  for (size_t i = 0; i < mw->channels; ++i) {
+    sts_reset_window(&mw->windows[i]);
+  }
+  return true;
+}
+
+void sts_free_multi_window(sts_multi_window mw)
+{
+  if (!mw) return;
+  if (mw->windows) {
+    for (size_t i = 0; i < mw->channels; ++i) {
+      free_window_options(&mw->windows[i]);
+    }
+  }
+  STS_FREE(mw->windows);
+  STS_FREE(mw->rings);
+  STS_FREE(mw->buffer);
+  STS_FREE(mw->word.symbols);
+  STS_FREE(mw);
+}
+
+sts_pyramid sts_new_pyramid(size_t levels,
+                            const size_t* factors,
+                            size_t n,
+                            size_t w,
+                            unsigned char c)
+{
+  if (levels == 0 || !factors || w == 0 || n % w != 0
+      || c < STS_MIN_CARDINALITY) {
+    return NULL;
+  }
+  for (size_t i = 0; i < levels; ++i) {
+    if (factors[i] == 0) return NULL;
+  }
+  sts_pyramid p = STS_MALLOC(sizeof*p);
+  if (!p) return NULL;
+  p->levels = levels;
+  p->windows = STS_MALLOC(levels * sizeof*p->windows);
+  p->buckets = STS_MALLOC(levels * sizeof*p->buckets);
+  p->rings = STS_MALLOC(levels * sizeof*p->rings);
+  p->buffer = STS_MALLOC(levels * n * sizeof*p->buffer);
+  p->symbols = STS_MALLOC(levels * w * sizeof*p->symbols);
+  if (!p->windows || !p->buckets || !p->rings || !p->buffer || !p->symbols) {
+    STS_FREE(p->windows);
+    STS_FREE(p->buckets);
+    STS_FREE(p->rings);
+    STS_FREE(p->buffer);
+    STS_FREE(p->symbols);
+    STS_FREE(p);
+    return NULL;
+  }
+  memset(p->rings, 0, levels * sizeof*p->rings);
+  memset(p->buckets, 0, levels * sizeof*p->buckets);
+  for (size_t i = 0; i < levels; ++i) {
+    p->buckets[i].factor = factors[i];
+    struct sts_ring_buffer* rb = &p->rings[i];
+    rb->buffer = p->buffer + i * n;
+    rb->buffer_end = rb->buffer + n;
+    rb_reset(rb);
+    init_window(&p->windows[i], n, w, c, rb, p->symbols + i * w);
+  }
+  return p;
+}
+
+size_t sts_pyramid_append(sts_pyramid p, double value)
+{
+  if (!p || !p->windows) return 0;
+  STS_LATENCY_START(latency_start);
+  // the raw sums and counts cascade, so every level averages raw samples
+  double sum = isnan(value) ? 0 : value;
+  size_t cnt = !isnan(value), level = 0;
+  for (; level < p->levels; ++level) {
+    struct sts_pyramid_level* b = &p->buckets[level];
+    b->sum += sum;
+    b->cnt += cnt;
+    if (++b->filled < b->factor) break;
+    sum = b->sum;
+    cnt = b->cnt;
+    b->sum = 0;
+    b->cnt = b->filled = 0;
+    append_value(&p->windows[level], cnt ? sum / cnt : NAN);
+    update_current_word(&p->windows[level]);
+  }
+  STS_LATENCY_STOP(append_latency, latency_start);
+  return level;
+}
+
+const struct sts_word* sts_pyramid_word(const struct sts_pyramid* p,
+                                        size_t level)
+{
+  if (!p || !p->windows || level >= p->levels) return NULL;
+  return &p->windows[level].current_word;
+}
+
+bool sts_reset_pyramid(sts_pyramid p)
+{
+  if (!p || !p->windows) return false;
+  for (size_t i = 0; i < p->levels; ++i) {
+    sts_reset_window(&p->windows[i]);
+    p->buckets[i].sum = 0;
+    p->buckets[i].cnt = p->buckets[i].filled = 0;
+  }
+  return true;
+}
+
+void sts_free_pyramid(sts_pyramid p)
+{
+  if (!p) return;
+  if (p->windows) {
+    for (size_t i = 0; i < p->levels; ++i) free_window_options(&p->windows[i]);
+  }
+  STS_FREE(p->windows);
+  STS_FREE(p->buckets);
+  STS_FREE(p->rings);
+  STS_FREE(p->buffer);
+  STS_FREE(p->symbols);
+  STS_FREE(p);
+}
+
+sts_window sts_new_time_window(size_t n,
+                               size_t w,
+                               unsigned char c,
+                               long long interval)
+{
+  if (interval <= 0) return NULL;
+  sts_window window = sts_new_window(n, w, c);
+  if (window && !sts_set_window_interval(window, interval)) {
+    sts_free_window(window);
+    return NULL;
+  }
+  return window;
+}
+
+bool sts_set_window_interval(sts_window window, long long interval)
+{
+  if (!valid_window(window) || interval <= 0) return false;
+  if (!window->bucket) {
+    window->bucket = STS_MALLOC(sizeof*window->bucket);
+    if (!window->bucket) return false;
+  }
+  window->bucket->interval = interval;
+  window->bucket->open = false;
+  return true;
+}
+
+bool sts_set_window_scale(sts_window window,
+                          double mu,
+                          double sigma,
+                          double alpha)
+{
+  if (!valid_window(window) || !isfinite(mu) || !isfinite(sigma) || sigma < 0
+      || !(alpha >= 0 && alpha < 1)) {
+    return false;
+  }
+  if (!window->scale) {
+    window->scale = STS_MALLOC(sizeof*window->scale);
+    if (!window->scale) return false;
+  }
+  window->scale->mu = window->scale->init_mu = mu;
+  window->scale->var = window->scale->init_var = sigma * sigma;
+  window->scale->alpha = alpha;
+  update_current_word(window);
+  return true;
+}
+
+bool sts_get_window_scale(const struct sts_window* window,
+                          double* mu,
+                          double* sigma)
+{
+  if (!valid_window(window) || !mu || !sigma) return false;
+  get_window_scale(window, mu, sigma);
+  return true;
+}
+
+bool sts_enable_window_trend(sts_window window, unsigned char cs)
+{
+  if (!valid_window(window) || cs < STS_MIN_CARDINALITY) return false;
+  if (!window->trend) {
+    struct sts_trend_word* trend = STS_MALLOC(sizeof*trend);
+    if (!trend) return false;
+    trend->slopes = STS_MALLOC(window->current_word.w * sizeof*trend->slopes);
+    if (!trend->slopes) {
+      STS_FREE(trend);
+      return false;
+    }
+    window->trend = trend;
+  }
+  window->trend->word = window->current_word;
+  window->trend->cs = cs;
+  update_current_word(window);
+  return true;
+}
+
+const struct sts_trend_word* sts_window_trend(const struct sts_window* window)
+{
+  return window ? window->trend : NULL;
+}
+
+static long long bucket_floor(long long ts, long long interval)
+{
+  long long start = ts - ts % interval;
+  return start > ts ? start - interval : start;
+}
+
+/*
+ * Appends the open bucket followed by NaNs for every empty bucket before the
+ * one starting at next_start. Nothing is symbolized here and at most n values
+ * are pushed no matter how long the gap is.
+ */
+static void close_buckets(sts_window window, long long next_start)
+{
+  struct sts_time_bucket* b = window->bucket;
+  append_value(window, b->cnt ? b->sum / b->cnt : NAN);
+  long long gap = (next_start - b->start) / b->interval - 1;
+  size_t n = window->current_word.n_values;
+  size_t nan_cnt = gap > (long long)n ? n : (size_t)gap;
+  for (size_t i = 0; i < nan_cnt; ++i) {
+    append_value(window, NAN);
+  }
+  b->start = next_start;
+  b->sum = 0;
+  b->cnt = 0;
+}
+
+const struct sts_word* sts_append_timed(sts_window window, long long ts,
+                                        double value)
+{
+  if (!valid_window(window) || !window->bucket) return NULL;
+  struct sts_time_bucket* b = window->bucket;
+  long long start = bucket_floor(ts, b->interval);
+  if (!b->open) {
+    b->open = true;
+    b->start = start;
+    b->sum = 0;
+    b->cnt = 0;
+  } else if (start < b->start) {
+    return &window->current_word; // late sample
+  }
+
+  const struct sts_word* word = &window->current_word;
+  if (start > b->start) {
+    STS_LATENCY_START(latency_start);
+    close_buckets(window, start);
+    word = update_current_word(window);
+    STS_LATENCY_STOP(append_latency, latency_start);
+  }
+  if (!isnan(value)) {
+    b->sum += value;
+    ++b->cnt;
+  }
+  return word;
+}
+
+const struct sts_word* sts_advance_timed(sts_window window, long long ts)
+{
+  if (!valid_window(window) || !window->bucket) return NULL;
+  struct sts_time_bucket* b = window->bucket;
+  long long start = bucket_floor(ts, b->interval);
+  if (!b->open || start <= b->start) return &window->current_word;
+  close_buckets(window, start);
+  return update_current_word(window);
+}
+
+sts_word sts_from_double_array(const double* series,
+                               size_t n_values,
+                               size_t w,
+                               unsigned int c)
+{
+  if (n_values % w != 0
+      || c > STS_MAX_CARDINALITY
+      || c < STS_MIN_CARDINALITY
+      || series == NULL) {
+    return NULL;
+  }
+  double mu, sigma;
+  estimate_mu_and_std(series, n_values, &mu, &sigma);
+  sts_symbol* symbols = STS_MALLOC(w * sizeof*symbols);
+  if (!symbols) return NULL;
+  apply_sax_transform(n_values, w, c, mu, sigma, symbols, NULL, NULL, 0,
+                      series, NULL, NULL);
+  return new_word(n_values, w, c, symbols);
+}
+
+sts_trend_word sts_trend_from_double_array(const double* series,
+                                           size_t n_values,
+                                           size_t w,
+                                           unsigned char c,
+                                           unsigned char cs)
+{
+  if (!series || w == 0 || n_values % w != 0 || c < STS_MIN_CARDINALITY
+      || cs < STS_MIN_CARDINALITY) {
+    return NULL;
+  }
+  sts_trend_word a = STS_MALLOC(sizeof*a);
+  if (!a) return NULL;
+  a->word.symbols = STS_MALLOC(w * sizeof*a->word.symbols);
+  a->slopes = STS_MALLOC(w * sizeof*a->slopes);
+  if (!a->word.symbols || !a->slopes) {
+    sts_free_trend_word(a);
+    return NULL;
+  }
+  a->word.n_values = n_values;
+  a->word.w = w;
+  a->word.c = c;
+  a->cs = cs;
+  double mu, sigma;
+  estimate_mu_and_std(series, n_values, &mu, &sigma);
+  apply_sax_transform(n_values, w, c, mu, sigma, a->word.symbols, NULL,
+                      a->slopes, cs, series, NULL, NULL);
+  return a;
+}
+
+struct sliding_job {
+  const double* series;
+  size_t words; // len - n + 1
+  size_t n, w;
+  unsigned char c;
+  sts_symbol* out;
+  unsigned long long failed;
+};
+
+/* Positions whose frame sums are accumulated together */
+#define STS_SLIDING_BLOCK 1024
+
+static void sliding_task(void* ctx, size_t task)
+{
+  struct sliding_job* job = ctx;
+  size_t first = task * STS_SLIDING_CHUNK;
+  size_t words = job->words - first;
+  if (words > STS_SLIDING_CHUNK) words = STS_SLIDING_CHUNK;
+  size_t n = job->n, w = job->w, frame_size = n / w;
+  unsigned char c = job->c;
+  // frame sums and counts of the non-NaN values starting at every position
+  // used by the words of the chunk, in the summation order of the windows
+  size_t positions = words + n - frame_size;
+  double* sums = STS_MALLOC(positions * sizeof*sums);
+  size_t* cnts = STS_MALLOC(positions * sizeof*cnts);
+  sts_window window = sts_new_window(n, w, c);
+  if (!sums || !cnts || !window) {
+    STS_ATOMIC_STORE(&job->failed, 1);
+    STS_FREE(sums);
+    STS_FREE(cnts);
+    sts_free_window(window);
+    return;
+  }
+  const double* series = job->series + first;
+  for (size_t p = 0; p < positions; p += STS_SLIDING_BLOCK) {
+    size_t end = p + STS_SLIDING_BLOCK < positions ? p + STS_SLIDING_BLOCK
+                                                   : positions;
+    for (size_t i = p; i < end; ++i) {
+      sums[i] = 0;
+      cnts[i] = 0;
+    }
+    for (size_t j = 0; j < frame_size; ++j) {
+      const double* val = series + j;
+      for (size_t i = p; i < end; ++i) {
+        bool nan = isnan(val[i]);
+        sums[i] += nan ? 0 : val[i];
+        cnts[i] += !nan;
+      }
+    }
+  }
+
+  for (size_t i = 0; i + 1 < n; ++i) append_value(window, series[i]);
+  sts_symbol (*symbol)(double, unsigned char) = window->kernels.symbol;
+  sts_symbol* out = job->out + first * w;
+  for (size_t t = 0; t < words; ++t, out += w) {
+    append_value(window, series[t + n - 1]);
+    double mu, std;
+    get_window_scale(window, &mu, &std);
+    for (size_t i = 0, pos = t; i < w; ++i, pos += frame_size) {
+      out[i] = symbol(normalize_frame(sums[pos], cnts[pos], mu, std), c);
+    }
+  }
+  STS_FREE(sums);
+  STS_FREE(cnts);
+  sts_free_window(window);
+}
+
+bool sts_sliding_words(const double* series,
+                       size_t len,
+                       size_t n,
+                       size_t w,
+                       unsigned char c,
+                       unsigned int n_threads,
+                       sts_symbol* out)
+{
+  if (!series || !out || w == 0 || n % w != 0 || n > len || n == 0
+      || c < STS_MIN_CARDINALITY) {
+    return false;
+  }
+  struct sliding_job job = { series, len - n + 1, n, w, c, out, 0 };
+  size_t tasks = (job.words + STS_SLIDING_CHUNK - 1) / STS_SLIDING_CHUNK;
+  sts_parallel_for(n_threads, tasks, sliding_task, &job);
+  return job.failed == 0;
+}
+
+sts_word sts_from_sax_string(const char* symbols, unsigned char c)
+{
+  if (!symbols || c < STS_MIN_CARDINALITY || c > STS_MAX_STRING_CARDINALITY) {
+    return NULL;
+  }
+  size_t w = strlen(symbols);
+  if (w == 0) {
+    return NULL;
+  }
+  sts_symbol* sts_symbols = STS_MALLOC(w * sizeof*sts_symbols);
+  if (!sts_symbols) return NULL;
+  for (size_t i = 0; i < w; ++i) {
+    if (symbols[i] == '#') {
+      sts_symbols[i] = c;
+    } else {
+      if (symbols[i] < 'A' || symbols[i] >= (char)('A' + c)) return NULL;
+      sts_symbols[i] = c - (symbols[i] - 'A') - 1;
+    }
+  }
+  return new_word(0, w, c, sts_symbols);
+}
+
+bool sts_word_write_sax_string(const struct sts_word* a, char* str)
+{
+  if (!a || !a->symbols || !str || a->c > STS_MAX_STRING_CARDINALITY) {
+    return false;
+  }
   for (size_t i = 0; i < a->w; ++i) {
     unsigned char dig = a->symbols[i];
-    if (dig > a->c) {
-      free(str);
-      return NULL;
-    }
+    if (dig > a->c) return false;
     if (dig == a->c) {
       // All-NaN frame
       str[i] = '#'; // Not to mix with valid SAX symbols
@@ -572,6 +1779,19 @@ char* sts_word_to_sax_string(const struct sts_word* a)
       str[i] = a->c - a->symbols[i] - 1 + 'A';
     }
   }
+  str[a->w] = '\0';
+  return true;
+}
+
+char* sts_word_to_sax_string(const struct sts_word* a)
+{
+  if (!a || !a->symbols) return NULL;
+  char* str = STS_MALLOC((a->w + 1) * sizeof*str);
+  if (!str) return NULL;
+  if (!sts_word_write_sax_string(a, str)) {
+    STS_FREE(str);
+    return NULL;
+  }
   return str;
 }
 
@@ -581,11 +1801,10 @@ double sts_mindist(const struct sts_word* a, const struct sts_word* b)
   return sts_mindist_ab(a, b, &above, &below);
 }
 
-
-double sts_mindist_ab(const struct sts_word* a,
-                      const struct sts_word* b,
-                      double* above,
-                      double* below)
+static double mindist_ab(const struct sts_word* a,
+                         const struct sts_word* b,
+                         double* above,
+                         double* below)
 {
   // TODO: mindist estimation for words of different n, w and c
   if (!a || !b || a->c != b->c || a->w != b->w) {
@@ -609,24 +1828,15 @@ double sts_mindist_ab(const struct sts_word* a,
   }
 
   *above = *below = 0;
-  sts_symbol sa, sb;
-  for (size_t i = 0; i < w; ++i) {
-    sa = a->symbols[i];
-    sb = b->symbols[i];
-    if (sa != sb) {
-      if (sa == a->c) {  // if NaN use the maximum mindist
-        sa = sb > b->c - 1 - sb ? 0 : b->c - 1;
-      } else if (sb == b->c) {
-        sb = sa > a->c - 1 - sa ? 0 : a->c - 1;
-      }
-      double sym_distance = dist_table[c - STS_MIN_CARDINALITY][sa * c + sb];
-      sym_distance *= sym_distance;
-      if (sa < sb) { // internally we use the reversed iSAX ordering
-        *above += sym_distance;
-      } else {
-        *below += sym_distance;
-      }
-    }
+  // a NaN symbol takes the maximum mindist, internally we use the reversed
+  // iSAX ordering for above/below
+  if (c > STS_TABLE_CARDINALITY) {
+    mindist_kernel_wide(a->symbols, b->symbols, w, (unsigned char)c, above,
+                        below);
+  } else {
+    sts_call_once(&dist2_once, init_dist2_table);
+    mindist_kernels[c - STS_MIN_CARDINALITY](a->symbols, b->symbols, w, above,
+                                             below);
   }
   double compression = sqrt((double)n / (double)w);
   double distance = compression * sqrt(*above + *below);
@@ -635,6 +1845,174 @@ double sts_mindist_ab(const struct sts_word* a,
   return distance;
 }
 
+double sts_mindist_ab(const struct sts_word* a,
+                      const struct sts_word* b,
+                      double* above,
+                      double* below)
+{
+  STS_STAT_ADD(mindist_calls, 1);
+  STS_LATENCY_START(start);
+  double distance = mindist_ab(a, b, above, below);
+  STS_LATENCY_STOP(mindist_latency, start);
+  return distance;
+}
+
+double sts_trend_mindist(const struct sts_trend_word* a,
+                         const struct sts_trend_word* b)
+{
+  if (!a || !b || !a->slopes || !b->slopes || a->cs != b->cs
+      || a->cs < STS_MIN_CARDINALITY) {
+    return NAN;
+  }
+  double above, below;
+  double distance = sts_mindist_ab(&a->word, &b->word, &above, &below);
+  if (isnan(distance)) return NAN;
+  size_t n = a->word.n_values > 0 ? a->word.n_values : b->word.n_values;
+  double l = n > 0 ? (double)n / a->word.w : 1;
+  // the slope gaps are in units of sqrt(STS_SLOPE_VARIANCE / l), the squared
+  // offsets of a frame sum to l * (l^2 - 1) / 12
+  double scale = (l * l - 1) / 12 * STS_SLOPE_VARIANCE;
+  unsigned char cs = a->cs;
+  double sum = 0;
+  for (size_t i = 0; i < a->word.w; ++i) {
+    sts_symbol sa = a->slopes[i], sb = b->slopes[i];
+    if (sa > cs || sb > cs) return NAN;
+    if (sa == cs || sb == cs || sa == sb) continue;
+    double d = symbol_dist(sa, sb, cs);
+    sum += d * d;
+  }
+  return sqrt(distance * distance + scale * sum);
+}
+
+void sts_symbol_dist2_lut(const sts_symbol* query,
+                          size_t w,
+                          unsigned char c,
+                          double* lut)
+{
+  size_t row = (size_t)c + 1;
+  for (size_t i = 0; i < w; ++i, lut += row) {
+    sts_symbol q = query[i];
+    for (size_t s = 0; s < row; ++s) {
+      sts_symbol sa = q, sb = (sts_symbol)s;
+      if (sa == sb) {
+        lut[s] = 0;
+        continue;
+      }
+      if (sa == c) {
+        sa = sb > c - 1 - sb ? 0 : c - 1;
+      } else if (sb == c) {
+        sb = sa > c - 1 - sa ? 0 : c - 1;
+      }
+      double d = symbol_dist(sa, sb, c);
+      lut[s] = d * d;
+    }
+  }
+}
+
+bool sts_window_paa(const struct sts_window* window, double* paa)
+{
+  if (!valid_window(window) || !paa) return false;
+  transform_window(window, NULL, paa, NULL);
+  return true;
+}
+
+bool sts_paa_from_double_array(const double* series,
+                               size_t n_values,
+                               size_t w,
+                               double* paa)
+{
+  if (!series || !paa || w == 0 || n_values % w != 0) return false;
+  double mu, sigma;
+  estimate_mu_and_std(series, n_values, &mu, &sigma);
+  apply_sax_transform(n_values, w, STS_MIN_CARDINALITY, mu, sigma, NULL, paa,
+                      NULL, 0, series, NULL, NULL);
+  return true;
+}
+
+/*
+ * Squared distance between a normalized frame average and the breakpoint
+ * interval of symbol s. NaNs follow the sts_mindist conventions: a NaN side is
+ * taken as the symbol furthest away from the other side and NaN vs NaN is 0.
+ */
+static double paa_symbol_dist2(double p, sts_symbol s, unsigned char c)
+{
+  const float* b = sax_breaks(c);
+  if (isnan(p)) {
+    if (s == c) return 0;
+    sts_symbol far = s > c - 1 - s ? 0 : c - 1;
+    double d = symbol_dist(s, far, c);
+    return d * d;
+  }
+  if (isinf(p)) {
+    // infinite averages map to the extreme symbols, measure from their edge
+    p = p > 0 ? b[c - 2] : b[0];
+  }
+  if (s == c) {
+    sts_symbol ps = get_symbol(p, c);
+    s = ps > c - 1 - ps ? 0 : c - 1;
+  }
+  int a = c - 1 - s; // ascending interval index, symbols are reversed
+  double lo = a == 0 ? -INFINITY : b[a - 1];
+  double hi = a == c - 1 ? INFINITY : b[a];
+  double d = fmax(lo - p, 0) + fmax(p - hi, 0);
+  return d * d;
+}
+
+double sts_mindist_paa(const double* paa, const struct sts_word* word)
+{
+  if (!paa
+      || !word
+      || !word->symbols
+      || word->c < STS_MIN_CARDINALITY) {
+    return NAN;
+  }
+  double sum = 0;
+  for (size_t i = 0; i < word->w; ++i) {
+    if (word->symbols[i] > word->c) return NAN;
+    sum += paa_symbol_dist2(paa[i], word->symbols[i], word->c);
+  }
+  size_t n = word->n_values > 0 ? word->n_values : word->w;
+  return sqrt((double)n / (double)word->w * sum);
+}
+
+bool sts_mindist_paa_batch(const double* paa,
+                           size_t n_values,
+                           size_t w,
+                           unsigned char c,
+                           const sts_symbol* words,
+                           size_t count,
+                           double* out)
+{
+  if (!paa
+      || !words
+      || !out
+      || w == 0
+      || c < STS_MIN_CARDINALITY) {
+    return false;
+  }
+  // per-query table of squared distances, one row of c + 1 symbols per frame
+  size_t row = (size_t)c + 1;
+  double* lut = STS_MALLOC(w * row * sizeof*lut);
+  if (!lut) return false;
+  for (size_t i = 0; i < w; ++i) {
+    for (size_t s = 0; s < row; ++s) {
+      lut[i * row + s] = paa_symbol_dist2(paa[i], (sts_symbol)s, c);
+    }
+  }
+  double compression = (double)(n_values > 0 ? n_values : w) / (double)w;
+  for (size_t j = 0; j < count; ++j) {
+    const sts_symbol* word = words + j * w;
+    const double* l = lut;
+    double sum = 0;
+    for (size_t i = 0; i < w; ++i, l += row) {
+      sum += word[i] < row ? l[word[i]] : NAN;
+    }
+    out[j] = sqrt(compression * sum);
+  }
+  STS_FREE(lut);
+  return true;
+}
+
 bool sts_words_equal(const struct sts_word* a, const struct sts_word* b)
 {
   if (!a || !b) return false;
@@ -646,19 +2024,19 @@ bool sts_words_equal(const struct sts_word* a, const struct sts_word* b)
 
 bool sts_reset_window(sts_window w)
 {
-  if (!w || w->values == NULL || w->values->buffer == NULL) {
+  if (!valid_window(w)) {
     return false;
   }
-  w->values->tail = w->values->buffer + w->current_word.n_values - 1;
-  w->values->head = w->values->buffer;
-  w->values->mu = 0;
-  w->values->s2 = 0;
-  w->values->finite_cnt = 0;
-  for (size_t i = 0; i < w->current_word.n_values; ++i) {
-    w->values->buffer[i] = NAN;
+  rb_reset(w->values);
+  if (w->bucket) w->bucket->open = false;
+  if (w->ingest) sts_discard_ingest(w->ingest);
+  if (w->scale) {
+    w->scale->mu = w->scale->init_mu;
+    w->scale->var = w->scale->init_var;
   }
   for (size_t i = 0; i < w->current_word.w; ++i) {
     w->current_word.symbols[i] = w->current_word.c;
+    if (w->trend) w->trend->slopes[i] = w->trend->cs;
   }
   return true;
 }
@@ -667,29 +2045,38 @@ void sts_free_window(sts_window w)
 {
   if (!w) return;
   if (w->values != NULL) {
-    free(w->values->buffer);
-    free(w->values);
+    STS_FREE(w->values->buffer);
+    STS_FREE(w->values->fbuffer);
+    STS_FREE(w->values);
   }
-  if (w->current_word.symbols != NULL) free(w->current_word.symbols);
-  free(w);
+  if (w->current_word.symbols != NULL) STS_FREE(w->current_word.symbols);
+  free_window_options(w);
+  STS_FREE(w);
 }
 
 void sts_free_word(sts_word a)
 {
   if (!a) return;
-  if (a->symbols != NULL) free(a->symbols);
-  free(a);
+  if (a->symbols != NULL) STS_FREE(a->symbols);
+  STS_FREE(a);
+}
+
+void sts_free_trend_word(sts_trend_word a)
+{
+  if (!a) return;
+  STS_FREE(a->word.symbols);
+  STS_FREE(a->slopes);
+  STS_FREE(a);
 }
 
 sts_word sts_dup_word(const struct sts_word* a)
 {
   if (a == NULL
       || a->c < STS_MIN_CARDINALITY
-      || a->c > STS_MAX_CARDINALITY
       || a->symbols == NULL) {
     return NULL;
   }
-  sts_symbol* sts_symbols = malloc(a->w * sizeof*sts_symbols);
+  sts_symbol* sts_symbols = STS_MALLOC(a->w * sizeof*sts_symbols);
   memcpy(sts_symbols, a->symbols, a->w * sizeof*sts_symbols);
   return new_word(a->n_values, a->w, a->c, sts_symbols);
 }
@@ -703,7 +2090,7 @@ sts_word sts_dup_word(const struct sts_word* a)
 
 static char* test_get_symbol_zero()
 {
-  for (unsigned char c = STS_MIN_CARDINALITY; c <= STS_MAX_CARDINALITY; ++c) {
+  for (unsigned c = STS_MIN_CARDINALITY; c <= STS_MAX_CARDINALITY; ++c) {
     sts_symbol zero_encoded = get_symbol(0.0, c);
     mu_assert(zero_encoded == (c / 2) - 1 + (c % 2),
               "zero encoded into %u for cardinality %u", zero_encoded, c);
@@ -715,7 +2102,7 @@ static char* test_get_symbol_breaks()
 {
   sts_symbol break_encoded;
   double value;
-  for (unsigned char c = STS_MIN_CARDINALITY; c <= STS_MAX_CARDINALITY; ++c) {
+  for (unsigned char c = STS_MIN_CARDINALITY; c <= STS_TABLE_CARDINALITY; ++c) {
     for (int i = 0; i < c - 1; ++i) { // test below the break
       value = breaks[c - STS_MIN_CARDINALITY][i] - STS_STAT_EPS;
       break_encoded = get_symbol(value, c);
@@ -758,6 +2145,20 @@ static char* test_to_sax_sample()
   return NULL;
 }
 
+static char* test_write_sax_string()
+{
+  sts_word a = sts_from_sax_string("AD#B", 4);
+  char buf[8];
+  memset(buf, 'x', sizeof buf);
+  mu_assert(sts_word_write_sax_string(a, buf), "write failed");
+  mu_assert(strcmp(buf, "AD#B") == 0, "received %s", buf);
+  a->symbols[1] = 5;
+  mu_assert(!sts_word_write_sax_string(a, buf), "symbol above the NaN one");
+  mu_assert(!sts_word_to_sax_string(a), "symbol above the NaN one");
+  sts_free_word(a);
+  return NULL;
+}
+
 static char* test_to_sax_stationary()
 {
   double sseq[60] = {
@@ -777,7 +2178,7 @@ static char* test_to_sax_stationary()
     8, 8 + STS_STAT_EPS, 8, 8 + STS_STAT_EPS,
     8 - STS_STAT_EPS, 8, 8 + STS_STAT_EPS, 8
   };
-  for (unsigned char c = STS_MIN_CARDINALITY; c <= STS_MAX_CARDINALITY; ++c) {
+  for (unsigned c = STS_MIN_CARDINALITY; c <= STS_MAX_CARDINALITY; ++c) {
     for (size_t w = 1; w <= 60; ++w) {
       sts_word sax = sts_from_double_array(sseq, 60 - (60 % w), w, c);
       mu_assert(sax->symbols != NULL, "sax conversion failed");
@@ -819,7 +2220,7 @@ static char* test_sliding_word()
     4, -3.5, 1.8, -0.4 };
   double nseq[17] = { 5, 4.2, -3.7, 1.0, 0.1, -2.1, 2.2, -3.3, 4, 0.8, 0.7,
     -0.2, 4, -3.5, 1.8, -0.4, 0.0 };
-  for (unsigned char c = STS_MIN_CARDINALITY; c < STS_MAX_CARDINALITY; ++c) {
+  for (unsigned c = STS_MIN_CARDINALITY; c < STS_MAX_CARDINALITY; ++c) {
     for (size_t w = 1; w <= 16; w *= 2) {
       sts_word word = sts_from_double_array(seq, 16, w, c);
       sts_window window = sts_new_window(16, w, c);
@@ -939,15 +2340,810 @@ static char* test_nan_and_infinity_in_series()
   return NULL;
 }
 
+static char* test_window_stats()
+{
+  double seq[6] = { 1, NAN, INFINITY, 2, 3, 4 };
+  sts_window win = sts_new_window(4, 2, 4);
+  mu_assert(win->stats.appends == 0, "stats should start zeroed");
+  sts_append_value(win, seq[0]);
+  sts_append_array(win, seq + 1, 5);
+#ifdef STS_ENABLE_STATS
+  mu_assert(win->stats.appends == 5, "appends %llu", win->stats.appends);
+  mu_assert(win->stats.word_recomputes == 2, "recomputes %llu",
+            win->stats.word_recomputes);
+  mu_assert(win->stats.nan_inputs == 0 && win->stats.inf_inputs == 1,
+            "only the last n values of an array are appended");
+  struct sts_stats s;
+  sts_get_stats(&s);
+  mu_assert(s.enabled && s.append_latency.count >= 2, "append latency");
+#else
+  mu_assert(win->stats.appends == 0, "stats are compiled out");
+#endif
+  sts_free_window(win);
+  return NULL;
+}
+
+/*
+ * Float32 storage only differs from the double path when rounding moves a
+ * frame average across a breakpoint. For a zero-centred unit-step random walk
+ * no symbol disagrees. Riding the same walk on a 1e5 offset leaves float ~2
+ * decimal digits below the step size and ~0.16% of the symbols (260 of 160000)
+ * flip; a disagreeing symbol is always a neighbour of the double one.
+ */
+static char* test_float_window_disagreement()
+{
+  const double offsets[] = { 0, 1e5 };
+  const size_t max_mismatch_ppm[] = { 0, 2000 };
+  const size_t n = 64, w = 8, len = 20000;
+  const unsigned char c = 16;
+  for (size_t o = 0; o < sizeof offsets / sizeof*offsets; ++o) {
+    sts_window dwin = sts_new_window(n, w, c);
+    sts_window fwin = sts_new_float_window(n, w, c);
+    mu_assert(fwin && fwin->values->fbuffer && !fwin->values->buffer,
+              "sts_new_float_window failed");
+    unsigned int seed = 42;
+    double level = offsets[o];
+    size_t mismatches = 0;
+    for (size_t i = 0; i < len; ++i) {
+      seed = seed * 1103515245 + 12345;
+      level += ((seed >> 16) & 0x7fff) / 16384.0 - 1.0;
+      double value = (seed & 0xff) == 0 ? NAN : level;
+      const struct sts_word* dword = sts_append_value(dwin, value);
+      const struct sts_word* fword = sts_append_value(fwin, value);
+      for (size_t j = 0; j < w; ++j) {
+        int diff = dword->symbols[j] - fword->symbols[j];
+        if (diff != 0) {
+          ++mismatches;
+          mu_assert(diff == 1 || diff == -1, "symbols %u and %u differ by "
+                    "more than one at %" PRIuSIZE, dword->symbols[j],
+                    fword->symbols[j], i);
+        }
+      }
+      mu_assert(dwin->values->finite_cnt == fwin->values->finite_cnt,
+                "finite_cnt diverged at %" PRIuSIZE, i);
+    }
+    mu_assert(mismatches * 1000000 <= max_mismatch_ppm[o] * len * w,
+              "%" PRIuSIZE " of %" PRIuSIZE " symbols disagree", mismatches,
+              len * w);
+    mu_assert(sts_window_value(fwin, n - 1) == (float)level
+              || isnan(sts_window_value(fwin, n - 1)), "last value");
+    mu_assert(isnan(sts_window_value(fwin, n)), "out of range value");
+    mu_assert(sts_reset_window(fwin) && isnan(sts_window_value(fwin, 0)),
+              "reset failed");
+    sts_free_window(dwin);
+    sts_free_window(fwin);
+  }
+  return NULL;
+}
+
+static char* test_multi_window()
+{
+  mu_assert(!sts_new_multi_window(0, 8, 4, 4), "no channels");
+  mu_assert(!sts_new_multi_window(3, 9, 4, 4), "n not divisible by w");
+  mu_assert(!sts_append_row(NULL, NULL), "NULL window");
+  const size_t channels = 3, n = 12, w = 4;
+  sts_multi_window mw = sts_new_multi_window(channels, n, w, 6);
+  mu_assert(mw, "sts_new_multi_window failed");
+  mu_assert(mw->word.w == channels * w && mw->word.n_values == channels * n,
+            "concatenated word");
+  sts_window ref[3];
+  for (size_t i = 0; i < channels; ++i) ref[i] = sts_new_window(n, w, 6);
+  double rows[3 * 7];
+  for (size_t t = 0; t < 200; ++t) {
+    // single rows first, then batches of 7 rows
+    size_t n_rows = t < 100 ? 1 : 7;
+    for (size_t r = 0; r < n_rows; ++r) {
+      for (size_t i = 0; i < channels; ++i) {
+        size_t k = t * 7 + r;
+        double v = (k + i) % 17 == 0 ? NAN : sin(k * 0.2 * (i + 1)) * (i + 1);
+        rows[r * channels + i] = v;
+        sts_append_value(ref[i], v);
+      }
+    }
+    const struct sts_word* word = sts_append_rows(mw, rows, n_rows);
+    mu_assert(word == &mw->word, "returned word");
+    for (size_t i = 0; i < channels; ++i) {
+      mu_assert(sts_words_equal(&mw->windows[i].current_word,
+                                &ref[i]->current_word),
+                "t = %" PRIuSIZE " channel %" PRIuSIZE, t, i);
+      mu_assert(memcmp(word->symbols + i * w, ref[i]->current_word.symbols, w)
+                == 0, "concatenation");
+      mu_assert(mw->windows[i].values->mu == ref[i]->values->mu,
+                "mu of channel %" PRIuSIZE, i);
+    }
+  }
+  mu_assert(sts_reset_multi_window(mw), "reset failed");
+  mu_assert(isnan(sts_window_value(&mw->windows[1], n - 1)), "reset values");
+  mu_assert(mw->word.symbols[0] == 6, "reset symbols");
+  for (size_t i = 0; i < channels; ++i) sts_free_window(ref[i]);
+  sts_free_multi_window(mw);
+  return NULL;
+}
+
+/* Symbols of the frames of the last n values of series under a fixed scale */
+static void scaled_symbols(const double* series, size_t n, size_t w,
+                           unsigned char c, double mu, double std,
+                           sts_symbol* out)
+{
+  apply_sax_transform(n, w, c, mu, std, out, NULL, NULL, 0, series, series,
+                      series + n);
+}
+
+static char* test_window_scale()
+{
+  const size_t n = 60, w = 6;
+  const unsigned char c = 8;
+  sts_window win = sts_new_window(n, w, c);
+  sts_window fwin = sts_new_float_window(n, w, c);
+  sts_window shifted = sts_new_window(n, w, c);
+  mu_assert(!sts_set_window_scale(win, NAN, 1, 0), "NaN mu");
+  mu_assert(!sts_set_window_scale(win, 0, -1, 0), "negative sigma");
+  mu_assert(!sts_set_window_scale(win, 0, 1, 1), "alpha = 1");
+  mu_assert(!win->scale, "failed calls leave the window alone");
+  mu_assert(sts_set_window_scale(win, 10, 4, 0), "fixed scale");
+  mu_assert(sts_set_window_scale(fwin, 10, 4, 0), "fixed scale");
+  mu_assert(sts_set_window_scale(shifted, 10, 4, 0), "fixed scale");
+
+  double series[200], level = 10;
+  unsigned int seed = 3;
+  sts_symbol expected[6];
+  for (size_t i = 0; i < 200; ++i) {
+    seed = seed * 1103515245 + 12345;
+    level += ((seed >> 16) & 0x7fff) / 16384.0 - 1.0;
+    series[i] = i == 150 ? NAN : level;
+    const struct sts_word* a = sts_append_value(win, series[i]);
+    const struct sts_word* f = sts_append_value(fwin, (float)series[i]);
+    const struct sts_word* s = sts_append_value(shifted, series[i] + 8);
+    if (i + 1 < n) continue;
+    scaled_symbols(series + i + 1 - n, n, w, c, 10, 4, expected);
+    mu_assert(memcmp(a->symbols, expected, w) == 0, "word at %" PRIuSIZE, i);
+    for (size_t j = 0; j < w; ++j) {
+      int diff = f->symbols[j] - expected[j];
+      mu_assert(diff >= -1 && diff <= 1, "float word at %" PRIuSIZE, i);
+      // the level shift shows in the symbols
+      mu_assert(s->symbols[j] < a->symbols[j] || a->symbols[j] == 0,
+                "shifted word at %" PRIuSIZE, i);
+    }
+  }
+  double mu, sigma;
+  mu_assert(sts_get_window_scale(win, &mu, &sigma) && mu == 10 && sigma == 4,
+            "fixed scale moved to %f %f", mu, sigma);
+
+  // EWMA
+  const double alpha = 0.05;
+  mu_assert(sts_set_window_scale(win, 0, 1, alpha), "EWMA scale");
+  double ref_mu = 0, ref_var = 1;
+  for (size_t i = 0; i < 200; ++i) {
+    sts_append_value(win, series[i]);
+    if (isnan(series[i])) continue;
+    double diff = series[i] - ref_mu;
+    ref_mu += alpha * diff;
+    ref_var = (1 - alpha) * (ref_var + alpha * diff * diff);
+  }
+  mu_assert(sts_get_window_scale(win, &mu, &sigma), "get scale");
+  mu_assert(fabs(mu - ref_mu) < 1e-9 && fabs(sigma - sqrt(ref_var)) < 1e-9,
+            "EWMA %f %f != %f %f", mu, sigma, ref_mu, sqrt(ref_var));
+  scaled_symbols(series + 200 - n, n, w, c, mu, sigma, expected);
+  mu_assert(memcmp(win->current_word.symbols, expected, w) == 0,
+            "EWMA word");
+  mu_assert(sts_reset_window(win) && sts_get_window_scale(win, &mu, &sigma)
+            && mu == 0 && sigma == 1, "reset restores the scale");
+
+  // batched appends move an EWMA scale like one value at a time
+  double ramp[200];
+  for (size_t i = 0; i < 100; ++i) ramp[2 * i] = ramp[2 * i + 1] = i;
+  for (int single = 0; single < 2; ++single) {
+    sts_window one = single ? sts_new_float_window(8, 2, 4)
+                            : sts_new_window(8, 2, 4);
+    sts_window batch = single ? sts_new_float_window(8, 2, 4)
+                              : sts_new_window(8, 2, 4);
+    sts_multi_window rows = sts_new_multi_window(2, 8, 2, 4);
+    mu_assert(sts_set_window_scale(one, 0, 1, 0.1)
+              && sts_set_window_scale(batch, 0, 1, 0.1)
+              && sts_set_window_scale(&rows->windows[0], 0, 1, 0.1),
+              "EWMA scale");
+    for (size_t i = 0; i < 100; ++i) sts_append_value(one, ramp[2 * i]);
+    double ramp_values[100];
+    for (size_t i = 0; i < 100; ++i) ramp_values[i] = ramp[2 * i];
+    sts_append_array(batch, ramp_values, 100);
+    sts_append_rows(rows, ramp, 100);
+    double batch_mu, batch_sigma;
+    mu_assert(sts_get_window_scale(one, &mu, &sigma)
+              && sts_get_window_scale(batch, &batch_mu, &batch_sigma)
+              && mu == batch_mu && sigma == batch_sigma, "batched scale "
+              "%f %f != %f %f", batch_mu, batch_sigma, mu, sigma);
+    mu_assert(sts_get_window_scale(&rows->windows[0], &batch_mu, &batch_sigma)
+              && mu == batch_mu && sigma == batch_sigma, "rows scale");
+    mu_assert(sts_words_equal(&one->current_word, &batch->current_word)
+              && memcmp(one->current_word.symbols, rows->word.symbols, 2)
+              == 0, "batched word");
+    sts_free_window(one);
+    sts_free_window(batch);
+    sts_free_multi_window(rows);
+  }
+
+  // sliding statistics for comparison
+  sts_window plain = sts_new_window(n, w, c);
+  sts_append_array(plain, series, 100);
+  mu_assert(sts_get_window_scale(plain, &mu, &sigma)
+            && mu == plain->values->mu && sigma == get_window_std(plain),
+            "sliding scale");
+
+  // channels of a multi window
+  sts_multi_window mw = sts_new_multi_window(2, n, w, c);
+  mu_assert(sts_set_window_scale(&mw->windows[1], 10, 4, 0), "channel scale");
+  for (size_t i = 0; i < 100; ++i) {
+    double row[2] = { series[i], series[i] };
+    sts_append_row(mw, row);
+  }
+  scaled_symbols(series + 100 - n, n, w, c, 10, 4, expected);
+  mu_assert(memcmp(mw->word.symbols + w, expected, w) == 0, "channel word");
+  sts_free_multi_window(mw);
+
+  sts_free_window(win);
+  sts_free_window(fwin);
+  sts_free_window(shifted);
+  sts_free_window(plain);
+  return NULL;
+}
+
+static char* test_pyramid()
+{
+  const size_t factors[] = { 1, 10, 6 }, n = 12, w = 4;
+  const unsigned char c = 8;
+  mu_assert(!sts_new_pyramid(0, factors, n, w, c), "no levels");
+  const size_t zero[] = { 1, 0 };
+  mu_assert(!sts_new_pyramid(2, zero, n, w, c), "zero factor");
+  mu_assert(!sts_new_pyramid(3, factors, n, 5, c), "w not a divisor of n");
+  sts_pyramid p = sts_new_pyramid(3, factors, n, w, c);
+  mu_assert(p, "allocation failed");
+  mu_assert(!sts_pyramid_word(p, 3), "level out of range");
+
+  // reference: a window per level fed by explicit aggregation
+  sts_window ref[3];
+  for (size_t i = 0; i < 3; ++i) ref[i] = sts_new_window(n, w, c);
+  double level = 0, sum[3] = { 0, 0, 0 };
+  size_t cnt[3] = { 0, 0, 0 };
+  unsigned int seed = 9;
+  for (int pass = 0; pass < 2; ++pass) {
+    for (size_t t = 0; t < 1000; ++t) {
+      seed = seed * 1103515245 + 12345;
+      level += ((seed >> 16) & 0x7fff) / 16384.0 - 1.0;
+      double value = (seed & 0x1f) == 0 || (t >= 300 && t < 330) ? NAN : level;
+      size_t expected = 1;
+      sts_append_value(ref[0], value);
+      if (!isnan(value)) {
+        sum[1] += value;
+        ++cnt[1];
+      }
+      if ((t + 1) % 10 == 0) {
+        sts_append_value(ref[1], cnt[1] ? sum[1] / cnt[1] : NAN);
+        sum[2] += sum[1];
+        cnt[2] += cnt[1];
+        sum[1] = 0;
+        cnt[1] = 0;
+        expected = 2;
+      }
+      if ((t + 1) % 60 == 0) {
+        sts_append_value(ref[2], cnt[2] ? sum[2] / cnt[2] : NAN);
+        sum[2] = 0;
+        cnt[2] = 0;
+        expected = 3;
+      }
+      size_t updated = sts_pyramid_append(p, value);
+      mu_assert(updated == expected, "t = %" PRIuSIZE ": %" PRIuSIZE
+                " levels updated", t, updated);
+      for (size_t i = 0; i < 3; ++i) {
+        mu_assert(sts_words_equal(sts_pyramid_word(p, i),
+                                  &ref[i]->current_word),
+                  "t = %" PRIuSIZE " level %" PRIuSIZE, t, i);
+        mu_assert(p->rings[i].mu == ref[i]->values->mu, "mu of level %"
+                  PRIuSIZE, i);
+      }
+    }
+    // 1000 samples leave open buckets behind, reset discards them
+    mu_assert(sts_reset_pyramid(p), "reset failed");
+    for (size_t i = 0; i < 3; ++i) sts_reset_window(ref[i]);
+    mu_assert(sts_pyramid_word(p, 2)->symbols[0] == c, "reset symbols");
+    sum[1] = sum[2] = 0;
+    cnt[1] = cnt[2] = 0;
+  }
+  for (size_t i = 0; i < 3; ++i) sts_free_window(ref[i]);
+  sts_free_pyramid(p);
+  return NULL;
+}
+
+static char* test_sliding_words()
+{
+  const size_t n = 120, w = 12, len = STS_SLIDING_CHUNK + 5000;
+  const unsigned char c = 9;
+  sts_symbol out[12];
+  double* series = malloc(len * sizeof*series);
+  mu_assert(series, "allocation failed");
+  unsigned int seed = 17;
+  double level = 0;
+  for (size_t i = 0; i < len; ++i) {
+    seed = seed * 1103515245 + 12345;
+    level += ((seed >> 16) & 0x7fff) / 16384.0 - 1.0;
+    series[i] = (seed & 0x3f) == 0 || (i >= 1000 && i < 1100) ? NAN : level;
+  }
+  series[3000] = INFINITY;
+  series[len - 200] = -INFINITY;
+  mu_assert(!sts_sliding_words(series, n - 1, n, w, c, 1, out), "len < n");
+  mu_assert(!sts_sliding_words(series, n, n, 7, c, 1, out), "w not a divisor");
+
+  size_t words = len - n + 1;
+  sts_symbol* one = malloc(words * w);
+  sts_symbol* many = malloc(words * w);
+  mu_assert(one && many, "allocation failed");
+  mu_assert(sts_sliding_words(series, len, n, w, c, 1, one), "1 thread");
+  mu_assert(sts_sliding_words(series, len, n, w, c, 4, many), "4 threads");
+  mu_assert(memcmp(one, many, words * w) == 0, "depends on n_threads");
+
+  // a window fed from the start of each chunk
+  for (size_t first = 0; first < words; first += STS_SLIDING_CHUNK) {
+    sts_window win = sts_new_window(n, w, c);
+    for (size_t i = 0; i + 1 < n; ++i) sts_append_value(win, series[first + i]);
+    for (size_t t = first; t < words && t < first + STS_SLIDING_CHUNK; ++t) {
+      const struct sts_word* a = sts_append_value(win, series[t + n - 1]);
+      mu_assert(memcmp(a->symbols, one + t * w, w) == 0, "word %" PRIuSIZE,
+                t);
+    }
+    sts_free_window(win);
+  }
+  free(one);
+  free(many);
+  free(series);
+  return NULL;
+}
+
+static char* test_time_window()
+{
+  sts_window win = sts_new_time_window(4, 2, 4, 10);
+  sts_window plain = sts_new_window(4, 2, 4);
+  mu_assert(win && win->bucket, "sts_new_time_window failed");
+  mu_assert(sts_new_time_window(4, 2, 4, 0) == NULL, "interval must be > 0");
+  mu_assert(sts_append_timed(plain, 0, 1) == NULL, "plain window");
+  mu_assert(bucket_floor(-5, 10) == -10 && bucket_floor(20, 10) == 20,
+            "bucket_floor");
+
+  sts_append_timed(win, 0, 1);
+  sts_append_timed(win, 5, 3);
+  sts_append_timed(win, 7, NAN); // ignored like NaNs within a frame
+  mu_assert(isnan(sts_window_value(win, 3)), "bucket closed too early");
+  sts_append_timed(win, 12, 4);
+  mu_assert(sts_window_value(win, 3) == 2, "bucket mean");
+  sts_append_timed(win, 35, 6); // [20, 30) is a gap
+  sts_append_timed(win, 25, 100); // late, dropped
+  const struct sts_word* word = sts_advance_timed(win, 45);
+  double expected[4] = { 2, 4, NAN, 6 };
+  for (size_t i = 0; i < 4; ++i) {
+    double v = sts_window_value(win, i);
+    mu_assert(v == expected[i] || (isnan(v) && isnan(expected[i])),
+              "value %" PRIuSIZE " is %f", i, v);
+  }
+  sts_append_array(plain, expected, 4);
+  mu_assert(sts_words_equal(word, &plain->current_word),
+            "time window and plain window disagree");
+
+  word = sts_advance_timed(win, 1000000);
+  mu_assert(word->symbols[0] == 4 && word->symbols[1] == 4,
+            "a long gap should leave only NaN frames");
+  mu_assert(sts_reset_window(win) && !win->bucket->open, "reset failed");
+  sts_append_timed(win, -5, 1);
+  mu_assert(win->bucket->start == -10, "negative timestamps");
+  sts_free_window(win);
+  sts_free_window(plain);
+  return NULL;
+}
+
+static double znorm_distance(const double* x, const double* y, size_t n)
+{
+  double mx, sx, my, sy, sum = 0;
+  estimate_mu_and_std(x, n, &mx, &sx);
+  estimate_mu_and_std(y, n, &my, &sy);
+  for (size_t i = 0; i < n; ++i) {
+    double d = (x[i] - mx) / sx - (y[i] - my) / sy;
+    sum += d * d;
+  }
+  return sqrt(sum);
+}
+
+static char* test_paa()
+{
+  const size_t n = 32, w = 8, count = 64;
+  double x[32], ys[64][32], paa[8], wpaa[8], batch[64];
+  sts_symbol words[64 * 8];
+  unsigned int seed = 7;
+  for (size_t j = 0; j <= count; ++j) {
+    double* series = j < count ? ys[j] : x;
+    for (size_t i = 0; i < n; ++i) {
+      seed = seed * 1103515245 + 12345;
+      series[i] = (double)((seed >> 16) & 0x7fff) / 1000.0 + (i % 8);
+    }
+  }
+  mu_assert(sts_paa_from_double_array(x, n, w, paa), "paa failed");
+  sts_window win = sts_new_window(n, w, 8);
+  sts_append_array(win, x, n);
+  mu_assert(sts_window_paa(win, wpaa), "window paa failed");
+  for (size_t i = 0; i < w; ++i) {
+    mu_assert(fabs(paa[i] - wpaa[i]) < 1e-9, "window and array paa differ");
+  }
+  sts_free_window(win);
+
+  for (unsigned c = STS_MIN_CARDINALITY; c <= STS_MAX_CARDINALITY; ++c) {
+    sts_word query = sts_from_double_array(x, n, w, c);
+    for (size_t i = 0; i < w; ++i) {
+      mu_assert(get_symbol(paa[i], c) == query->symbols[i],
+                "paa doesn't symbolize into the word");
+    }
+    for (size_t j = 0; j < count; ++j) {
+      sts_word word = sts_from_double_array(ys[j], n, w, c);
+      memcpy(words + j * w, word->symbols, w);
+      double sax = sts_mindist(query, word);
+      double tight = sts_mindist_paa(paa, word);
+      double exact = znorm_distance(x, ys[j], n);
+      // the hand-written tables are rounded to 3 decimals
+      mu_assert(sax <= tight + 1e-2, "c = %u: paa bound %f looser than "
+                "sax %f", c, tight, sax);
+      mu_assert(tight <= exact + 1e-9, "c = %u: paa bound %f above exact "
+                "distance %f", c, tight, exact);
+      sts_free_word(word);
+    }
+    mu_assert(sts_mindist_paa_batch(paa, n, w, c, words, count, batch),
+              "batch failed");
+    for (size_t j = 0; j < count; ++j) {
+      sts_word word = sts_from_double_array(ys[j], n, w, c);
+      mu_assert(fabs(batch[j] - sts_mindist_paa(paa, word)) < 1e-12,
+                "batch and single distances differ");
+      sts_free_word(word);
+    }
+    sts_free_word(query);
+  }
+
+  double nan_paa[2] = { NAN, -1.0 };
+  sts_word nan_word = sts_from_sax_string("#A", 4);
+  sts_word far = sts_from_sax_string("DA", 4);
+  sts_word nan_query = sts_from_sax_string("#A", 4);
+  mu_assert(isclose(sts_mindist_paa(nan_paa, nan_word),
+                    sts_mindist(nan_query, nan_word)), "NaN vs NaN frame");
+  mu_assert(isclose(sts_mindist_paa(nan_paa, far),
+                    sts_mindist(nan_query, far)), "NaN vs symbol frame");
+  sts_free_word(nan_word);
+  sts_free_word(far);
+  sts_free_word(nan_query);
+  return NULL;
+}
+
+static char* test_trend()
+{
+  double ramps[8] = { 0, 1, 2, 3, 3, 2, 1, 0 };
+  double mirror[8] = { 3, 2, 1, 0, 0, 1, 2, 3 };
+  mu_assert(!sts_trend_from_double_array(ramps, 8, 3, 4, 4), "w");
+  mu_assert(!sts_trend_from_double_array(ramps, 8, 2, 4, 1), "cs");
+  sts_trend_word a = sts_trend_from_double_array(ramps, 8, 2, 4, 4);
+  sts_trend_word b = sts_trend_from_double_array(mirror, 8, 2, 4, 4);
+  mu_assert(a && b && sts_words_equal(&a->word, &b->word), "same averages");
+  mu_assert(a->slopes[0] < a->slopes[1] && a->slopes[0] == b->slopes[1]
+            && a->slopes[1] == b->slopes[0], "opposite slopes");
+  double d = sts_trend_mindist(a, b);
+  mu_assert(sts_mindist(&a->word, &b->word) == 0 && d > 0
+            && d <= znorm_distance(ramps, mirror, 8), "ramps: %f", d);
+  mu_assert(sts_trend_mindist(a, a) == 0, "self distance");
+  sts_trend_word other = sts_trend_from_double_array(mirror, 8, 2, 4, 5);
+  mu_assert(isnan(sts_trend_mindist(a, other)), "cs mismatch");
+  sts_free_trend_word(other);
+  sts_free_trend_word(a);
+  sts_free_trend_word(b);
+
+  // lower bound of the exact distance, tighter than the averages alone
+  enum { n = 64, w = 4, count = 100 };
+  double (*walks)[n] = malloc(count * sizeof*walks);
+  sts_trend_word words[count];
+  unsigned int seed = 23;
+  for (size_t j = 0; j < count; ++j) {
+    double v = 0;
+    for (size_t i = 0; i < n; ++i) {
+      seed = seed * 1103515245 + 12345;
+      v += ((seed >> 16) & 0x7fff) / 16384.0 - 1.0;
+      walks[j][i] = v;
+    }
+    words[j] = sts_trend_from_double_array(walks[j], n, w, 8, 8);
+    mu_assert(words[j], "trend word");
+  }
+  size_t sax_pruned = 0, trend_pruned = 0;
+  for (size_t q = 0; q < 10; ++q) {
+    double nearest = INFINITY;
+    for (size_t j = 0; j < count; ++j) {
+      if (j == q) continue;
+      nearest = fmin(nearest, znorm_distance(walks[q], walks[j], n));
+    }
+    for (size_t j = 0; j < count; ++j) {
+      if (j == q) continue;
+      double sax = sts_mindist(&words[q]->word, &words[j]->word);
+      double trend = sts_trend_mindist(words[q], words[j]);
+      // the hand-written tables are rounded to 3 decimals
+      mu_assert(sax <= trend && trend <= znorm_distance(walks[q], walks[j], n)
+                + 1e-2, "bounds %f %f", sax, trend);
+      sax_pruned += sax > nearest;
+      trend_pruned += trend > nearest;
+    }
+  }
+  mu_assert(trend_pruned > sax_pruned, "pruned %" PRIuSIZE " vs %" PRIuSIZE,
+            trend_pruned, sax_pruned);
+
+  // windows keep the slopes of their last n values
+  sts_window win = sts_new_window(n, w, 8);
+  sts_window fwin = sts_new_float_window(n, w, 8);
+  mu_assert(!sts_window_trend(win) && !sts_enable_window_trend(win, 1),
+            "disabled");
+  mu_assert(sts_enable_window_trend(win, 6) && sts_enable_window_trend(win, 8)
+            && sts_enable_window_trend(fwin, 8), "enable");
+  const struct sts_trend_word* t = sts_window_trend(win);
+  mu_assert(t && t->cs == 8 && t->word.symbols == win->current_word.symbols
+            && t->slopes[0] == 8, "empty window");
+  for (size_t i = 0; i < 3 * n; ++i) {
+    double value = walks[i / n][i % n] + (i == 100 ? NAN : 0);
+    sts_append_value(win, value);
+    sts_append_value(fwin, (float)value);
+    if (i + 1 < n) continue;
+    double last[n];
+    for (size_t k = 0; k < n; ++k) last[k] = sts_window_value(win, k);
+    sts_trend_word ref = sts_trend_from_double_array(last, n, w, 8, 8);
+    mu_assert(sts_words_equal(&ref->word, &t->word)
+              && memcmp(ref->slopes, t->slopes, w) == 0, "window at %"
+              PRIuSIZE, i);
+    mu_assert(memcmp(sts_window_trend(fwin)->slopes, t->slopes, w) == 0,
+              "float window at %" PRIuSIZE, i);
+    sts_free_trend_word(ref);
+  }
+  mu_assert(sts_reset_window(win) && t->slopes[w - 1] == 8, "reset");
+
+  // so do channels and levels, their owner frees the trends and buckets
+  sts_multi_window mw = sts_new_multi_window(2, n, w, 8);
+  size_t factors[] = { 1, 2 };
+  sts_pyramid p = sts_new_pyramid(2, factors, n, w, 8);
+  mu_assert(mw && p, "owners");
+  mu_assert(sts_enable_window_trend(&mw->windows[1], 8)
+            && sts_enable_window_trend(&p->windows[0], 8), "enable embedded");
+  for (size_t i = 0; i < n; ++i) {
+    double row[2] = { 0, walks[0][i] };
+    sts_append_value(win, walks[0][i]);
+    mu_assert(sts_append_row(mw, row) && sts_pyramid_append(p, walks[0][i]),
+              "append %" PRIuSIZE, i);
+  }
+  mu_assert(memcmp(mw->windows[1].trend->slopes, t->slopes, w) == 0
+            && memcmp(p->windows[0].trend->slopes, t->slopes, w) == 0,
+            "embedded slopes");
+  mu_assert(sts_set_window_interval(&mw->windows[0], 10)
+            && sts_set_window_interval(&p->windows[1], 10), "buckets");
+  sts_free_multi_window(mw);
+  sts_free_pyramid(p);
+  sts_free_window(win);
+  sts_free_window(fwin);
+  for (size_t j = 0; j < count; ++j) sts_free_trend_word(words[j]);
+  free(walks);
+  return NULL;
+}
+
+static char* test_symbol_kernels()
+{
+  for (unsigned char c = STS_MIN_CARDINALITY; c <= STS_TABLE_CARDINALITY; ++c) {
+    sts_symbol (*symbol)(double, unsigned char) =
+      symbol_kernels[c - STS_MIN_CARDINALITY];
+    for (double v = -4; v <= 4; v += 0.0005) {
+      mu_assert(symbol(v, c) == get_symbol(v, c), "c = %u: %f", c, v);
+    }
+    for (int i = 0; i < c - 1; ++i) {
+      double b = breaks[c - STS_MIN_CARDINALITY][i];
+      double around[] = { b, nextafter(b, -INFINITY), nextafter(b, INFINITY) };
+      for (int j = 0; j < 3; ++j) {
+        mu_assert(symbol(around[j], c) == get_symbol(around[j], c),
+                  "c = %u: breakpoint %.17g", c, around[j]);
+      }
+    }
+    mu_assert(symbol(INFINITY, c) == get_symbol(INFINITY, c), "+inf");
+    mu_assert(symbol(-INFINITY, c) == get_symbol(-INFINITY, c), "-inf");
+    mu_assert(symbol(NAN, c) == c, "NaN");
+  }
+  return NULL;
+}
+
+static char* test_lut_symbols()
+{
+  sts_call_once(&lut_once, init_lut);
+  for (unsigned char c = STS_MIN_CARDINALITY; c <= STS_TABLE_CARDINALITY; ++c) {
+    const float* b = breaks[c - STS_MIN_CARDINALITY];
+    sts_symbol (*symbol)(double, unsigned char) =
+      lut_symbol_kernels[c - STS_MIN_CARDINALITY];
+    for (size_t k = 0; k < STS_LUT_BUCKETS; ++k) {
+      double lo = k / STS_LUT_SCALE - STS_LUT_RANGE - STS_LUT_MARGIN;
+      double hi = (k + 1) / STS_LUT_SCALE - STS_LUT_RANGE + STS_LUT_MARGIN;
+      int inside = 0;
+      for (int i = 0; i < c - 1; ++i) inside += b[i] > lo && b[i] <= hi;
+      mu_assert(inside <= 1, "c = %u: bucket %" PRIuSIZE " straddles %d "
+                "breakpoints", c, k, inside);
+      // bucket edges and a few ulps around them
+      double edge = k / STS_LUT_SCALE - STS_LUT_RANGE;
+      double v = edge;
+      for (int j = 0; j < 4; ++j) v = nextafter(v, -INFINITY);
+      for (int j = 0; j < 8; ++j, v = nextafter(v, INFINITY)) {
+        mu_assert(symbol(v, c) == get_symbol(v, c), "c = %u: edge %.17g", c, v);
+      }
+    }
+    for (double v = -5; v <= 5; v += 0.0001) {
+      mu_assert(symbol(v, c) == get_symbol(v, c), "c = %u: %.17g", c, v);
+    }
+    for (int i = 0; i < c - 1; ++i) {
+      double v = b[i];
+      for (int j = 0; j < 4; ++j) v = nextafter(v, -INFINITY);
+      for (int j = 0; j < 8; ++j, v = nextafter(v, INFINITY)) {
+        mu_assert(symbol(v, c) == get_symbol(v, c), "c = %u: breakpoint %.17g",
+                  c, v);
+      }
+    }
+    mu_assert(symbol(INFINITY, c) == get_symbol(INFINITY, c), "+inf");
+    mu_assert(symbol(-INFINITY, c) == get_symbol(-INFINITY, c), "-inf");
+    mu_assert(symbol(DBL_MAX, c) == get_symbol(DBL_MAX, c), "DBL_MAX");
+    mu_assert(symbol(NAN, c) == c, "NaN");
+  }
+  return NULL;
+}
+
+static char* test_transform_kernels()
+{
+  size_t sizes[][2] = { { 8, 8 }, { 16, 8 }, { 60, 4 }, { 63, 9 }, { 96, 4 },
+    { 1440, 24 }, { 50, 2 } };
+  unsigned int seed = 11;
+  for (size_t k = 0; k < sizeof sizes / sizeof*sizes; ++k) {
+    size_t n = sizes[k][0], w = sizes[k][1];
+    for (int single = 0; single < 2; ++single) {
+      sts_window win = single ? sts_new_float_window(n, w, 9)
+                              : sts_new_window(n, w, 9);
+      sts_symbol* generic = malloc(w);
+      sts_symbol* generic_slopes = malloc(w);
+      double* paa = malloc(w * sizeof*paa);
+      double* generic_paa = malloc(w * sizeof*paa);
+      mu_assert(sts_enable_window_trend(win, 7), "trend");
+      sts_symbol* slopes = win->trend->slopes;
+      for (size_t t = 0; t < 3 * n; ++t) {
+        seed = seed * 1103515245 + 12345;
+        sts_append_value(win, ((seed >> 16) & 0x7fff) / 100.0 + (t % 5));
+        if (t < n) continue;
+        win->kernels.transform(win, win->current_word.symbols, paa, slopes);
+        transform_window_generic(win, generic, generic_paa, generic_slopes);
+        mu_assert(memcmp(generic, win->current_word.symbols, w) == 0,
+                  "n = %" PRIuSIZE " w = %" PRIuSIZE ": symbols differ", n, w);
+        mu_assert(memcmp(paa, generic_paa, w * sizeof*paa) == 0,
+                  "n = %" PRIuSIZE " w = %" PRIuSIZE ": paa differs", n, w);
+        mu_assert(memcmp(slopes, generic_slopes, w) == 0,
+                  "n = %" PRIuSIZE " w = %" PRIuSIZE ": slopes differ", n, w);
+      }
+      free(generic);
+      free(generic_slopes);
+      free(paa);
+      free(generic_paa);
+      sts_free_window(win);
+    }
+  }
+  return NULL;
+}
+
+static char* test_mindist_kernels()
+{
+  unsigned int seed = 13;
+  for (unsigned c = STS_MIN_CARDINALITY; c <= STS_MAX_CARDINALITY; ++c) {
+    for (int t = 0; t < 200; ++t) {
+      sts_symbol a[8], b[8];
+      double above = 0, below = 0;
+      for (int i = 0; i < 8; ++i) {
+        seed = seed * 1103515245 + 12345;
+        a[i] = (seed >> 16) % (c + 1);
+        b[i] = (seed >> 8) % (c + 1);
+        sts_symbol sa = a[i], sb = b[i];
+        if (sa == sb) continue;
+        if (sa == c) {
+          sa = sb > c - 1 - sb ? 0 : c - 1;
+        } else if (sb == c) {
+          sb = sa > c - 1 - sa ? 0 : c - 1;
+        }
+        double d = symbol_dist(sa, sb, c);
+        if (sa < sb) {
+          above += d * d;
+        } else {
+          below += d * d;
+        }
+      }
+      struct sts_word wa = { a, 16, 8, c }, wb = { b, 16, 8, c };
+      double ka, kb, d = sts_mindist_ab(&wa, &wb, &ka, &kb);
+      mu_assert(ka == sqrt(2.0) * sqrt(above) && kb == sqrt(2.0) * sqrt(below)
+                && d == sqrt(2.0) * sqrt(above + below), "c = %u", c);
+    }
+  }
+  return NULL;
+}
+
+static char* test_wide_cardinalities()
+{
+  // the hand-written breakpoints are the same quantiles to 3 decimals
+  for (unsigned c = STS_MIN_CARDINALITY; c <= STS_TABLE_CARDINALITY; ++c) {
+    for (unsigned i = 1; 2 * i <= c; ++i) {
+      double q = inverse_normal_cdf((double)i / c);
+      mu_assert(fabs(q - breaks[c - STS_MIN_CARDINALITY][i - 1]) < 1e-3,
+                "c = %u: quantile %u is %f", c, i, q);
+    }
+  }
+  for (double p = 1e-4; p <= 0.5; p += 1e-3) {
+    double q = inverse_normal_cdf(p);
+    mu_assert(fabs(0.5 * erfc(-q / sqrt(2.0)) - p) < 1e-14, "p = %g", p);
+  }
+
+  unsigned int seed = 17;
+  for (unsigned c = STS_TABLE_CARDINALITY + 1; c <= STS_MAX_CARDINALITY; ++c) {
+    const float* b = sax_breaks(c);
+    for (unsigned i = 0; i + 1 < c; ++i) {
+      mu_assert(b[i] == -b[c - 2 - i], "c = %u: asymmetric at %u", c, i);
+      mu_assert(i == 0 || b[i - 1] < b[i], "c = %u: not ascending at %u", c, i);
+      // one ulp below a breakpoint is still in the interval below it
+      sts_symbol below = (sts_symbol)(c - 1 - i);
+      mu_assert(get_symbol(nextafter(b[i], -INFINITY), c) == below
+                && get_symbol(b[i], c) == below - 1, "c = %u: breakpoint %u",
+                c, i);
+    }
+    mu_assert(get_symbol(-INFINITY, c) == c - 1 && get_symbol(INFINITY, c) == 0
+              && get_symbol(NAN, c) == c, "c = %u: extremes", c);
+    for (int t = 0; t < 50; ++t) {
+      seed = seed * 1103515245 + 12345;
+      sts_symbol sa = (seed >> 16) % c, sb = (seed >> 8) % c;
+      sts_symbol top = sa < sb ? sa : sb, bottom = sa < sb ? sb : sa;
+      // gap between the intervals, s covers [b[c - 2 - s], b[c - 1 - s])
+      double gap = bottom - top < 2 ? 0
+                   : (double)b[c - 2 - top] - b[c - 1 - bottom];
+      mu_assert(symbol_dist(sa, sb, c) == gap && gap >= 0, "c = %u: %u %u", c,
+                sa, sb);
+    }
+  }
+  mu_assert(fabs(sax_breaks(100)[0] + 2.3263479) < 1e-6, "1st percentile");
+
+  sts_word wide = sts_from_double_array((double[]){ 1, 2, 3, 4 }, 4, 4, 200);
+  mu_assert(wide && wide->c == 200, "c = 200");
+  mu_assert(!sts_word_to_sax_string(wide), "no string form above 26 symbols");
+  sts_free_word(wide);
+  mu_assert(!sts_from_sax_string("AB", STS_MAX_STRING_CARDINALITY + 1),
+            "no string form above 26 symbols");
+  sts_word z = sts_from_sax_string("ZA#", STS_MAX_STRING_CARDINALITY);
+  char* str = sts_word_to_sax_string(z);
+  mu_assert(z && z->symbols[0] == 0 && str && strcmp(str, "ZA#") == 0,
+            "26 symbols");
+  free(str);
+  sts_free_word(z);
+  return NULL;
+}
+
 static char* all_tests()
 {
   mu_run_test(test_get_symbol_zero);
   mu_run_test(test_get_symbol_breaks);
   mu_run_test(test_to_sax_sample);
+  mu_run_test(test_write_sax_string);
   mu_run_test(test_to_sax_stationary);
   mu_run_test(test_nan_and_infinity_in_series);
   mu_run_test(test_sliding_word);
   mu_run_test(test_online_mu_sigma_random);
+  mu_run_test(test_window_stats);
+  mu_run_test(test_float_window_disagreement);
+  mu_run_test(test_multi_window);
+  mu_run_test(test_window_scale);
+  mu_run_test(test_pyramid);
+  mu_run_test(test_sliding_words);
+  mu_run_test(test_time_window);
+  mu_run_test(test_paa);
+  mu_run_test(test_trend);
+  mu_run_test(test_symbol_kernels);
+  mu_run_test(test_lut_symbols);
+  mu_run_test(test_transform_kernels);
+  mu_run_test(test_mindist_kernels);
+  mu_run_test(test_wide_cardinalities);
   return NULL;
 }
 
@@ -0,0 +1,264 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Sliding SAX encoder for series files */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "symtseries.h"
+#include "sts_word_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Words per sts_sliding_words call, a multiple of STS_SLIDING_CHUNK */
+#define ENCODE_SEGMENT (16 * STS_SLIDING_CHUNK)
+#define ENCODE_LINE_MAX 65536
+
+typedef enum {
+  FORMAT_DOUBLE, FORMAT_FLOAT, FORMAT_CSV
+} input_format;
+
+/* Sequential reader over a mapped binary file or a CSV stream */
+typedef struct reader {
+  input_format format;
+  const unsigned char* map;
+  size_t map_size, pos; // bytes
+  FILE* fh;
+  size_t column; // 1-based CSV column
+  char* line;
+} reader;
+
+static double now_s()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool open_reader(reader* r, const char* path, bool header)
+{
+  if (r->format == FORMAT_CSV) {
+    r->fh = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    r->line = malloc(ENCODE_LINE_MAX);
+    if (!r->fh || !r->line) return false;
+    if (header && !fgets(r->line, ENCODE_LINE_MAX, r->fh)) return false;
+    return true;
+  }
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  r->map_size = (size_t)st.st_size;
+  if (r->map_size) {
+    void* map = mmap(NULL, r->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      close(fd);
+      return false;
+    }
+    posix_madvise(map, r->map_size, POSIX_MADV_SEQUENTIAL);
+    r->map = map;
+  }
+  close(fd);
+  return true;
+}
+
+static void close_reader(reader* r)
+{
+  if (r->map) munmap((void*)r->map, r->map_size);
+  if (r->fh && r->fh != stdin) fclose(r->fh);
+  free(r->line);
+}
+
+/* Empty and unparseable fields read as NaN */
+static double parse_field(const char* line, size_t column)
+{
+  for (size_t i = 1; i < column; ++i) {
+    line = strchr(line, ',');
+    if (!line) return NAN;
+    ++line;
+  }
+  char* end;
+  double value = strtod(line, &end);
+  if (end == line) return NAN;
+  while (*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n') ++end;
+  return *end == ',' || *end == '\0' ? value : NAN;
+}
+
+/* Reads up to max values, returns the number read */
+static size_t fill(reader* r, double* values, size_t max)
+{
+  size_t cnt = 0;
+  if (r->format == FORMAT_CSV) {
+    while (cnt < max && fgets(r->line, ENCODE_LINE_MAX, r->fh)) {
+      values[cnt++] = parse_field(r->line, r->column);
+    }
+    return cnt;
+  }
+  size_t size = r->format == FORMAT_DOUBLE ? sizeof(double) : sizeof(float);
+  size_t avail = (r->map_size - r->pos) / size;
+  cnt = avail < max ? avail : max;
+  if (r->format == FORMAT_DOUBLE) {
+    memcpy(values, r->map + r->pos, cnt * size);
+  } else {
+    for (size_t i = 0; i < cnt; ++i) {
+      float f;
+      memcpy(&f, r->map + r->pos + i * size, size);
+      values[i] = f;
+    }
+  }
+  r->pos += cnt * size;
+  return cnt;
+}
+
+static void usage(const char* name)
+{
+  fprintf(stderr, "usage: %s -n size -w length -c cardinality "
+          "[--format double|float|csv] [--column k] [--header] [--step s] "
+          "[--threads t] input output\n"
+          "Writes the SAX word of every length n subsequence of input "
+          "(every s-th with --step)\nas a word file; CSV input is read from "
+          "column k (default 1), - reads stdin.\n", name);
+}
+
+int main(int argc, char* argv[])
+{
+  size_t n = 0, w = 0, step = 1, column = 1;
+  unsigned int c = 0, n_threads = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus > 0) n_threads = (unsigned int)cpus;
+#endif
+  bool header = false;
+  reader r;
+  memset(&r, 0, sizeof r);
+  const char* paths[2] = { NULL, NULL };
+  size_t n_paths = 0;
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (strcmp(arg, "-n") == 0 && has_value) {
+      n = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "-w") == 0 && has_value) {
+      w = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "-c") == 0 && has_value) {
+      c = (unsigned int)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "--format") == 0 && has_value) {
+      const char* f = argv[++i];
+      if (strcmp(f, "double") == 0) {
+        r.format = FORMAT_DOUBLE;
+      } else if (strcmp(f, "float") == 0) {
+        r.format = FORMAT_FLOAT;
+      } else if (strcmp(f, "csv") == 0) {
+        r.format = FORMAT_CSV;
+      } else {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (strcmp(arg, "--column") == 0 && has_value) {
+      column = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "--header") == 0) {
+      header = true;
+    } else if (strcmp(arg, "--step") == 0 && has_value) {
+      step = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "--threads") == 0 && has_value) {
+      n_threads = (unsigned int)strtoul(argv[++i], NULL, 10);
+    } else if (arg[0] != '-' || strcmp(arg, "-") == 0) {
+      if (n_paths == 2) {
+        usage(argv[0]);
+        return 1;
+      }
+      paths[n_paths++] = arg;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (n_paths != 2 || w == 0 || n < w || n % w != 0
+      || c < STS_MIN_CARDINALITY || c > STS_MAX_CARDINALITY || step == 0
+      || column == 0 || n_threads == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  r.column = column;
+
+  // consecutive segments overlap by the n - 1 values of the straddling words
+  size_t capacity = ENCODE_SEGMENT + n - 1;
+  double* values = malloc(capacity * sizeof*values);
+  sts_symbol* words = malloc((size_t)ENCODE_SEGMENT * w);
+  if (!values || !words) {
+    fprintf(stderr, "memory allocation failed\n");
+    return 1;
+  }
+  if (!open_reader(&r, paths[0], header)) {
+    fprintf(stderr, "%s: %s\n", paths[0], strerror(errno));
+    return 1;
+  }
+  FILE* out = fopen(paths[1], "wb");
+  if (!out) {
+    fprintf(stderr, "%s: %s\n", paths[1], strerror(errno));
+    return 1;
+  }
+  struct sts_word_file_header h;
+  sts_init_word_file_header(&h, n, w, (unsigned char)c, step);
+  bool ok = fwrite(&h, sizeof h, 1, out) == 1;
+
+  double start = now_s();
+  size_t have = 0, consumed = 0;
+  while (ok) {
+    have += fill(&r, values + have, capacity - have);
+    if (have < n) break;
+    size_t cnt = have - n + 1;
+    if (!sts_sliding_words(values, have, n, w, (unsigned char)c, n_threads,
+                           words)) {
+      fprintf(stderr, "encoding failed\n");
+      ok = false;
+      break;
+    }
+    if (step == 1) {
+      ok = fwrite(words, w, cnt, out) == cnt;
+      h.count += cnt;
+    } else {
+      // first word of the segment on the step grid
+      for (size_t i = (step - consumed % step) % step; ok && i < cnt;
+           i += step) {
+        ok = fwrite(words + i * w, w, 1, out) == 1;
+        ++h.count;
+      }
+    }
+    consumed += cnt;
+    memmove(values, values + cnt, (n - 1) * sizeof*values);
+    have = n - 1;
+  }
+  double elapsed = now_s() - start;
+  size_t total = consumed + have;
+  if (ok) {
+    ok = fseek(out, 0, SEEK_SET) == 0 && fwrite(&h, sizeof h, 1, out) == 1;
+  }
+  if (fclose(out) != 0) ok = false;
+  if (!ok) {
+    fprintf(stderr, "%s: write failed\n", paths[1]);
+  } else {
+    fprintf(stderr, "%" PRIuSIZE " values, %llu words in %.3f s "
+            "(%.1f M values/s)\n", total, (unsigned long long)h.count,
+            elapsed, elapsed > 0 ? total / elapsed * 1e-6 : 0.0);
+  }
+  close_reader(&r);
+  free(values);
+  free(words);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,483 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Similarity search over word files */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "symtseries.h"
+#include "../sts_internal.h"
+#include "../sts_parallel.h"
+#include "sts_word_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SEARCH_MAX_QUERIES 64
+#define SEARCH_PARTITION 65536
+#define SEARCH_NO_OFFSET ((size_t)-1)
+
+typedef struct mapping {
+  const unsigned char* data;
+  size_t size;
+} mapping;
+
+/* A query word, plus its normalized values when they are known */
+typedef struct query {
+  const char* label;
+  sts_word word;
+  double* values;
+  size_t at; // series offset of a --query-at query, SEARCH_NO_OFFSET otherwise
+} query;
+
+typedef struct options {
+  size_t k;
+  double threshold; // NAN for top-k
+  unsigned int n_threads;
+  bool float_series;
+} options;
+
+typedef struct match {
+  size_t index;
+  double mindist, distance; // distance is NAN without refinement
+} match;
+
+static double now_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+static bool map_file(const char* path, mapping* m)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  bool ok = fstat(fd, &st) == 0 && st.st_size > 0;
+  if (ok) {
+    m->size = (size_t)st.st_size;
+    void* data = mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ok = data != MAP_FAILED;
+    if (ok) m->data = data;
+  }
+  close(fd);
+  return ok;
+}
+
+static double series_value(const mapping* series, bool is_float, size_t i)
+{
+  if (is_float) {
+    float f;
+    memcpy(&f, series->data + i * sizeof f, sizeof f);
+    return f;
+  }
+  double d;
+  memcpy(&d, series->data + i * sizeof d, sizeof d);
+  return d;
+}
+
+/*
+ * Normalizes n values like the SAX words do (population deviation, zeros
+ * below STS_STAT_EPS), false if any of them isn't finite
+ */
+static bool znormalize(double* values, size_t n)
+{
+  double mu = 0, s2 = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (!isfinite(values[i])) return false;
+    mu += values[i];
+  }
+  mu /= n;
+  for (size_t i = 0; i < n; ++i) s2 += (values[i] - mu) * (values[i] - mu);
+  double std = sqrt(s2 / n);
+  for (size_t i = 0; i < n; ++i) {
+    values[i] = std < STS_STAT_EPS ? 0 : (values[i] - mu) / std;
+  }
+  return true;
+}
+
+/* Reads numbers separated by whitespace or commas, NULL unless exactly n */
+static double* read_values(const char* path, size_t n)
+{
+  FILE* fh = fopen(path, "r");
+  if (!fh) return NULL;
+  double* values = malloc(n * sizeof*values);
+  size_t cnt = 0;
+  char token[128];
+  int ch = 0;
+  while (values && ch != EOF) {
+    size_t len = 0;
+    while ((ch = fgetc(fh)) != EOF && ch != ',' && ch != ' ' && ch != '\t'
+           && ch != '\n' && ch != '\r') {
+      if (len + 1 < sizeof token) token[len++] = (char)ch;
+    }
+    if (len == 0) continue;
+    token[len] = '\0';
+    char* end;
+    double value = strtod(token, &end);
+    if (cnt == n || *end) {
+      cnt = n + 1;
+      break;
+    }
+    values[cnt++] = value;
+  }
+  fclose(fh);
+  if (cnt != n) {
+    free(values);
+    return NULL;
+  }
+  return values;
+}
+
+struct mindist_job {
+  const struct sts_word_set* set;
+  const struct sts_word* query;
+  double* out;
+  unsigned long long failed;
+};
+
+static void mindist_task(void* ctx, size_t task)
+{
+  struct mindist_job* job = ctx;
+  struct sts_word_set part = *job->set;
+  size_t first = task * SEARCH_PARTITION;
+  part.symbols += first * part.w;
+  part.count -= first;
+  if (part.count > SEARCH_PARTITION) part.count = SEARCH_PARTITION;
+  if (!sts_word_set_mindist(&part, job->query, job->out + first)) {
+    STS_ATOMIC_STORE(&job->failed, 1ULL);
+  }
+}
+
+/* Binary heap of word indices, ordered by key then index */
+typedef struct heap {
+  size_t* items;
+  size_t size;
+  const double* keys;
+  bool max; // max-heap instead of min-heap
+} heap;
+
+static bool heap_before(const heap* h, size_t a, size_t b)
+{
+  double ka = h->keys[a], kb = h->keys[b];
+  if (ka != kb) return h->max ? ka > kb : ka < kb;
+  return h->max ? a > b : a < b;
+}
+
+static void sift_down(heap* h, size_t i)
+{
+  for (;;) {
+    size_t best = i, l = 2 * i + 1, r = l + 1;
+    if (l < h->size && heap_before(h, h->items[l], h->items[best])) best = l;
+    if (r < h->size && heap_before(h, h->items[r], h->items[best])) best = r;
+    if (best == i) return;
+    size_t tmp = h->items[i];
+    h->items[i] = h->items[best];
+    h->items[best] = tmp;
+    i = best;
+  }
+}
+
+static void heap_push(heap* h, size_t item)
+{
+  size_t i = h->size++;
+  h->items[i] = item;
+  while (i > 0 && heap_before(h, h->items[i], h->items[(i - 1) / 2])) {
+    size_t parent = (i - 1) / 2, tmp = h->items[i];
+    h->items[i] = h->items[parent];
+    h->items[parent] = tmp;
+    i = parent;
+  }
+}
+
+static size_t heap_pop(heap* h)
+{
+  size_t top = h->items[0];
+  h->items[0] = h->items[--h->size];
+  sift_down(h, 0);
+  return top;
+}
+
+/*
+ * Z-normalized Euclidean distance of the query values to a subsequence,
+ * abandoned (INFINITY) once above bound; INFINITY as well when the
+ * subsequence holds non-finite values or runs past the series
+ */
+static double exact_distance(const double* q, const mapping* series,
+                             bool is_float, size_t offset, size_t n,
+                             double bound, double* scratch)
+{
+  size_t len = series->size / (is_float ? sizeof(float) : sizeof(double));
+  if (offset > len || n > len - offset) return INFINITY;
+  for (size_t i = 0; i < n; ++i) {
+    scratch[i] = series_value(series, is_float, offset + i);
+  }
+  if (!znormalize(scratch, n)) return INFINITY;
+  double bound2 = bound * bound, sum = 0;
+  for (size_t i = 0; i < n; ++i) {
+    double d = q[i] - scratch[i];
+    sum += d * d;
+    if (sum > bound2) return INFINITY;
+  }
+  return sqrt(sum);
+}
+
+static int compare_matches(const void* a, const void* b)
+{
+  const match* x = a, * y = b;
+  double dx = isnan(x->distance) ? x->mindist : x->distance;
+  double dy = isnan(y->distance) ? y->mindist : y->distance;
+  if (dx != dy) return dx < dy ? -1 : 1;
+  return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static bool search(const struct sts_word_set* set,
+                   const struct sts_word_file_header* h,
+                   const query* q,
+                   size_t qi,
+                   const mapping* series,
+                   const options* opt)
+{
+  double start = now_ms();
+  size_t count = set->count;
+  double* mindist = malloc(count * sizeof*mindist);
+  size_t* items = malloc(count * sizeof*items);
+  double* scratch = malloc(h->n * sizeof*scratch);
+  double* exact = NULL;
+  match* matches = NULL;
+  bool refine = q->values && series->data;
+  if (refine) exact = malloc(count * sizeof*exact);
+  if (!mindist || !items || !scratch || (refine && !exact)) {
+    fprintf(stderr, "memory allocation failed\n");
+    free(mindist);
+    free(items);
+    free(scratch);
+    free(exact);
+    return false;
+  }
+  struct mindist_job job = { set, q->word, mindist, 0 };
+  sts_parallel_for(opt->n_threads,
+                   (count + SEARCH_PARTITION - 1) / SEARCH_PARTITION,
+                   mindist_task, &job);
+  bool failed = STS_ATOMIC_LOAD(&job.failed) != 0;
+  double scanned = now_ms();
+
+  // candidates by increasing mindist, without the words overlapping a
+  // --query-at subsequence
+  heap candidates = { items, 0, mindist, false };
+  for (size_t i = 0; i < count && !failed; ++i) {
+    size_t offset = h->first + i * h->step;
+    if (q->at != SEARCH_NO_OFFSET && offset + h->n > q->at
+        && offset < q->at + h->n) {
+      continue;
+    }
+    if (!isnan(opt->threshold) && !(mindist[i] <= opt->threshold)) continue;
+    candidates.items[candidates.size++] = i;
+  }
+  for (size_t i = candidates.size / 2; i-- > 0;) sift_down(&candidates, i);
+  size_t n_candidates = candidates.size;
+
+  size_t limit = isnan(opt->threshold) ? opt->k : n_candidates;
+  matches = malloc((limit ? limit : 1) * sizeof*matches);
+  size_t found = 0, refined = 0;
+  if (!matches) {
+    failed = true;
+  } else if (!refine) {
+    while (found < limit && candidates.size) {
+      size_t i = heap_pop(&candidates);
+      matches[found++] = (match){ i, mindist[i], NAN };
+    }
+  } else {
+    // mindist lower bounds the exact distance: stop once it exceeds the
+    // k-th best exact distance (or the threshold)
+    size_t* best_items = malloc((limit ? limit : 1) * sizeof*best_items);
+    heap best = { best_items, 0, exact, true };
+    double bound = isnan(opt->threshold) ? INFINITY : opt->threshold;
+    while (best_items && candidates.size) {
+      size_t i = candidates.items[0];
+      if (mindist[i] > bound) break;
+      heap_pop(&candidates);
+      ++refined;
+      exact[i] = exact_distance(q->values, series, opt->float_series,
+                                h->first + i * h->step, h->n, bound, scratch);
+      if (isinf(exact[i])) continue;
+      if (best.size == limit) {
+        heap_pop(&best);
+      }
+      heap_push(&best, i);
+      if (best.size == limit && isnan(opt->threshold)) {
+        bound = exact[best.items[0]];
+      }
+    }
+    if (!best_items) failed = true;
+    for (size_t j = 0; j < best.size; ++j) {
+      size_t i = best.items[j];
+      matches[found++] = (match){ i, mindist[i], exact[i] };
+    }
+    free(best_items);
+  }
+  qsort(matches, found, sizeof*matches, compare_matches);
+  double finished = now_ms();
+
+  for (size_t j = 0; j < found; ++j) {
+    const match* m = &matches[j];
+    printf("%" PRIuSIZE "\t%" PRIuSIZE "\t%" PRIuSIZE "\t%llu\t%.6f", qi + 1,
+           j + 1, m->index,
+           (unsigned long long)(h->first + m->index * h->step), m->mindist);
+    if (!isnan(m->distance)) printf("\t%.6f", m->distance);
+    printf("\n");
+  }
+  fprintf(stderr, "query %" PRIuSIZE " (%s): %" PRIuSIZE " words, mindist "
+          "scan %.1f ms, %" PRIuSIZE " candidates", qi + 1, q->label, count,
+          scanned - start, n_candidates);
+  if (refine) {
+    fprintf(stderr, ", %" PRIuSIZE " exact distances (%.2f%% pruned)",
+            refined, count ? 100.0 * (count - refined) / count : 0.0);
+  }
+  fprintf(stderr, ", %" PRIuSIZE " matches in %.1f ms\n", found,
+          finished - start);
+  free(mindist);
+  free(items);
+  free(scratch);
+  free(exact);
+  free(matches);
+  return !failed;
+}
+
+static void usage(const char* name)
+{
+  fprintf(stderr, "usage: %s [--top k | --threshold d] [--series file "
+          "[--float]] [--threads t]\n"
+          "  (--query SAX | --query-file path | --query-at offset)... words\n"
+          "Finds the words of a word file closest to each query in terms of "
+          "mindist; with\nthe raw series the candidates of value queries are "
+          "refined by their exact\nz-normalized Euclidean distance. Prints "
+          "query, rank, word index, series offset,\nmindist and distance "
+          "per match.\n", name);
+}
+
+int main(int argc, char* argv[])
+{
+  options opt = { 10, NAN, 1, false };
+#ifdef _SC_NPROCESSORS_ONLN
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus > 0) opt.n_threads = (unsigned int)cpus;
+#endif
+  const char* words_path = NULL, * series_path = NULL;
+  // queries are resolved once the word file is known
+  const char* specs[SEARCH_MAX_QUERIES];
+  char kinds[SEARCH_MAX_QUERIES];
+  size_t n_queries = 0;
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (strcmp(arg, "--top") == 0 && has_value) {
+      opt.k = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "--threshold") == 0 && has_value) {
+      opt.threshold = atof(argv[++i]);
+    } else if (strcmp(arg, "--series") == 0 && has_value) {
+      series_path = argv[++i];
+    } else if (strcmp(arg, "--float") == 0) {
+      opt.float_series = true;
+    } else if (strcmp(arg, "--threads") == 0 && has_value) {
+      opt.n_threads = (unsigned int)strtoul(argv[++i], NULL, 10);
+    } else if ((strcmp(arg, "--query") == 0 || strcmp(arg, "--query-file") == 0
+                || strcmp(arg, "--query-at") == 0) && has_value
+               && n_queries < SEARCH_MAX_QUERIES) {
+      kinds[n_queries] = arg[7] == '\0' ? 's' : arg[8];
+      specs[n_queries++] = argv[++i];
+    } else if (arg[0] != '-' && !words_path) {
+      words_path = arg;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (!words_path || n_queries == 0 || opt.k == 0 || opt.n_threads == 0
+      || (!isnan(opt.threshold) && !(opt.threshold >= 0))) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  mapping words = { NULL, 0 }, series = { NULL, 0 };
+  if (!map_file(words_path, &words)) {
+    fprintf(stderr, "%s: %s\n", words_path, strerror(errno));
+    return 1;
+  }
+  struct sts_word_file_header h;
+  if (words.size >= sizeof h) memcpy(&h, words.data, sizeof h);
+  if (words.size < sizeof h || !sts_valid_word_file_header(&h, words.size)) {
+    fprintf(stderr, "%s: not a word file\n", words_path);
+    return 1;
+  }
+  if (series_path && !map_file(series_path, &series)) {
+    fprintf(stderr, "%s: %s\n", series_path, strerror(errno));
+    return 1;
+  }
+  // the symbols are used in place
+  struct sts_word_set set = { (sts_symbol*)(words.data + sizeof h), h.count,
+    h.count, h.n, h.w, (unsigned char)h.c };
+
+  int rv = 0;
+  for (size_t i = 0; i < n_queries && rv == 0; ++i) {
+    query q = { specs[i], NULL, NULL, SEARCH_NO_OFFSET };
+    if (kinds[i] == 's') {
+      q.word = sts_from_sax_string(specs[i], (unsigned char)h.c);
+      if (q.word && q.word->w != h.w) {
+        sts_free_word(q.word);
+        q.word = NULL;
+      }
+    } else {
+      if (kinds[i] == 'f') {
+        q.values = read_values(specs[i], h.n);
+      } else if (series.data) {
+        q.at = strtoul(specs[i], NULL, 10);
+        size_t len = series.size / (opt.float_series ? sizeof(float)
+                                                     : sizeof(double));
+        if (q.at < len && h.n <= len - q.at) {
+          q.values = malloc(h.n * sizeof*q.values);
+          for (size_t j = 0; q.values && j < h.n; ++j) {
+            q.values[j] = series_value(&series, opt.float_series, q.at + j);
+          }
+        }
+      }
+      if (q.values) {
+        q.word = sts_from_double_array(q.values, h.n, h.w, h.c);
+        if (!znormalize(q.values, h.n)) {
+          // only the word is usable
+          free(q.values);
+          q.values = NULL;
+        }
+      }
+    }
+    if (kinds[i] == 'a' && !series.data) {
+      fprintf(stderr, "query %" PRIuSIZE " (%s): --query-at needs --series\n",
+              i + 1, specs[i]);
+      rv = 1;
+    } else if (!q.word) {
+      fprintf(stderr, "query %" PRIuSIZE " (%s): invalid for n = %llu, "
+              "w = %llu, c = %u\n", i + 1, specs[i], (unsigned long long)h.n,
+              (unsigned long long)h.w, (unsigned)h.c);
+      rv = 1;
+    } else if (!search(&set, &h, &q, i, &series, &opt)) {
+      rv = 1;
+    }
+    sts_free_word(q.word);
+    free(q.values);
+  }
+  munmap((void*)words.data, words.size);
+  if (series.data) munmap((void*)series.data, series.size);
+  return rv;
+}
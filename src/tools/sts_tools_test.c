@@ -0,0 +1,266 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* End to end check of sts_encode and sts_search against a brute force scan */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "symtseries.h"
+#include "sts_word_file.h"
+#include "../test/sts_test.h"
+
+#include <math.h>
+
+#define TEST_LEN 20000
+#define TEST_N 128
+#define TEST_W 8
+#define TEST_C 8
+#define TEST_K 5
+#define TEST_QUERY_AT 5000
+#define TEST_WORDS (TEST_LEN - TEST_N + 1)
+
+static const char* encode_path, * search_path;
+static char series_file[1024], words_file[1024], err_file[1024];
+static double series[TEST_LEN];
+static sts_symbol words[TEST_WORDS * TEST_W];
+// brute force distances of every word to the --query-at subsequence
+static double exact[TEST_WORDS], mindist[TEST_WORDS];
+static bool candidate[TEST_WORDS]; // finite and not overlapping the query
+static size_t top[TEST_K + 1];
+
+/* Same normalization as the tools, false if a value isn't finite */
+static bool znormalize(double* values, size_t n)
+{
+  double mu = 0, s2 = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (!isfinite(values[i])) return false;
+    mu += values[i];
+  }
+  mu /= n;
+  for (size_t i = 0; i < n; ++i) s2 += (values[i] - mu) * (values[i] - mu);
+  double std = sqrt(s2 / n);
+  for (size_t i = 0; i < n; ++i) {
+    values[i] = std < STS_STAT_EPS ? 0 : (values[i] - mu) / std;
+  }
+  return true;
+}
+
+typedef struct result {
+  size_t index;
+  double mindist, distance;
+} result;
+
+/*
+ * Runs sts_search with the raw series and the --query-at query, returns the
+ * number of matches read into out (-1 on failure) and the number of exact
+ * distances it computed
+ */
+static int run_search(const char* args, result* out, size_t max,
+                      size_t* refined)
+{
+  char cmd[4096];
+  snprintf(cmd, sizeof cmd, "\"%s\" --threads 2 --series \"%s\" --query-at %d"
+           " %s \"%s\" 2> \"%s\"", search_path, series_file, TEST_QUERY_AT,
+           args, words_file, err_file);
+  FILE* fh = popen(cmd, "r");
+  if (!fh) return -1;
+  int found = 0;
+  char line[256];
+  while (fgets(line, sizeof line, fh)) {
+    unsigned long q, rank, index;
+    unsigned long long offset;
+    double md, d;
+    if (found < 0 || (size_t)found == max
+        || sscanf(line, "%lu %lu %lu %llu %lf %lf", &q, &rank, &index, &offset,
+                  &md, &d) != 6
+        || q != 1 || rank != (unsigned long)found + 1 || offset != index) {
+      found = -1;
+      continue;
+    }
+    out[found++] = (result){ index, md, d };
+  }
+  if (pclose(fh) != 0) return -1;
+
+  fh = fopen(err_file, "r");
+  if (!fh) return -1;
+  const char* stats = fgets(line, sizeof line, fh)
+    ? strstr(line, "candidates, ") : NULL;
+  fclose(fh);
+  unsigned long cnt;
+  if (!stats || sscanf(stats, "candidates, %lu exact", &cnt) != 1) return -1;
+  *refined = cnt;
+  return found;
+}
+
+static char* test_encode()
+{
+  unsigned int seed = 31;
+  double level = 0;
+  for (size_t i = 0; i < TEST_LEN; ++i) {
+    seed = seed * 1103515245 + 12345;
+    level += ((seed >> 16) & 0x7fff) / 16384.0 - 1.0;
+    series[i] = i >= 12000 && i < 12010 ? NAN : level;
+  }
+  FILE* fh = fopen(series_file, "wb");
+  mu_assert(fh, "%s: %s", series_file, strerror(errno));
+  mu_assert(fwrite(series, sizeof series, 1, fh) == 1, "write failed");
+  mu_assert(fclose(fh) == 0, "write failed");
+
+  char cmd[4096];
+  snprintf(cmd, sizeof cmd, "\"%s\" -n %d -w %d -c %d --threads 2 \"%s\" "
+           "\"%s\" 2> \"%s\"", encode_path, TEST_N, TEST_W, TEST_C,
+           series_file, words_file, err_file);
+  mu_assert(system(cmd) == 0, "%s failed", cmd);
+
+  fh = fopen(words_file, "rb");
+  mu_assert(fh, "%s: %s", words_file, strerror(errno));
+  struct sts_word_file_header h;
+  bool ok = fread(&h, sizeof h, 1, fh) == 1
+    && fread(words, sizeof words, 1, fh) == 1 && fgetc(fh) == EOF;
+  fclose(fh);
+  mu_assert(ok && sts_valid_word_file_header(&h, sizeof h + sizeof words),
+            "invalid word file");
+  mu_assert(h.n == TEST_N && h.w == TEST_W && h.c == TEST_C
+            && h.count == TEST_WORDS && h.first == 0 && h.step == 1,
+            "header");
+
+  sts_word query = sts_from_double_array(series + TEST_QUERY_AT, TEST_N,
+                                         TEST_W, TEST_C);
+  mu_assert(query, "query word");
+  double q[TEST_N], v[TEST_N];
+  memcpy(q, series + TEST_QUERY_AT, sizeof q);
+  mu_assert(znormalize(q, TEST_N), "query values");
+  for (size_t i = 0; i < TEST_WORDS; ++i) {
+    sts_word a = sts_from_double_array(series + i, TEST_N, TEST_W, TEST_C);
+    mu_assert(a && memcmp(a->symbols, words + i * TEST_W, TEST_W) == 0,
+              "word %" PRIuSIZE, i);
+    mindist[i] = sts_mindist(query, a);
+    sts_free_word(a);
+
+    memcpy(v, series + i, sizeof v);
+    candidate[i] = (i + TEST_N <= TEST_QUERY_AT
+                    || i >= TEST_QUERY_AT + TEST_N) && znormalize(v, TEST_N);
+    double sum = 0;
+    for (size_t j = 0; j < TEST_N; ++j) sum += (q[j] - v[j]) * (q[j] - v[j]);
+    exact[i] = candidate[i] ? sqrt(sum) : INFINITY;
+  }
+  sts_free_word(query);
+
+  // the K + 1 nearest subsequences
+  static bool picked[TEST_WORDS];
+  for (size_t k = 0; k <= TEST_K; ++k) {
+    size_t best = TEST_WORDS;
+    for (size_t i = 0; i < TEST_WORDS; ++i) {
+      if (!picked[i] && (best == TEST_WORDS || exact[i] < exact[best])) {
+        best = i;
+      }
+    }
+    picked[best] = true;
+    top[k] = best;
+  }
+  return NULL;
+}
+
+static char* test_top_k()
+{
+  result out[TEST_K + 1];
+  size_t refined;
+  char args[64];
+  snprintf(args, sizeof args, "--top %d", TEST_K);
+  int found = run_search(args, out, TEST_K + 1, &refined);
+  mu_assert(found == TEST_K, "found %d", found);
+  for (size_t k = 0; k < TEST_K; ++k) {
+    size_t i = out[k].index;
+    mu_assert(i == top[k], "rank %" PRIuSIZE ": %" PRIuSIZE " != %" PRIuSIZE,
+              k + 1, i, top[k]);
+    mu_assert(fabs(out[k].distance - exact[i]) < 1e-5
+              && fabs(out[k].mindist - mindist[i]) < 1e-5,
+              "rank %" PRIuSIZE ": %f %f != %f %f", k + 1, out[k].mindist,
+              out[k].distance, mindist[i], exact[i]);
+  }
+
+  // every word with a mindist below the K-th distance must have been
+  // refined, the others are pruned
+  double kth = exact[top[TEST_K - 1]];
+  size_t needed = 0;
+  for (size_t i = 0; i < TEST_WORDS; ++i) {
+    mu_assert(!candidate[i] || mindist[i] <= exact[i] + 1e-9,
+              "mindist of %" PRIuSIZE " isn't a lower bound", i);
+    needed += candidate[i] && mindist[i] < kth;
+  }
+  mu_assert(needed <= refined && refined < TEST_WORDS / 2,
+            "%" PRIuSIZE " exact distances, %" PRIuSIZE " needed", refined,
+            needed);
+  return NULL;
+}
+
+static char* test_threshold()
+{
+  static result out[TEST_WORDS];
+  // halfway to the next nearest, the top K match
+  double threshold = (exact[top[TEST_K - 1]] + exact[top[TEST_K]]) / 2;
+  size_t expected = 0, refined;
+  for (size_t i = 0; i < TEST_WORDS; ++i) expected += exact[i] <= threshold;
+  char args[64];
+  snprintf(args, sizeof args, "--threshold %.17g", threshold);
+  int found = run_search(args, out, TEST_WORDS, &refined);
+  mu_assert(found >= 0 && (size_t)found == expected, "found %d expected %"
+            PRIuSIZE, found, expected);
+  for (int k = 0; k < found; ++k) {
+    size_t i = out[k].index;
+    mu_assert(i < TEST_WORDS && fabs(out[k].distance - exact[i]) < 1e-5
+              && exact[i] <= threshold, "match %" PRIuSIZE, i);
+    mu_assert(k == 0 || out[k - 1].distance <= out[k].distance,
+              "not sorted at %d", k);
+  }
+  // the threshold stays the bound: exactly the words within it by mindist
+  // are refined, up to the rounding of the mindist kernels
+  size_t low = 0, high = 0;
+  for (size_t i = 0; i < TEST_WORDS; ++i) {
+    if (i + TEST_N > TEST_QUERY_AT && i < TEST_QUERY_AT + TEST_N) continue;
+    low += mindist[i] <= threshold - 1e-9;
+    high += mindist[i] <= threshold + 1e-9;
+  }
+  mu_assert(low <= refined && refined <= high && refined < TEST_WORDS / 2,
+            "%" PRIuSIZE " exact distances, expected %" PRIuSIZE, refined,
+            low);
+  return NULL;
+}
+
+static char* all_tests()
+{
+  mu_run_test(test_encode);
+  mu_run_test(test_top_k);
+  mu_run_test(test_threshold);
+  return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc != 4) {
+    fprintf(stderr, "usage: %s sts_encode sts_search scratch_prefix\n",
+            argv[0]);
+    return 1;
+  }
+  encode_path = argv[1];
+  search_path = argv[2];
+  snprintf(series_file, sizeof series_file, "%s.bin", argv[3]);
+  snprintf(words_file, sizeof words_file, "%s.words", argv[3]);
+  snprintf(err_file, sizeof err_file, "%s.err", argv[3]);
+
+  char* result = all_tests();
+  if (result) {
+    printf("%s\n", result);
+  } else {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n", mu_tests_run);
+  remove(series_file);
+  remove(words_file);
+  remove(err_file);
+
+  return result != 0;
+}
@@ -0,0 +1,60 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Word file layout shared by the command line tools */
+
+#ifndef _STS_WORD_FILE_H_
+#define _STS_WORD_FILE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define STS_WORD_FILE_MAGIC "STSWORDS"
+#define STS_WORD_FILE_VERSION 1
+
+/*
+ * A word file is this header (host byte order) followed by count * w symbols,
+ * one byte each, laid out like the symbols of a sts_word_set. Word i is the
+ * word of the subsequence starting at series offset first + i * step.
+ */
+struct sts_word_file_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t c;
+  uint64_t n; // subsequence length
+  uint64_t w;
+  uint64_t count; // number of words
+  uint64_t first;
+  uint64_t step;
+  uint64_t reserved;
+};
+
+static inline void sts_init_word_file_header(struct sts_word_file_header* h,
+                                             size_t n,
+                                             size_t w,
+                                             unsigned char c,
+                                             size_t step)
+{
+  memset(h, 0, sizeof*h);
+  memcpy(h->magic, STS_WORD_FILE_MAGIC, sizeof h->magic);
+  h->version = STS_WORD_FILE_VERSION;
+  h->c = c;
+  h->n = n;
+  h->w = w;
+  h->step = step;
+}
+
+/* Checks the header against the size of the whole file */
+static inline bool sts_valid_word_file_header(
+  const struct sts_word_file_header* h, uint64_t size)
+{
+  return size >= sizeof*h
+    && memcmp(h->magic, STS_WORD_FILE_MAGIC, sizeof h->magic) == 0
+    && h->version == STS_WORD_FILE_VERSION
+    && h->c >= STS_MIN_CARDINALITY && h->c <= STS_MAX_CARDINALITY
+    && h->w > 0 && h->n % h->w == 0 && h->step > 0
+    && (size - sizeof*h) / h->w >= h->count;
+}
+
+#endif